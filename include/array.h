@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "value.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct kb_array_s kb_array_t;
+
+size_t array_length(kb_array_t *array);
+
+void array_rewind(kb_array_t *array);
+bool array_next(kb_array_t *array);
+kb_value_type_t array_value_type(kb_array_t *array);
+kb_value_t array_get_value(kb_array_t *array);
+
+size_t array_get_int32_values(kb_array_t *array, int32_t *values, size_t max_values, bool *success);
+size_t array_get_int64_values(kb_array_t *array, int64_t *values, size_t max_values, bool *success);
+size_t array_get_double_values(kb_array_t *array, double *values, size_t max_values, bool *success);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -6,6 +6,7 @@
 
 #include <log4c/category.h>
 
+#include "array.h"
 #include "value.h"
 
 #ifdef __cplusplus
@@ -15,6 +16,7 @@ extern "C" {
 typedef struct kb_document_s kb_document_t;
 typedef struct kb_array_s kb_array_t;
 
+bool document_build_index(kb_document_t *document);
 bool document_has_field(kb_document_t *document, const char *key);
 kb_value_t document_get_value(kb_document_t *document, const char *key);
 kb_value_type_t document_value_type(kb_document_t *document, const char *key);
@@ -25,6 +27,9 @@ int64_t document_get_int64(kb_document_t *document, const char *key, bool *succe
 double document_get_double(kb_document_t *document, const char *key, bool *success);
 const char *document_get_utf8(kb_document_t *document, const char *key, size_t *size, bool *success);
 const uint8_t *document_get_binary(kb_document_t *document, const char *key, size_t *size, bool *success);
+const int32_t *document_get_int32_array(kb_document_t *document, const char *key, size_t *count, bool *success);
+const int64_t *document_get_int64_array(kb_document_t *document, const char *key, size_t *count, bool *success);
+const double *document_get_double_array(kb_document_t *document, const char *key, size_t *count, bool *success);
 kb_document_t *document_get_document(kb_document_t *document, const char *key, bool *success);
 kb_array_t *document_get_array(kb_document_t *document, const char *key, bool *success);
 
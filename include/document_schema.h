@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <log4c/category.h>
+
+#include "document.h"
+#include "value.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maximum number of fields in a schema. Field presence is reported as a bitmask
+#define KB_SCHEMA_MAX_FIELDS 64
+
+/**
+ * @brief Destination of a KB_VALUE_TYPE_STRING field. Points into the document data
+ */
+struct kb_schema_string_s
+{
+    const char *str;
+    uint32_t len;
+};
+typedef struct kb_schema_string_s kb_schema_string_t;
+
+/**
+ * @brief Destination of a KB_VALUE_TYPE_BINARY field. Points into the document data
+ */
+struct kb_schema_binary_s
+{
+    const uint8_t *data;
+    uint32_t data_len;
+};
+typedef struct kb_schema_binary_s kb_schema_binary_t;
+
+/**
+ * @brief Schema field description
+ */
+struct kb_schema_field_s
+{
+    const char *key;      // Field name. Must outlive the schema
+    kb_value_type_t type; // Expected type
+    size_t offset;        // Offset of the destination in the output structure. Use offsetof()
+    bool required;        // Fail extraction if the field is missing
+};
+typedef struct kb_schema_field_s kb_schema_field_t;
+
+typedef struct kb_document_schema_s kb_document_schema_t;
+
+/**
+ * @brief Compile a schema for a fixed-shape document.
+ *        Destination types are bool, int32_t, int64_t, double, kb_schema_string_t and kb_schema_binary_t.
+ *        KB_VALUE_TYPE_NULL fields only report presence
+ *
+ * @param fields Fields in the order they're usually written
+ * @param num_fields Number of fields. At most KB_SCHEMA_MAX_FIELDS
+ * @param logger Logger
+ * @return Compiled schema or NULL on error
+ */
+kb_document_schema_t *document_schema_create(const kb_schema_field_t *fields, size_t num_fields, log4c_category_t *logger);
+
+/**
+ * @brief Destroy a schema
+ *
+ * @param schema Schema to destroy
+ */
+void document_schema_destroy(kb_document_schema_t *schema);
+
+/**
+ * @brief Extract all schema fields from a document in a single pass, checking their types.
+ *        Fields which aren't in the schema are skipped
+ *
+ * @param schema Compiled schema
+ * @param document Document to read
+ * @param out Output structure
+ * @param present Optional. Bit N is set if the field N was found. Also set on failure
+ * @return false if a field has an unexpected type or a required field is missing
+ */
+bool document_schema_extract(const kb_document_schema_t *schema, kb_document_t *document, void *out, uint64_t *present);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
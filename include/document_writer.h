@@ -24,6 +24,10 @@ bool doc_writer_append_double(kb_document_writer_t *writer, const char *key, dou
 bool doc_writer_append_int32(kb_document_writer_t *writer, const char *key, int32_t value);
 bool doc_writer_append_int64(kb_document_writer_t *writer, const char *key, int64_t value);
 
+bool doc_writer_append_int32_array(kb_document_writer_t *writer, const char *key, const int32_t *values, uint32_t count);
+bool doc_writer_append_int64_array(kb_document_writer_t *writer, const char *key, const int64_t *values, uint32_t count);
+bool doc_writer_append_double_array(kb_document_writer_t *writer, const char *key, const double *values, uint32_t count);
+
 kb_document_writer_t *doc_writer_document_begin(kb_document_writer_t *writer, const char *key);
 bool doc_writer_document_end(kb_document_writer_t *writer);
 
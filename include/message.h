@@ -19,13 +19,14 @@ struct kb_message_s
 typedef struct kb_message_s kb_message_t;
 
 /**
- * @brief Initialize a new message with data buffer
+ * @brief Initialize a new message with data buffer and a caller-owned document structure.
+ *        Doesn't allocate memory
  * @param message Pointer to message to initialize
+ * @param document Document structure. Must outlive the message
  * @param data Pointer to message data buffer
  * @param size Size of the data buffer
- * @return Pointer to initialized message or NULL on error
  */
-void message_init(kb_message_t *mesage, uint8_t *data, size_t size);
+void message_init_static(kb_message_t *message, bson_t *document, uint8_t *data, size_t size);
 
 /**
  * @brief Destroy a message and free resources
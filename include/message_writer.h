@@ -21,6 +21,12 @@ struct kb_message_writer_s
     log4c_category_t *logger;
     int (*send)(struct kb_message_writer_s *writer);
     void (*cancel)(struct kb_message_writer_s *writer);
+    // Grow the message buffer to at least `size` bytes. Returns the new buffer or NULL. Optional
+    uint8_t *(*grow)(struct kb_message_writer_s *writer, size_t size);
+    // Queue the message without notifying the receiver until the transport is flushed. Optional
+    int (*send_deferred)(struct kb_message_writer_s *writer);
+    // Scratch buffer BSON writes into after the message buffer failed to grow. The message can't be sent
+    uint8_t *overflow;
 };
 
 typedef struct kb_message_writer_s kb_message_writer_t;
@@ -31,6 +37,20 @@ typedef struct kb_message_writer_s kb_message_writer_t;
 
 void message_writer_init(kb_message_writer_t *writer, uint8_t *data, size_t size, log4c_category_t *logger);
 
+/**
+ * @brief Reuses an initialized message writer for a new message buffer. Doesn't allocate memory
+ * @param writer The message writer
+ * @param data New message buffer
+ * @param size Size of the buffer
+ */
+void message_writer_reset(kb_message_writer_t *writer, uint8_t *data, size_t size);
+
+/**
+ * @brief Releases the resources of the message writer, but not the writer itself
+ * @param writer The message writer
+ */
+void message_writer_deinit(kb_message_writer_t *writer);
+
 /**
  * @brief Gets the document from the message writer
  * @param writer The message writer
@@ -45,13 +65,30 @@ kb_document_writer_t *message_writer_root(kb_message_writer_t *writer);
  */
 size_t message_writer_size(kb_message_writer_t *writer);
 
+/**
+ * @brief Checks if the message buffer failed to grow. Appends to a failed message fail,
+ *        and sending it cancels the message
+ * @param writer The message writer
+ * @return true if the message can't be sent
+ */
+bool message_writer_failed(kb_message_writer_t *writer);
+
 /**
  * @brief Sends the written message using the writer's send callback
  * @param writer The message writer
- * @return 0 on success, non-zero on failure
+ * @return 0 on success, non-zero on failure. A failed message is cancelled
  */
 int message_send(kb_message_writer_t *writer);
 
+/**
+ * @brief Queues the written message without notifying the receiver.
+ *        The message is delivered on the next `transport_flush` or `message_send`.
+ *        Writers without deferred sending send the message immediately
+ * @param writer The message writer
+ * @return 0 on success, non-zero on failure
+ */
+int message_send_deferred(kb_message_writer_t *writer);
+
 /**
  * @brief Cancels sending the message
  * @param writer The message writer
@@ -2,6 +2,15 @@
 
 #include <stdint.h>
 
+// BSON binary subtypes of packed numeric arrays. The payload is a padding length byte, the padding
+// and the values in little-endian byte order. The padding aligns the values to 8 bytes relative to the root document
+#define KB_BINARY_SUBTYPE_INT32_ARRAY 0x80
+#define KB_BINARY_SUBTYPE_INT64_ARRAY 0x81
+#define KB_BINARY_SUBTYPE_DOUBLE_ARRAY 0x82
+
+// Alignment of packed array values
+#define KB_PACKED_ARRAY_ALIGNMENT 8
+
 enum kb_value_type_e
 {
     KB_VALUE_TYPE_NULL,
@@ -26,5 +26,14 @@ int main()
         std::cout << "~" << int(1000000.f / duration.count() * test_case.second) << " messages/s" << std::endl;
     }
 
+    for (auto &test_case : shmem_test_cases)
+    {
+        TransportPerfTestRunner runner{test_case.first, test_case.second, TransportPerfTestRunner::TransportType::SHMEM_RING, logger};
+        auto duration = runner.run();
+
+        std::cout << "Shared memory ring transport: " << test_case.first << " bytes, " << test_case.second << " messages: " << duration.count() << "us" << std::endl;
+        std::cout << "~" << int(1000000.f / duration.count() * test_case.second) << " messages/s" << std::endl;
+    }
+
     return 0;
 }
\ No newline at end of file
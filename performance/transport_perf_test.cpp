@@ -67,6 +67,16 @@ TransportPerfTestRunner::TransportPerfTestRunner(size_t message_size, size_t mes
 
         break;
     }
+    case TransportType::SHMEM_RING:
+    {
+        auto map_fd_0 = transport_shm_create_mapping_with_mode("map0", ARENA_SIZE, KB_SHM_QUEUE_SPSC_RING, logger);
+        auto map_fd_1 = transport_shm_create_mapping_with_mode("map1", ARENA_SIZE, KB_SHM_QUEUE_SPSC_RING, logger);
+
+        m_sender_transport = transport_shm_init("sender", map_fd_0, map_fd_1, message_size * 1.2, &m_sender_ring, logger);
+        m_receiver_transport = transport_shm_init("receiver", map_fd_1, map_fd_0, message_size * 1.2, &m_receiver_ring, logger);
+
+        break;
+    }
     default:
         exit(1);
     }
@@ -19,7 +19,8 @@ public:
     enum class TransportType
     {
         UDS,
-        SHMEM
+        SHMEM,
+        SHMEM_RING
     };
 
     TransportPerfTestRunner(size_t message_size, size_t message_count, TransportType transport_type, log4c_category_t *logger);
@@ -0,0 +1,156 @@
+#include "array.h"
+
+#include <assert.h>
+
+#include "readers_private.h"
+
+kb_array_t *array_from_data(const uint8_t *data, size_t size, log4c_category_t *logger)
+{
+    kb_array_t *array = malloc(sizeof(kb_array_t));
+    if (array == NULL)
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Failed to allocate memory for array\n");
+        return NULL;
+    }
+
+    array->logger = logger;
+    array->data = data;
+    array->size = size;
+    array->children.slots = NULL;
+    array->children.capacity = 0;
+    array->children.size = 0;
+
+    if (!bson_iter_init_from_data(&array->iter, data, size))
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Failed to initialize BSON iterator\n");
+        free(array);
+        return NULL;
+    }
+
+    return array;
+}
+
+bool array_destroy(kb_array_t *array)
+{
+    assert(array != NULL);
+
+    reader_children_destroy(&array->children);
+
+    free(array);
+    return true;
+}
+
+size_t array_length(kb_array_t *array)
+{
+    assert(array != NULL);
+
+    bson_iter_t iter;
+    if (!bson_iter_init_from_data(&iter, array->data, array->size))
+    {
+        return 0;
+    }
+
+    size_t length = 0;
+    while (bson_iter_next(&iter))
+    {
+        length++;
+    }
+
+    return length;
+}
+
+void array_rewind(kb_array_t *array)
+{
+    assert(array != NULL);
+
+    bson_iter_init_from_data(&array->iter, array->data, array->size);
+}
+
+bool array_next(kb_array_t *array)
+{
+    assert(array != NULL);
+
+    return bson_iter_next(&array->iter);
+}
+
+kb_value_type_t array_value_type(kb_array_t *array)
+{
+    assert(array != NULL);
+
+    switch (bson_iter_type(&array->iter))
+    {
+        case BSON_TYPE_NULL:
+            return KB_VALUE_TYPE_NULL;
+        case BSON_TYPE_BOOL:
+            return KB_VALUE_TYPE_BOOL;
+        case BSON_TYPE_INT32:
+            return KB_VALUE_TYPE_INT32;
+        case BSON_TYPE_INT64:
+            return KB_VALUE_TYPE_INT64;
+        case BSON_TYPE_DOUBLE:
+            return KB_VALUE_TYPE_DOUBLE;
+        case BSON_TYPE_UTF8:
+            return KB_VALUE_TYPE_STRING;
+        case BSON_TYPE_BINARY:
+            return KB_VALUE_TYPE_BINARY;
+        case BSON_TYPE_DOCUMENT:
+            return KB_VALUE_TYPE_DOCUMENT;
+        case BSON_TYPE_ARRAY:
+            return KB_VALUE_TYPE_ARRAY;
+        default:
+            return KB_VALUE_DOES_NOT_EXIST;
+    }
+}
+
+kb_value_t array_get_value(kb_array_t *array)
+{
+    assert(array != NULL);
+
+    return reader_value_from_iter(&array->iter, &array->children, array->logger);
+}
+
+// Bulk extraction. Reads from the beginning of the array and stops at the first element of another type
+#define ARRAY_GET_VALUES(array, values, max_values, success, bson_type, getter) \
+    do                                                                        \
+    {                                                                         \
+        assert(array != NULL);                                                \
+        assert(values != NULL || max_values == 0);                            \
+        assert(success != NULL);                                              \
+                                                                              \
+        bson_iter_t iter;                                                     \
+        if (!bson_iter_init_from_data(&iter, array->data, array->size))       \
+        {                                                                     \
+            *success = false;                                                 \
+            return 0;                                                         \
+        }                                                                     \
+                                                                              \
+        size_t count = 0;                                                     \
+        while (count < max_values && bson_iter_next(&iter))                   \
+        {                                                                     \
+            if (bson_iter_type(&iter) != bson_type)                           \
+            {                                                                 \
+                *success = false;                                             \
+                return count;                                                 \
+            }                                                                 \
+                                                                              \
+            values[count++] = getter(&iter);                                  \
+        }                                                                     \
+                                                                              \
+        *success = true;                                                      \
+        return count;                                                         \
+    } while (0)
+
+size_t array_get_int32_values(kb_array_t *array, int32_t *values, size_t max_values, bool *success)
+{
+    ARRAY_GET_VALUES(array, values, max_values, success, BSON_TYPE_INT32, bson_iter_int32);
+}
+
+size_t array_get_int64_values(kb_array_t *array, int64_t *values, size_t max_values, bool *success)
+{
+    ARRAY_GET_VALUES(array, values, max_values, success, BSON_TYPE_INT64, bson_iter_int64);
+}
+
+size_t array_get_double_values(kb_array_t *array, double *values, size_t max_values, bool *success)
+{
+    ARRAY_GET_VALUES(array, values, max_values, success, BSON_TYPE_DOUBLE, bson_iter_double);
+}
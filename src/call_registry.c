@@ -0,0 +1,246 @@
+#include "call_registry.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+
+// Fibonacci hashing. Sequential IDs spread evenly over the table
+static size_t call_registry_slot(const kb_call_registry_t *registry, uint64_t id)
+{
+    return (size_t)((id * 0x9E3779B97F4A7C15ull) >> 32) & registry->slot_mask;
+}
+
+// Link entries [from, to) into the free list in front of the current free entries
+static void call_registry_link_free(kb_call_registry_t *registry, size_t from, size_t to)
+{
+    for (size_t i = from; i < to; i++)
+    {
+        registry->entries[i].next_free = i + 1 < to ? (uint32_t)(i + 1) : registry->free_entry;
+    }
+
+    if (from < to)
+    {
+        registry->free_entry = (uint32_t)from;
+    }
+}
+
+static void call_registry_insert_slot(kb_call_registry_t *registry, uint32_t index)
+{
+    size_t slot = call_registry_slot(registry, registry->entries[index].id);
+    while (registry->slots[slot] != 0)
+    {
+        slot = (slot + 1) & registry->slot_mask;
+    }
+
+    registry->slots[slot] = index + 1;
+}
+
+bool call_registry_init(kb_call_registry_t *registry, size_t capacity, log4c_category_t *logger)
+{
+    assert(registry != NULL);
+    assert(capacity > 0);
+
+    size_t slot_count = 1;
+    while (slot_count < capacity * 2)
+    {
+        slot_count *= 2;
+    }
+
+    registry->logger = logger;
+    registry->capacity = capacity;
+    registry->slot_mask = slot_count - 1;
+    registry->size = 0;
+    registry->free_entry = (uint32_t)capacity;
+
+    registry->entries = malloc(capacity * sizeof(kb_call_entry_t));
+    registry->slots = calloc(slot_count, sizeof(uint32_t));
+    bool timers_initialized = timer_wheel_init(&registry->timers, capacity, logger);
+    if (registry->entries == NULL || registry->slots == NULL || !timers_initialized)
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Failed to allocate memory for call registry");
+        call_registry_deinit(registry);
+        return false;
+    }
+
+    call_registry_link_free(registry, 0, capacity);
+    return true;
+}
+
+void call_registry_deinit(kb_call_registry_t *registry)
+{
+    assert(registry != NULL);
+
+    free(registry->entries);
+    free(registry->slots);
+    timer_wheel_deinit(&registry->timers);
+    registry->entries = NULL;
+    registry->slots = NULL;
+    registry->size = 0;
+}
+
+// Double the slab and the table. Entry indices stay the same
+static bool call_registry_grow(kb_call_registry_t *registry)
+{
+    size_t new_capacity = registry->capacity * 2;
+    size_t slot_count = (registry->slot_mask + 1) * 2;
+    if (new_capacity >= UINT32_MAX)
+    {
+        log4c_category_log(registry->logger, LOG4C_PRIORITY_ERROR, "Too many outstanding calls");
+        return false;
+    }
+
+    kb_call_entry_t *entries = realloc(registry->entries, new_capacity * sizeof(kb_call_entry_t));
+    if (entries == NULL)
+    {
+        log4c_category_log(registry->logger, LOG4C_PRIORITY_ERROR, "Failed to grow call registry");
+        return false;
+    }
+    registry->entries = entries;
+
+    if (!timer_wheel_reserve(&registry->timers, new_capacity))
+    {
+        return false;
+    }
+
+    uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+    if (slots == NULL)
+    {
+        log4c_category_log(registry->logger, LOG4C_PRIORITY_ERROR, "Failed to grow call registry");
+        return false;
+    }
+
+    uint32_t *old_slots = registry->slots;
+    size_t old_slot_count = registry->slot_mask + 1;
+    registry->slots = slots;
+    registry->slot_mask = slot_count - 1;
+
+    for (size_t i = 0; i < old_slot_count; i++)
+    {
+        if (old_slots[i] != 0)
+        {
+            call_registry_insert_slot(registry, old_slots[i] - 1);
+        }
+    }
+    free(old_slots);
+
+    // The free list is empty. The new entries end with the new sentinel
+    registry->free_entry = (uint32_t)new_capacity;
+    call_registry_link_free(registry, registry->capacity, new_capacity);
+    registry->capacity = new_capacity;
+    return true;
+}
+
+kb_call_entry_t *call_registry_insert(kb_call_registry_t *registry, uint64_t id, kb_message_type_t type,
+                                      void (*callback)(kb_message_t *, void *), void *context)
+{
+    assert(registry != NULL);
+    assert(call_registry_find(registry, id) == NULL);
+
+    if (registry->free_entry == registry->capacity && !call_registry_grow(registry))
+    {
+        return NULL;
+    }
+
+    uint32_t index = registry->free_entry;
+    kb_call_entry_t *entry = &registry->entries[index];
+    registry->free_entry = entry->next_free;
+
+    entry->id = id;
+    entry->type = type;
+    entry->callback = callback;
+    entry->context = context;
+
+    call_registry_insert_slot(registry, index);
+    registry->size++;
+
+    return entry;
+}
+
+// Slot of the call or the empty slot which ends its probe sequence
+static size_t call_registry_probe(kb_call_registry_t *registry, uint64_t id)
+{
+    size_t slot = call_registry_slot(registry, id);
+    while (registry->slots[slot] != 0 && registry->entries[registry->slots[slot] - 1].id != id)
+    {
+        slot = (slot + 1) & registry->slot_mask;
+    }
+
+    return slot;
+}
+
+kb_call_entry_t *call_registry_find(kb_call_registry_t *registry, uint64_t id)
+{
+    assert(registry != NULL);
+
+    size_t slot = call_registry_probe(registry, id);
+    return registry->slots[slot] != 0 ? &registry->entries[registry->slots[slot] - 1] : NULL;
+}
+
+bool call_registry_remove(kb_call_registry_t *registry, uint64_t id)
+{
+    assert(registry != NULL);
+
+    size_t slot = call_registry_probe(registry, id);
+    if (registry->slots[slot] == 0)
+    {
+        return false;
+    }
+
+    uint32_t index = registry->slots[slot] - 1;
+    timer_wheel_cancel(&registry->timers, index);
+    registry->entries[index].next_free = registry->free_entry;
+    registry->free_entry = index;
+    registry->size--;
+
+    // Shift the following entries of the cluster back, so lookups don't need tombstones
+    size_t hole = slot;
+    for (size_t next = (slot + 1) & registry->slot_mask; registry->slots[next] != 0; next = (next + 1) & registry->slot_mask)
+    {
+        size_t home = call_registry_slot(registry, registry->entries[registry->slots[next] - 1].id);
+        // Move the entry if its home slot isn't in (hole, next]
+        if (((next - home) & registry->slot_mask) >= ((next - hole) & registry->slot_mask))
+        {
+            registry->slots[hole] = registry->slots[next];
+            hole = next;
+        }
+    }
+
+    registry->slots[hole] = 0;
+    return true;
+}
+
+void call_registry_set_deadline(kb_call_registry_t *registry, kb_call_entry_t *entry, uint64_t deadline, uint64_t now)
+{
+    assert(registry != NULL);
+    assert(entry != NULL);
+
+    uint32_t index = (uint32_t)(entry - registry->entries);
+    timer_wheel_cancel(&registry->timers, index);
+    timer_wheel_arm(&registry->timers, index, deadline, now);
+}
+
+static void call_registry_on_expired(uint32_t index, void *context)
+{
+    kb_call_registry_t *registry = (kb_call_registry_t *)context;
+
+    // The callback may register new calls, which can move the entries
+    kb_call_entry_t entry = registry->entries[index];
+    call_registry_remove(registry, entry.id);
+
+    log4c_category_log(registry->logger, LOG4C_PRIORITY_DEBUG, "Call with id `%" PRIu64 "` timed out", entry.id);
+    entry.callback(NULL, entry.context);
+}
+
+size_t call_registry_expire(kb_call_registry_t *registry, uint64_t now)
+{
+    assert(registry != NULL);
+
+    return timer_wheel_advance(&registry->timers, now, call_registry_on_expired, registry);
+}
+
+uint64_t call_registry_next_expiry(kb_call_registry_t *registry)
+{
+    assert(registry != NULL);
+
+    return timer_wheel_next_expiry(&registry->timers);
+}
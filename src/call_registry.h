@@ -0,0 +1,145 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <log4c/category.h>
+
+#include "message.h"
+#include "timer_wheel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Initial number of outstanding calls. The registry doubles when it runs out of entries
+#define KB_CALL_REGISTRY_INITIAL_CAPACITY 256
+
+/**
+ * @brief Message type enumeration for RPC communication
+ */
+enum kb_message_type_e
+{
+    KB_MESSAGE_TYPE_MESSAGE = 0,      // One-way message
+    KB_MESSAGE_TYPE_CALL = 1,         // Call requesting a response
+    KB_MESSAGE_TYPE_SUBSCRIPTION = 2, // Subscription request
+    KB_MESSAGE_TYPE_RESPONSE = 3,     // Response to a call
+    KB_MESSAGE_TYPE_STREAM = 4,       // Stream request with flow control credits
+    KB_MESSAGE_TYPE_CREDIT = 5,       // More credits for a stream
+    KB_MESSAGE_TYPE_CANCEL = 6,       // Stream cancellation
+};
+
+typedef enum kb_message_type_e kb_message_type_t;
+
+/**
+ * @brief Call registry entry for tracking outgoing calls
+ */
+struct kb_call_entry_s
+{
+    uint64_t id;                              // Call ID
+    kb_message_type_t type;                   // Message type
+    void (*callback)(kb_message_t *, void *); // Callback function
+    void *context;                            // User context for callback
+    uint32_t next_free;                       // Next free entry in the slab
+};
+
+typedef struct kb_call_entry_s kb_call_entry_t;
+
+/**
+ * @brief Registry for tracking outgoing calls.
+ *        Open-addressing table of entry indices with linear probing. Entries come from a slab
+ */
+struct kb_call_registry_s
+{
+    kb_call_entry_t *entries; // Entry slab
+    uint32_t *slots;          // Table of entry indices plus one. Zero for empty slots
+    size_t capacity;          // Number of entries in the slab
+    size_t slot_mask;         // Number of slots minus one. The table is kept at most half full
+    size_t size;              // Number of registered calls
+    uint32_t free_entry;      // First free entry in the slab. `capacity` if there are none
+    kb_timer_wheel_t timers;  // Call timeouts. Timer indices are entry indices
+    log4c_category_t *logger;
+};
+
+typedef struct kb_call_registry_s kb_call_registry_t;
+
+/**
+ * @brief Initialize a call registry
+ *
+ * @param registry Registry to initialize
+ * @param capacity Initial number of outstanding calls
+ * @param logger Logger
+ * @return true on success, false if failed to allocate memory
+ */
+bool call_registry_init(kb_call_registry_t *registry, size_t capacity, log4c_category_t *logger);
+
+/**
+ * @brief Free the registry memory
+ *
+ * @param registry Registry to deinitialize
+ */
+void call_registry_deinit(kb_call_registry_t *registry);
+
+/**
+ * @brief Register an outgoing call. Grows the registry if it's full
+ *
+ * @param registry Call registry
+ * @param id Call ID. Must not be registered already
+ * @param type Message type
+ * @param callback Response callback
+ * @param context User context for callback
+ * @return New entry or NULL if failed to allocate memory
+ */
+kb_call_entry_t *call_registry_insert(kb_call_registry_t *registry, uint64_t id, kb_message_type_t type,
+                                      void (*callback)(kb_message_t *, void *), void *context);
+
+/**
+ * @brief Find a call by ID
+ *
+ * @param registry Call registry
+ * @param id Call ID
+ * @return Entry or NULL if the call isn't registered
+ */
+kb_call_entry_t *call_registry_find(kb_call_registry_t *registry, uint64_t id);
+
+/**
+ * @brief Set a call deadline. When the deadline passes, `call_registry_expire` removes the call
+ *        and invokes its callback with a NULL message
+ *
+ * @param registry Call registry
+ * @param entry Registered call
+ * @param deadline Deadline tick
+ * @param now Current tick
+ */
+void call_registry_set_deadline(kb_call_registry_t *registry, kb_call_entry_t *entry, uint64_t deadline, uint64_t now);
+
+/**
+ * @brief Remove calls with passed deadlines and invoke their callbacks with a NULL message
+ *
+ * @param registry Call registry
+ * @param now Current tick
+ * @return Number of expired calls
+ */
+size_t call_registry_expire(kb_call_registry_t *registry, uint64_t now);
+
+/**
+ * @brief Get the tick at which `call_registry_expire` has to be called next
+ *
+ * @param registry Call registry
+ * @return Tick or UINT64_MAX if no calls have deadlines
+ */
+uint64_t call_registry_next_expiry(kb_call_registry_t *registry);
+
+/**
+ * @brief Remove a call by ID and return its entry to the slab. Cancels its deadline
+ *
+ * @param registry Call registry
+ * @param id Call ID
+ * @return true if the call was registered
+ */
+bool call_registry_remove(kb_call_registry_t *registry, uint64_t id);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
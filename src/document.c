@@ -1,8 +1,10 @@
 #include "document.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include "readers_private.h"
+#include "utils.h"
 
 kb_document_t *document_from_data(uint8_t *data, size_t size, log4c_category_t *logger)
 {
@@ -14,6 +16,14 @@ kb_document_t *document_from_data(uint8_t *data, size_t size, log4c_category_t *
     }
 
     document->logger = logger;
+    document->data = data;
+    document->size = size;
+    document->index = NULL;
+    document->index_capacity = 0;
+    document->index_size = 0;
+    document->children.slots = NULL;
+    document->children.capacity = 0;
+    document->children.size = 0;
 
     if (!bson_iter_init_from_data(&document->iter, data, size))
     {
@@ -29,31 +39,203 @@ bool document_destroy(kb_document_t *document)
 {
     assert(document != NULL);
 
+    reader_children_destroy(&document->children);
+
+    free(document->index);
     free(document);
     return true;
 }
 
-bool document_has_field(kb_document_t *document, const char *key)
+// Multiplicative hash. Nested data pointers differ in the low bits
+static size_t reader_child_hash(const uint8_t *data)
 {
-    assert(document != NULL);
-    assert(key != NULL);
+    return (size_t)(((uint64_t)(uintptr_t)data * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+// Find the slot of the nested data, or the empty slot to put it into
+static kb_reader_child_t *reader_children_find(kb_reader_children_t *children, const uint8_t *data)
+{
+    size_t mask = children->capacity - 1;
 
-    return bson_iter_find(&document->iter, key);
+    for (size_t slot = reader_child_hash(data) & mask;; slot = (slot + 1) & mask)
+    {
+        kb_reader_child_t *child = &children->slots[slot];
+        if (child->data == NULL || child->data == data)
+        {
+            return child;
+        }
+    }
 }
 
-kb_value_t document_get_value(kb_document_t *document, const char *key)
+// Make room for one more reader. Keeps the load factor under a half
+static bool reader_children_reserve(kb_reader_children_t *children, log4c_category_t *logger)
 {
-    assert(document != NULL);
-    assert(key != NULL);
+    if ((children->size + 1) * 2 <= children->capacity)
+    {
+        return true;
+    }
 
-    kb_value_t value;
-    if (!bson_iter_find(&document->iter, key))
+    kb_reader_child_t *old_slots = children->slots;
+    size_t old_capacity = children->capacity;
+    size_t capacity = old_capacity == 0 ? READER_CHILDREN_INITIAL_CAPACITY : old_capacity * 2;
+
+    children->slots = calloc(capacity, sizeof(kb_reader_child_t));
+    if (children->slots == NULL)
     {
-        value.type = KB_VALUE_DOES_NOT_EXIST;
-        return value;
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Failed to allocate memory for nested readers\n");
+        children->slots = old_slots;
+        return false;
     }
 
-    bson_type_t bson_type = bson_iter_type(&document->iter);
+    children->capacity = capacity;
+
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (old_slots[i].data != NULL)
+        {
+            *reader_children_find(children, old_slots[i].data) = old_slots[i];
+        }
+    }
+
+    free(old_slots);
+    return true;
+}
+
+void reader_children_destroy(kb_reader_children_t *children)
+{
+    for (size_t i = 0; i < children->capacity; i++)
+    {
+        kb_reader_child_t *child = &children->slots[i];
+        if (child->data == NULL)
+        {
+            continue;
+        }
+
+        switch (child->kind)
+        {
+            case KB_READER_CHILD_DOCUMENT:
+                document_destroy(child->document);
+                break;
+            case KB_READER_CHILD_ARRAY:
+                array_destroy(child->array);
+                break;
+            case KB_READER_CHILD_PACKED_COPY:
+                free(child->values);
+                break;
+        }
+    }
+
+    free(children->slots);
+    children->slots = NULL;
+    children->capacity = 0;
+    children->size = 0;
+}
+
+kb_document_t *reader_child_document(kb_reader_children_t *children, const bson_iter_t *iter, log4c_category_t *logger)
+{
+    uint32_t size = 0;
+    const uint8_t *data = NULL;
+    bson_iter_document(iter, &size, &data);
+
+    if (!reader_children_reserve(children, logger))
+    {
+        return NULL;
+    }
+
+    kb_reader_child_t *child = reader_children_find(children, data);
+    if (child->data != NULL)
+    {
+        assert(child->kind == KB_READER_CHILD_DOCUMENT);
+        return child->document;
+    }
+
+    // Points into the parent buffer
+    kb_document_t *document = document_from_data((uint8_t *)data, size, logger);
+    if (document == NULL)
+    {
+        return NULL;
+    }
+
+    child->data = data;
+    child->kind = KB_READER_CHILD_DOCUMENT;
+    child->document = document;
+    children->size++;
+    return document;
+}
+
+kb_array_t *reader_child_array(kb_reader_children_t *children, const bson_iter_t *iter, log4c_category_t *logger)
+{
+    uint32_t size = 0;
+    const uint8_t *data = NULL;
+    bson_iter_array(iter, &size, &data);
+
+    if (!reader_children_reserve(children, logger))
+    {
+        return NULL;
+    }
+
+    kb_reader_child_t *child = reader_children_find(children, data);
+    if (child->data != NULL)
+    {
+        assert(child->kind == KB_READER_CHILD_ARRAY);
+
+        // Nested readers are shared. Start over for the new user
+        bson_iter_init_from_data(&child->array->iter, child->array->data, child->array->size);
+        return child->array;
+    }
+
+    kb_array_t *array = array_from_data(data, size, logger);
+    if (array == NULL)
+    {
+        return NULL;
+    }
+
+    child->data = data;
+    child->kind = KB_READER_CHILD_ARRAY;
+    child->array = array;
+    children->size++;
+    return array;
+}
+
+const void *reader_child_packed_copy(kb_reader_children_t *children, const uint8_t *values, size_t size,
+                                     size_t element_size, log4c_category_t *logger)
+{
+    if (!reader_children_reserve(children, logger))
+    {
+        return NULL;
+    }
+
+    kb_reader_child_t *child = reader_children_find(children, values);
+    if (child->data != NULL)
+    {
+        assert(child->kind == KB_READER_CHILD_PACKED_COPY);
+        return child->values;
+    }
+
+    // A multiple of the alignment, which is never zero
+    size_t copy_size = (size + KB_PACKED_ARRAY_ALIGNMENT) & ~(size_t)(KB_PACKED_ARRAY_ALIGNMENT - 1);
+    void *copy = aligned_alloc(KB_PACKED_ARRAY_ALIGNMENT, copy_size);
+    if (copy == NULL)
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Failed to allocate memory for packed array\n");
+        return NULL;
+    }
+
+    memcpy(copy, values, size);
+    packed_values_swap_order(copy, size / element_size, element_size);
+
+    child->data = values;
+    child->kind = KB_READER_CHILD_PACKED_COPY;
+    child->values = copy;
+    children->size++;
+    return copy;
+}
+
+kb_value_t reader_value_from_iter(bson_iter_t *iter, kb_reader_children_t *children, log4c_category_t *logger)
+{
+    kb_value_t value;
+
+    bson_type_t bson_type = bson_iter_type(iter);
     switch (bson_type)
     {
         case BSON_TYPE_NULL:
@@ -61,35 +243,43 @@ kb_value_t document_get_value(kb_document_t *document, const char *key)
             break;
         case BSON_TYPE_BOOL:
             value.type = KB_VALUE_TYPE_BOOL;
-            value.value.boolean = bson_iter_bool(&document->iter);
+            value.value.boolean = bson_iter_bool(iter);
             break;
         case BSON_TYPE_INT32:
             value.type = KB_VALUE_TYPE_INT32;
-            value.value.int32 = bson_iter_int32(&document->iter);
+            value.value.int32 = bson_iter_int32(iter);
             break;
         case BSON_TYPE_INT64:
             value.type = KB_VALUE_TYPE_INT64;
-            value.value.int64 = bson_iter_int64(&document->iter);
+            value.value.int64 = bson_iter_int64(iter);
             break;
         case BSON_TYPE_DOUBLE:
             value.type = KB_VALUE_TYPE_DOUBLE;
-            value.value.double_value = bson_iter_double(&document->iter);
+            value.value.double_value = bson_iter_double(iter);
             break;
         case BSON_TYPE_UTF8:
             value.type = KB_VALUE_TYPE_STRING;
-            value.value.utf8.str = (char *)bson_iter_utf8(&document->iter, &value.value.utf8.len);
+            value.value.utf8.str = (char *)bson_iter_utf8(iter, &value.value.utf8.len);
             break;
         case BSON_TYPE_BINARY:
             value.type = KB_VALUE_TYPE_BINARY;
-            bson_iter_binary(&document->iter, NULL, &value.value.binary.data_len, &value.value.binary.data);
+            bson_iter_binary(iter, NULL, &value.value.binary.data_len, &value.value.binary.data);
             break;
         case BSON_TYPE_DOCUMENT:
             value.type = KB_VALUE_TYPE_DOCUMENT;
-            // Handle document type
+            value.value.document = reader_child_document(children, iter, logger);
+            if (value.value.document == NULL)
+            {
+                value.type = KB_VALUE_DOES_NOT_EXIST;
+            }
             break;
         case BSON_TYPE_ARRAY:
             value.type = KB_VALUE_TYPE_ARRAY;
-            // Handle array type
+            value.value.array = reader_child_array(children, iter, logger);
+            if (value.value.array == NULL)
+            {
+                value.type = KB_VALUE_DOES_NOT_EXIST;
+            }
             break;
         default:
             value.type = KB_VALUE_DOES_NOT_EXIST;
@@ -98,12 +288,185 @@ kb_value_t document_get_value(kb_document_t *document, const char *key)
     return value;
 }
 
+// FNV-1a
+static uint32_t document_key_hash(const char *key, size_t key_len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < key_len; i++)
+    {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+// Point the document iterator at an indexed element
+static bool document_index_seek(kb_document_t *document, kb_document_index_entry_t *entry)
+{
+    return bson_iter_init_from_data_at_offset(&document->iter, document->data, document->size, entry->offset, entry->key_len);
+}
+
+// Add a field to the index. The first of duplicate keys wins, same as with a linear search
+static void document_index_insert(kb_document_t *document, uint32_t hash, uint32_t offset, uint32_t key_len, const char *key)
+{
+    size_t mask = document->index_capacity - 1;
+
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask)
+    {
+        kb_document_index_entry_t *entry = &document->index[slot];
+        if (entry->offset == 0)
+        {
+            entry->hash = hash;
+            entry->offset = offset;
+            entry->key_len = key_len;
+            document->index_size++;
+            return;
+        }
+
+        if (key != NULL && entry->hash == hash && entry->key_len == key_len &&
+            memcmp(document->data + entry->offset + 1, key, key_len) == 0)
+        {
+            return;
+        }
+    }
+}
+
+// Double the index capacity
+static bool document_index_grow(kb_document_t *document)
+{
+    kb_document_index_entry_t *old_index = document->index;
+    size_t old_capacity = document->index_capacity;
+
+    document->index = calloc(old_capacity * 2, sizeof(kb_document_index_entry_t));
+    if (document->index == NULL)
+    {
+        log4c_category_log(document->logger, LOG4C_PRIORITY_ERROR, "Failed to allocate memory for document index\n");
+        document->index = old_index;
+        return false;
+    }
+
+    document->index_capacity = old_capacity * 2;
+    document->index_size = 0;
+
+    // Keys are unique already
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (old_index[i].offset != 0)
+        {
+            document_index_insert(document, old_index[i].hash, old_index[i].offset, old_index[i].key_len, NULL);
+        }
+    }
+
+    free(old_index);
+    return true;
+}
+
+bool document_build_index(kb_document_t *document)
+{
+    assert(document != NULL);
+
+    if (document->index != NULL)
+    {
+        return true;
+    }
+
+    document->index = calloc(DOCUMENT_INDEX_INITIAL_CAPACITY, sizeof(kb_document_index_entry_t));
+    if (document->index == NULL)
+    {
+        log4c_category_log(document->logger, LOG4C_PRIORITY_ERROR, "Failed to allocate memory for document index\n");
+        return false;
+    }
+
+    document->index_capacity = DOCUMENT_INDEX_INITIAL_CAPACITY;
+    document->index_size = 0;
+
+    bson_iter_t iter;
+    if (!bson_iter_init_from_data(&iter, document->data, document->size))
+    {
+        log4c_category_log(document->logger, LOG4C_PRIORITY_ERROR, "Failed to initialize BSON iterator\n");
+        free(document->index);
+        document->index = NULL;
+        return false;
+    }
+
+    while (bson_iter_next(&iter))
+    {
+        // Keep the load factor under a half
+        if ((document->index_size + 1) * 2 > document->index_capacity && !document_index_grow(document))
+        {
+            free(document->index);
+            document->index = NULL;
+            return false;
+        }
+
+        const char *key = bson_iter_key(&iter);
+        uint32_t key_len = bson_iter_key_len(&iter);
+        document_index_insert(document, document_key_hash(key, key_len), bson_iter_offset(&iter), key_len, key);
+    }
+
+    return true;
+}
+
+// Point the document iterator at the field. Searches from the beginning, so any field is found regardless of the previous lookups
+static bool document_find(kb_document_t *document, const char *key)
+{
+    if (document->index == NULL)
+    {
+        return bson_iter_init_from_data(&document->iter, document->data, document->size) &&
+               bson_iter_find(&document->iter, key);
+    }
+
+    size_t key_len = strlen(key);
+    uint32_t hash = document_key_hash(key, key_len);
+    size_t mask = document->index_capacity - 1;
+
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask)
+    {
+        kb_document_index_entry_t *entry = &document->index[slot];
+        if (entry->offset == 0)
+        {
+            return false;
+        }
+
+        // The key follows the type byte of the element
+        if (entry->hash == hash && entry->key_len == key_len &&
+            memcmp(document->data + entry->offset + 1, key, key_len) == 0)
+        {
+            return document_index_seek(document, entry);
+        }
+    }
+}
+
+bool document_has_field(kb_document_t *document, const char *key)
+{
+    assert(document != NULL);
+    assert(key != NULL);
+
+    return document_find(document, key);
+}
+
+kb_value_t document_get_value(kb_document_t *document, const char *key)
+{
+    assert(document != NULL);
+    assert(key != NULL);
+
+    if (!document_find(document, key))
+    {
+        kb_value_t value;
+        value.type = KB_VALUE_DOES_NOT_EXIST;
+        return value;
+    }
+
+    return reader_value_from_iter(&document->iter, &document->children, document->logger);
+}
+
 kb_value_type_t document_value_type(kb_document_t *document, const char *key)
 {
     assert(document != NULL);
     assert(key != NULL);
 
-    if (!bson_iter_find(&document->iter, key))
+    if (!document_find(document, key))
     {
         return KB_VALUE_DOES_NOT_EXIST;
     }
@@ -140,7 +503,7 @@ bool document_get_bool(kb_document_t *document, const char *key, bool *success)
     assert(key != NULL);
     assert(success != NULL);
 
-    if (!bson_iter_find(&document->iter, key))
+    if (!document_find(document, key))
     {
         *success = false;
         return false;
@@ -162,7 +525,7 @@ int32_t document_get_int32(kb_document_t *document, const char *key, bool *succe
     assert(key != NULL);
     assert(success != NULL);
 
-    if (!bson_iter_find(&document->iter, key))
+    if (!document_find(document, key))
     {
         *success = false;
         return 0;
@@ -184,7 +547,7 @@ int64_t document_get_int64(kb_document_t *document, const char *key, bool *succe
     assert(key != NULL);
     assert(success != NULL);
 
-    if (!bson_iter_find(&document->iter, key))
+    if (!document_find(document, key))
     {
         *success = false;
         return 0;
@@ -206,7 +569,7 @@ double document_get_double(kb_document_t *document, const char *key, bool *succe
     assert(key != NULL);
     assert(success != NULL);
 
-    if (!bson_iter_find(&document->iter, key))
+    if (!document_find(document, key))
     {
         *success = false;
         return 0.0;
@@ -229,7 +592,7 @@ const char *document_get_utf8(kb_document_t *document, const char *key, size_t *
     assert(size != NULL);
     assert(success != NULL);
 
-    if (!bson_iter_find(&document->iter, key))
+    if (!document_find(document, key))
     {
         *success = false;
         return NULL;
@@ -252,7 +615,7 @@ const uint8_t *document_get_binary(kb_document_t *document, const char *key, siz
     assert(size != NULL);
     assert(success != NULL);
 
-    if (!bson_iter_find(&document->iter, key))
+    if (!document_find(document, key))
     {
         *success = false;
         return NULL;
@@ -272,5 +635,114 @@ const uint8_t *document_get_binary(kb_document_t *document, const char *key, siz
     return data;
 }
 
-kb_document_t *document_get_document(kb_document_t *document, const char *key, bool *success);
-kb_array_t *document_get_array(kb_document_t *document, const char *key, bool *success);
\ No newline at end of file
+// Get the values of a packed array in place
+static const void *document_get_packed(kb_document_t *document, const char *key, uint8_t subtype,
+                                       size_t element_size, size_t *count, bool *success)
+{
+    assert(document != NULL);
+    assert(key != NULL);
+    assert(count != NULL);
+    assert(success != NULL);
+
+    *success = false;
+    *count = 0;
+
+    if (!document_find(document, key) || bson_iter_type(&document->iter) != BSON_TYPE_BINARY)
+    {
+        return NULL;
+    }
+
+    bson_subtype_t binary_subtype;
+    uint32_t size = 0;
+    const uint8_t *data = NULL;
+    bson_iter_binary(&document->iter, &binary_subtype, &size, &data);
+    if ((uint8_t)binary_subtype != subtype)
+    {
+        return NULL;
+    }
+
+    if (size < 1 || data[0] >= KB_PACKED_ARRAY_ALIGNMENT || (size - 1 - data[0]) % element_size != 0)
+    {
+        log4c_category_log(document->logger, LOG4C_PRIORITY_ERROR, "Invalid packed array '%s'\n", key);
+        return NULL;
+    }
+
+    const void *values = data + 1 + data[0];
+    size_t values_size = size - 1 - data[0];
+
+    // The padding aligns the values relative to the root document. If the receiver put it at a misaligned address,
+    // or the values need a byte swap, read a copy
+    if ((uintptr_t)values % element_size != 0 || __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    {
+        values = reader_child_packed_copy(&document->children, values, values_size, element_size, document->logger);
+        if (values == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    *count = values_size / element_size;
+    *success = true;
+    return values;
+}
+
+const int32_t *document_get_int32_array(kb_document_t *document, const char *key, size_t *count, bool *success)
+{
+    return document_get_packed(document, key, KB_BINARY_SUBTYPE_INT32_ARRAY, sizeof(int32_t), count, success);
+}
+
+const int64_t *document_get_int64_array(kb_document_t *document, const char *key, size_t *count, bool *success)
+{
+    return document_get_packed(document, key, KB_BINARY_SUBTYPE_INT64_ARRAY, sizeof(int64_t), count, success);
+}
+
+const double *document_get_double_array(kb_document_t *document, const char *key, size_t *count, bool *success)
+{
+    return document_get_packed(document, key, KB_BINARY_SUBTYPE_DOUBLE_ARRAY, sizeof(double), count, success);
+}
+
+kb_document_t *document_get_document(kb_document_t *document, const char *key, bool *success)
+{
+    assert(document != NULL);
+    assert(key != NULL);
+    assert(success != NULL);
+
+    if (!document_find(document, key))
+    {
+        *success = false;
+        return NULL;
+    }
+
+    if (bson_iter_type(&document->iter) != BSON_TYPE_DOCUMENT)
+    {
+        *success = false;
+        return NULL;
+    }
+
+    kb_document_t *child = reader_child_document(&document->children, &document->iter, document->logger);
+    *success = child != NULL;
+    return child;
+}
+
+kb_array_t *document_get_array(kb_document_t *document, const char *key, bool *success)
+{
+    assert(document != NULL);
+    assert(key != NULL);
+    assert(success != NULL);
+
+    if (!document_find(document, key))
+    {
+        *success = false;
+        return NULL;
+    }
+
+    if (bson_iter_type(&document->iter) != BSON_TYPE_ARRAY)
+    {
+        *success = false;
+        return NULL;
+    }
+
+    kb_array_t *child = reader_child_array(&document->children, &document->iter, document->logger);
+    *success = child != NULL;
+    return child;
+}
\ No newline at end of file
@@ -0,0 +1,222 @@
+#include "document_schema.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "readers_private.h"
+
+struct kb_compiled_field_s
+{
+    const char *key;
+    uint32_t key_len;
+    bson_type_t bson_type;
+    size_t offset;
+    bool required;
+};
+typedef struct kb_compiled_field_s kb_compiled_field_t;
+
+struct kb_document_schema_s
+{
+    log4c_category_t *logger;
+    size_t num_fields;
+    uint64_t required_mask; // Bit N is set if the field N is required
+    kb_compiled_field_t fields[];
+};
+
+static bool value_type_to_bson(kb_value_type_t type, bson_type_t *bson_type)
+{
+    switch (type)
+    {
+        case KB_VALUE_TYPE_NULL:
+            *bson_type = BSON_TYPE_NULL;
+            return true;
+        case KB_VALUE_TYPE_BOOL:
+            *bson_type = BSON_TYPE_BOOL;
+            return true;
+        case KB_VALUE_TYPE_INT32:
+            *bson_type = BSON_TYPE_INT32;
+            return true;
+        case KB_VALUE_TYPE_INT64:
+            *bson_type = BSON_TYPE_INT64;
+            return true;
+        case KB_VALUE_TYPE_DOUBLE:
+            *bson_type = BSON_TYPE_DOUBLE;
+            return true;
+        case KB_VALUE_TYPE_STRING:
+            *bson_type = BSON_TYPE_UTF8;
+            return true;
+        case KB_VALUE_TYPE_BINARY:
+            *bson_type = BSON_TYPE_BINARY;
+            return true;
+        default:
+            return false;
+    }
+}
+
+kb_document_schema_t *document_schema_create(const kb_schema_field_t *fields, size_t num_fields, log4c_category_t *logger)
+{
+    assert(fields != NULL || num_fields == 0);
+
+    if (num_fields > KB_SCHEMA_MAX_FIELDS)
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Too many schema fields: %zu. Max %d\n", num_fields, KB_SCHEMA_MAX_FIELDS);
+        return NULL;
+    }
+
+    kb_document_schema_t *schema = malloc(sizeof(kb_document_schema_t) + num_fields * sizeof(kb_compiled_field_t));
+    if (schema == NULL)
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Failed to allocate memory for document schema\n");
+        return NULL;
+    }
+
+    schema->logger = logger;
+    schema->num_fields = num_fields;
+    schema->required_mask = 0;
+
+    for (size_t i = 0; i < num_fields; i++)
+    {
+        assert(fields[i].key != NULL);
+
+        kb_compiled_field_t *field = &schema->fields[i];
+        if (!value_type_to_bson(fields[i].type, &field->bson_type))
+        {
+            log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Unsupported schema field type for '%s': %d\n", fields[i].key, fields[i].type);
+            free(schema);
+            return NULL;
+        }
+
+        field->key = fields[i].key;
+        field->key_len = strlen(fields[i].key);
+        field->offset = fields[i].offset;
+        field->required = fields[i].required;
+
+        if (field->required)
+        {
+            schema->required_mask |= 1ull << i;
+        }
+    }
+
+    return schema;
+}
+
+void document_schema_destroy(kb_document_schema_t *schema)
+{
+    free(schema);
+}
+
+static bool field_matches(const kb_compiled_field_t *field, const char *key, uint32_t key_len)
+{
+    return field->key_len == key_len && memcmp(field->key, key, key_len) == 0;
+}
+
+// Find the schema field of the element. Fields usually come in the schema order, so the next one is checked first
+static ssize_t document_schema_find_field(const kb_document_schema_t *schema, size_t expected, const char *key, uint32_t key_len)
+{
+    if (expected < schema->num_fields && field_matches(&schema->fields[expected], key, key_len))
+    {
+        return expected;
+    }
+
+    for (size_t i = 0; i < schema->num_fields; i++)
+    {
+        if (field_matches(&schema->fields[i], key, key_len))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void document_schema_store(const kb_compiled_field_t *field, bson_iter_t *iter, uint8_t *out)
+{
+    void *destination = out + field->offset;
+
+    switch (field->bson_type)
+    {
+        case BSON_TYPE_BOOL:
+            *(bool *)destination = bson_iter_bool(iter);
+            break;
+        case BSON_TYPE_INT32:
+            *(int32_t *)destination = bson_iter_int32(iter);
+            break;
+        case BSON_TYPE_INT64:
+            *(int64_t *)destination = bson_iter_int64(iter);
+            break;
+        case BSON_TYPE_DOUBLE:
+            *(double *)destination = bson_iter_double(iter);
+            break;
+        case BSON_TYPE_UTF8:
+        {
+            kb_schema_string_t *string = destination;
+            string->str = bson_iter_utf8(iter, &string->len);
+            break;
+        }
+        case BSON_TYPE_BINARY:
+        {
+            kb_schema_binary_t *binary = destination;
+            bson_iter_binary(iter, NULL, &binary->data_len, &binary->data);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+bool document_schema_extract(const kb_document_schema_t *schema, kb_document_t *document, void *out, uint64_t *present)
+{
+    assert(schema != NULL);
+    assert(document != NULL);
+    assert(out != NULL);
+
+    uint64_t found = 0;
+    if (present != NULL)
+    {
+        *present = 0;
+    }
+
+    bson_iter_t iter;
+    if (!bson_iter_init_from_data(&iter, document->data, document->size))
+    {
+        log4c_category_log(schema->logger, LOG4C_PRIORITY_ERROR, "Failed to initialize BSON iterator\n");
+        return false;
+    }
+
+    bool result = true;
+    size_t expected = 0;
+    while (bson_iter_next(&iter))
+    {
+        ssize_t index = document_schema_find_field(schema, expected, bson_iter_key(&iter), bson_iter_key_len(&iter));
+        // Unknown field or a duplicate. The first one wins, same as with the getters
+        if (index < 0 || (found & (1ull << index)) != 0)
+        {
+            continue;
+        }
+
+        const kb_compiled_field_t *field = &schema->fields[index];
+        if (bson_iter_type(&iter) != field->bson_type)
+        {
+            log4c_category_log(schema->logger, LOG4C_PRIORITY_ERROR, "Invalid type of the field '%s': %d\n", field->key, bson_iter_type(&iter));
+            result = false;
+            break;
+        }
+
+        document_schema_store(field, &iter, out);
+        found |= 1ull << index;
+        expected = index + 1;
+    }
+
+    if (present != NULL)
+    {
+        *present = found;
+    }
+
+    if (result && (found & schema->required_mask) != schema->required_mask)
+    {
+        log4c_category_log(schema->logger, LOG4C_PRIORITY_ERROR, "Missing required document fields\n");
+        result = false;
+    }
+
+    return result;
+}
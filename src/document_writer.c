@@ -1,47 +1,89 @@
 #include "document_writer.h"
 
 #include <assert.h>
+#include <stddef.h>
 
 #include <bson.h>
 
+#include "value.h"
 #include "writers_private.h"
+#include "utils.h"
 
-static void *kb_bson_realloc(void *mem, size_t num_bytes, void *ctx)
+// Packed arrays up to this size are assembled on the stack
+#define PACKED_ARRAY_STACK_SIZE 256
+
+// Root document writer with the stack of its nested writers
+struct kb_root_writer_s
 {
-    return NULL;
-}
+    kb_document_writer_t document;
+    kb_writer_stack_t stack;
+};
 
-kb_document_writer_t *doc_writer_from_buffer(uint8_t *data, size_t size, log4c_category_t *logger)
+kb_document_writer_t *doc_writer_from_buffer(uint8_t *data, size_t size, bson_realloc_func realloc_func,
+                                             void *realloc_ctx, log4c_category_t *logger)
 {
-    kb_document_writer_t *writer = malloc(sizeof(kb_document_writer_t));
-    if (writer == NULL)
+    struct kb_root_writer_s *root = malloc(sizeof(struct kb_root_writer_s));
+    if (root == NULL)
     {
         log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Failed to allocate memory for document writer\n");
         return NULL;
     }
+
+    kb_document_writer_t *writer = &root->document;
     writer->logger = logger;
-    writer->parent_document = NULL;
-    writer->parent_array = NULL;
+    writer->parent = NULL;
+    writer->stack = &root->stack;
+    writer->stack->depth = 0;
+    writer->stack->failed = false;
 
     uint8_t bson_header[5] = {5, 0, 0, 0, 0};
     memcpy(data, bson_header, sizeof(bson_header));
-    writer->bson = bson_new_from_buffer(&data, &size, kb_bson_realloc, NULL);
+
+    // BSON keeps pointers to the buffer and its size to update them on growth, so they must outlive this call
+    writer->buffer = data;
+    writer->buffer_size = size;
+    writer->bson = bson_new_from_buffer(&writer->buffer, &writer->buffer_size, realloc_func, realloc_ctx);
     if (writer->bson == NULL)
     {
         log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Failed to create BSON writer\n");
+        free(writer);
         return NULL;
     }
+
+    return writer;
 }
 
 bool doc_writer_destroy(kb_document_writer_t *writer)
 {
     assert(writer != NULL);
-    assert(writer->parent_document == NULL && writer->parent_array == NULL);
+    assert(writer->parent == NULL);
 
+    // BSON frees the buffer it writes into, but the buffer belongs to the message writer
+    writer->buffer = NULL;
     bson_destroy(writer->bson);
+    free(writer);
+
     return true;
 }
 
+void doc_writer_reset(kb_document_writer_t *writer, uint8_t *data, size_t size)
+{
+    assert(writer != NULL);
+    assert(writer->bson != NULL);
+    assert(data != NULL);
+    assert(writer->parent == NULL);
+
+    // A cancelled message may leave nested writers open
+    writer->stack->depth = 0;
+    writer->stack->failed = false;
+    writer->bson->flags &= ~BSON_FLAG_IN_CHILD;
+
+    // BSON reads the buffer through the pointers to these fields, so the same BSON writer can be reused
+    writer->buffer = data;
+    writer->buffer_size = size;
+    bson_reinit(writer->bson);
+}
+
 size_t doc_writer_data_size(kb_document_writer_t *writer)
 {
     assert(writer != NULL);
@@ -58,7 +100,7 @@ bool doc_writer_append_binary(kb_document_writer_t *writer, const char *key,
     assert(key != NULL);
     assert(binary != NULL);
 
-    return bson_append_binary(writer->bson, key, -1, BSON_SUBTYPE_BINARY, binary, length);
+    return WRITER_APPEND(writer->stack, bson_append_binary(writer->bson, key, -1, BSON_SUBTYPE_BINARY, binary, length));
 }
 
 bool doc_writer_append_utf8(kb_document_writer_t *writer, const char *key,
@@ -69,7 +111,7 @@ bool doc_writer_append_utf8(kb_document_writer_t *writer, const char *key,
     assert(key != NULL);
     assert(value != NULL);
 
-    return bson_append_utf8(writer->bson, key, -1, value, length);
+    return WRITER_APPEND(writer->stack, bson_append_utf8(writer->bson, key, -1, value, length));
 }
 
 bool doc_writer_append_null(kb_document_writer_t *writer, const char *key)
@@ -78,7 +120,7 @@ bool doc_writer_append_null(kb_document_writer_t *writer, const char *key)
     assert(writer->bson != NULL);
     assert(key != NULL);
 
-    return bson_append_null(writer->bson, key, -1);
+    return WRITER_APPEND(writer->stack, bson_append_null(writer->bson, key, -1));
 }
 
 bool doc_writer_append_bool(kb_document_writer_t *writer, const char *key, bool value)
@@ -87,7 +129,7 @@ bool doc_writer_append_bool(kb_document_writer_t *writer, const char *key, bool
     assert(writer->bson != NULL);
     assert(key != NULL);
 
-    return bson_append_bool(writer->bson, key, -1, value);
+    return WRITER_APPEND(writer->stack, bson_append_bool(writer->bson, key, -1, value));
 }
 
 bool doc_writer_append_double(kb_document_writer_t *writer, const char *key, double value)
@@ -96,7 +138,7 @@ bool doc_writer_append_double(kb_document_writer_t *writer, const char *key, dou
     assert(writer->bson != NULL);
     assert(key != NULL);
 
-    return bson_append_double(writer->bson, key, -1, value);
+    return WRITER_APPEND(writer->stack, bson_append_double(writer->bson, key, -1, value));
 }
 
 bool doc_writer_append_int32(kb_document_writer_t *writer, const char *key, int32_t value)
@@ -105,7 +147,7 @@ bool doc_writer_append_int32(kb_document_writer_t *writer, const char *key, int3
     assert(writer->bson != NULL);
     assert(key != NULL);
 
-    return bson_append_int32(writer->bson, key, -1, value);
+    return WRITER_APPEND(writer->stack, bson_append_int32(writer->bson, key, -1, value));
 }
 
 bool doc_writer_append_int64(kb_document_writer_t *writer, const char *key, int64_t value)
@@ -114,74 +156,206 @@ bool doc_writer_append_int64(kb_document_writer_t *writer, const char *key, int6
     assert(writer->bson != NULL);
     assert(key != NULL);
 
-    return bson_append_int64(writer->bson, key, -1, value);
+    return WRITER_APPEND(writer->stack, bson_append_int64(writer->bson, key, -1, value));
 }
 
-kb_document_writer_t *doc_writer_document_begin(kb_document_writer_t *writer, const char *key)
+// Start of the root document. Nested writers write into it in place
+static const uint8_t *doc_writer_root_data(kb_document_writer_t *writer)
+{
+    struct kb_root_writer_s *root = (struct kb_root_writer_s *)((char *)writer->stack - offsetof(struct kb_root_writer_s, stack));
+    return root->document.buffer;
+}
+
+// Append a packed numeric array as a binary element, padding the values so they're aligned relative to the root document.
+// The receiver may put the document anywhere, so the address of the buffer doesn't matter
+static bool doc_writer_append_packed(kb_document_writer_t *writer, const char *key, uint8_t subtype,
+                                     const void *values, uint32_t count, size_t element_size)
 {
     assert(writer != NULL);
     assert(writer->bson != NULL);
     assert(key != NULL);
+    assert(values != NULL || count == 0);
+
+    if (count > (UINT32_MAX - KB_PACKED_ARRAY_ALIGNMENT) / element_size)
+    {
+        log4c_category_log(writer->logger, LOG4C_PRIORITY_ERROR, "Packed array is too large: %u elements\n", count);
+        return false;
+    }
+
+    // The new element replaces the document terminator: type byte, key, binary length, subtype, payload
+    size_t document_offset = bson_get_data(writer->bson) - doc_writer_root_data(writer);
+    size_t payload_offset = document_offset + writer->bson->len - 1 + 1 + strlen(key) + 1 + 4 + 1;
+    uint8_t padding = (KB_PACKED_ARRAY_ALIGNMENT - (payload_offset + 1) % KB_PACKED_ARRAY_ALIGNMENT) % KB_PACKED_ARRAY_ALIGNMENT;
+    uint32_t payload_size = 1 + padding + count * element_size;
+
+    uint8_t stack_buffer[PACKED_ARRAY_STACK_SIZE];
+    uint8_t *payload = stack_buffer;
+    if (payload_size > sizeof(stack_buffer))
+    {
+        payload = malloc(payload_size);
+        if (payload == NULL)
+        {
+            log4c_category_log(writer->logger, LOG4C_PRIORITY_ERROR, "Failed to allocate memory for packed array\n");
+            return false;
+        }
+    }
+
+    payload[0] = padding;
+    memset(payload + 1, 0, padding);
+    if (count > 0)
+    {
+        memcpy(payload + 1 + padding, values, count * element_size);
+        packed_values_swap_order(payload + 1 + padding, count, element_size);
+    }
+
+    bool result = WRITER_APPEND(writer->stack, bson_append_binary(writer->bson, key, -1, subtype, payload, payload_size));
 
-    kb_document_writer_t *sub_writer = malloc(sizeof(kb_document_writer_t));
-    if (sub_writer == NULL)
+    if (payload != stack_buffer)
     {
-        log4c_category_log(writer->logger, LOG4C_PRIORITY_ERROR, "Failed to allocate memory for sub-document writer\n");
+        free(payload);
+    }
+
+    return result;
+}
+
+bool doc_writer_append_int32_array(kb_document_writer_t *writer, const char *key, const int32_t *values, uint32_t count)
+{
+    return doc_writer_append_packed(writer, key, KB_BINARY_SUBTYPE_INT32_ARRAY, values, count, sizeof(int32_t));
+}
+
+bool doc_writer_append_int64_array(kb_document_writer_t *writer, const char *key, const int64_t *values, uint32_t count)
+{
+    return doc_writer_append_packed(writer, key, KB_BINARY_SUBTYPE_INT64_ARRAY, values, count, sizeof(int64_t));
+}
+
+bool doc_writer_append_double_array(kb_document_writer_t *writer, const char *key, const double *values, uint32_t count)
+{
+    return doc_writer_append_packed(writer, key, KB_BINARY_SUBTYPE_DOUBLE_ARRAY, values, count, sizeof(double));
+}
+
+kb_document_writer_t *writer_stack_push_document(kb_writer_stack_t *stack, bson_t *parent, const char *key,
+                                                 int key_length, log4c_category_t *logger)
+{
+    assert(stack != NULL);
+    assert(parent != NULL);
+
+    if (stack->depth == KB_WRITER_MAX_DEPTH)
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Documents are nested too deep. Max depth is %d\n", KB_WRITER_MAX_DEPTH);
         return NULL;
     }
 
-    sub_writer->logger = writer->logger;
-    sub_writer->bson = bson_new();
-    sub_writer->parent_document = writer->bson;
-    if (sub_writer->bson == NULL)
+    kb_document_writer_t *sub_writer = &stack->frames[stack->depth].document;
+    sub_writer->buffer = NULL;
+    sub_writer->buffer_size = 0;
+    sub_writer->bson = &sub_writer->nested;
+    sub_writer->parent = parent;
+    sub_writer->stack = stack;
+    sub_writer->logger = logger;
+
+    if (!WRITER_APPEND(stack, bson_append_document_begin(parent, key, key_length, sub_writer->bson)))
     {
-        log4c_category_log(writer->logger, LOG4C_PRIORITY_ERROR, "Failed to create BSON writer\n");
-        free(sub_writer);
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Failed to init internal document\n");
         return NULL;
     }
 
-    if (!bson_append_document_begin(sub_writer->parent_document, key, -1, sub_writer->bson))
+    stack->depth++;
+    return sub_writer;
+}
+
+kb_array_writer_t *writer_stack_push_array(kb_writer_stack_t *stack, bson_t *parent, const char *key,
+                                           int key_length, log4c_category_t *logger)
+{
+    assert(stack != NULL);
+    assert(parent != NULL);
+
+    if (stack->depth == KB_WRITER_MAX_DEPTH)
     {
-        log4c_category_log(writer->logger, LOG4C_PRIORITY_ERROR, "Failed to init internal document\n");
-        free(sub_writer);
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Arrays are nested too deep. Max depth is %d\n", KB_WRITER_MAX_DEPTH);
         return NULL;
     }
 
+    kb_array_writer_t *sub_writer = &stack->frames[stack->depth].array;
+    sub_writer->parent = parent;
+    sub_writer->index = 0;
+    sub_writer->stack = stack;
+    sub_writer->logger = logger;
+
+    if (!WRITER_APPEND(stack, bson_append_array_begin(parent, key, key_length, &sub_writer->bson)))
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Failed to init internal array\n");
+        return NULL;
+    }
+
+    stack->depth++;
     return sub_writer;
 }
-bool doc_writer_document_end(kb_document_writer_t *writer)
+
+bool writer_stack_pop(kb_writer_stack_t *stack, bson_t *parent, bson_t *child, bool is_array, log4c_category_t *logger)
 {
-    assert(writer != NULL);
-    assert(writer->bson != NULL);
+    assert(stack != NULL);
 
-    if (!writer->parent_document)
+    if (stack->depth == 0)
     {
-        log4c_category_log(writer->logger, LOG4C_PRIORITY_ERROR, "Can't end root document\n");
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "No nested writer to finish\n");
+        return false;
+    }
+
+    // Nested writers must be finished in the reverse order
+    union kb_writer_frame_u *top = &stack->frames[stack->depth - 1];
+    if ((is_array ? &top->array.bson : top->document.bson) != child)
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Nested writer is finished out of order\n");
         return false;
     }
 
-    if (!bson_append_document_end(writer->parent_document, writer->bson))
+    bool result = WRITER_APPEND(stack, is_array ? bson_append_array_end(parent, child) : bson_append_document_end(parent, child));
+    if (!result)
     {
-        log4c_category_log(writer->logger, LOG4C_PRIORITY_ERROR, "Failed to append document end\n");
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Failed to finish internal %s\n", is_array ? "array" : "document");
         return false;
     }
 
+    stack->depth--;
     return true;
 }
 
+kb_document_writer_t *doc_writer_document_begin(kb_document_writer_t *writer, const char *key)
+{
+    assert(writer != NULL);
+    assert(writer->bson != NULL);
+    assert(key != NULL);
+
+    return writer_stack_push_document(writer->stack, writer->bson, key, -1, writer->logger);
+}
+
+bool doc_writer_document_end(kb_document_writer_t *writer)
+{
+    assert(writer != NULL);
+    assert(writer->bson != NULL);
+
+    if (!writer->parent)
+    {
+        log4c_category_log(writer->logger, LOG4C_PRIORITY_ERROR, "Can't end root document\n");
+        return false;
+    }
+
+    return writer_stack_pop(writer->stack, writer->parent, writer->bson, false, writer->logger);
+}
+
 kb_array_writer_t *doc_writer_array_begin(kb_document_writer_t *writer, const char *key)
 {
     assert(writer != NULL);
     assert(writer->bson != NULL);
     assert(key != NULL);
 
-    return arr_writer_create(writer, key, writer->logger);
+    return writer_stack_push_array(writer->stack, writer->bson, key, -1, writer->logger);
 }
 
 bool doc_writer_array_end(kb_array_writer_t *writer)
 {
     assert(writer != NULL);
-    assert(writer->builder != NULL);
+    assert(writer->parent != NULL);
 
-    return arr_writer_finish(writer);
+    return writer_stack_pop(writer->stack, writer->parent, &writer->bson, true, writer->logger);
 }
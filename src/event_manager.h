@@ -22,6 +22,15 @@ struct kb_event_manager_s
      * @return Message associated with the event or NULL if no message is available
      */
     kb_message_t *(*handle_event)(struct io_uring_cqe *cqe);
+
+    /**
+     * @brief Handle a completion event and retrieve all messages it made available. Optional
+     * @param cqe Completion queue event from io_uring
+     * @param messages Array to put received messages into
+     * @param max_messages Size of the array
+     * @return Number of received messages
+     */
+    size_t (*handle_event_batch)(struct io_uring_cqe *cqe, kb_message_t **messages, size_t max_messages);
 };
 
 typedef struct kb_event_manager_s kb_event_manager_t;
@@ -31,9 +40,14 @@ typedef struct kb_event_manager_s kb_event_manager_t;
  */
 enum kb_event_type_u
 {
-    KB_UDS_EVENT_READABLE,  // Data is available to read
-    KB_UDS_EVENT_WRITEABLE, // Buffer is available to write
-    KB_UDS_EVENT_MAX        // Maximum event type value
+    KB_UDS_EVENT_READABLE,       // Data is available to read
+    KB_UDS_EVENT_WRITEABLE,      // Buffer is available to write
+    KB_SHM_EVENT_WAKE,           // Peer wake request. Completes only on failure
+    KB_UDS_EVENT_SEND_ZC,        // Zero-copy send result or notification that the buffer is free
+    KB_RPC_EVENT_TIMEOUT,        // Call timeout timer expired
+    KB_RPC_EVENT_TIMEOUT_UPDATE, // Call timeout timer update. Completes only on failure
+    KB_RPC_EVENT_TIMEOUT_REMOVE, // Call timeout timer removal on destroy
+    KB_UDS_EVENT_MAX             // Maximum event type value
 };
 
 typedef enum kb_event_type_u kb_event_type_t;
@@ -59,4 +73,32 @@ typedef struct kb_event_s kb_event_t;
 inline kb_message_t *event_manager_handle_event(kb_event_manager_t *manager, struct io_uring_cqe *cqe)
 {
     return manager->handle_event(cqe);
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Handle a completion event and retrieve all messages it made available.
+ *        Event managers without batches return at most one message
+ *
+ * @param manager Event manager to handle the event
+ * @param cqe Completion queue event from io_uring
+ * @param messages Array to put received messages into
+ * @param max_messages Size of the array
+ * @return Number of received messages
+ */
+inline size_t event_manager_handle_event_batch(kb_event_manager_t *manager, struct io_uring_cqe *cqe,
+                                               kb_message_t **messages, size_t max_messages)
+{
+    if (manager->handle_event_batch == NULL)
+    {
+        kb_message_t *message = manager->handle_event(cqe);
+        if (message == NULL)
+        {
+            return 0;
+        }
+
+        messages[0] = message;
+        return 1;
+    }
+
+    return manager->handle_event_batch(cqe, messages, max_messages);
+}
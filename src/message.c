@@ -8,19 +8,16 @@
 typedef bson_reader_t kb_data_reader_t;
 typedef bson_t kb_data_document_t;
 
-void message_init(kb_message_t *message, uint8_t *data, size_t size)
+void message_init_static(kb_message_t *message, bson_t *document, uint8_t *data, size_t size)
 {
     assert(message != NULL);
+    assert(document != NULL);
     assert(data != NULL);
     assert(size > 0);
 
-    message->document = bson_new();
-    if (message->document == NULL)
-    {
-        return;
-    }
-
-    bson_init_static(message->document, data, size);
+    // Static documents are not freed by `bson_destroy`, so the storage can be reused
+    bson_init_static(document, data, size);
+    message->document = document;
 }
 
 void message_destroy(kb_message_t *message)
@@ -1,22 +1,159 @@
 #include "message_writer.h"
 
 #include <assert.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/mman.h>
 
 #include "writers_private.h"
 
+// BSON never grows a document past INT32_MAX bytes
+#define OVERFLOW_SCRATCH_SIZE ((size_t)INT32_MAX + 1)
+
+// Scratch space shared by all writers that failed to get their own overflow buffer. Only reserved,
+// so it costs no memory until written. The contents are never read
+static _Atomic(uint8_t *) overflow_scratch = NULL;
+
+static uint8_t *message_writer_overflow_scratch(kb_message_writer_t *writer)
+{
+    uint8_t *scratch = atomic_load(&overflow_scratch);
+    if (scratch != NULL)
+    {
+        return scratch;
+    }
+
+    uint8_t *mapping = mmap(NULL, OVERFLOW_SCRATCH_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    // Without any scratch space BSON would write through a NULL pointer
+    if (mapping == MAP_FAILED)
+    {
+        log4c_category_log(writer->logger, LOG4C_PRIORITY_ERROR, "Failed to reserve overflow scratch space\n");
+        abort();
+    }
+
+    // Another writer could reserve it first
+    if (!atomic_compare_exchange_strong(&overflow_scratch, &scratch, mapping))
+    {
+        munmap(mapping, OVERFLOW_SCRATCH_SIZE);
+        return scratch;
+    }
+
+    return mapping;
+}
+
+static void message_writer_free_overflow(kb_message_writer_t *writer)
+{
+    if (writer->overflow == NULL)
+    {
+        return;
+    }
+
+    if (writer->overflow == atomic_load(&overflow_scratch))
+    {
+        // Give the written pages back. Other failed writers may still write there, but nothing reads it
+        madvise(writer->overflow, OVERFLOW_SCRATCH_SIZE, MADV_DONTNEED);
+    }
+    else
+    {
+        free(writer->overflow);
+    }
+
+    writer->overflow = NULL;
+}
+
+// BSON doesn't check the result of a growth and writes into whatever it gets. Give it a scratch buffer
+// and fail the writer, so the rest of the appends and the send fail
+static void *message_writer_fail(kb_message_writer_t *writer, size_t num_bytes)
+{
+    writer->document_writer->stack->failed = true;
+
+    uint8_t *scratch = atomic_load(&overflow_scratch);
+    if (writer->overflow != NULL && writer->overflow == scratch)
+    {
+        return scratch;
+    }
+
+    uint8_t *overflow = realloc(writer->overflow, num_bytes);
+    if (overflow == NULL)
+    {
+        // Out of memory isn't a reason to crash: the message is lost anyway
+        log4c_category_log(writer->logger, LOG4C_PRIORITY_ERROR, "Failed to allocate %zu bytes of overflow buffer\n", num_bytes);
+        message_writer_free_overflow(writer);
+        overflow = message_writer_overflow_scratch(writer);
+    }
+
+    writer->overflow = overflow;
+    return overflow;
+}
+
+// BSON calls this when the document doesn't fit the buffer anymore
+static void *message_writer_realloc(void *mem, size_t num_bytes, void *ctx)
+{
+    kb_message_writer_t *writer = (kb_message_writer_t *)ctx;
+
+    if (writer->overflow != NULL)
+    {
+        assert(writer->overflow == mem);
+        return message_writer_fail(writer, num_bytes);
+    }
+
+    assert(writer->buffer == mem);
+
+    if (writer->grow == NULL)
+    {
+        log4c_category_log(writer->logger, LOG4C_PRIORITY_ERROR, "Message doesn't fit into the buffer\n");
+        return message_writer_fail(writer, num_bytes);
+    }
+
+    uint8_t *buffer = writer->grow(writer, num_bytes);
+    if (buffer == NULL)
+    {
+        log4c_category_log(writer->logger, LOG4C_PRIORITY_ERROR, "Failed to grow message buffer to %zu bytes\n", num_bytes);
+        return message_writer_fail(writer, num_bytes);
+    }
+
+    writer->buffer = buffer;
+    return buffer;
+}
+
 void message_writer_init(kb_message_writer_t *writer, uint8_t *data, size_t size, log4c_category_t *logger)
 {
-    uint8_t bson_header[5] = {5, 0, 0, 0, 0};
-    memcpy(data, bson_header, sizeof(bson_header));
-    writer->document_writer = doc_writer_from_buffer(data, size, logger);
+    writer->grow = NULL;
+    writer->send_deferred = NULL;
+    writer->cancel = NULL;
+    writer->logger = logger;
+    writer->buffer = data;
+    writer->overflow = NULL;
+
+    writer->document_writer = doc_writer_from_buffer(data, size, message_writer_realloc, writer, logger);
     if (writer->document_writer == NULL)
     {
         log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Failed to create document writer\n");
         return;
     }
+}
 
-    writer->logger = logger;
+void message_writer_reset(kb_message_writer_t *writer, uint8_t *data, size_t size)
+{
+    assert(writer != NULL);
+    assert(writer->document_writer != NULL);
+
+    message_writer_free_overflow(writer);
     writer->buffer = data;
+    doc_writer_reset(writer->document_writer, data, size);
+}
+
+void message_writer_deinit(kb_message_writer_t *writer)
+{
+    assert(writer != NULL);
+
+    message_writer_free_overflow(writer);
+
+    if (writer->document_writer != NULL)
+    {
+        doc_writer_destroy(writer->document_writer);
+        writer->document_writer = NULL;
+    }
 }
 
 kb_document_writer_t *message_writer_root(kb_message_writer_t *writer)
@@ -31,6 +168,13 @@ size_t message_writer_size(kb_message_writer_t *writer)
     return doc_writer_data_size(writer->document_writer);
 }
 
+bool message_writer_failed(kb_message_writer_t *writer)
+{
+    assert(writer != NULL);
+
+    return writer->document_writer->stack->failed;
+}
+
 int message_send(kb_message_writer_t *writer)
 {
     if (writer == NULL || writer->send == NULL)
@@ -38,15 +182,41 @@ int message_send(kb_message_writer_t *writer)
         return 1;
     }
 
+    // The document is incomplete
+    if (message_writer_failed(writer))
+    {
+        message_cancel(writer);
+        return 1;
+    }
+
     // Keep writer because we want to free self memory
     int result = writer->send(writer);
 
     return result;
 }
 
+int message_send_deferred(kb_message_writer_t *writer)
+{
+    if (writer == NULL)
+    {
+        return 1;
+    }
+
+    if (writer->send_deferred == NULL || message_writer_failed(writer))
+    {
+        return message_send(writer);
+    }
+
+    return writer->send_deferred(writer);
+}
+
 void message_cancel(kb_message_writer_t *writer)
 {
-    writer->cancel(writer);
+    if (writer == NULL || writer->cancel == NULL)
+    {
+        return;
+    }
 
-    doc_writer_destroy(writer->document_writer);
+    // The writer owns the document writer and may free itself, so the writer releases everything
+    writer->cancel(writer);
 }
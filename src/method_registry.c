@@ -0,0 +1,156 @@
+#include "method_registry.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+uint32_t method_id(const char *name)
+{
+    assert(name != NULL);
+
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const char *c = name; *c != '\0'; c++)
+    {
+        hash ^= (uint8_t)*c;
+        hash *= 16777619u;
+    }
+
+    return hash != KB_METHOD_NONE ? hash : 1;
+}
+
+bool method_registry_init(kb_method_registry_t *registry, size_t capacity, log4c_category_t *logger)
+{
+    assert(registry != NULL);
+    assert(capacity > 0);
+
+    size_t slot_count = 1;
+    while (slot_count < capacity * 2)
+    {
+        slot_count *= 2;
+    }
+
+    registry->logger = logger;
+    registry->capacity = capacity;
+    registry->slot_mask = slot_count - 1;
+    registry->size = 0;
+
+    registry->entries = malloc(capacity * sizeof(kb_method_entry_t));
+    registry->slots = calloc(slot_count, sizeof(uint32_t));
+    if (registry->entries == NULL || registry->slots == NULL)
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Failed to allocate memory for method registry");
+        method_registry_deinit(registry);
+        return false;
+    }
+
+    return true;
+}
+
+void method_registry_deinit(kb_method_registry_t *registry)
+{
+    assert(registry != NULL);
+
+    free(registry->entries);
+    free(registry->slots);
+    registry->entries = NULL;
+    registry->slots = NULL;
+    registry->size = 0;
+}
+
+// Slot of the method or the empty slot which ends its probe sequence
+static size_t method_registry_probe(const kb_method_registry_t *registry, uint32_t id)
+{
+    // IDs are hashes already
+    size_t slot = id & registry->slot_mask;
+    while (registry->slots[slot] != 0 && registry->entries[registry->slots[slot] - 1].id != id)
+    {
+        slot = (slot + 1) & registry->slot_mask;
+    }
+
+    return slot;
+}
+
+// Double the entries and the table
+static bool method_registry_grow(kb_method_registry_t *registry)
+{
+    size_t new_capacity = registry->capacity * 2;
+    size_t slot_count = (registry->slot_mask + 1) * 2;
+
+    kb_method_entry_t *entries = realloc(registry->entries, new_capacity * sizeof(kb_method_entry_t));
+    if (entries == NULL)
+    {
+        log4c_category_log(registry->logger, LOG4C_PRIORITY_ERROR, "Failed to grow method registry");
+        return false;
+    }
+    registry->entries = entries;
+
+    uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+    if (slots == NULL)
+    {
+        log4c_category_log(registry->logger, LOG4C_PRIORITY_ERROR, "Failed to grow method registry");
+        return false;
+    }
+
+    free(registry->slots);
+    registry->slots = slots;
+    registry->slot_mask = slot_count - 1;
+    registry->capacity = new_capacity;
+
+    for (size_t i = 0; i < registry->size; i++)
+    {
+        registry->slots[method_registry_probe(registry, registry->entries[i].id)] = (uint32_t)(i + 1);
+    }
+
+    return true;
+}
+
+uint32_t method_registry_add(kb_method_registry_t *registry, const char *name,
+                             void (*handler)(struct kb_rpc_message_s *, void *), void *context)
+{
+    assert(registry != NULL);
+    assert(name != NULL);
+    assert(handler != NULL);
+
+    uint32_t id = method_id(name);
+
+    kb_method_entry_t *existing = method_registry_find(registry, id);
+    if (existing != NULL)
+    {
+        if (strcmp(existing->name, name) == 0)
+        {
+            log4c_category_log(registry->logger, LOG4C_PRIORITY_ERROR, "Method `%s` is registered already", name);
+        }
+        else
+        {
+            log4c_category_log(registry->logger, LOG4C_PRIORITY_ERROR, "Method `%s` has the same ID as `%s`. Rename one of them",
+                               name, existing->name);
+        }
+
+        return KB_METHOD_NONE;
+    }
+
+    if (registry->size == registry->capacity && !method_registry_grow(registry))
+    {
+        return KB_METHOD_NONE;
+    }
+
+    size_t index = registry->size++;
+    kb_method_entry_t *entry = &registry->entries[index];
+    entry->id = id;
+    entry->name = name;
+    entry->handler = handler;
+    entry->context = context;
+
+    registry->slots[method_registry_probe(registry, id)] = (uint32_t)(index + 1);
+
+    return id;
+}
+
+kb_method_entry_t *method_registry_find(kb_method_registry_t *registry, uint32_t id)
+{
+    assert(registry != NULL);
+
+    size_t slot = method_registry_probe(registry, id);
+    return registry->slots[slot] != 0 ? &registry->entries[registry->slots[slot] - 1] : NULL;
+}
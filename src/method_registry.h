@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <log4c/category.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Method ID of messages without a method
+#define KB_METHOD_NONE 0
+
+// Initial number of methods. The registry doubles when it runs out of them
+#define KB_METHOD_REGISTRY_INITIAL_CAPACITY 64
+
+struct kb_rpc_message_s;
+
+/**
+ * @brief Registered method
+ */
+struct kb_method_entry_s
+{
+    uint32_t id;                                                 // Method ID
+    const char *name;                                            // Method name. Must outlive the registry
+    void (*handler)(struct kb_rpc_message_s *message, void *);   // Handler. Takes ownership of the message
+    void *context;                                               // User context for handler
+};
+
+typedef struct kb_method_entry_s kb_method_entry_t;
+
+/**
+ * @brief Method dispatch table. Method IDs map to entries through an open-addressing table of entry indices
+ */
+struct kb_method_registry_s
+{
+    kb_method_entry_t *entries; // Registered methods
+    uint32_t *slots;            // Table of entry indices plus one. Zero for empty slots
+    size_t capacity;            // Number of entries
+    size_t slot_mask;           // Number of slots minus one. The table is kept at most half full
+    size_t size;                // Number of registered methods
+    log4c_category_t *logger;
+};
+
+typedef struct kb_method_registry_s kb_method_registry_t;
+
+/**
+ * @brief Get the ID of a method name. IDs are hashes of the names, so every peer gets the same ID
+ *        without negotiation. Compute it once and keep it
+ *
+ * @param name Method name
+ * @return Method ID. Never KB_METHOD_NONE
+ */
+uint32_t method_id(const char *name);
+
+/**
+ * @brief Initialize a method registry
+ *
+ * @param registry Registry to initialize
+ * @param capacity Initial number of methods
+ * @param logger Logger
+ * @return true on success, false if failed to allocate memory
+ */
+bool method_registry_init(kb_method_registry_t *registry, size_t capacity, log4c_category_t *logger);
+
+/**
+ * @brief Free the registry memory
+ *
+ * @param registry Registry to deinitialize
+ */
+void method_registry_deinit(kb_method_registry_t *registry);
+
+/**
+ * @brief Register a method handler
+ *
+ * @param registry Method registry
+ * @param name Method name. Must outlive the registry
+ * @param handler Handler
+ * @param context User context for handler
+ * @return Method ID or KB_METHOD_NONE if the method or its ID is registered already, or on allocation failure
+ */
+uint32_t method_registry_add(kb_method_registry_t *registry, const char *name,
+                             void (*handler)(struct kb_rpc_message_s *, void *), void *context);
+
+/**
+ * @brief Find a method by ID
+ *
+ * @param registry Method registry
+ * @param id Method ID
+ * @return Entry or NULL if the method isn't registered
+ */
+kb_method_entry_t *method_registry_find(kb_method_registry_t *registry, uint32_t id);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -3,13 +3,148 @@
 #include <bson.h>
 #include <log4c/category.h>
 
+#include "value.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Initial number of slots in the field index. Fits 32 fields before growing
+#define DOCUMENT_INDEX_INITIAL_CAPACITY 64
+
+/**
+ * @brief Field index slot
+ */
+struct kb_document_index_entry_s
+{
+    uint32_t hash;    // Key hash
+    uint32_t offset;  // Offset of the element in the document. Zero for empty slots
+    uint32_t key_len; // Key length
+};
+typedef struct kb_document_index_entry_s kb_document_index_entry_t;
+
+// Initial number of slots in the nested reader cache
+#define READER_CHILDREN_INITIAL_CAPACITY 8
+
+/**
+ * @brief Kind of a nested reader cache slot
+ */
+enum kb_reader_child_kind_e
+{
+    KB_READER_CHILD_DOCUMENT,
+    KB_READER_CHILD_ARRAY,
+    KB_READER_CHILD_PACKED_COPY, // Aligned copy of packed array values, which are misaligned in place
+};
+typedef enum kb_reader_child_kind_e kb_reader_child_kind_t;
+
+/**
+ * @brief Nested reader cache slot
+ */
+struct kb_reader_child_s
+{
+    const uint8_t *data;         // Data of the nested document, array or packed values. NULL for empty slots
+    kb_reader_child_kind_t kind; // Kind of the cached reader
+    union
+    {
+        struct kb_document_s *document;
+        struct kb_array_s *array;
+        void *values;
+    };
+};
+typedef struct kb_reader_child_s kb_reader_child_t;
+
+/**
+ * @brief Nested readers owned by a document or an array. Open-addressing hash of nested data to readers
+ */
+struct kb_reader_children_s
+{
+    kb_reader_child_t *slots; // Cache slots. NULL until the first nested reader
+    size_t capacity;          // Number of slots. Power of two
+    size_t size;              // Number of cached readers
+};
+typedef struct kb_reader_children_s kb_reader_children_t;
+
 struct kb_document_s
 {
     bson_iter_t iter;
     log4c_category_t *logger;
+    const uint8_t *data;                // Document data
+    size_t size;                        // Document size
+    kb_document_index_entry_t *index;   // Open-addressing hash of keys to element offsets. NULL if not built
+    size_t index_capacity;              // Number of index slots. Power of two
+    size_t index_size;                  // Number of indexed fields
+    kb_reader_children_t children;      // Nested readers owned by the document
 };
 typedef struct kb_document_s kb_document_t;
 
+struct kb_array_s
+{
+    bson_iter_t iter;                   // Iterator pointing at the current element
+    log4c_category_t *logger;
+    const uint8_t *data;                // Array data
+    size_t size;                        // Array size
+    kb_reader_children_t children;      // Nested readers owned by the array
+};
+typedef struct kb_array_s kb_array_t;
+
 kb_document_t *document_from_data(uint8_t *data, size_t size, log4c_category_t *logger);
 bool document_destroy(kb_document_t *document);
 
+kb_array_t *array_from_data(const uint8_t *data, size_t size, log4c_category_t *logger);
+bool array_destroy(kb_array_t *array);
+
+/**
+ * @brief Get a reader of the document the iterator points to. Readers are cached by their data,
+ *        so reading the same field twice doesn't allocate
+ *
+ * @param children Nested readers of the owner
+ * @param iter Iterator pointing at a document element
+ * @param logger Logger
+ * @return Document reader or NULL on error
+ */
+kb_document_t *reader_child_document(kb_reader_children_t *children, const bson_iter_t *iter, log4c_category_t *logger);
+
+/**
+ * @brief Get a reader of the array the iterator points to. Readers are cached by their data
+ *
+ * @param children Nested readers of the owner
+ * @param iter Iterator pointing at an array element
+ * @param logger Logger
+ * @return Array reader or NULL on error
+ */
+kb_array_t *reader_child_array(kb_reader_children_t *children, const bson_iter_t *iter, log4c_category_t *logger);
+
+/**
+ * @brief Get an aligned copy of packed array values, which are misaligned in the buffer or not in the host byte order.
+ *        Copies are cached by the values, so reading the same field twice doesn't copy
+ *
+ * @param children Nested readers of the owner
+ * @param values Values in the buffer
+ * @param size Size of the values
+ * @param element_size Size of a single value
+ * @param logger Logger
+ * @return Copy in the host byte order aligned to KB_PACKED_ARRAY_ALIGNMENT or NULL on error
+ */
+const void *reader_child_packed_copy(kb_reader_children_t *children, const uint8_t *values, size_t size,
+                                     size_t element_size, log4c_category_t *logger);
+
+/**
+ * @brief Destroy all nested readers of the owner
+ *
+ * @param children Nested readers of the owner
+ */
+void reader_children_destroy(kb_reader_children_t *children);
+
+/**
+ * @brief Convert the element the iterator points to into a value. Nested readers go to the owner cache
+ *
+ * @param iter Iterator pointing at an element
+ * @param children Nested readers of the owner
+ * @param logger Logger
+ * @return Element value
+ */
+kb_value_t reader_value_from_iter(bson_iter_t *iter, kb_reader_children_t *children, log4c_category_t *logger);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
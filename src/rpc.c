@@ -1,17 +1,190 @@
 #include "rpc.h"
 
 #include <assert.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <liburing.h>
 
 #include "message.h"
+#include "writers_private.h"
+
+static const char *HEADER_KEY = "h";
+
+// The header element right after the document length: BSON type, the key, the binary length and subtype
+static const uint8_t HEADER_ELEMENT_PREFIX[] = {BSON_TYPE_BINARY, 'h', '\0', sizeof(kb_rpc_header_t), 0, 0, 0, KB_BINARY_SUBTYPE_RPC_HEADER};
+#define HEADER_ELEMENT_OFFSET 4
+#define HEADER_OFFSET (HEADER_ELEMENT_OFFSET + sizeof(HEADER_ELEMENT_PREFIX))
 
-static const char *ID_KEY = "id";
-static const char *TYPE_KEY = "type";
+// Fills the header of an outgoing message
+static bool rpc_write_header(kb_message_writer_t *writer, uint64_t id, kb_message_type_t type, uint64_t deadline,
+                             uint32_t method_id)
+{
+    kb_rpc_header_t header = {
+        .id = id,
+        .deadline = deadline,
+        .method_id = method_id,
+        .type = (uint16_t)type,
+        .flags = 0,
+    };
+
+    return rpc_write_message_header(writer, &header);
+}
+
+uint64_t rpc_clock_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
 
 uint64_t next_id(kb_rpc_t *rpc)
 {
     return atomic_fetch_add(&rpc->id_counter, 1);
 }
 
+// Get a submission queue entry for the timer. NULL if the queue stays full
+static struct io_uring_sqe *rpc_timer_get_sqe(kb_rpc_t *rpc)
+{
+    struct io_uring *ring = rpc->timer.base.ring;
+
+    struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+    if (sqe == NULL)
+    {
+        // Submission queue is full. Flush it and try again
+        io_uring_submit(ring);
+        sqe = io_uring_get_sqe(ring);
+        if (sqe == NULL)
+        {
+            log4c_category_log(rpc->logger, LOG4C_PRIORITY_ERROR, "io_uring call timeout: submission queue is full");
+        }
+    }
+
+    return sqe;
+}
+
+// Arm or move the io_uring timeout to the next call expiration
+static void rpc_timer_schedule(kb_rpc_t *rpc)
+{
+    kb_rpc_timer_t *timer = &rpc->timer;
+    struct io_uring *ring = timer->base.ring;
+    if (ring == NULL)
+    {
+        return;
+    }
+
+    uint64_t next = call_registry_next_expiry(&rpc->calls_registry);
+    if (next == UINT64_MAX || (timer->expiry != 0 && timer->expiry <= next))
+    {
+        return;
+    }
+
+    struct io_uring_sqe *sqe = rpc_timer_get_sqe(rpc);
+    if (sqe == NULL)
+    {
+        return;
+    }
+
+    timer->timeout.tv_sec = next / 1000;
+    timer->timeout.tv_nsec = (next % 1000) * 1000000;
+
+    if (timer->expiry == 0)
+    {
+        io_uring_prep_timeout(sqe, &timer->timeout, 0, IORING_TIMEOUT_ABS);
+        io_uring_sqe_set_data(sqe, &timer->timeout_event);
+    }
+    else
+    {
+        // An earlier call deadline. Move the armed timeout
+        io_uring_prep_timeout_update(sqe, &timer->timeout, (uint64_t)(uintptr_t)&timer->timeout_event, IORING_TIMEOUT_ABS);
+        io_uring_sqe_set_data(sqe, &timer->update_event);
+        io_uring_sqe_set_flags(sqe, IOSQE_CQE_SKIP_SUCCESS);
+    }
+
+    timer->expiry = next;
+
+    int ret = io_uring_submit(ring);
+    if (ret < 0)
+    {
+        log4c_category_log(rpc->logger, LOG4C_PRIORITY_ERROR, "io_uring call timeout submit error: %s", strerror(-ret));
+    }
+}
+
+// Free a destroyed RPC module once the ring is done with its timeout
+static void rpc_free_destroyed(kb_rpc_t *rpc)
+{
+    assert(rpc->timer.destroyed);
+
+    if (rpc->timer.expiry == 0 && !rpc->timer.remove_pending)
+    {
+        free(rpc);
+    }
+}
+
+static kb_message_t *rpc_timer_handle_event(struct io_uring_cqe *cqe)
+{
+    kb_event_t *event = (kb_event_t *)io_uring_cqe_get_data(cqe);
+    kb_rpc_timer_t *timer = (kb_rpc_timer_t *)event->manager;
+
+    if (event->event_type == KB_RPC_EVENT_TIMEOUT_REMOVE)
+    {
+        // The timeout may be firing or have fired already. Its completion comes anyway
+        if (cqe->res < 0 && cqe->res != -ENOENT && cqe->res != -EALREADY)
+        {
+            log4c_category_log(timer->base.logger, LOG4C_PRIORITY_ERROR, "io_uring call timeout remove error: %s", strerror(-cqe->res));
+        }
+
+        timer->remove_pending = false;
+        rpc_free_destroyed(timer->rpc);
+        return NULL;
+    }
+
+    if (event->event_type == KB_RPC_EVENT_TIMEOUT_UPDATE)
+    {
+        // The timeout has fired already. Its completion reschedules the timer
+        if (cqe->res != -ENOENT)
+        {
+            log4c_category_log(timer->base.logger, LOG4C_PRIORITY_ERROR, "io_uring call timeout update error: %s", strerror(-cqe->res));
+        }
+
+        return NULL;
+    }
+
+    timer->expiry = 0;
+    if (timer->destroyed)
+    {
+        rpc_free_destroyed(timer->rpc);
+        return NULL;
+    }
+
+    if (cqe->res != -ETIME && cqe->res != 0)
+    {
+        log4c_category_log(timer->base.logger, LOG4C_PRIORITY_ERROR, "io_uring call timeout error: %s", strerror(-cqe->res));
+    }
+
+    rpc_process_timeouts(timer->rpc, rpc_clock_ms());
+    return NULL;
+}
+
+void rpc_attach_ring(kb_rpc_t *rpc, struct io_uring *ring)
+{
+    assert(rpc != NULL);
+    assert(rpc->timer.base.ring == NULL);
+
+    rpc->timer.base.ring = ring;
+    rpc_timer_schedule(rpc);
+}
+
+size_t rpc_process_timeouts(kb_rpc_t *rpc, uint64_t now)
+{
+    assert(rpc != NULL);
+
+    size_t expired = call_registry_expire(&rpc->calls_registry, now);
+    rpc_timer_schedule(rpc);
+
+    return expired;
+}
+
 kb_rpc_t *rpc_init(kb_transport_t *transport, log4c_category_t *logger)
 {
     kb_rpc_t *rpc = malloc(sizeof(kb_rpc_t));
@@ -22,9 +195,45 @@ kb_rpc_t *rpc_init(kb_transport_t *transport, log4c_category_t *logger)
 
     rpc->transport = transport;
     rpc->logger = logger;
-    rpc->calls_registry.entries = NULL;
     rpc->id_counter = 1;
 
+    if (!call_registry_init(&rpc->calls_registry, KB_CALL_REGISTRY_INITIAL_CAPACITY, logger))
+    {
+        free(rpc);
+        return NULL;
+    }
+
+    if (!method_registry_init(&rpc->methods, KB_METHOD_REGISTRY_INITIAL_CAPACITY, logger))
+    {
+        call_registry_deinit(&rpc->calls_registry);
+        free(rpc);
+        return NULL;
+    }
+
+    if (!call_registry_init(&rpc->streams, KB_CALL_REGISTRY_INITIAL_CAPACITY, logger))
+    {
+        method_registry_deinit(&rpc->methods);
+        call_registry_deinit(&rpc->calls_registry);
+        free(rpc);
+        return NULL;
+    }
+
+    rpc->timer.base.logger = logger;
+    rpc->timer.base.transport = transport;
+    rpc->timer.base.ring = NULL;
+    rpc->timer.base.handle_event = rpc_timer_handle_event;
+    rpc->timer.base.handle_event_batch = NULL;
+    rpc->timer.rpc = rpc;
+    rpc->timer.timeout_event.manager = &rpc->timer.base;
+    rpc->timer.timeout_event.event_type = KB_RPC_EVENT_TIMEOUT;
+    rpc->timer.update_event.manager = &rpc->timer.base;
+    rpc->timer.update_event.event_type = KB_RPC_EVENT_TIMEOUT_UPDATE;
+    rpc->timer.remove_event.manager = &rpc->timer.base;
+    rpc->timer.remove_event.event_type = KB_RPC_EVENT_TIMEOUT_REMOVE;
+    rpc->timer.expiry = 0;
+    rpc->timer.remove_pending = false;
+    rpc->timer.destroyed = false;
+
     return rpc;
 }
 
@@ -32,29 +241,70 @@ kb_message_writer_t *rpc_message(kb_rpc_t *rpc)
 {
     kb_message_writer_t *writer = transport_message_init(rpc->transport);
 
-    if (writer)
+    if (writer && !rpc_write_header(writer, next_id(rpc), KB_MESSAGE_TYPE_MESSAGE, 0, KB_METHOD_NONE))
     {
-        rpc_write_message_header(writer, next_id(rpc), KB_MESSAGE_TYPE_MESSAGE);
+        message_cancel(writer);
+        return NULL;
     }
 
     return writer;
 }
 
+kb_message_writer_t *rpc_message_method(kb_rpc_t *rpc, uint32_t method_id)
+{
+    kb_message_writer_t *writer = transport_message_init(rpc->transport);
+
+    if (writer && !rpc_write_header(writer, next_id(rpc), KB_MESSAGE_TYPE_MESSAGE, 0, method_id))
+    {
+        message_cancel(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+kb_message_writer_t *rpc_call_method(kb_rpc_t *rpc, uint32_t method_id, void (*callback)(kb_message_t *, void *),
+                                     void *context, uint32_t timeout_ms)
+{
+    kb_message_writer_t *writer = transport_message_init(rpc->transport);
+    uint64_t deadline = timeout_ms != 0 ? rpc_clock_ms() + timeout_ms : 0;
+
+    return rpc_wrap_transport_message(rpc, writer, KB_MESSAGE_TYPE_CALL, callback, context, deadline, method_id);
+}
+
+uint32_t rpc_register_method(kb_rpc_t *rpc, const char *name, void (*handler)(kb_rpc_message_t *, void *), void *context)
+{
+    assert(rpc != NULL);
+
+    return method_registry_add(&rpc->methods, name, handler, context);
+}
+
 kb_message_writer_t *rpc_call(kb_rpc_t *rpc, void (*callback)(kb_message_t *, void *), void *context)
 {
     kb_message_writer_t *writer = transport_message_init(rpc->transport);
 
-    return rpc_wrap_transport_message(rpc, writer, KB_MESSAGE_TYPE_CALL, callback, context);
+    return rpc_wrap_transport_message(rpc, writer, KB_MESSAGE_TYPE_CALL, callback, context, 0, KB_METHOD_NONE);
+}
+
+kb_message_writer_t *rpc_call_with_timeout(kb_rpc_t *rpc, void (*callback)(kb_message_t *, void *), void *context,
+                                           uint32_t timeout_ms)
+{
+    kb_message_writer_t *writer = transport_message_init(rpc->transport);
+
+    uint64_t deadline = timeout_ms != 0 ? rpc_clock_ms() + timeout_ms : 0;
+    return rpc_wrap_transport_message(rpc, writer, KB_MESSAGE_TYPE_CALL, callback, context, deadline, KB_METHOD_NONE);
 }
 
 kb_message_writer_t *rpc_subscribe(kb_rpc_t *rpc, void (*callback)(kb_message_t *, void *), void *context)
 {
     kb_message_writer_t *writer = transport_message_init(rpc->transport);
 
-    return rpc_wrap_transport_message(rpc, writer, KB_MESSAGE_TYPE_SUBSCRIPTION, callback, context);
+    return rpc_wrap_transport_message(rpc, writer, KB_MESSAGE_TYPE_SUBSCRIPTION, callback, context, 0, KB_METHOD_NONE);
 }
 
-kb_message_writer_t *rpc_wrap_transport_message(kb_rpc_t *rpc, kb_message_writer_t *writer, kb_message_type_t type, void (*callback)(kb_message_t *, void *), void *context)
+// Wrap a transport message with a header
+static kb_message_writer_t *rpc_wrap_with_header(kb_rpc_t *rpc, kb_message_writer_t *writer, kb_rpc_header_t *header,
+                                                 void (*callback)(kb_message_t *, void *), void *context)
 {
     if (writer == NULL)
     {
@@ -65,47 +315,286 @@ kb_message_writer_t *rpc_wrap_transport_message(kb_rpc_t *rpc, kb_message_writer
 
     if (message == NULL)
     {
+        log4c_category_log(rpc->logger, LOG4C_PRIORITY_ERROR, "malloc failed");
+        message_cancel(writer);
         return NULL;
     }
 
-    uint64_t id = next_id(rpc);
+    if (!rpc_write_message_header(writer, header))
+    {
+        free(message);
+        message_cancel(writer);
+        return NULL;
+    }
 
     message->rpc = rpc;
     message->transport_writer = writer;
-    message->id = id;
-    message->type = type;
+    message->id = header->id;
+    message->type = header->type;
     message->callback = callback;
     message->context = context;
+    message->deadline = header->deadline;
+    message->method_id = header->method_id;
+    message->stream = NULL;
 
     message->base.document_writer = writer->document_writer;
     message->base.logger = writer->logger;
     message->base.send = rpc_message_send;
     message->base.cancel = rpc_message_cancel;
-
-    rpc_write_message_header(writer, id, type);
+    message->base.grow = NULL;
+    message->base.send_deferred = NULL;
+    message->base.overflow = NULL;
 
     return &message->base;
 }
 
+kb_message_writer_t *rpc_wrap_transport_message(kb_rpc_t *rpc, kb_message_writer_t *writer, kb_message_type_t type, void (*callback)(kb_message_t *, void *), void *context, uint64_t deadline, uint32_t method_id)
+{
+    kb_rpc_header_t header = {
+        .id = next_id(rpc),
+        .deadline = deadline,
+        .method_id = method_id,
+        .type = (uint16_t)type,
+    };
+
+    return rpc_wrap_with_header(rpc, writer, &header, callback, context);
+}
+
+kb_message_writer_t *rpc_stream_open(kb_rpc_t *rpc, uint32_t method_id, uint32_t credits,
+                                     void (*callback)(kb_message_t *, void *), void *context, uint64_t *stream_id)
+{
+    assert(stream_id != NULL);
+
+    kb_rpc_header_t header = {
+        .id = next_id(rpc),
+        .method_id = method_id,
+        .type = KB_MESSAGE_TYPE_STREAM,
+        .credits = credits,
+    };
+
+    kb_message_writer_t *writer = transport_message_init(rpc->transport);
+    writer = rpc_wrap_with_header(rpc, writer, &header, callback, context);
+    *stream_id = header.id;
+
+    return writer;
+}
+
+// Send a stream control message without a body
+static int rpc_stream_control(kb_rpc_t *rpc, uint64_t stream_id, kb_message_type_t type, uint16_t flags, uint32_t credits)
+{
+    kb_message_writer_t *writer = transport_message_init(rpc->transport);
+    if (writer == NULL)
+    {
+        return -1;
+    }
+
+    kb_rpc_header_t header = {
+        .id = stream_id,
+        .type = (uint16_t)type,
+        .flags = flags,
+        .credits = credits,
+    };
+
+    if (!rpc_write_message_header(writer, &header))
+    {
+        message_cancel(writer);
+        return -1;
+    }
+
+    return message_send(writer);
+}
+
+int rpc_stream_grant(kb_rpc_t *rpc, uint64_t stream_id, uint32_t credits)
+{
+    assert(rpc != NULL);
+
+    return rpc_stream_control(rpc, stream_id, KB_MESSAGE_TYPE_CREDIT, 0, credits);
+}
+
+int rpc_stream_cancel(kb_rpc_t *rpc, uint64_t stream_id)
+{
+    assert(rpc != NULL);
+
+    // The stream stays open if the publisher doesn't learn about the cancellation
+    int result = rpc_stream_control(rpc, stream_id, KB_MESSAGE_TYPE_CANCEL, 0, 0);
+    if (result != 0)
+    {
+        return result;
+    }
+
+    // Responses already in flight are dropped
+    call_registry_remove(&rpc->calls_registry, stream_id);
+
+    return 0;
+}
+
+bool rpc_message_end_of_stream(kb_message_t *message)
+{
+    kb_rpc_header_t header;
+
+    return rpc_read_message_header(message, &header) && (header.flags & KB_RPC_FLAG_END_OF_STREAM) != 0;
+}
+
+void rpc_stream_set_writable_callback(kb_rpc_message_t *message, void (*on_writable)(kb_rpc_message_t *, void *),
+                                      void *context)
+{
+    assert(message != NULL);
+    assert(message->stream != NULL);
+
+    message->stream->on_writable = on_writable;
+    message->stream->context = context;
+}
+
+bool rpc_stream_cancelled(kb_rpc_message_t *message)
+{
+    assert(message != NULL);
+    assert(message->stream != NULL);
+
+    return message->stream->cancelled;
+}
+
+int rpc_stream_end(kb_rpc_message_t *message)
+{
+    assert(message != NULL);
+    assert(message->stream != NULL);
+
+    kb_rpc_stream_t *stream = message->stream;
+    if (stream->ended || stream->cancelled)
+    {
+        return 0;
+    }
+
+    // The publisher can retry if the end of the stream isn't sent
+    int result = rpc_stream_control(message->rpc, message->id, KB_MESSAGE_TYPE_RESPONSE, KB_RPC_FLAG_END_OF_STREAM, 0);
+    if (result == 0)
+    {
+        stream->ended = true;
+    }
+
+    return result;
+}
+
+// Create the publisher side of an incoming stream
+static kb_rpc_stream_t *rpc_stream_accept(kb_rpc_t *rpc, kb_rpc_message_t *message, uint32_t credits)
+{
+    kb_rpc_stream_t *stream = malloc(sizeof(kb_rpc_stream_t));
+    if (stream == NULL)
+    {
+        log4c_category_log(rpc->logger, LOG4C_PRIORITY_ERROR, "malloc failed");
+        return NULL;
+    }
+
+    stream->message = message;
+    stream->credits = credits;
+    stream->blocked = false;
+    stream->cancelled = false;
+    stream->ended = false;
+    stream->on_writable = NULL;
+    stream->context = NULL;
+
+    if (call_registry_insert(&rpc->streams, message->id, KB_MESSAGE_TYPE_STREAM, NULL, stream) == NULL)
+    {
+        free(stream);
+        return NULL;
+    }
+
+    return stream;
+}
+
+// Let a blocked publisher write again
+static void rpc_stream_wake(kb_rpc_stream_t *stream)
+{
+    stream->blocked = false;
+    if (stream->on_writable != NULL)
+    {
+        stream->on_writable(stream->message, stream->context);
+    }
+}
+
+// Apply a credit or a cancel message to an incoming stream
+static void rpc_stream_handle_control(kb_rpc_t *rpc, const kb_rpc_header_t *header)
+{
+    kb_call_entry_t *entry = call_registry_find(&rpc->streams, header->id);
+    if (entry == NULL)
+    {
+        log4c_category_log(rpc->logger, LOG4C_PRIORITY_DEBUG, "Received a control message for unknown stream id: %" PRIu64, header->id);
+        return;
+    }
+
+    kb_rpc_stream_t *stream = (kb_rpc_stream_t *)entry->context;
+    if (header->type == KB_MESSAGE_TYPE_CANCEL)
+    {
+        stream->cancelled = true;
+    }
+    else
+    {
+        stream->credits = stream->credits + header->credits < stream->credits ? UINT32_MAX : stream->credits + header->credits;
+        if (!stream->blocked)
+        {
+            return;
+        }
+    }
+
+    rpc_stream_wake(stream);
+}
+
+// Give back the credit of a stream response that wasn't sent
+static void rpc_stream_refund(kb_rpc_stream_t *stream)
+{
+    stream->credits++;
+    if (stream->blocked)
+    {
+        rpc_stream_wake(stream);
+    }
+}
+
 int rpc_message_send(kb_message_writer_t *writer)
 {
     kb_rpc_message_writer_t *message = (kb_rpc_message_writer_t *)writer;
     kb_rpc_t *rpc = message->rpc;
 
-    int result = message->transport_writer->send(message->transport_writer);
+    // Only calls, subscriptions and streams get responses
+    bool expects_response = message->type == KB_MESSAGE_TYPE_CALL || message->type == KB_MESSAGE_TYPE_SUBSCRIPTION ||
+                            message->type == KB_MESSAGE_TYPE_STREAM;
+
+    // Register before sending, so the response can't arrive before the call is known
+    kb_call_entry_t *entry = NULL;
+    if (expects_response)
+    {
+        entry = call_registry_insert(&rpc->calls_registry, message->id, message->type, message->callback, message->context);
+        if (entry == NULL)
+        {
+            rpc_message_cancel(writer);
+            return -1;
+        }
+    }
+
+    // Takes the transport writer even on failure
+    int result = message_send(message->transport_writer);
 
     if (result != 0)
     {
+        if (expects_response)
+        {
+            call_registry_remove(&rpc->calls_registry, message->id);
+        }
+
+        kb_rpc_stream_t *stream = message->stream;
+        free(message);
+
+        if (stream != NULL)
+        {
+            rpc_stream_refund(stream);
+        }
+
         return result;
     }
 
-    kb_call_entry_t *entry = malloc(sizeof(kb_call_entry_t));
-    entry->id = message->id;
-    entry->callback = message->callback;
-    entry->context = message->context;
-    entry->type = message->type;
-
-    HASH_ADD_INT(rpc->calls_registry.entries, id, entry);
+    if (entry != NULL && message->deadline != 0)
+    {
+        call_registry_set_deadline(&rpc->calls_registry, entry, message->deadline, rpc_clock_ms());
+        rpc_timer_schedule(rpc);
+    }
 
     log4c_category_log(rpc->logger, LOG4C_PRIORITY_DEBUG, "Sending new message with id `%ld` of type `%d`", message->id, message->type);
 
@@ -116,7 +605,16 @@ int rpc_message_send(kb_message_writer_t *writer)
 
 void rpc_message_cancel(kb_message_writer_t *writer)
 {
-    return message_cancel(writer);
+    kb_rpc_message_writer_t *message = (kb_rpc_message_writer_t *)writer;
+    kb_rpc_stream_t *stream = message->stream;
+
+    message_cancel(message->transport_writer);
+    free(message);
+
+    if (stream != NULL)
+    {
+        rpc_stream_refund(stream);
+    }
 }
 
 kb_message_t *rpc_message_body(kb_rpc_message_t *message)
@@ -126,18 +624,72 @@ kb_message_t *rpc_message_body(kb_rpc_message_t *message)
 
 kb_message_writer_t *rpc_message_respond(kb_rpc_message_t *message)
 {
+    kb_rpc_stream_t *stream = message->stream;
+    if (stream != NULL)
+    {
+        if (stream->cancelled || stream->ended)
+        {
+            return NULL;
+        }
+
+        // Don't take arena memory for responses the subscriber can't accept yet
+        if (stream->credits == 0)
+        {
+            stream->blocked = true;
+            return NULL;
+        }
+    }
+
     kb_message_writer_t *writer = transport_message_init(message->rpc->transport);
 
-    if (writer)
+    if (writer == NULL)
     {
-        rpc_write_message_header(writer, message->id, KB_MESSAGE_TYPE_RESPONSE);
+        return NULL;
     }
 
-    return writer;
+    if (stream == NULL)
+    {
+        if (!rpc_write_header(writer, message->id, KB_MESSAGE_TYPE_RESPONSE, 0, KB_METHOD_NONE))
+        {
+            message_cancel(writer);
+            return NULL;
+        }
+
+        return writer;
+    }
+
+    // The response takes a credit, which is given back if the response is cancelled or fails to send
+    kb_rpc_header_t header = {
+        .id = message->id,
+        .method_id = KB_METHOD_NONE,
+        .type = KB_MESSAGE_TYPE_RESPONSE,
+    };
+
+    kb_message_writer_t *response = rpc_wrap_with_header(message->rpc, writer, &header, NULL, NULL);
+    if (response == NULL)
+    {
+        return NULL;
+    }
+
+    ((kb_rpc_message_writer_t *)response)->stream = stream;
+    stream->credits--;
+
+    return response;
+}
+
+bool rpc_message_expired(kb_rpc_message_t *message)
+{
+    return message->deadline != 0 && message->deadline <= rpc_clock_ms();
 }
 
 void rpc_message_release(kb_rpc_message_t *message)
 {
+    if (message->stream != NULL)
+    {
+        call_registry_remove(&message->rpc->streams, message->id);
+        free(message->stream);
+    }
+
     message_destroy(message->message);
     free(message);
 }
@@ -146,47 +698,48 @@ kb_rpc_message_t *rpc_handle_incoming_message(kb_rpc_t *rpc, kb_message_t *messa
 {
     kb_call_entry_t *entry = NULL;
 
-    bson_t *document = message_get_document(message);
-    if (document == NULL)
+    kb_rpc_header_t header;
+    if (!rpc_read_message_header(message, &header))
     {
-        log4c_category_log(rpc->logger, LOG4C_PRIORITY_ERROR, "Failed to get document from message");
+        log4c_category_log(rpc->logger, LOG4C_PRIORITY_ERROR, "Failed to find RPC header in message");
         return NULL;
     }
 
-    bson_iter_t iter;
-    if (!bson_iter_init(&iter, document))
-    {
-        log4c_category_log(rpc->logger, LOG4C_PRIORITY_ERROR, "Failed to initialize BSON iterator");
-        return NULL;
-    }
+    uint64_t id = header.id;
+    kb_message_type_t type = header.type;
+    uint64_t deadline = header.deadline;
+    uint32_t method_id = header.method_id;
 
-    if (!bson_iter_find(&iter, ID_KEY))
+    if (type == KB_MESSAGE_TYPE_CREDIT || type == KB_MESSAGE_TYPE_CANCEL)
     {
-        log4c_category_log(rpc->logger, LOG4C_PRIORITY_ERROR, "Failed to find id in BSON document");
+        rpc_stream_handle_control(rpc, &header);
+        message_destroy(message);
         return NULL;
     }
-    uint64_t id = bson_iter_int64(&iter);
 
-    if (!bson_iter_find(&iter, TYPE_KEY))
+    log4c_category_log(rpc->logger, LOG4C_PRIORITY_DEBUG, "Received new message with id `%ld` of type `%d`", id, type);
+
+    // The caller has given up already. Don't waste time on the call
+    if (deadline != 0 && deadline <= rpc_clock_ms())
     {
-        log4c_category_log(rpc->logger, LOG4C_PRIORITY_ERROR, "Failed to find type in BSON document");
+        log4c_category_log(rpc->logger, LOG4C_PRIORITY_DEBUG, "Dropping expired message with id `%" PRIu64 "`", id);
+        message_destroy(message);
         return NULL;
     }
-    kb_message_type_t type = bson_iter_int64(&iter);
-
-    log4c_category_log(rpc->logger, LOG4C_PRIORITY_DEBUG, "Received new message with id `%ld` of type `%d`", id, type);
 
     if (type == KB_MESSAGE_TYPE_RESPONSE)
     {
-        HASH_FIND_INT(rpc->calls_registry.entries, &id, entry);
+        entry = call_registry_find(&rpc->calls_registry, id);
 
         if (entry != NULL)
         {
+            // The callback may start new calls, which can move the entries when the registry grows
+            kb_message_type_t entry_type = entry->type;
             entry->callback(message, entry->context);
-            if (entry->type == KB_MESSAGE_TYPE_CALL)
+            if (entry_type == KB_MESSAGE_TYPE_CALL ||
+                (entry_type == KB_MESSAGE_TYPE_STREAM && (header.flags & KB_RPC_FLAG_END_OF_STREAM) != 0))
             {
-                HASH_DEL(rpc->calls_registry.entries, entry);
-                free(entry);
+                call_registry_remove(&rpc->calls_registry, id);
             }
         }
         else
@@ -212,29 +765,114 @@ kb_rpc_message_t *rpc_handle_incoming_message(kb_rpc_t *rpc, kb_message_t *messa
         rpc_message->rpc = rpc;
         rpc_message->id = id;
         rpc_message->type = type;
+        rpc_message->deadline = deadline;
+        rpc_message->method_id = method_id;
+        rpc_message->stream = NULL;
+
+        if (type == KB_MESSAGE_TYPE_STREAM)
+        {
+            rpc_message->stream = rpc_stream_accept(rpc, rpc_message, header.credits);
+            if (rpc_message->stream == NULL)
+            {
+                message_destroy(message);
+                free(rpc_message);
+                return NULL;
+            }
+        }
+
+        kb_method_entry_t *method = method_id != KB_METHOD_NONE ? method_registry_find(&rpc->methods, method_id) : NULL;
+        if (method != NULL)
+        {
+            method->handler(rpc_message, method->context);
+            return NULL;
+        }
 
         return rpc_message;
     }
 }
 
-void rpc_write_message_header(kb_message_writer_t *message, uint64_t id, kb_message_type_t type)
+bool rpc_write_message_header(kb_message_writer_t *message, const kb_rpc_header_t *header)
 {
     assert(message != NULL);
+    assert(header != NULL);
 
     kb_document_writer_t *document = message_writer_root(message);
-    doc_writer_append_int64(document, ID_KEY, id);
-    doc_writer_append_int32(document, TYPE_KEY, type);
+
+    // Readers find the header at a fixed offset
+    if (document->bson->len != 5)
+    {
+        log4c_category_log(message->logger, LOG4C_PRIORITY_ERROR, "RPC header must be the first element of a message");
+        return false;
+    }
+
+    if (!WRITER_APPEND(document->stack, bson_append_binary(document->bson, HEADER_KEY, 1, KB_BINARY_SUBTYPE_RPC_HEADER,
+                                                           (const uint8_t *)header, sizeof(kb_rpc_header_t))))
+    {
+        log4c_category_log(message->logger, LOG4C_PRIORITY_ERROR, "Failed to write RPC header");
+        return false;
+    }
+
+    return true;
+}
+
+bool rpc_read_message_header(kb_message_t *message, kb_rpc_header_t *header)
+{
+    assert(message != NULL);
+    assert(header != NULL);
+
+    bson_t *document = message_get_document(message);
+    if (document == NULL || document->len < HEADER_OFFSET + sizeof(kb_rpc_header_t))
+    {
+        return false;
+    }
+
+    const uint8_t *data = bson_get_data(document);
+    if (memcmp(data + HEADER_ELEMENT_OFFSET, HEADER_ELEMENT_PREFIX, sizeof(HEADER_ELEMENT_PREFIX)) != 0)
+    {
+        return false;
+    }
+
+    // The header isn't aligned in the document
+    memcpy(header, data + HEADER_OFFSET, sizeof(kb_rpc_header_t));
+    return true;
+}
+
+// Remove the armed io_uring timeout of a destroyed RPC module
+static void rpc_timer_remove(kb_rpc_t *rpc)
+{
+    kb_rpc_timer_t *timer = &rpc->timer;
+    assert(timer->base.ring != NULL);
+
+    // Without the removal the module is freed when the timeout fires
+    struct io_uring_sqe *sqe = rpc_timer_get_sqe(rpc);
+    if (sqe == NULL)
+    {
+        return;
+    }
+
+    io_uring_prep_timeout_remove(sqe, (uint64_t)(uintptr_t)&timer->timeout_event, 0);
+    io_uring_sqe_set_data(sqe, &timer->remove_event);
+    timer->remove_pending = true;
+
+    int ret = io_uring_submit(timer->base.ring);
+    if (ret < 0)
+    {
+        log4c_category_log(rpc->logger, LOG4C_PRIORITY_ERROR, "io_uring call timeout submit error: %s", strerror(-ret));
+    }
 }
 
 void rpc_destroy(kb_rpc_t *rpc)
 {
-    kb_call_entry_t *entry, *tmp;
+    call_registry_deinit(&rpc->calls_registry);
+    method_registry_deinit(&rpc->methods);
+    call_registry_deinit(&rpc->streams);
 
-    HASH_ITER(hh, rpc->calls_registry.entries, entry, tmp)
+    // The armed timeout points into the module. Its completions still come through the ring, and the last one frees it
+    rpc->timer.destroyed = true;
+    if (rpc->timer.expiry != 0)
     {
-        HASH_DEL(rpc->calls_registry.entries, entry);
-        free(entry);
+        rpc_timer_remove(rpc);
     }
 
-    free(rpc);
+    rpc_free_destroyed(rpc);
 }
@@ -1,8 +1,11 @@
 #pragma once
 
-#include <uthash.h>
 #include <stdatomic.h>
 
+#include <linux/time_types.h>
+
+#include "call_registry.h"
+#include "method_registry.h"
 #include "transport.h"
 #include "message.h"
 
@@ -10,42 +13,46 @@
 extern "C" {
 #endif
 
-/**
- * @brief Message type enumeration for RPC communication
- */
-enum kb_message_type_e
-{
-    KB_MESSAGE_TYPE_MESSAGE = 0,      // One-way message
-    KB_MESSAGE_TYPE_CALL = 1,         // Call requesting a response
-    KB_MESSAGE_TYPE_SUBSCRIPTION = 2, // Subscription request
-    KB_MESSAGE_TYPE_RESPONSE = 3,     // Response to a call
-};
+// BSON binary subtype of the RPC header. Follows the packed array subtypes of value.h
+#define KB_BINARY_SUBTYPE_RPC_HEADER 0x83
 
-typedef enum kb_message_type_e kb_message_type_t;
+// RPC header flags
+#define KB_RPC_FLAG_END_OF_STREAM 0x1 // The last response of a stream
 
 /**
- * @brief Call registry entry for tracking outgoing calls
+ * @brief Fixed-layout RPC header in the host byte order. Written as the first element
+ *        of the message document, so it's read at a fixed offset without parsing BSON
  */
-struct kb_call_entry_s
+struct kb_rpc_header_s
 {
-    int id;                                   // Call ID
-    kb_message_type_t type;                   // Message type
-    void (*callback)(kb_message_t *, void *); // Callback function
-    void *context;                            // User context for callback
-    UT_hash_handle hh;                        // Hash handle for uthash
+    uint64_t id;        // Message ID
+    uint64_t deadline;  // Response deadline in milliseconds of CLOCK_MONOTONIC. Zero if none
+    uint32_t method_id; // Called method. KB_METHOD_NONE if none
+    uint16_t type;      // Message type
+    uint16_t flags;     // Message flags. Zero if none
+    uint32_t credits;   // Stream responses granted by stream requests and credit messages
+    uint32_t reserved;  // Zero
 };
 
-typedef struct kb_call_entry_s kb_call_entry_t;
+typedef struct kb_rpc_header_s kb_rpc_header_t;
 
 /**
- * @brief Registry for tracking outgoing calls
+ * @brief Call timeout timer. A single io_uring timeout set to the next expiration of the call registry
  */
-struct kb_call_registry_s
+struct kb_rpc_timer_s
 {
-    kb_call_entry_t *entries; // Hash table of call entries
+    kb_event_manager_t base;          // Event manager interface. Handles the timeout completions
+    struct kb_rpc_s *rpc;             // RPC module
+    kb_event_t timeout_event;         // Timeout expiration
+    kb_event_t update_event;          // Timeout update
+    kb_event_t remove_event;          // Timeout removal
+    struct __kernel_timespec timeout; // Absolute CLOCK_MONOTONIC time of the timeout
+    uint64_t expiry;                  // Timeout expiration in milliseconds. Zero if the timeout isn't armed
+    bool remove_pending;              // The removal of the timeout hasn't completed yet
+    bool destroyed;                   // The RPC module is destroyed and waits for the timeout completions
 };
 
-typedef struct kb_call_registry_s kb_call_registry_t;
+typedef struct kb_rpc_timer_s kb_rpc_timer_t;
 
 /**
  * @brief RPC module for handling remote procedure calls
@@ -53,6 +60,9 @@ typedef struct kb_call_registry_s kb_call_registry_t;
 struct kb_rpc_s
 {
     kb_call_registry_t calls_registry; // Registry for tracking outgoing calls
+    kb_method_registry_t methods;      // Handlers of incoming messages by method
+    kb_call_registry_t streams;        // Incoming streams by ID. The entry context is the stream
+    kb_rpc_timer_t timer;              // Call timeout timer
     kb_transport_t *transport;         // Transport for sending/receiving messages
     log4c_category_t *logger;          // Logger for debugging
     atomic_uint_fast64_t id_counter;   // Counter for generating unique message IDs
@@ -72,6 +82,9 @@ struct kb_rpc_message_writer_s
     kb_message_type_t type;                   // Message type
     void (*callback)(kb_message_t *, void *); // Callback function for responses
     void *context;                            // User context for callback
+    uint64_t deadline;                        // Response deadline in milliseconds of CLOCK_MONOTONIC. Zero if none
+    uint32_t method_id;                       // Called method. KB_METHOD_NONE if none
+    struct kb_rpc_stream_s *stream;           // Stream of a stream response. Gets the credit back if not sent
 };
 
 typedef struct kb_rpc_message_writer_s kb_rpc_message_writer_t;
@@ -81,14 +94,33 @@ typedef struct kb_rpc_message_writer_s kb_rpc_message_writer_t;
  */
 struct kb_rpc_message_s
 {
-    kb_message_t *message;  // Underlying transport message
-    kb_rpc_t *rpc;          // RPC module
-    uint64_t id;            // Message ID
-    kb_message_type_t type; // Message type
+    kb_message_t *message;          // Underlying transport message
+    kb_rpc_t *rpc;                  // RPC module
+    uint64_t id;                    // Message ID
+    kb_message_type_t type;         // Message type
+    uint64_t deadline;              // Caller deadline in milliseconds of CLOCK_MONOTONIC. Zero if none
+    uint32_t method_id;             // Called method. KB_METHOD_NONE if none
+    struct kb_rpc_stream_s *stream; // Stream state. NULL if the message isn't a stream request
 };
 
 typedef struct kb_rpc_message_s kb_rpc_message_t;
 
+/**
+ * @brief Publisher side of an incoming stream. Owned by the stream request message
+ */
+struct kb_rpc_stream_s
+{
+    kb_rpc_message_t *message;                       // Stream request
+    uint32_t credits;                                // Responses the subscriber can still accept
+    bool blocked;                                    // A response was refused for lack of credits
+    bool cancelled;                                  // The subscriber has cancelled the stream
+    bool ended;                                      // The end of the stream is sent
+    void (*on_writable)(kb_rpc_message_t *, void *); // Called when a blocked stream gets credits or is cancelled
+    void *context;                                   // User context for `on_writable`
+};
+
+typedef struct kb_rpc_stream_s kb_rpc_stream_t;
+
 /**
  * @brief Generate a new unique message ID
  *
@@ -97,6 +129,13 @@ typedef struct kb_rpc_message_s kb_rpc_message_t;
  */
 uint64_t next_id(kb_rpc_t *rpc);
 
+/**
+ * @brief Current time for call deadlines
+ *
+ * @return CLOCK_MONOTONIC time in milliseconds
+ */
+uint64_t rpc_clock_ms(void);
+
 /**
  * @brief Initialize a new RPC module
  *
@@ -131,6 +170,124 @@ kb_message_writer_t *rpc_message(kb_rpc_t *rpc);
  */
 kb_message_writer_t *rpc_call(kb_rpc_t *rpc, void (*callback)(kb_message_t *, void *), void *context);
 
+/**
+ * @brief Create a new RPC call with a deadline. If the response doesn't arrive in time,
+ *        the call is dropped and the callback is invoked with a NULL message.
+ *        The deadline is sent with the call, so the callee can skip the calls nobody waits for
+ *
+ * @param rpc RPC module
+ * @param callback Callback function to call when response is received or with NULL on timeout
+ * @param context User context for callback
+ * @param timeout_ms Timeout in milliseconds. Zero for no timeout
+ * @return Message writer for constructing the call
+ */
+kb_message_writer_t *rpc_call_with_timeout(kb_rpc_t *rpc, void (*callback)(kb_message_t *, void *), void *context,
+                                           uint32_t timeout_ms);
+
+/**
+ * @brief Create a new one-way message to a method
+ *
+ * @param rpc RPC module
+ * @param method_id Method ID from `method_id`
+ * @return Message writer for constructing the message
+ */
+kb_message_writer_t *rpc_message_method(kb_rpc_t *rpc, uint32_t method_id);
+
+/**
+ * @brief Create a new call of a method
+ *
+ * @param rpc RPC module
+ * @param method_id Method ID from `method_id`
+ * @param callback Callback function to call when response is received or with NULL on timeout
+ * @param context User context for callback
+ * @param timeout_ms Timeout in milliseconds. Zero for no timeout
+ * @return Message writer for constructing the call
+ */
+kb_message_writer_t *rpc_call_method(kb_rpc_t *rpc, uint32_t method_id, void (*callback)(kb_message_t *, void *),
+                                     void *context, uint32_t timeout_ms);
+
+/**
+ * @brief Register a handler of incoming messages to a method. Handled messages aren't returned
+ *        from `rpc_handle_incoming_message`, the handler gets them and must release them
+ *
+ * @param rpc RPC module
+ * @param name Method name. Must outlive the RPC module
+ * @param handler Handler
+ * @param context User context for handler
+ * @return Method ID or KB_METHOD_NONE on error
+ */
+uint32_t rpc_register_method(kb_rpc_t *rpc, const char *name, void (*handler)(kb_rpc_message_t *, void *), void *context);
+
+/**
+ * @brief Create a new stream request. The callback gets the responses until the end of the stream.
+ *        The publisher sends at most `credits` responses until more are granted with `rpc_stream_grant`
+ *
+ * @param rpc RPC module
+ * @param method_id Method ID from `method_id`. KB_METHOD_NONE if none
+ * @param credits Number of responses the subscriber can accept
+ * @param callback Callback function to call for every response
+ * @param context User context for callback
+ * @param stream_id Stream ID for `rpc_stream_grant` and `rpc_stream_cancel`
+ * @return Message writer for constructing the request
+ */
+kb_message_writer_t *rpc_stream_open(kb_rpc_t *rpc, uint32_t method_id, uint32_t credits,
+                                     void (*callback)(kb_message_t *, void *), void *context, uint64_t *stream_id);
+
+/**
+ * @brief Let the publisher send more responses to a stream
+ *
+ * @param rpc RPC module
+ * @param stream_id Stream ID from `rpc_stream_open`
+ * @param credits Number of additional responses the subscriber can accept
+ * @return 0 on success, non-zero on failure
+ */
+int rpc_stream_grant(kb_rpc_t *rpc, uint64_t stream_id, uint32_t credits);
+
+/**
+ * @brief Cancel a stream. The callback doesn't get any more responses.
+ *        If the cancellation can't be sent, the stream stays open and the call can be retried
+ *
+ * @param rpc RPC module
+ * @param stream_id Stream ID from `rpc_stream_open`
+ * @return 0 on success, non-zero on failure
+ */
+int rpc_stream_cancel(kb_rpc_t *rpc, uint64_t stream_id);
+
+/**
+ * @brief Check if a response is the last one of a stream
+ *
+ * @param message Response message
+ * @return true if the stream has ended
+ */
+bool rpc_message_end_of_stream(kb_message_t *message);
+
+/**
+ * @brief Set the callback of a stream request, which is called when a stream blocked
+ *        for lack of credits can send again or when the subscriber cancels the stream
+ *
+ * @param message Stream request
+ * @param on_writable Callback
+ * @param context User context for callback
+ */
+void rpc_stream_set_writable_callback(kb_rpc_message_t *message, void (*on_writable)(kb_rpc_message_t *, void *),
+                                      void *context);
+
+/**
+ * @brief Check if the subscriber has cancelled a stream
+ *
+ * @param message Stream request
+ * @return true if the stream is cancelled
+ */
+bool rpc_stream_cancelled(kb_rpc_message_t *message);
+
+/**
+ * @brief Send the end of a stream. Doesn't need a credit
+ *
+ * @param message Stream request
+ * @return 0 on success, non-zero on failure
+ */
+int rpc_stream_end(kb_rpc_message_t *message);
+
 /**
  * @brief Create a new subscription request
  *
@@ -141,6 +298,26 @@ kb_message_writer_t *rpc_call(kb_rpc_t *rpc, void (*callback)(kb_message_t *, vo
  */
 kb_message_writer_t *rpc_subscribe(kb_rpc_t *rpc, void (*callback)(kb_message_t *, void *), void *context);
 
+/**
+ * @brief Drive call timeouts by an io_uring timeout. Its completions go to `event_manager_handle_event`
+ *        like the transport events. The armed timeout points to the RPC module: `rpc_destroy` removes it,
+ *        and the module memory is freed when its completions arrive, so the ring must outlive the module.
+ *        Without a ring, call `rpc_process_timeouts` periodically
+ *
+ * @param rpc RPC module
+ * @param ring IO_URING instance
+ */
+void rpc_attach_ring(kb_rpc_t *rpc, struct io_uring *ring);
+
+/**
+ * @brief Expire the calls with passed deadlines
+ *
+ * @param rpc RPC module
+ * @param now Current time from `rpc_clock_ms`
+ * @return Number of expired calls
+ */
+size_t rpc_process_timeouts(kb_rpc_t *rpc, uint64_t now);
+
 /**
  * @brief Wrap a transport message with RPC information
  *
@@ -149,11 +326,13 @@ kb_message_writer_t *rpc_subscribe(kb_rpc_t *rpc, void (*callback)(kb_message_t
  * @param type Message type
  * @param callback Callback function for responses
  * @param context User context for callback
+ * @param deadline Response deadline from `rpc_clock_ms`. Zero if none
+ * @param method_id Called method. KB_METHOD_NONE if none
  * @return RPC message writer
  */
 kb_message_writer_t *rpc_wrap_transport_message(kb_rpc_t *rpc, kb_message_writer_t *writer,
                                                 kb_message_type_t type, void (*callback)(kb_message_t *, void *),
-                                                void *context);
+                                                void *context, uint64_t deadline, uint32_t method_id);
 
 /**
  * @brief Send an RPC message
@@ -179,13 +358,24 @@ void rpc_message_cancel(kb_message_writer_t *writer);
 kb_message_t *rpc_message_body(kb_rpc_message_t *message);
 
 /**
- * @brief Create a response to an RPC call
+ * @brief Create a response to an RPC call. A response to a stream request uses a credit,
+ *        which is given back if the response is cancelled or fails to send.
+ *        The stream request must outlive the response writer
  *
  * @param message Original RPC call message
- * @return Message writer for constructing the response
+ * @return Message writer for constructing the response, or NULL if a stream is out
+ *         of credits, cancelled or ended
  */
 kb_message_writer_t *rpc_message_respond(kb_rpc_message_t *message);
 
+/**
+ * @brief Check if the caller stopped waiting for the response
+ *
+ * @param message Incoming RPC message
+ * @return true if the message deadline has passed
+ */
+bool rpc_message_expired(kb_rpc_message_t *message);
+
 /**
  * @brief Release an RPC message and free resources
  *
@@ -194,22 +384,32 @@ kb_message_writer_t *rpc_message_respond(kb_rpc_message_t *message);
 void rpc_message_release(kb_rpc_message_t *message);
 
 /**
- * @brief Handle an incoming transport message
+ * @brief Handle an incoming transport message. Responses go to the call callbacks
+ *        and messages to registered methods go to their handlers
  *
  * @param rpc RPC module
  * @param message Incoming transport message
- * @return RPC message wrapper or NULL on error
+ * @return RPC message wrapper, or NULL if the message is handled or on error
  */
 kb_rpc_message_t *rpc_handle_incoming_message(kb_rpc_t *rpc, kb_message_t *message);
 
 /**
- * @brief Write the RPC header to a message
+ * @brief Write the RPC header to a message. Must be the first element of the message
  *
  * @param message Message writer
- * @param id Message ID
- * @param type Message type
+ * @param header RPC header
+ * @return true on success, false if the message already has elements or the header doesn't fit
+ */
+bool rpc_write_message_header(kb_message_writer_t *message, const kb_rpc_header_t *header);
+
+/**
+ * @brief Read the RPC header of a message
+ *
+ * @param message A message
+ * @param header Header to fill
+ * @return true if the message starts with an RPC header, false otherwise
  */
-void rpc_write_message_header(kb_message_writer_t *message, uint64_t id, kb_message_type_t type);
+bool rpc_read_message_header(kb_message_t *message, kb_rpc_header_t *header);
 
 #ifdef __cplusplus
 } // extern "C"
@@ -18,6 +18,29 @@
 // Minimum block size (including header and footer)
 #define MIN_BLOCK_SIZE (BLOCK_HEADER_SIZE + BLOCK_FOOTER_SIZE + 64)
 
+// Smallest size class is [2^BIN_SHIFT, 2^(BIN_SHIFT + 1))
+#define BIN_SHIFT 6
+// Allocator header size
+#define ALLOCATOR_HEADER_SIZE ALIGN(sizeof(kb_allocator_header_t))
+
+// Size class of a block. Class N holds blocks of [2^(N + BIN_SHIFT), 2^(N + BIN_SHIFT + 1)) bytes,
+// the last class also holds everything bigger
+static inline size_t allocator_bin_index(size_t size)
+{
+    assert(size >= (1 << BIN_SHIFT));
+
+    size_t bin = (sizeof(unsigned long long) * CHAR_BIT - 1 - __builtin_clzll(size)) - BIN_SHIFT;
+    return bin < KB_ALLOCATOR_BIN_COUNT ? bin : KB_ALLOCATOR_BIN_COUNT - 1;
+}
+
+// Block size for `size` bytes of payload. Never below the minimum block size, so every block
+// belongs to a size class and can be split off
+static inline size_t allocator_block_size(size_t size)
+{
+    size_t block_size = ALIGN(size) + BLOCK_HEADER_SIZE + BLOCK_FOOTER_SIZE;
+    return block_size > MIN_BLOCK_SIZE ? block_size : MIN_BLOCK_SIZE;
+}
+
 static void allocator_add_free_block(kb_allocator_t *allocator, kb_block_header_t *block)
 {
     assert(allocator != NULL);
@@ -27,48 +50,89 @@ static void allocator_add_free_block(kb_allocator_t *allocator, kb_block_header_
     kb_allocator_header_t *alloc_header = allocator->header;
 
     size_t block_offset = allocator_block_offset(allocator, block);
+    size_t bin = allocator_bin_index(block->size);
 
-    // Put the new block at the head of the free list
-    block->next_free_block_offset = alloc_header->next_free_block_offset;
-    alloc_header->next_free_block_offset = block_offset;
+    // Put the new block at the head of its size class list
+    block->prev_free_block_offset = NULL_OFFSET;
+    block->next_free_block_offset = alloc_header->free_bins[bin];
+
+    kb_block_header_t *next_block = allocator_offset_to_block(allocator, block->next_free_block_offset);
+    if (next_block != NULL)
+    {
+        next_block->prev_free_block_offset = block_offset;
+    }
+
+    alloc_header->free_bins[bin] = block_offset;
+    alloc_header->free_bins_bitmap |= 1ull << bin;
 }
 
 static void allocator_remove_free_block(kb_allocator_t *allocator, kb_block_header_t *block)
 {
     assert(allocator != NULL);
     assert(block != NULL);
+    assert(block->type == KB_BLOCK_TAG_FREE);
 
     kb_allocator_header_t *alloc_header = allocator->header;
-    assert(alloc_header->next_free_block_offset != NULL_OFFSET);
+    size_t bin = allocator_bin_index(block->size);
 
-    size_t block_offset = allocator_block_offset(allocator, block);
+    kb_block_header_t *prev_block = allocator_offset_to_block(allocator, block->prev_free_block_offset);
+    kb_block_header_t *next_block = allocator_offset_to_block(allocator, block->next_free_block_offset);
 
-    // It's the first block in the free list
-    if (alloc_header->next_free_block_offset == block_offset)
+    if (prev_block != NULL)
     {
-        alloc_header->next_free_block_offset = block->next_free_block_offset;
-        block->next_free_block_offset = NULL_OFFSET;
-        allocator_write_block_tags(allocator, block, block->size, KB_BLOCK_TAG_ALLOCATED);
-        return;
+        prev_block->next_free_block_offset = block->next_free_block_offset;
     }
-
-    // Somewhere in the middle of the list. Let's search
-    kb_block_header_t *current_block = allocator_offset_to_block(allocator, alloc_header->next_free_block_offset);
-    while (current_block != NULL)
+    // It's the first block in the size class list
+    else
     {
-        // Check if the next block is the one we're looking for
-        if (current_block->next_free_block_offset == block_offset)
+        assert(alloc_header->free_bins[bin] == allocator_block_offset(allocator, block));
+
+        alloc_header->free_bins[bin] = block->next_free_block_offset;
+        if (alloc_header->free_bins[bin] == NULL_OFFSET)
         {
-            current_block->next_free_block_offset = block->next_free_block_offset;
-            block->next_free_block_offset = NULL_OFFSET;
-            allocator_write_block_tags(allocator, block, block->size, KB_BLOCK_TAG_ALLOCATED);
-            return;
+            alloc_header->free_bins_bitmap &= ~(1ull << bin);
         }
+    }
 
-        current_block = allocator_offset_to_block(allocator, current_block->next_free_block_offset);
+    if (next_block != NULL)
+    {
+        next_block->prev_free_block_offset = block->prev_free_block_offset;
     }
 
-    assert(false);
+    block->next_free_block_offset = NULL_OFFSET;
+    block->prev_free_block_offset = NULL_OFFSET;
+    allocator_write_block_tags(allocator, block, block->size, KB_BLOCK_TAG_ALLOCATED);
+}
+
+// Find a free block of at least `size` bytes. Any block of a bigger size class fits, so the own
+// size class is only walked if none of them is free
+static kb_block_header_t *allocator_find_free_block(kb_allocator_t *allocator, size_t size)
+{
+    assert(allocator != NULL);
+
+    kb_allocator_header_t *alloc_header = allocator->header;
+    size_t bin = allocator_bin_index(size);
+    kb_block_header_t *block = allocator_offset_to_block(allocator, alloc_header->free_bins[bin]);
+
+    // Every block of the own size class fits a size at the lower bound of the class
+    if (block != NULL && size == 1ull << (bin + BIN_SHIFT))
+    {
+        return block;
+    }
+
+    uint64_t bigger_bins = bin + 1 < KB_ALLOCATOR_BIN_COUNT ? alloc_header->free_bins_bitmap & (~0ull << (bin + 1)) : 0;
+    if (bigger_bins != 0)
+    {
+        return allocator_offset_to_block(allocator, alloc_header->free_bins[__builtin_ctzll(bigger_bins)]);
+    }
+
+    // Blocks of the own size class can still be too small, so look for the first one that fits
+    while (block != NULL && block->size < size)
+    {
+        block = allocator_offset_to_block(allocator, block->next_free_block_offset);
+    }
+
+    return block;
 }
 
 static void allocator_lock(kb_allocator_t *allocator)
@@ -123,7 +187,7 @@ kb_allocator_t *allocator_create(void *memory, size_t total_size, size_t max_mes
     log_trace(logger, "Creating allocator at %p", memory);
 
     // Ensure the memory region is large enough for the allocator structure and at least one block
-    if (total_size < sizeof(kb_allocator_t) + ALIGN(max_message_size) + sizeof(kb_block_header_t))
+    if (total_size < ALLOCATOR_HEADER_SIZE + ALIGN(max_message_size) + BLOCK_HEADER_SIZE + BLOCK_FOOTER_SIZE)
     {
         log4c_category_error(logger, "Memory region is too small for allocator");
         return NULL;
@@ -140,14 +204,19 @@ kb_allocator_t *allocator_create(void *memory, size_t total_size, size_t max_mes
     allocator->header = alloc_header;
     allocator->logger = logger;
 
-    size_t header_size = ALIGN(sizeof(kb_allocator_header_t));
+    size_t header_size = ALLOCATOR_HEADER_SIZE;
 
     // Initialize the allocator header
     alloc_header->futex = 0;
-    alloc_header->total_size = total_size - header_size;
+    alloc_header->total_size = (total_size - header_size) & ~(ALIGNMENT - 1);
     alloc_header->free_size = alloc_header->total_size;
-    alloc_header->next_free_block_offset = NULL_OFFSET;
     alloc_header->max_message_size = ALIGN(max_message_size);
+    alloc_header->free_bins_bitmap = 0;
+
+    for (size_t bin = 0; bin < KB_ALLOCATOR_BIN_COUNT; bin++)
+    {
+        alloc_header->free_bins[bin] = NULL_OFFSET;
+    }
 
     log_trace(logger, "Allocator header initialized: total_size=%zu, free_size=%zu, max_message_size=%zu",
               alloc_header->total_size, alloc_header->free_size, alloc_header->max_message_size);
@@ -155,6 +224,7 @@ kb_allocator_t *allocator_create(void *memory, size_t total_size, size_t max_mes
     // Initialize the first block
     kb_block_header_t *first_block = (kb_block_header_t*)(memory + header_size);
     first_block->next_free_block_offset = NULL_OFFSET;
+    first_block->prev_free_block_offset = NULL_OFFSET;
     allocator_write_block_tags(allocator, first_block, alloc_header->total_size, KB_BLOCK_TAG_FREE);
 
     // Add the block to the free list
@@ -204,7 +274,7 @@ inline size_t allocator_block_offset(kb_allocator_t *allocator, kb_block_header_
 kb_block_header_t *allocator_offset_to_block(kb_allocator_t *allocator, size_t offset)
 {
     assert(allocator != NULL);
-    assert(offset == NULL_OFFSET ? true : offset < allocator->header->total_size && offset > 0 && offset % ALIGNMENT == 0);
+    assert(offset == NULL_OFFSET ? true : offset < allocator->header->total_size + ALLOCATOR_HEADER_SIZE && offset > 0 && offset % ALIGNMENT == 0);
 
     if (offset == NULL_OFFSET)
     {
@@ -232,26 +302,20 @@ void *allocator_alloc(kb_allocator_t *allocator)
 {
     assert(allocator != NULL);
 
-    // Always allocate the maximum message size initially
-    size_t alloc_size = allocator->header->max_message_size + BLOCK_HEADER_SIZE + BLOCK_FOOTER_SIZE;
+    // Allocate the maximum message size, the caller trims it later
+    return allocator_alloc_n(allocator, allocator->header->max_message_size);
+}
 
-    allocator_lock(allocator);
+void *allocator_alloc_n(kb_allocator_t *allocator, size_t size)
+{
+    assert(allocator != NULL);
+    assert(size > 0);
 
-    // Find a suitable free block (best fit strategy)
-    kb_block_header_t *block = allocator_offset_to_block(allocator, allocator->header->next_free_block_offset);
-    kb_block_header_t *best_fit = NULL;
+    size_t alloc_size = allocator_block_size(size);
 
-    // Find the best fit block
-    while (block)
-    {
-        if (block->size >= alloc_size)
-        {
-            best_fit = block;
-            break;
-        }
+    allocator_lock(allocator);
 
-        block = allocator_offset_to_block(allocator, block->next_free_block_offset);
-    }
+    kb_block_header_t *best_fit = allocator_find_free_block(allocator, alloc_size);
 
     if (!best_fit)
     {
@@ -264,12 +328,12 @@ void *allocator_alloc(kb_allocator_t *allocator)
 
     // Remove the block from the free list
     allocator_remove_free_block(allocator, best_fit);
-    // Split the block if it's too large
+    allocator->header->free_size -= best_fit->size;
+    // Split the block if it's too large. Returns the tail to the free size
     allocator_trim_block(allocator, best_fit, alloc_size, false);
 
     // Mark the block as allocated
     allocator_write_block_tags(allocator, best_fit, best_fit->size, KB_BLOCK_TAG_ALLOCATED);
-    allocator->header->free_size -= best_fit->size;
 
     allocator_unlock(allocator);
 
@@ -306,6 +370,12 @@ static kb_block_header_t *allocator_prev_adjacent_free_block(kb_allocator_t *all
     assert(allocator != NULL);
     assert(block != NULL);
 
+    // The first block has no previous neighbour, only the allocator header
+    if (allocator_block_offset(allocator, block) == ALLOCATOR_HEADER_SIZE)
+    {
+        return NULL;
+    }
+
     kb_block_footer_t *prev_block_footer = OFFSET_POINTER(block, -BLOCK_FOOTER_SIZE);
     if (prev_block_footer->type == KB_BLOCK_TAG_FREE)
     {
@@ -320,7 +390,15 @@ static kb_block_header_t *allocator_next_adjacent_free_block(kb_allocator_t *all
     assert(allocator != NULL);
     assert(block != NULL);
 
-    kb_block_header_t *next_block = allocator_offset_to_block(allocator, allocator_block_offset(allocator, block) + block->size);
+    size_t next_block_offset = allocator_block_offset(allocator, block) + block->size;
+
+    // The last block has no next neighbour
+    if (next_block_offset >= allocator->header->total_size + ALLOCATOR_HEADER_SIZE)
+    {
+        return NULL;
+    }
+
+    kb_block_header_t *next_block = allocator_offset_to_block(allocator, next_block_offset);
     if (next_block->type == KB_BLOCK_TAG_FREE)
     {
         return next_block;
@@ -337,21 +415,69 @@ void allocator_coalesce_free_blocks(kb_allocator_t *allocator, kb_block_header_t
     assert(block->type == KB_BLOCK_TAG_FREE);
 
     kb_block_header_t *prev_block = allocator_prev_adjacent_free_block(allocator, block);
+    kb_block_header_t *next_block = allocator_next_adjacent_free_block(allocator, block);
+
+    if (!prev_block && !next_block)
+    {
+        return;
+    }
+
+    // The merged block can change its size class, so all parts leave their lists first
+    allocator_remove_free_block(allocator, block);
+    size_t size = block->size;
+
     if (prev_block)
     {
-        // Update size for the previous block
-        allocator_remove_free_block(allocator, block);
-        allocator_write_block_tags(allocator, prev_block, prev_block->size += block->size, KB_BLOCK_TAG_FREE);
+        allocator_remove_free_block(allocator, prev_block);
+        size += prev_block->size;
         block = prev_block;
     }
 
-    kb_block_header_t *next_block = allocator_next_adjacent_free_block(allocator, block);
     if (next_block)
     {
-        // Update size for the current block
         allocator_remove_free_block(allocator, next_block);
-        allocator_write_block_tags(allocator, block, block->size += next_block->size, KB_BLOCK_TAG_FREE);
+        size += next_block->size;
+    }
+
+    block->size = size;
+    allocator_add_free_block(allocator, block);
+}
+
+bool allocator_grow(kb_allocator_t *allocator, void *ptr, size_t new_size)
+{
+    assert(allocator != NULL);
+    assert(ptr != NULL);
+    assert(new_size > 0);
+
+    size_t total_size = allocator_block_size(new_size);
+    kb_block_header_t *block = OFFSET_POINTER(ptr, -BLOCK_HEADER_SIZE);
+    assert(block->type == KB_BLOCK_TAG_ALLOCATED);
+
+    if (block->size >= total_size)
+    {
+        return true;
     }
+
+    allocator_lock(allocator);
+
+    kb_block_header_t *next_block = allocator_next_adjacent_free_block(allocator, block);
+    if (next_block == NULL || block->size + next_block->size < total_size)
+    {
+        allocator_unlock(allocator);
+        return false;
+    }
+
+    log_trace(allocator->logger, "Growing block at %zd from %zu to %zu bytes", allocator_block_offset(allocator, block), block->size, total_size);
+
+    // Take the whole neighbour and give the excess back
+    allocator_remove_free_block(allocator, next_block);
+    allocator->header->free_size -= next_block->size;
+    allocator_write_block_tags(allocator, block, block->size + next_block->size, KB_BLOCK_TAG_ALLOCATED);
+    allocator_trim_block(allocator, block, total_size, false);
+
+    allocator_unlock(allocator);
+
+    return true;
 }
 
 void allocator_trim_block(kb_allocator_t *allocator, kb_block_header_t *block, size_t new_size, bool lock)
@@ -382,13 +508,14 @@ void allocator_trim_block(kb_allocator_t *allocator, kb_block_header_t *block, s
     // Create a new block
     kb_block_header_t *new_block = allocator_offset_to_block(allocator, new_block_offset);
     allocator_write_block_tags(allocator, new_block, block->size - new_size, KB_BLOCK_TAG_FREE);
-    new_block->next_free_block_offset = block->next_free_block_offset;
 
     // Update the current block
     allocator_write_block_tags(allocator, block, new_size, KB_BLOCK_TAG_ALLOCATED);
 
-    // Add the new block to the free list
+    // Add the new block to the free list and merge it with the next block if that one is free
+    allocator->header->free_size += new_block->size;
     allocator_add_free_block(allocator, new_block);
+    allocator_coalesce_free_blocks(allocator, new_block);
 
     if (lock)
     {
@@ -402,7 +529,7 @@ void allocator_trim(kb_allocator_t *allocator, void *ptr, size_t new_size)
     assert(ptr != NULL);
     assert(new_size > 0);
 
-    size_t total_size = ALIGN(new_size) + BLOCK_HEADER_SIZE + BLOCK_FOOTER_SIZE;
+    size_t total_size = allocator_block_size(new_size);
     kb_block_header_t *block = OFFSET_POINTER(ptr, -BLOCK_HEADER_SIZE);
     allocator_trim_block(allocator, block, total_size, true);
 }
@@ -10,6 +10,9 @@
 extern "C" {
 #endif
 
+// Number of power-of-two size classes for free blocks
+#define KB_ALLOCATOR_BIN_COUNT 32
+
 /**
  * @brief Block type enumeration
  */
@@ -28,7 +31,8 @@ struct kb_block_header_s
 {
     size_t size;                   // Size of the block (including tags)
     kb_block_type_t type;          // Free or allocated
-    size_t next_free_block_offset; // Offset of the next block in the list
+    size_t next_free_block_offset; // Offset of the next block in the size class list
+    size_t prev_free_block_offset; // Offset of the previous block in the size class list
 };
 
 typedef struct kb_block_header_s kb_block_header_t;
@@ -50,11 +54,12 @@ typedef struct kb_block_footer_s kb_block_footer_t;
  */
 struct kb_allocator_header_s
 {
-    uint32_t futex;                  // Futex for synchronization
-    size_t total_size;               // Total size of the shared memory region
-    size_t free_size;                // Currently used size
-    size_t max_message_size;         // Maximum message size for initial allocations
-    size_t next_free_block_offset;   // Offset of the first free block
+    uint32_t futex;                            // Futex for synchronization
+    size_t total_size;                         // Total size of the shared memory region
+    size_t free_size;                          // Currently used size
+    size_t max_message_size;                   // Maximum message size for initial allocations
+    uint64_t free_bins_bitmap;                 // Bit N is set if size class N has free blocks
+    size_t free_bins[KB_ALLOCATOR_BIN_COUNT];  // Offsets of the first free block of each size class
 };
 
 typedef struct kb_allocator_header_s kb_allocator_header_t;
@@ -106,6 +111,25 @@ void allocator_destroy(kb_allocator_t *allocator);
  */
 void *allocator_alloc(kb_allocator_t *allocator);
 
+/**
+ * Allocate a block of a specific size
+ *
+ * @param allocator Pointer to the allocator
+ * @param size Requested size
+ * @return Pointer to the allocated memory, or NULL if allocation failed
+ */
+void *allocator_alloc_n(kb_allocator_t *allocator, size_t size);
+
+/**
+ * @brief Grow an allocation in place by taking memory from the next adjacent free block
+ *
+ * @param allocator Memory allocator
+ * @param ptr Pointer to the allocated memory
+ * @param new_size New size for the allocation
+ * @return true if the allocation has at least `new_size` bytes, false if it can't be grown in place
+ */
+bool allocator_grow(kb_allocator_t *allocator, void *ptr, size_t new_size);
+
 /**
  * Free a block of memory
  *
@@ -12,9 +12,22 @@
 // No block offset (used for empty lists)
 #define NULL_OFFSET ((size_t)-1)
 
+// Cache line size used to keep fields shared between processes apart
+#define CACHE_LINE_SIZE 64
+
 #define OFFSET_POINTER(pointer, offset) \
     ((void *)((char *)(pointer) + (offset)))
 
+// Hint the CPU that we're in a busy-wait loop
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
 static inline int futex_wait(uint32_t *uaddr, int val)
 {
     return syscall(SYS_futex == 0 ? SYS_futex : SYS_futex, uaddr, FUTEX_WAIT, val, NULL, NULL, 0);
@@ -9,6 +9,9 @@
 #include "transport_shm.h"
 #include "../utils.h"
 
+// Lower bound for the adaptive spin limit, so the reader can find out that spinning pays off again
+#define MIN_SPIN_LIMIT 16
+
 kb_event_manager_shm_t *event_manager_shm_create(struct kb_transport_shm_s *transport, struct io_uring *ring, log4c_category_t *logger)
 {
     assert(transport != NULL);
@@ -48,10 +51,17 @@ kb_event_manager_shm_t *event_manager_shm_create(struct kb_transport_shm_s *tran
     manager->write_event.manager = (kb_event_manager_t *)manager;
     manager->write_event.event_type = KB_UDS_EVENT_WRITEABLE;
 
+    manager->wake_event.manager = (kb_event_manager_t *)manager;
+    manager->wake_event.event_type = KB_SHM_EVENT_WAKE;
+
+    manager->spin_limit = 0;
+    manager->max_spin_limit = 0;
+
     manager->base.transport = (kb_transport_t *)transport;
     manager->base.ring = ring;
     manager->base.logger = logger;
     manager->base.handle_event = event_manager_shm_handle_event;
+    manager->base.handle_event_batch = event_manager_shm_handle_event_batch;
 
     return manager;
 }
@@ -68,34 +78,67 @@ void event_manager_shm_signal_new_message(kb_event_manager_shm_t *manager)
 {
     struct io_uring *ring = manager->base.ring;
     struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
-    io_uring_sqe_set_data(sqe, &manager->read_event);
+    if (sqe == NULL)
+    {
+        // Submission queue is full. Flush it and try again
+        io_uring_submit(ring);
+        sqe = io_uring_get_sqe(ring);
+        if (sqe == NULL)
+        {
+            log4c_category_log(manager->base.logger, LOG4C_PRIORITY_ERROR, "io_uring futex wake: submission queue is full");
+            return;
+        }
+    }
+
+    io_uring_sqe_set_data(sqe, &manager->wake_event);
 
     kb_transport_shm_t *transport = (kb_transport_shm_t *)manager->base.transport;
     kb_arena_header_t *header = transport->write_arena.header;
 
     log_trace(manager->base.logger, "Signalling %p", &header->num_messages);
     io_uring_prep_futex_wake(sqe, &header->num_messages, 1, FUTEX_BITSET_MATCH_ANY, FUTEX2_SIZE_U32, 0);
+    // Don't wait for the wake result. A successful wake doesn't post a completion at all,
+    // so the event loop only sees failed wakes
+    io_uring_sqe_set_flags(sqe, IOSQE_CQE_SKIP_SUCCESS);
 
     int ret = io_uring_submit(ring);
     if (ret < 0)
     {
         log4c_category_log(manager->base.logger, LOG4C_PRIORITY_ERROR, "io_uring futex wake submit error: %s", strerror(-ret));
     }
+}
 
-    // Wait for completion
-    struct io_uring_cqe *cqe;
-    ret = io_uring_wait_cqe(ring, &cqe);
+void event_manager_shm_set_spin_limit(kb_event_manager_shm_t *manager, size_t max_spin_limit)
+{
+    assert(manager != NULL);
 
-    if (ret < 0)
+    manager->max_spin_limit = max_spin_limit;
+    manager->spin_limit = max_spin_limit;
+}
+
+// Poll the message counter. Returns true if messages arrived before the spin limit
+static bool event_manager_shm_spin(kb_event_manager_shm_t *manager, kb_arena_header_t *header)
+{
+    for (size_t i = 0; i < manager->spin_limit; i++)
     {
-        log4c_category_log(manager->base.logger, LOG4C_PRIORITY_ERROR, "io_uring futex wake error: %s", strerror(-ret));
+        if (atomic_load_explicit(&header->num_messages, memory_order_acquire) != 0)
+        {
+            // Spinning pays off. Allow longer spins next time
+            manager->spin_limit = manager->spin_limit * 2 < manager->max_spin_limit ? manager->spin_limit * 2 : manager->max_spin_limit;
+            return true;
+        }
+
+        cpu_relax();
     }
-    else if (cqe->res < 0)
+
+    // Spinning was a waste of time. Park sooner next time
+    manager->spin_limit = manager->spin_limit / 2 > MIN_SPIN_LIMIT ? manager->spin_limit / 2 : MIN_SPIN_LIMIT;
+    if (manager->spin_limit > manager->max_spin_limit)
     {
-        log4c_category_log(manager->base.logger, LOG4C_PRIORITY_ERROR, "io_uring_prep_futex_wake error: %s", strerror(-cqe->res));
+        manager->spin_limit = manager->max_spin_limit;
     }
 
-    io_uring_cqe_seen(ring, cqe);
+    return false;
 }
 
 void event_manager_shm_wait_messages(kb_event_manager_shm_t *manager)
@@ -107,6 +150,14 @@ void event_manager_shm_wait_messages(kb_event_manager_shm_t *manager)
     kb_transport_shm_t *transport = (kb_transport_shm_t *)manager->base.transport;
     kb_arena_header_t *header = transport->read_arena.header;
 
+    // The waiting flag is clear while spinning, so senders don't waste time on a wake.
+    // If messages arrive during the spin, the futex wait below completes right away
+    if (manager->max_spin_limit == 0 || !event_manager_shm_spin(manager, header))
+    {
+        // Let senders know they have to wake us up. Must be visible before the futex checks the counter
+        atomic_store(&header->receiver_waiting, 1);
+    }
+
     log_trace(manager->base.logger, "Waiting %p", &header->num_messages);
     io_uring_prep_futex_wait(sqe, &header->num_messages, 0, FUTEX_BITSET_MATCH_ANY, FUTEX2_SIZE_U32, 0);
 
@@ -117,16 +168,58 @@ void event_manager_shm_wait_messages(kb_event_manager_shm_t *manager)
     }
 }
 
+// Only failed wakes post completions
+static void event_manager_shm_handle_wake_error(kb_event_manager_shm_t *manager, struct io_uring_cqe *cqe)
+{
+    log4c_category_log(manager->base.logger, LOG4C_PRIORITY_ERROR, "io_uring_prep_futex_wake error: %s", strerror(-cqe->res));
+}
+
 kb_message_t *event_manager_shm_handle_event(struct io_uring_cqe *cqe)
 {
     kb_event_t *event = (kb_event_t *)io_uring_cqe_get_data(cqe);
     kb_event_manager_shm_t *self = (kb_event_manager_shm_t *)event->manager;
 
-    if (cqe->res == EINTR || cqe->res == EAGAIN)
+    if (event->event_type == KB_SHM_EVENT_WAKE)
+    {
+        event_manager_shm_handle_wake_error(self, cqe);
+        return NULL;
+    }
+
+    kb_transport_shm_t *transport = (kb_transport_shm_t *)self->base.transport;
+    // We're awake. Senders may skip the wake until we wait again
+    atomic_store(&transport->read_arena.header->receiver_waiting, 0);
+
+    // Interrupted wait. -EAGAIN means the counter wasn't zero, so there are messages to read
+    if (cqe->res == -EINTR)
     {
         event_manager_shm_wait_messages(self);
         return NULL;
     }
 
     return transport_shm_message_receive(event->manager->transport);
-}
\ No newline at end of file
+}
+
+size_t event_manager_shm_handle_event_batch(struct io_uring_cqe *cqe, kb_message_t **messages, size_t max_messages)
+{
+    kb_event_t *event = (kb_event_t *)io_uring_cqe_get_data(cqe);
+    kb_event_manager_shm_t *self = (kb_event_manager_shm_t *)event->manager;
+
+    if (event->event_type == KB_SHM_EVENT_WAKE)
+    {
+        event_manager_shm_handle_wake_error(self, cqe);
+        return 0;
+    }
+
+    kb_transport_shm_t *transport = (kb_transport_shm_t *)self->base.transport;
+    // We're awake. Senders may skip the wake until we wait again
+    atomic_store(&transport->read_arena.header->receiver_waiting, 0);
+
+    // Interrupted wait. -EAGAIN means the counter wasn't zero, so there are messages to read
+    if (cqe->res == -EINTR)
+    {
+        event_manager_shm_wait_messages(self);
+        return 0;
+    }
+
+    return transport_shm_message_receive_batch(event->manager->transport, messages, max_messages);
+}
@@ -19,6 +19,9 @@ struct kb_event_manager_shm_s
     kb_event_manager_t base; // Base event manager interface
     kb_event_t read_event;   // Event triggered when data is available to read
     kb_event_t write_event;  // Event triggered when buffer is available to write
+    kb_event_t wake_event;   // Tag of the fire-and-forget peer wake requests
+    size_t spin_limit;       // Current number of polls before parking. Tuned after each wait
+    size_t max_spin_limit;   // Upper bound for the spin limit. Zero disables spinning
 };
 
 typedef struct kb_event_manager_shm_s kb_event_manager_shm_t;
@@ -41,14 +44,27 @@ kb_event_manager_shm_t *event_manager_shm_create(struct kb_transport_shm_s *tran
 void event_manager_shm_destroy(kb_event_manager_shm_t *manager);
 
 /**
- * @brief Wait for new messages to arrive
+ * @brief Enable polling for new messages before parking the reader on the futex.
+ *        The number of polls adapts between waits: it grows when messages arrive
+ *        during the spin and shrinks when the reader ends up parking anyway
+ *
+ * @param manager Event manager of the reading transport
+ * @param max_spin_limit Maximum number of polls before parking. Zero disables spinning
+ */
+void event_manager_shm_set_spin_limit(kb_event_manager_shm_t *manager, size_t max_spin_limit);
+
+/**
+ * @brief Wait for new messages to arrive.
+ *        With spinning enabled, polls the message counter first. Senders don't wake a spinning reader
  *
  * @param manager Event manager to wait on
  */
 void event_manager_shm_wait_messages(kb_event_manager_shm_t *manager);
 
 /**
- * @brief Signal that a new message is available
+ * @brief Signal that a new message is available.
+ *        Doesn't wait for the wake completion. Only a failed wake posts a completion,
+ *        which is reported by `event_manager_shm_handle_event`
  *
  * @param manager Event manager to signal
  */
@@ -62,6 +78,16 @@ void event_manager_shm_signal_new_message(kb_event_manager_shm_t *manager);
  */
 kb_message_t *event_manager_shm_handle_event(struct io_uring_cqe *cqe);
 
+/**
+ * @brief Handle a completion event and retrieve all available messages up to a limit
+ *
+ * @param cqe Completion queue event from io_uring
+ * @param messages Array to put received messages into
+ * @param max_messages Size of the array
+ * @return Number of received messages
+ */
+size_t event_manager_shm_handle_event_batch(struct io_uring_cqe *cqe, kb_message_t **messages, size_t max_messages);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -1,6 +1,7 @@
 #include "message_shm.h"
 
 #include <assert.h>
+#include <stdalign.h>
 
 kb_message_shm_t *message_shm_init(kb_transport_shm_t *transport,
                                    kb_message_header_t *header,
@@ -10,11 +11,27 @@ kb_message_shm_t *message_shm_init(kb_transport_shm_t *transport,
     assert(header != NULL);
     assert(buffer != NULL);
 
-    kb_message_shm_t *message = malloc(sizeof(kb_message_shm_t));
+    kb_message_shm_t *message = transport->free_messages;
+    if (message != NULL)
+    {
+        transport->free_messages = message->next_free;
+    }
+    else
+    {
+        // BSON documents may require extra alignment
+        message = aligned_alloc(alignof(kb_message_shm_t), sizeof(kb_message_shm_t));
+        if (message == NULL)
+        {
+            log4c_category_log(transport->base.logger, LOG4C_PRIORITY_ERROR, "Failed to allocate message");
+            return NULL;
+        }
+    }
+
     message->transport = transport;
     message->header = header;
+    message->next_free = NULL;
 
-    message_init(&message->base, buffer, header->size);
+    message_init_static(&message->base, &message->document, (uint8_t *)buffer, header->size);
     message->base.destroy = message_shm_clean;
 
     return message;
@@ -28,9 +45,17 @@ int message_shm_clean(kb_message_t *message)
     }
 
     kb_message_shm_t *self = (kb_message_shm_t *)message;
+    kb_transport_shm_t *transport = self->transport;
 
-    transport_shm_message_release(&self->transport->base, message);
-    free(self);
+    transport_shm_message_release(&transport->base, message);
+
+    self->next_free = transport->free_messages;
+    transport->free_messages = self;
 
     return 0;
-}
\ No newline at end of file
+}
+
+void message_shm_destroy(kb_message_shm_t *message)
+{
+    free(message);
+}
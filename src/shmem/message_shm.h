@@ -12,15 +12,18 @@ extern "C" {
  */
 struct kb_message_shm_s
 {
-    kb_message_t base;             // Base message interface
-    kb_message_header_t *header;   // Header for the message being read
-    kb_transport_shm_t *transport; // Transport that provided the message
+    kb_message_t base;                  // Base message interface
+    kb_message_header_t *header;        // Header for the message being read
+    kb_transport_shm_t *transport;      // Transport that provided the message
+    struct kb_message_shm_s *next_free; // Next message in the transport pool
+    bson_t document;                    // Message document storage
 };
 
 typedef struct kb_message_shm_s kb_message_shm_t;
 
 /**
- * @brief Initialize a shared memory message reader
+ * @brief Initialize a shared memory message reader.
+ *        Reuses a released message of the transport if there is one
  *
  * @param transport Transport that provided the message
  * @param header Message header for the message being read
@@ -32,13 +35,20 @@ kb_message_shm_t *message_shm_init(kb_transport_shm_t *transport,
                                    char *buffer);
 
 /**
- * @brief Clean up resources used by a message
+ * @brief Clean up resources used by a message and return it to the transport pool
  *
  * @param message Message to clean up
  * @return 0 on success, negative error code on failure
  */
 int message_shm_clean(kb_message_t *message);
 
+/**
+ * @brief Free a pooled message
+ *
+ * @param message Message to free
+ */
+void message_shm_destroy(kb_message_shm_t *message);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
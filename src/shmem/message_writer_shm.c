@@ -2,6 +2,16 @@
 
 #include <assert.h>
 
+// Return the writer to the transport pool
+static void message_writer_shm_release(kb_message_writer_shm_t *writer)
+{
+    kb_transport_shm_t *transport = writer->transport;
+
+    writer->header = NULL;
+    writer->next_free = transport->free_writers;
+    transport->free_writers = writer;
+}
+
 kb_message_writer_shm_t *message_writer_shm_init(kb_transport_shm_t *transport,
                                                  kb_message_header_t *header,
                                                  char *buffer)
@@ -10,13 +20,34 @@ kb_message_writer_shm_t *message_writer_shm_init(kb_transport_shm_t *transport,
     assert(header != NULL);
     assert(buffer != NULL);
 
-    kb_message_writer_shm_t *writer = malloc(sizeof(kb_message_writer_shm_t));
+    kb_message_writer_shm_t *writer = transport->free_writers;
+    if (writer != NULL)
+    {
+        // Pooled writers keep their document writer
+        transport->free_writers = writer->next_free;
+        writer->header = header;
+        writer->next_free = NULL;
+
+        message_writer_reset(&writer->base, (uint8_t *)buffer, header->size);
+        return writer;
+    }
+
+    writer = malloc(sizeof(kb_message_writer_shm_t));
+    if (writer == NULL)
+    {
+        log4c_category_log(transport->base.logger, LOG4C_PRIORITY_ERROR, "Failed to allocate message writer");
+        return NULL;
+    }
+
     writer->transport = transport;
     writer->header = header;
+    writer->next_free = NULL;
 
-    message_writer_init(&writer->base, buffer, header->size, transport->base.logger);
+    message_writer_init(&writer->base, (uint8_t *)buffer, header->size, transport->base.logger);
     writer->base.send = message_writer_shm_send;
     writer->base.cancel = message_writer_shm_cancel;
+    writer->base.grow = message_writer_shm_grow;
+    writer->base.send_deferred = message_writer_shm_send_deferred;
 
     return writer;
 }
@@ -29,13 +60,47 @@ int message_writer_shm_send(kb_message_writer_t *writer)
 
     kb_message_writer_shm_t *self = (kb_message_writer_shm_t*)writer;
 
-    transport_shm_message_send(&self->transport->base, writer);
-    free(writer);
+    int result = transport_shm_message_send(&self->transport->base, writer);
+    message_writer_shm_release(self);
+
+    return result;
+}
+
+int message_writer_shm_send_deferred(kb_message_writer_t *writer)
+{
+    if (writer == NULL) {
+        return 1;
+    }
+
+    kb_message_writer_shm_t *self = (kb_message_writer_shm_t*)writer;
 
-    return 0;
+    int result = transport_shm_message_send_deferred(&self->transport->base, writer);
+    message_writer_shm_release(self);
+
+    return result;
+}
+
+uint8_t *message_writer_shm_grow(kb_message_writer_t *writer, size_t size)
+{
+    assert(writer != NULL);
+
+    kb_message_writer_shm_t *self = (kb_message_writer_shm_t *)writer;
+
+    return transport_shm_message_grow(&self->transport->base, writer, size);
 }
 
 void message_writer_shm_cancel(kb_message_writer_t *writer)
 {
+    assert(writer != NULL);
+
+    kb_message_writer_shm_t *self = (kb_message_writer_shm_t *)writer;
+
+    transport_shm_message_cancel(&self->transport->base, writer);
+    message_writer_shm_release(self);
+}
+
+void message_writer_shm_destroy(kb_message_writer_shm_t *writer)
+{
+    message_writer_deinit(&writer->base);
     free(writer);
 }
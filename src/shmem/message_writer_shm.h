@@ -12,15 +12,17 @@ extern "C" {
  */
 struct kb_message_writer_shm_s
 {
-    kb_message_writer_t base;      // Base message writer interface
-    kb_message_header_t *header;   // Header for the message being written
-    kb_transport_shm_t *transport; // Transport used for sending the message
+    kb_message_writer_t base;                  // Base message writer interface
+    kb_message_header_t *header;               // Header for the message being written
+    kb_transport_shm_t *transport;             // Transport used for sending the message
+    struct kb_message_writer_shm_s *next_free; // Next writer in the transport pool
 };
 
 typedef struct kb_message_writer_shm_s kb_message_writer_shm_t;
 
 /**
- * @brief Initialize a shared memory message writer
+ * @brief Initialize a shared memory message writer.
+ *        Reuses a released writer of the transport if there is one
  *
  * @param transport Transport to use for sending the message
  * @param header Message header for the message being written
@@ -39,6 +41,23 @@ kb_message_writer_shm_t *message_writer_shm_init(kb_transport_shm_t *transport,
  */
 int message_writer_shm_send(kb_message_writer_t *writer);
 
+/**
+ * @brief Queue a message in the shared memory transport until the transport is flushed
+ *
+ * @param writer Message writer containing the message to send
+ * @return 0 on success, negative error code on failure
+ */
+int message_writer_shm_send_deferred(kb_message_writer_t *writer);
+
+/**
+ * @brief Grow the buffer of a message being written
+ *
+ * @param writer Message writer to grow
+ * @param size New buffer size
+ * @return New message buffer or NULL on failure
+ */
+uint8_t *message_writer_shm_grow(kb_message_writer_t *writer, size_t size);
+
 /**
  * @brief Cancel a message being written and release resources
  *
@@ -46,6 +65,13 @@ int message_writer_shm_send(kb_message_writer_t *writer);
  */
 void message_writer_shm_cancel(kb_message_writer_t *writer);
 
+/**
+ * @brief Free a pooled message writer
+ *
+ * @param writer Message writer to free
+ */
+void message_writer_shm_destroy(kb_message_writer_shm_t *writer);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
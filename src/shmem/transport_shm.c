@@ -19,8 +19,12 @@
 #define RING_QUEUE_DEPTH 32
 
 #define MESSAGE_HEADER_SIZE (ALIGN(sizeof(kb_message_header_t)))
+// Smallest message buffer. Fits an empty BSON document
+#define MIN_MESSAGE_SIZE ALIGN(5)
 #define ARENA_HEADER_SIZE (ALIGN(sizeof(kb_arena_header_t)))
 
+static_assert((SHM_RING_CAPACITY & (SHM_RING_CAPACITY - 1)) == 0, "SHM_RING_CAPACITY must be a power of two");
+
 static void arena_lock(kb_arena_t *arena)
 {
     assert(arena != NULL);
@@ -62,7 +66,75 @@ static void arena_unlock(kb_arena_t *arena)
     }
 }
 
+static void arena_ring_push_chain(kb_arena_t *arena, size_t first_message_offset, size_t num_messages)
+{
+    assert(arena != NULL);
+
+    kb_arena_header_t *arena_header = arena->header;
+
+    // Only the producer writes the tail, so a relaxed load is enough
+    size_t tail = atomic_load_explicit(&arena_header->ring_tail, memory_order_relaxed);
+
+    // Free slots are checked by `arena_ring_full` before the messages are queued
+    size_t message_offset = first_message_offset;
+    for (size_t i = 0; i < num_messages; i++)
+    {
+        arena_header->ring[(tail + i) & (SHM_RING_CAPACITY - 1)] = message_offset;
+        message_offset = transport_message_from_offset(arena, message_offset)->next_message_offset;
+    }
+
+    // Publish all slots at once. Pairs with the acquire load in `arena_ring_pop`
+    atomic_store_explicit(&arena_header->ring_tail, tail + num_messages, memory_order_release);
+}
+
+static size_t arena_ring_pop(kb_arena_t *arena)
+{
+    assert(arena != NULL);
+
+    kb_arena_header_t *arena_header = arena->header;
+
+    // Only the consumer writes the head, so a relaxed load is enough
+    size_t head = atomic_load_explicit(&arena_header->ring_head, memory_order_relaxed);
+
+    // Check the cached tail first, and only reload the producer's cache line if the ring looks empty
+    if (head == arena->cached_ring_index)
+    {
+        arena->cached_ring_index = atomic_load_explicit(&arena_header->ring_tail, memory_order_acquire);
+        if (head == arena->cached_ring_index)
+        {
+            return NULL_OFFSET;
+        }
+    }
+
+    size_t message_offset = arena_header->ring[head & (SHM_RING_CAPACITY - 1)];
+    // Release the slot. Pairs with the acquire load in `arena_ring_full`
+    atomic_store_explicit(&arena_header->ring_head, head + 1, memory_order_release);
+
+    return message_offset;
+}
+
+static bool arena_ring_full(kb_arena_t *arena, size_t num_pending)
+{
+    assert(arena != NULL);
+
+    // Pending messages have their slots reserved, but not published yet
+    size_t tail = atomic_load_explicit(&arena->header->ring_tail, memory_order_relaxed) + num_pending;
+    if (tail - arena->cached_ring_index < SHM_RING_CAPACITY)
+    {
+        return false;
+    }
+
+    arena->cached_ring_index = atomic_load_explicit(&arena->header->ring_head, memory_order_acquire);
+    return tail - arena->cached_ring_index >= SHM_RING_CAPACITY;
+}
+
 int transport_shm_create_mapping(const char *name, size_t buffer_size, log4c_category_t *logger)
+{
+    return transport_shm_create_mapping_with_mode(name, buffer_size, KB_SHM_QUEUE_LIST, logger);
+}
+
+int transport_shm_create_mapping_with_mode(const char *name, size_t buffer_size,
+                                           kb_shm_queue_mode_t queue_mode, log4c_category_t *logger)
 {
     assert(name != NULL);
     assert(buffer_size > 0);
@@ -99,7 +171,11 @@ int transport_shm_create_mapping(const char *name, size_t buffer_size, log4c_cat
     arena_header->first_message_offset = NULL_OFFSET;
     arena_header->last_message_offset = NULL_OFFSET;
     arena_header->size = buffer_size;
+    arena_header->queue_mode = queue_mode;
+    arena_header->ring_head = 0;
+    arena_header->ring_tail = 0;
     atomic_init(&arena_header->num_messages, 0);
+    atomic_init(&arena_header->receiver_waiting, 0);
 
     log_trace(logger, "Shared memory arena `%s` created at %p", name, map_addr);
 
@@ -134,10 +210,16 @@ kb_transport_t *transport_shm_init(const char *name, int read_fd, int write_fd,
         return NULL;
     }
 
+    transport->free_writers = NULL;
+    transport->free_messages = NULL;
+
     transport->base.name = strdup(name);
     transport->base.logger = logger;
     transport->base.message_init = transport_shm_message_init;
+    transport->base.message_init_sized = transport_shm_message_init_sized;
     transport->base.message_receive = transport_shm_message_receive;
+    transport->base.message_receive_batch = transport_shm_message_receive_batch;
+    transport->base.flush = transport_shm_flush;
     transport->base.destroy = transport_shm_destroy;
 
     kb_event_manager_shm_t *event_manager = event_manager_shm_create(transport, ring, logger);
@@ -152,7 +234,7 @@ kb_transport_t *transport_shm_init(const char *name, int read_fd, int write_fd,
 
     // Map receiving memory mapping
     size_t read_mapping_size = transport_shm_get_mapping_size(read_fd, logger);
-    void *map_read_addr = mmap(NULL, read_mapping_size, PROT_READ | PROT_WRITE,
+    void *map_read_addr = mmap(NULL, read_mapping_size + ARENA_HEADER_SIZE, PROT_READ | PROT_WRITE,
                                MAP_SHARED, read_fd, 0);
     if (map_read_addr == MAP_FAILED)
     {
@@ -173,7 +255,11 @@ kb_transport_t *transport_shm_init(const char *name, int read_fd, int write_fd,
     transport->read_arena.header = (kb_arena_header_t *)map_read_addr;
     transport->read_arena.allocator = read_allocator;
     transport->read_arena.shm_fd = read_fd;
+    transport->read_arena.cached_ring_index = transport->read_arena.header->ring_tail;
     transport->max_message_size = max_message_size;
+    transport->deferred_first_offset = NULL_OFFSET;
+    transport->deferred_last_offset = NULL_OFFSET;
+    transport->num_deferred = 0;
 
     log_trace(logger, "Shared memory read arena `%s` mapped at %p", name, map_read_addr);
 
@@ -188,7 +274,7 @@ kb_transport_t *transport_shm_init(const char *name, int read_fd, int write_fd,
         return NULL;
     }
 
-    void *map_write_addr = mmap(NULL, write_mapping_size, PROT_READ | PROT_WRITE,
+    void *map_write_addr = mmap(NULL, write_mapping_size + ARENA_HEADER_SIZE, PROT_READ | PROT_WRITE,
                                 MAP_SHARED, write_fd, 0);
     if (map_write_addr == MAP_FAILED)
     {
@@ -199,7 +285,7 @@ kb_transport_t *transport_shm_init(const char *name, int read_fd, int write_fd,
 
     kb_allocator_t *write_allocator = allocator_create(
         OFFSET_POINTER(map_write_addr, ARENA_HEADER_SIZE),
-        write_mapping_size - ARENA_HEADER_SIZE,
+        write_mapping_size,
         max_message_size + MESSAGE_HEADER_SIZE, logger);
     if (write_allocator == NULL)
     {
@@ -211,6 +297,7 @@ kb_transport_t *transport_shm_init(const char *name, int read_fd, int write_fd,
     transport->write_arena.header = (kb_arena_header_t *)map_write_addr;
     transport->write_arena.allocator = write_allocator;
     transport->write_arena.shm_fd = write_fd;
+    transport->write_arena.cached_ring_index = transport->write_arena.header->ring_head;
 
     log_trace(logger, "Shared memory write arena `%s` mapped at %p", name, map_write_addr);
 
@@ -220,7 +307,7 @@ kb_transport_t *transport_shm_init(const char *name, int read_fd, int write_fd,
 kb_message_header_t *transport_message_from_offset(kb_arena_t *arena, size_t offset)
 {
     assert(arena != NULL);
-    assert(offset == NULL_OFFSET ? true : offset < arena->header->size && offset > 0 && offset % ALIGNMENT == 0);
+    assert(offset == NULL_OFFSET ? true : offset < arena->header->size + ARENA_HEADER_SIZE && offset > 0 && offset % ALIGNMENT == 0);
 
     if (offset == NULL_OFFSET)
     {
@@ -248,25 +335,94 @@ kb_message_writer_t *transport_shm_message_init(kb_transport_t *transport)
 
     kb_transport_shm_t *self = (kb_transport_shm_t *)transport;
 
-    void *memory_chunk = allocator_alloc(self->write_arena.allocator);
-    if (memory_chunk == NULL)
+    return transport_shm_message_init_sized(transport, self->max_message_size);
+}
+
+kb_message_writer_t *transport_shm_message_init_sized(kb_transport_t *transport, size_t size_hint)
+{
+    assert(transport != NULL);
+
+    kb_transport_shm_t *self = (kb_transport_shm_t *)transport;
+    size_t buffer_size = size_hint > MIN_MESSAGE_SIZE ? ALIGN(size_hint) : MIN_MESSAGE_SIZE;
+
+    // No free slot for the message. Don't waste arena memory
+    if (self->write_arena.header->queue_mode == KB_SHM_QUEUE_SPSC_RING && arena_ring_full(&self->write_arena, self->num_deferred))
     {
         return NULL;
     }
 
-    kb_arena_t *arena = &self->write_arena;
-    kb_arena_header_t *arena_header = arena->header;
+    void *memory_chunk = allocator_alloc_n(self->write_arena.allocator, buffer_size + MESSAGE_HEADER_SIZE);
+    if (memory_chunk == NULL)
+    {
+        return NULL;
+    }
 
     kb_message_header_t *message_header = (kb_message_header_t *)memory_chunk;
-    message_header->size = self->max_message_size;
+    message_header->size = buffer_size;
     message_header->next_message_offset = NULL_OFFSET;
 
     kb_message_writer_shm_t *writer = message_writer_shm_init(self, message_header,
                                                               OFFSET_POINTER(memory_chunk, MESSAGE_HEADER_SIZE));
+    if (writer == NULL)
+    {
+        allocator_free(self->write_arena.allocator, memory_chunk);
+        return NULL;
+    }
+
     return &writer->base;
 }
 
+uint8_t *transport_shm_message_grow(kb_transport_t *transport, kb_message_writer_t *writer, size_t size)
+{
+    assert(transport != NULL);
+    assert(writer != NULL);
+
+    kb_transport_shm_t *self = (kb_transport_shm_t *)transport;
+    kb_message_writer_shm_t *shm_writer = (kb_message_writer_shm_t *)writer;
+    kb_arena_t *arena = &self->write_arena;
+
+    kb_message_header_t *message_header = shm_writer->header;
+    size_t buffer_size = ALIGN(size);
+
+    if (allocator_grow(arena->allocator, message_header, buffer_size + MESSAGE_HEADER_SIZE))
+    {
+        log_trace(transport->logger, "Message %p grown in place from %zu to %zu bytes", message_header, message_header->size, buffer_size);
+
+        message_header->size = buffer_size;
+        return OFFSET_POINTER(message_header, MESSAGE_HEADER_SIZE);
+    }
+
+    // The next block is taken. Move the message into a bigger block
+    kb_message_header_t *new_message_header = allocator_alloc_n(arena->allocator, buffer_size + MESSAGE_HEADER_SIZE);
+    if (new_message_header == NULL)
+    {
+        log4c_category_log(transport->logger, LOG4C_PRIORITY_ERROR, "No memory to grow a message in `%s` to %zu bytes", transport->name, buffer_size);
+        return NULL;
+    }
+
+    log_trace(transport->logger, "Message %p moved to %p to grow from %zu to %zu bytes", message_header, new_message_header, message_header->size, buffer_size);
+
+    memcpy(new_message_header, message_header, message_header->size + MESSAGE_HEADER_SIZE);
+    new_message_header->size = buffer_size;
+    allocator_free(arena->allocator, message_header);
+
+    shm_writer->header = new_message_header;
+    return OFFSET_POINTER(new_message_header, MESSAGE_HEADER_SIZE);
+}
+
 int transport_shm_message_send(kb_transport_t *transport, kb_message_writer_t *writer)
+{
+    int result = transport_shm_message_send_deferred(transport, writer);
+    if (result != 0)
+    {
+        return result;
+    }
+
+    // Also delivers previously deferred messages to keep the order
+    return transport_shm_flush(transport);
+}
+
+int transport_shm_message_send_deferred(kb_transport_t *transport, kb_message_writer_t *writer)
 {
     assert(transport != NULL);
     assert(writer != NULL);
@@ -275,42 +431,126 @@ int transport_shm_message_send(kb_transport_t *transport, kb_message_writer_t *w
     kb_message_writer_shm_t *shm_writer = (kb_message_writer_shm_t *)writer;
 
     kb_arena_t *arena = &self->write_arena;
-    kb_arena_header_t *arena_header = arena->header;
 
     // Release extra memory
     kb_message_header_t *message_header = shm_writer->header;
     message_header->size = message_writer_size(writer);
     allocator_trim(arena->allocator, message_header, message_header->size + MESSAGE_HEADER_SIZE);
 
+    if (arena->header->queue_mode == KB_SHM_QUEUE_SPSC_RING && arena_ring_full(arena, self->num_deferred))
+    {
+        log4c_category_log(transport->logger, LOG4C_PRIORITY_ERROR, "Message ring of `%s` is full", transport->name);
+        allocator_free(arena->allocator, message_header);
+        return -1;
+    }
+
     size_t message_offset = transport_message_offset(arena, message_header);
+    message_header->next_message_offset = NULL_OFFSET;
 
-    // Locking here also prevents from reading the mesage list
-    arena_lock(arena);
-    // Append mesage to the messages list
-    size_t last_message_offset = arena_header->last_message_offset;
-    // In case we have a mesage in the buffer, we change it's pointer to point to the incoming message
-    if (last_message_offset != NULL_OFFSET)
+    // Deferred messages are chained locally. The reader doesn't see them until the flush
+    if (self->deferred_last_offset != NULL_OFFSET)
     {
-        kb_message_header_t *last_message = transport_message_from_offset(arena, last_message_offset);
+        kb_message_header_t *last_message = transport_message_from_offset(arena, self->deferred_last_offset);
         last_message->next_message_offset = message_offset;
     }
-    // In case of en empty list, we need to set the first message pointer
-    // The last message pointer will be update after the `if` block
     else
     {
-        // No message in the list means we also need to replace the list head
-        arena_header->first_message_offset = message_offset;
+        self->deferred_first_offset = message_offset;
     }
 
-    atomic_store(&arena_header->last_message_offset, message_offset);
-    arena_unlock(arena);
+    self->deferred_last_offset = message_offset;
+    self->num_deferred++;
+
+    log_trace(transport->logger, "Deferred message offset %zd. Pointer: %p. Size: %zd", message_offset, message_header, message_header->size);
+
+    return 0;
+}
 
-    uint32_t num_mesages = atomic_fetch_add(&arena_header->num_messages, 1);
-    log4c_category_log(transport->logger, LOG4C_PRIORITY_DEBUG, "New shmem message in `%s`: %d messages in the buffer", transport->name, num_mesages + 1);
-    log_trace(transport->logger, "Written message offset %zd. Pointer: %p. Size: %zd", message_offset, message_header, message_header->size);
+int transport_shm_flush(kb_transport_t *transport)
+{
+    assert(transport != NULL);
+
+    kb_transport_shm_t *self = (kb_transport_shm_t *)transport;
+    kb_arena_t *arena = &self->write_arena;
+    kb_arena_header_t *arena_header = arena->header;
+
+    if (self->num_deferred == 0)
+    {
+        return 0;
+    }
+
+    if (arena_header->queue_mode == KB_SHM_QUEUE_SPSC_RING)
+    {
+        arena_ring_push_chain(arena, self->deferred_first_offset, self->num_deferred);
+    }
+    else
+    {
+        // Locking here also prevents from reading the mesage list
+        arena_lock(arena);
+        // Append deferred mesages to the messages list
+        size_t last_message_offset = arena_header->last_message_offset;
+        // In case we have a mesage in the buffer, we change it's pointer to point to the incoming messages
+        if (last_message_offset != NULL_OFFSET)
+        {
+            kb_message_header_t *last_message = transport_message_from_offset(arena, last_message_offset);
+            last_message->next_message_offset = self->deferred_first_offset;
+        }
+        // In case of en empty list, we need to set the first message pointer
+        // The last message pointer will be update after the `if` block
+        else
+        {
+            // No message in the list means we also need to replace the list head
+            arena_header->first_message_offset = self->deferred_first_offset;
+        }
+
+        atomic_store(&arena_header->last_message_offset, self->deferred_last_offset);
+        arena_unlock(arena);
+    }
+
+    uint32_t num_mesages = atomic_fetch_add(&arena_header->num_messages, self->num_deferred);
+    log4c_category_log(transport->logger, LOG4C_PRIORITY_DEBUG, "%zu new shmem messages in `%s`: %zu messages in the buffer",
+                       self->num_deferred, transport->name, num_mesages + self->num_deferred);
     log_trace(transport->logger, "New mesage list: first: %zd, last: %zd", arena_header->first_message_offset, arena_header->last_message_offset);
 
-    event_manager_shm_signal_new_message((kb_event_manager_shm_t *)transport->event_manager);
+    self->deferred_first_offset = NULL_OFFSET;
+    self->deferred_last_offset = NULL_OFFSET;
+    self->num_deferred = 0;
+
+    // The reader sets the flag before it starts waiting on the message counter, and we read it after the
+    // counter update. Either the reader sees new messages, or we see the reader waiting
+    if (atomic_load(&arena_header->receiver_waiting))
+    {
+        event_manager_shm_signal_new_message((kb_event_manager_shm_t *)transport->event_manager);
+    }
+
+    return 0;
+}
+
+void transport_shm_message_cancel(kb_transport_t *transport, kb_message_writer_t *writer)
+{
+    assert(transport != NULL);
+    assert(writer != NULL);
+
+    kb_transport_shm_t *self = (kb_transport_shm_t *)transport;
+    kb_message_writer_shm_t *shm_writer = (kb_message_writer_shm_t *)writer;
+
+    log_trace(transport->logger, "Cancelling message %p", shm_writer->header);
+    allocator_free(self->write_arena.allocator, shm_writer->header);
+}
+
+// Wrap a message taken from the queue. Drops the message if that fails, so its block isn't lost
+static kb_message_t *transport_shm_wrap_message(kb_transport_shm_t *self, kb_message_header_t *incoming_message)
+{
+    kb_message_shm_t *message = message_shm_init(self, incoming_message,
+                                                 OFFSET_POINTER(incoming_message, MESSAGE_HEADER_SIZE));
+    if (message == NULL)
+    {
+        log4c_category_log(self->base.logger, LOG4C_PRIORITY_ERROR, "Dropping shmem message from `%s`", self->base.name);
+        allocator_free(self->read_arena.allocator, incoming_message);
+        return NULL;
+    }
+
+    return &message->base;
 }
 
 kb_message_t *transport_shm_message_receive(kb_transport_t *transport)
@@ -322,6 +562,20 @@ kb_message_t *transport_shm_message_receive(kb_transport_t *transport)
     kb_arena_header_t *arena_header = arena->header;
     log_trace(transport->logger, "READ Arena header data: %zd %zd %zd", arena_header->size, arena_header->first_message_offset, arena_header->last_message_offset);
 
+    if (arena_header->queue_mode == KB_SHM_QUEUE_SPSC_RING)
+    {
+        size_t message_offset = arena_ring_pop(arena);
+        if (message_offset == NULL_OFFSET)
+        {
+            return NULL;
+        }
+
+        uint32_t num_mesages = atomic_fetch_sub(&arena_header->num_messages, 1);
+        log4c_category_log(transport->logger, LOG4C_PRIORITY_DEBUG, "Removed shmem ring message from `%s`: %d messages in the buffer", transport->name, num_mesages - 1);
+
+        return transport_shm_wrap_message(self, transport_message_from_offset(arena, message_offset));
+    }
+
     if (atomic_load(&arena_header->num_messages) == 0)
     {
         return NULL;
@@ -348,10 +602,94 @@ kb_message_t *transport_shm_message_receive(kb_transport_t *transport)
     log4c_category_log(transport->logger, LOG4C_PRIORITY_DEBUG, "Removed shmem message from `%s`: %d messages in the buffer", transport->name, num_mesages - 1);
     log_trace(transport->logger, "New mesage list: first: %zd, last: %zd", arena_header->first_message_offset, arena_header->last_message_offset);
 
-    kb_message_shm_t *message = message_shm_init(self, incoming_message,
-                                                 OFFSET_POINTER(incoming_message, MESSAGE_HEADER_SIZE));
+    return transport_shm_wrap_message(self, incoming_message);
+}
 
-    return &message->base;
+size_t transport_shm_message_receive_batch(kb_transport_t *transport, kb_message_t **messages, size_t max_messages)
+{
+    assert(transport != NULL);
+    assert(messages != NULL);
+
+    kb_transport_shm_t *self = (kb_transport_shm_t *)transport;
+    kb_arena_t *arena = &self->read_arena;
+    kb_arena_header_t *arena_header = arena->header;
+
+    size_t num_received = 0;
+    // Messages taken from the queue. Messages which failed to wrap are dropped
+    size_t num_taken = 0;
+
+    if (arena_header->queue_mode == KB_SHM_QUEUE_SPSC_RING)
+    {
+        while (num_taken < max_messages)
+        {
+            size_t message_offset = arena_ring_pop(arena);
+            if (message_offset == NULL_OFFSET)
+            {
+                break;
+            }
+
+            num_taken++;
+            kb_message_t *message = transport_shm_wrap_message(self, transport_message_from_offset(arena, message_offset));
+            if (message != NULL)
+            {
+                messages[num_received++] = message;
+            }
+        }
+    }
+    else
+    {
+        // A sender increments the counter after linking a message, so the list has at least this many messages
+        size_t num_available = atomic_load(&arena_header->num_messages);
+        size_t num_detached = num_available < max_messages ? num_available : max_messages;
+
+        if (num_detached == 0)
+        {
+            return 0;
+        }
+
+        arena_lock(arena);
+
+        // Find the last message to take and cut the list after it
+        size_t first_message_offset = arena_header->first_message_offset;
+        kb_message_header_t *last_message = transport_message_from_offset(arena, first_message_offset);
+        for (size_t i = 1; i < num_detached; i++)
+        {
+            last_message = transport_message_from_offset(arena, last_message->next_message_offset);
+        }
+
+        arena_header->first_message_offset = last_message->next_message_offset;
+        if (arena_header->first_message_offset == NULL_OFFSET)
+        {
+            // The whole list is taken. Also nullify the last mesage offset
+            arena_header->last_message_offset = NULL_OFFSET;
+        }
+
+        arena_unlock(arena);
+
+        // The detached messages are not reachable by the sender anymore
+        kb_message_header_t *incoming_message = transport_message_from_offset(arena, first_message_offset);
+        for (; num_taken < num_detached; num_taken++)
+        {
+            size_t next_message_offset = incoming_message->next_message_offset;
+
+            kb_message_t *message = transport_shm_wrap_message(self, incoming_message);
+            if (message != NULL)
+            {
+                messages[num_received++] = message;
+            }
+
+            incoming_message = transport_message_from_offset(arena, next_message_offset);
+        }
+    }
+
+    if (num_taken > 0)
+    {
+        uint32_t num_mesages = atomic_fetch_sub(&arena_header->num_messages, num_taken);
+        log4c_category_log(transport->logger, LOG4C_PRIORITY_DEBUG, "Removed %zu shmem messages from `%s`: %zu messages in the buffer",
+                           num_taken, transport->name, num_mesages - num_taken);
+    }
+
+    return num_received;
 }
 
 int transport_shm_message_release(kb_transport_t *transport, kb_message_t *message)
@@ -387,8 +725,7 @@ void transport_shm_destroy(kb_transport_t *transport)
     kb_allocator_t *read_allocator = self->read_arena.allocator;
     if (read_allocator != NULL)
     {
-        munmap(OFFSET_POINTER(read_allocator->header, -ARENA_HEADER_SIZE),
-               read_allocator->header->total_size + ARENA_HEADER_SIZE);
+        munmap(self->read_arena.header, self->read_arena.header->size + ARENA_HEADER_SIZE);
         close(self->read_arena.shm_fd);
         allocator_destroy(read_allocator);
     }
@@ -396,12 +733,25 @@ void transport_shm_destroy(kb_transport_t *transport)
     kb_allocator_t *write_allocator = self->write_arena.allocator;
     if (write_allocator != NULL)
     {
-        munmap(OFFSET_POINTER(write_allocator->header, -ARENA_HEADER_SIZE),
-               write_allocator->header->total_size + ARENA_HEADER_SIZE);
+        munmap(self->write_arena.header, self->write_arena.header->size + ARENA_HEADER_SIZE);
         close(self->write_arena.shm_fd);
         allocator_destroy(write_allocator);
     }
 
+    while (self->free_writers != NULL)
+    {
+        kb_message_writer_shm_t *writer = self->free_writers;
+        self->free_writers = writer->next_free;
+        message_writer_shm_destroy(writer);
+    }
+
+    while (self->free_messages != NULL)
+    {
+        kb_message_shm_t *message = self->free_messages;
+        self->free_messages = message->next_free;
+        message_shm_destroy(message);
+    }
+
     event_manager_shm_destroy((kb_event_manager_shm_t *)transport->event_manager);
 
     free(transport);
@@ -1,28 +1,54 @@
 #pragma once
 
 #include <semaphore.h>
+#include <stdalign.h>
 #include <stdatomic.h>
 
 #include "../transport.h"
 #include "event_manager_shm.h"
 #include "allocator.h"
+#include "common.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Number of message slots in the SPSC ring. Must be a power of two
+#ifndef SHM_RING_CAPACITY
+#define SHM_RING_CAPACITY 256
+#endif
+
 struct kb_message_writer_shm_s;
+struct kb_message_shm_s;
+
+/**
+ * @brief Message queue implementation used by an arena
+ */
+enum kb_shm_queue_mode_e
+{
+    KB_SHM_QUEUE_LIST = 0,     // Offset-linked list protected by the arena futex
+    KB_SHM_QUEUE_SPSC_RING = 1 // Lock-free single-producer/single-consumer ring of offsets
+};
+
+typedef enum kb_shm_queue_mode_e kb_shm_queue_mode_t;
 
 /**
  * @brief Arena header structure at the beginning of the shared memory region
  */
 struct kb_arena_header_s
 {
-    size_t size;                 // Total size of the arena
-    uint32_t num_messages;       // Number of messages in the arena
-    uint32_t futex;              // Futex for synchronization
-    size_t first_message_offset; // Offset of the first message in the arena
-    size_t last_message_offset;  // Offset of the last message in the arena
+    size_t size;                     // Total size of the arena
+    uint32_t num_messages;           // Number of messages in the arena
+    uint32_t receiver_waiting;       // Non-zero while the reader is parked on `num_messages`
+    uint32_t futex;                  // Futex for synchronization
+    size_t first_message_offset;     // Offset of the first message in the arena
+    size_t last_message_offset;      // Offset of the last message in the arena
+    kb_shm_queue_mode_t queue_mode;  // Message queue implementation
+
+    // Ring indices live on separate cache lines, so the writer and the reader don't invalidate each other's lines
+    alignas(CACHE_LINE_SIZE) size_t ring_head; // Next slot to read. Written by the consumer only
+    alignas(CACHE_LINE_SIZE) size_t ring_tail; // Next slot to write. Written by the producer only
+    alignas(CACHE_LINE_SIZE) size_t ring[SHM_RING_CAPACITY]; // Message offsets
 };
 
 typedef struct kb_arena_header_s kb_arena_header_t;
@@ -35,6 +61,7 @@ struct kb_arena_s
     kb_arena_header_t *header; // Header for the shared memory region
     kb_allocator_t *allocator; // Memory allocator for the arena
     int shm_fd;                // Shared memory file descriptor
+    size_t cached_ring_index;  // Local copy of the peer's ring index to avoid touching its cache line
 };
 
 typedef struct kb_arena_s kb_arena_t;
@@ -59,6 +86,16 @@ struct kb_transport_shm_s
     kb_arena_t read_arena;   // Arena for reading messages
     kb_arena_t write_arena;  // Arena for writing messages
     size_t max_message_size; // Maximum message size for this transport
+
+    // Messages sent with `message_send_deferred` and not yet visible to the reader
+    size_t deferred_first_offset; // Offset of the first deferred message
+    size_t deferred_last_offset;  // Offset of the last deferred message
+    size_t num_deferred;          // Number of deferred messages
+
+    // Released objects kept for reuse, so sending and receiving don't allocate in a steady state.
+    // Not thread-safe, like the rest of the transport
+    struct kb_message_writer_shm_s *free_writers; // Message writers pool
+    struct kb_message_shm_s *free_messages;       // Received messages pool
 };
 
 typedef struct kb_transport_shm_s kb_transport_shm_t;
@@ -73,6 +110,19 @@ typedef struct kb_transport_shm_s kb_transport_shm_t;
  */
 int transport_shm_create_mapping(const char *name, size_t buffer_size, log4c_category_t *logger);
 
+/**
+ * @brief Create a new shared memory mapping with a specific message queue implementation.
+ *        The SPSC ring mode requires exactly one writing and one reading transport for the mapping
+ *
+ * @param name Name of the shared memory segment
+ * @param buffer_size Size of the shared memory segment
+ * @param queue_mode Message queue implementation
+ * @param logger Logger for debugging
+ * @return File descriptor for the shared memory segment, or -1 on error
+ */
+int transport_shm_create_mapping_with_mode(const char *name, size_t buffer_size,
+                                           kb_shm_queue_mode_t queue_mode, log4c_category_t *logger);
+
 /**
  * @brief Get the size of an existing shared memory mapping from the memory header
  *
@@ -122,6 +172,26 @@ size_t transport_message_offset(kb_arena_t *arena, kb_message_header_t *message_
  */
 kb_message_writer_t* transport_shm_message_init(kb_transport_t *transport);
 
+/**
+ * @brief Initialize a new message for writing, reserving only the expected size
+ *
+ * @param transport Transport to use for sending the message
+ * @param size_hint Expected message size. The message grows if it doesn't fit
+ * @return Message writer or NULL on failure
+ */
+kb_message_writer_t *transport_shm_message_init_sized(kb_transport_t *transport, size_t size_hint);
+
+/**
+ * @brief Grow the buffer of a message being written.
+ *        Takes the next adjacent free block if possible, moves the message otherwise
+ *
+ * @param transport Transport used for sending the message
+ * @param writer Message writer to grow
+ * @param size New buffer size
+ * @return New message buffer or NULL on failure
+ */
+uint8_t *transport_shm_message_grow(kb_transport_t *transport, kb_message_writer_t *writer, size_t size);
+
 /**
  * @brief Send a message through the transport
  *
@@ -131,6 +201,33 @@ kb_message_writer_t* transport_shm_message_init(kb_transport_t *transport);
  */
 int transport_shm_message_send(kb_transport_t *transport, kb_message_writer_t *writer);
 
+/**
+ * @brief Queue a message without making it visible to the reader.
+ *        Deferred messages are delivered by the next flush or send
+ *
+ * @param transport Transport to use for sending the message
+ * @param writer Message writer containing the message to send
+ * @return 0 on success, negative error code on failure
+ */
+int transport_shm_message_send_deferred(kb_transport_t *transport, kb_message_writer_t *writer);
+
+/**
+ * @brief Deliver all deferred messages to the reader.
+ *        Wakes the reader once and only if it's waiting for messages
+ *
+ * @param transport Transport to flush
+ * @return 0 on success, negative error code on failure
+ */
+int transport_shm_flush(kb_transport_t *transport);
+
+/**
+ * @brief Cancel a message being written and release its arena memory
+ *
+ * @param transport Transport the message was initialized with
+ * @param writer Message writer to cancel
+ */
+void transport_shm_message_cancel(kb_transport_t *transport, kb_message_writer_t *writer);
+
 /**
  * @brief Receive a message from the transport
  *
@@ -139,6 +236,17 @@ int transport_shm_message_send(kb_transport_t *transport, kb_message_writer_t *w
  */
 kb_message_t *transport_shm_message_receive(kb_transport_t *transport);
 
+/**
+ * @brief Receive all available messages up to a limit.
+ *        Detaches the messages from the arena with a single lock acquisition
+ *
+ * @param transport Transport to receive the messages from
+ * @param messages Array to put received messages into
+ * @param max_messages Size of the array
+ * @return Number of received messages
+ */
+size_t transport_shm_message_receive_batch(kb_transport_t *transport, kb_message_t **messages, size_t max_messages);
+
 /**
  * @brief Release a received message back to the transport
  *
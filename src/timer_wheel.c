@@ -0,0 +1,242 @@
+#include "timer_wheel.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#define SLOT_MASK (KB_TIMER_WHEEL_SLOTS - 1)
+
+// Number of ticks covered by the levels below `level`
+static uint64_t level_span(size_t level)
+{
+    return 1ull << (KB_TIMER_WHEEL_SLOT_BITS * level);
+}
+
+bool timer_wheel_init(kb_timer_wheel_t *wheel, size_t capacity, log4c_category_t *logger)
+{
+    assert(wheel != NULL);
+
+    wheel->logger = logger;
+    wheel->nodes = NULL;
+    wheel->capacity = 0;
+    wheel->armed_count = 0;
+    wheel->now = 0;
+
+    for (size_t i = 0; i < KB_TIMER_WHEEL_LEVELS * KB_TIMER_WHEEL_SLOTS; i++)
+    {
+        wheel->heads[i] = KB_TIMER_NONE;
+    }
+
+    return timer_wheel_reserve(wheel, capacity);
+}
+
+void timer_wheel_deinit(kb_timer_wheel_t *wheel)
+{
+    assert(wheel != NULL);
+
+    free(wheel->nodes);
+    wheel->nodes = NULL;
+    wheel->capacity = 0;
+    wheel->armed_count = 0;
+}
+
+bool timer_wheel_reserve(kb_timer_wheel_t *wheel, size_t capacity)
+{
+    assert(wheel != NULL);
+
+    if (capacity <= wheel->capacity)
+    {
+        return true;
+    }
+
+    kb_timer_node_t *nodes = realloc(wheel->nodes, capacity * sizeof(kb_timer_node_t));
+    if (nodes == NULL)
+    {
+        log4c_category_log(wheel->logger, LOG4C_PRIORITY_ERROR, "Failed to allocate memory for timers");
+        return false;
+    }
+
+    for (size_t i = wheel->capacity; i < capacity; i++)
+    {
+        nodes[i].armed = false;
+    }
+
+    wheel->nodes = nodes;
+    wheel->capacity = capacity;
+    return true;
+}
+
+static void timer_wheel_link(kb_timer_wheel_t *wheel, uint32_t index, uint16_t slot)
+{
+    kb_timer_node_t *node = &wheel->nodes[index];
+    node->slot = slot;
+    node->prev = KB_TIMER_NONE;
+    node->next = wheel->heads[slot];
+    if (node->next != KB_TIMER_NONE)
+    {
+        wheel->nodes[node->next].prev = index;
+    }
+
+    wheel->heads[slot] = index;
+}
+
+static void timer_wheel_unlink(kb_timer_wheel_t *wheel, uint32_t index)
+{
+    kb_timer_node_t *node = &wheel->nodes[index];
+    if (node->prev != KB_TIMER_NONE)
+    {
+        wheel->nodes[node->prev].next = node->next;
+    }
+    else
+    {
+        wheel->heads[node->slot] = node->next;
+    }
+
+    if (node->next != KB_TIMER_NONE)
+    {
+        wheel->nodes[node->next].prev = node->prev;
+    }
+}
+
+// Put the timer into the slot of `tick`. The level is picked by the distance from the current tick
+static void timer_wheel_place(kb_timer_wheel_t *wheel, uint32_t index, uint64_t tick)
+{
+    assert(tick >= wheel->now);
+
+    uint64_t delta = tick - wheel->now;
+    size_t level = 0;
+    while (level < KB_TIMER_WHEEL_LEVELS - 1 && delta >= level_span(level + 1))
+    {
+        level++;
+    }
+
+    // Too far away. Wait in the farthest slot and get placed again on cascade
+    if (delta >= level_span(KB_TIMER_WHEEL_LEVELS))
+    {
+        tick = wheel->now + level_span(KB_TIMER_WHEEL_LEVELS) - 1;
+    }
+
+    size_t slot = (tick >> (KB_TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK;
+    timer_wheel_link(wheel, index, (uint16_t)(level * KB_TIMER_WHEEL_SLOTS + slot));
+}
+
+void timer_wheel_arm(kb_timer_wheel_t *wheel, uint32_t index, uint64_t expires, uint64_t now)
+{
+    assert(wheel != NULL);
+    assert(index < wheel->capacity);
+    assert(!wheel->nodes[index].armed);
+
+    // Nothing to process in between
+    if (wheel->armed_count == 0 && now > wheel->now)
+    {
+        wheel->now = now;
+    }
+
+    kb_timer_node_t *node = &wheel->nodes[index];
+    node->expires = expires;
+    node->armed = true;
+    wheel->armed_count++;
+
+    // The current tick is processed already
+    timer_wheel_place(wheel, index, expires > wheel->now ? expires : wheel->now + 1);
+}
+
+void timer_wheel_cancel(kb_timer_wheel_t *wheel, uint32_t index)
+{
+    assert(wheel != NULL);
+    assert(index < wheel->capacity);
+
+    if (!wheel->nodes[index].armed)
+    {
+        return;
+    }
+
+    timer_wheel_unlink(wheel, index);
+    wheel->nodes[index].armed = false;
+    wheel->armed_count--;
+}
+
+uint64_t timer_wheel_next_expiry(const kb_timer_wheel_t *wheel)
+{
+    assert(wheel != NULL);
+
+    if (wheel->armed_count == 0)
+    {
+        return UINT64_MAX;
+    }
+
+    uint64_t next = UINT64_MAX;
+    for (size_t level = 0; level < KB_TIMER_WHEEL_LEVELS; level++)
+    {
+        size_t shift = KB_TIMER_WHEEL_SLOT_BITS * level;
+        for (uint64_t i = 1; i <= KB_TIMER_WHEEL_SLOTS; i++)
+        {
+            // Level 0 slots fire at their tick, higher level slots cascade at the start of their span
+            uint64_t tick = ((wheel->now >> shift) + i) << shift;
+            if (tick >= next)
+            {
+                break;
+            }
+
+            if (wheel->heads[level * KB_TIMER_WHEEL_SLOTS + ((tick >> shift) & SLOT_MASK)] != KB_TIMER_NONE)
+            {
+                next = tick;
+                break;
+            }
+        }
+    }
+
+    return next;
+}
+
+// Move the timers of a higher level slot closer to the current tick
+static void timer_wheel_cascade(kb_timer_wheel_t *wheel, size_t level)
+{
+    uint16_t slot = (uint16_t)(level * KB_TIMER_WHEEL_SLOTS + ((wheel->now >> (KB_TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK));
+
+    uint32_t index = wheel->heads[slot];
+    wheel->heads[slot] = KB_TIMER_NONE;
+
+    while (index != KB_TIMER_NONE)
+    {
+        uint32_t next = wheel->nodes[index].next;
+        uint64_t expires = wheel->nodes[index].expires;
+        timer_wheel_place(wheel, index, expires > wheel->now ? expires : wheel->now);
+        index = next;
+    }
+}
+
+size_t timer_wheel_advance(kb_timer_wheel_t *wheel, uint64_t now, void (*on_expired)(uint32_t index, void *context), void *context)
+{
+    assert(wheel != NULL);
+    assert(on_expired != NULL);
+
+    size_t expired = 0;
+    while (wheel->now < now)
+    {
+        uint64_t next = timer_wheel_next_expiry(wheel);
+        if (next > now)
+        {
+            wheel->now = now;
+            break;
+        }
+
+        wheel->now = next;
+
+        for (size_t level = 1; level < KB_TIMER_WHEEL_LEVELS && (next & (level_span(level) - 1)) == 0; level++)
+        {
+            timer_wheel_cascade(wheel, level);
+        }
+
+        // Callbacks can't put timers into the current slot, so the loop ends
+        uint16_t slot = next & SLOT_MASK;
+        while (wheel->heads[slot] != KB_TIMER_NONE)
+        {
+            uint32_t index = wheel->heads[slot];
+            timer_wheel_cancel(wheel, index);
+            on_expired(index, context);
+            expired++;
+        }
+    }
+
+    return expired;
+}
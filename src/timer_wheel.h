@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <log4c/category.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Slots per level
+#define KB_TIMER_WHEEL_SLOT_BITS 6
+#define KB_TIMER_WHEEL_SLOTS (1 << KB_TIMER_WHEEL_SLOT_BITS)
+// Levels of the wheel. Four levels of 64 slots cover 2^24 ticks. Later timers wait in the last level
+#define KB_TIMER_WHEEL_LEVELS 4
+// No timer index
+#define KB_TIMER_NONE UINT32_MAX
+
+/**
+ * @brief Timer wheel node. Nodes are linked by indices, so the node array may be reallocated
+ */
+struct kb_timer_node_s
+{
+    uint64_t expires; // Expiration tick
+    uint32_t next;    // Next node in the slot
+    uint32_t prev;    // Previous node in the slot
+    uint16_t slot;    // Slot index in the wheel, including the level
+    bool armed;       // The timer is in the wheel
+};
+
+typedef struct kb_timer_node_s kb_timer_node_t;
+
+/**
+ * @brief Hierarchical timer wheel with O(1) arm and cancel.
+ *        Timers are identified by their index in the node array
+ */
+struct kb_timer_wheel_s
+{
+    kb_timer_node_t *nodes;                                          // Timer nodes
+    size_t capacity;                                                 // Number of nodes
+    size_t armed_count;                                              // Number of armed timers
+    uint64_t now;                                                    // Last processed tick
+    uint32_t heads[KB_TIMER_WHEEL_LEVELS * KB_TIMER_WHEEL_SLOTS];    // First node of each slot
+    log4c_category_t *logger;
+};
+
+typedef struct kb_timer_wheel_s kb_timer_wheel_t;
+
+/**
+ * @brief Initialize a timer wheel
+ *
+ * @param wheel Timer wheel
+ * @param capacity Number of timers
+ * @param logger Logger
+ * @return true on success, false if failed to allocate memory
+ */
+bool timer_wheel_init(kb_timer_wheel_t *wheel, size_t capacity, log4c_category_t *logger);
+
+/**
+ * @brief Free the wheel memory
+ *
+ * @param wheel Timer wheel
+ */
+void timer_wheel_deinit(kb_timer_wheel_t *wheel);
+
+/**
+ * @brief Grow the node array. Armed timers stay armed
+ *
+ * @param wheel Timer wheel
+ * @param capacity New number of timers
+ * @return true on success, false if failed to allocate memory
+ */
+bool timer_wheel_reserve(kb_timer_wheel_t *wheel, size_t capacity);
+
+/**
+ * @brief Arm a timer. Timers which are already due fire on the next tick
+ *
+ * @param wheel Timer wheel
+ * @param index Timer index. Must not be armed
+ * @param expires Expiration tick
+ * @param now Current tick. Used only to catch up an empty wheel
+ */
+void timer_wheel_arm(kb_timer_wheel_t *wheel, uint32_t index, uint64_t expires, uint64_t now);
+
+/**
+ * @brief Cancel a timer if it's armed
+ *
+ * @param wheel Timer wheel
+ * @param index Timer index
+ */
+void timer_wheel_cancel(kb_timer_wheel_t *wheel, uint32_t index);
+
+/**
+ * @brief Get the next tick at which the wheel has work: a timer expiration or a cascade of a non-empty slot
+ *
+ * @param wheel Timer wheel
+ * @return Tick or UINT64_MAX if no timers are armed
+ */
+uint64_t timer_wheel_next_expiry(const kb_timer_wheel_t *wheel);
+
+/**
+ * @brief Process ticks up to `now` and fire expired timers. Skips ticks without work.
+ *        Timers are disarmed before their callback, which may arm and cancel timers and grow the wheel
+ *
+ * @param wheel Timer wheel
+ * @param now Current tick
+ * @param on_expired Callback for each expired timer
+ * @param context User context for callback
+ * @return Number of expired timers
+ */
+size_t timer_wheel_advance(kb_timer_wheel_t *wheel, uint64_t now, void (*on_expired)(uint32_t index, void *context), void *context);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -26,6 +26,14 @@ struct kb_transport_s
      */
     kb_message_writer_t *(*message_init)(struct kb_transport_s *transport);
 
+    /**
+     * @brief Initialize a new message for writing with an expected size. Optional
+     * @param transport Transport to use for sending the message
+     * @param size_hint Expected message size. The message grows if it doesn't fit
+     * @return Initialized message writer or NULL on failure
+     */
+    kb_message_writer_t *(*message_init_sized)(struct kb_transport_s *transport, size_t size_hint);
+
     /**
      * @brief Receive a message from the transport
      * @param transport Transport to receive the message from
@@ -33,6 +41,22 @@ struct kb_transport_s
      */
     kb_message_t *(*message_receive)(struct kb_transport_s *transport);
 
+    /**
+     * @brief Receive all available messages up to a limit. Optional
+     * @param transport Transport to receive the messages from
+     * @param messages Array to put received messages into
+     * @param max_messages Size of the array
+     * @return Number of received messages
+     */
+    size_t (*message_receive_batch)(struct kb_transport_s *transport, kb_message_t **messages, size_t max_messages);
+
+    /**
+     * @brief Deliver deferred messages and notify the receiver once. Optional
+     * @param transport Transport to flush
+     * @return 0 on success, non-zero on failure
+     */
+    int (*flush)(struct kb_transport_s *transport);
+
     /**
      * @brief Destroy the transport and release all resources
      * @param transport Transport to destroy
@@ -53,6 +77,24 @@ inline kb_message_writer_t *transport_message_init(kb_transport_t *transport)
     return transport->message_init(transport);
 }
 
+/**
+ * @brief Initialize a new message for writing with an expected size.
+ *        Transports without sized messages reserve the maximum message size
+ *
+ * @param transport Transport to use for sending the message
+ * @param size_hint Expected message size
+ * @return Initialized message writer or NULL on failure
+ */
+inline kb_message_writer_t *transport_message_init_sized(kb_transport_t *transport, size_t size_hint)
+{
+    if (transport->message_init_sized == NULL)
+    {
+        return transport->message_init(transport);
+    }
+
+    return transport->message_init_sized(transport, size_hint);
+}
+
 /**
  * @brief Get the event manager for the transport
  *
@@ -75,6 +117,53 @@ inline kb_message_t *transport_message_receive(kb_transport_t *transport)
     return transport->message_receive(transport);
 }
 
+/**
+ * @brief Receive all available messages up to a limit.
+ *        Transports without batched receive get the messages one by one
+ *
+ * @param transport Transport to receive the messages from
+ * @param messages Array to put received messages into
+ * @param max_messages Size of the array
+ * @return Number of received messages
+ */
+inline size_t transport_message_receive_batch(kb_transport_t *transport, kb_message_t **messages, size_t max_messages)
+{
+    if (transport->message_receive_batch != NULL)
+    {
+        return transport->message_receive_batch(transport, messages, max_messages);
+    }
+
+    size_t num_messages = 0;
+    while (num_messages < max_messages)
+    {
+        kb_message_t *message = transport->message_receive(transport);
+        if (message == NULL)
+        {
+            break;
+        }
+
+        messages[num_messages++] = message;
+    }
+
+    return num_messages;
+}
+
+/**
+ * @brief Deliver messages queued with `message_send_deferred` and notify the receiver once
+ *
+ * @param transport Transport to flush
+ * @return 0 on success, non-zero on failure
+ */
+inline int transport_flush(kb_transport_t *transport)
+{
+    if (transport->flush == NULL)
+    {
+        return 0;
+    }
+
+    return transport->flush(transport);
+}
+
 /**
  * @brief Destroy the transport and release all resources
  *
@@ -2,13 +2,62 @@
 
 #include <assert.h>
 #include <linux/futex.h>
+#include <poll.h>
+#include <stdatomic.h>
 
 #include <liburing.h>
 #include <log4c.h>
 
 #include "transport_uds.h"
 
+// Buffer group ids must be unique within a ring, so each manager takes its own
+static atomic_uint next_buffer_group = 0;
+
 kb_event_manager_uds_t *event_manager_uds_create(struct kb_transport_uds_s *transport, struct io_uring *ring, log4c_category_t *logger)
+{
+    return event_manager_uds_create_with_buffer_ring(transport, ring, 0, 0, logger);
+}
+
+// Register provided buffers with the ring and give all of them to the kernel
+static bool event_manager_uds_setup_buffer_ring(kb_event_manager_uds_t *manager, unsigned int num_buffers, size_t buffer_size)
+{
+    assert((num_buffers & (num_buffers - 1)) == 0);
+    assert(buffer_size > 0);
+
+    manager->num_buffers = num_buffers;
+    manager->buffer_size = buffer_size;
+    manager->buffer_group = (uint16_t)atomic_fetch_add(&next_buffer_group, 1);
+
+    manager->buffers = malloc(num_buffers * buffer_size);
+    manager->buffer_refs = calloc(num_buffers, sizeof(uint32_t));
+    if (manager->buffers == NULL || manager->buffer_refs == NULL)
+    {
+        log4c_category_log(manager->base.logger, LOG4C_PRIORITY_ERROR, "malloc failed");
+        return false;
+    }
+
+    int ret;
+    manager->buf_ring = io_uring_setup_buf_ring(manager->base.ring, num_buffers, manager->buffer_group, 0, &ret);
+    if (manager->buf_ring == NULL)
+    {
+        log4c_category_log(manager->base.logger, LOG4C_PRIORITY_ERROR, "io_uring_setup_buf_ring failed: %s", strerror(-ret));
+        return false;
+    }
+
+    int mask = io_uring_buf_ring_mask(num_buffers);
+    for (unsigned int i = 0; i < num_buffers; i++)
+    {
+        io_uring_buf_ring_add(manager->buf_ring, manager->buffers + i * buffer_size, buffer_size, i, mask, i);
+    }
+
+    io_uring_buf_ring_advance(manager->buf_ring, num_buffers);
+
+    return true;
+}
+
+kb_event_manager_uds_t *event_manager_uds_create_with_buffer_ring(struct kb_transport_uds_s *transport, struct io_uring *ring,
+                                                                  unsigned int num_buffers, size_t buffer_size,
+                                                                  log4c_category_t *logger)
 {
     assert(transport != NULL);
     assert(ring != NULL);
@@ -24,6 +73,7 @@ kb_event_manager_uds_t *event_manager_uds_create(struct kb_transport_uds_s *tran
     manager->base.ring = ring;
     manager->base.logger = logger;
     manager->base.handle_event = event_manager_uds_handle_event;
+    manager->base.handle_event_batch = event_manager_uds_handle_event_batch;
 
     manager->read_event.manager = (kb_event_manager_t *)manager;
     manager->read_event.event_type = KB_UDS_EVENT_READABLE;
@@ -31,7 +81,30 @@ kb_event_manager_uds_t *event_manager_uds_create(struct kb_transport_uds_s *tran
     manager->write_event.manager = (kb_event_manager_t *)manager;
     manager->write_event.event_type = KB_UDS_EVENT_WRITEABLE;
 
-    event_manager_uds_wait_readable(manager);
+    manager->pending_event.manager = (kb_event_manager_t *)manager;
+    manager->pending_event.event_type = KB_UDS_EVENT_READABLE;
+    manager->read_scheduled = false;
+
+    manager->buf_ring = NULL;
+    manager->buffers = NULL;
+    manager->buffer_refs = NULL;
+    manager->num_buffers = 0;
+    manager->buffer_size = 0;
+    manager->recv_stalled = false;
+
+    if (num_buffers == 0)
+    {
+        event_manager_uds_wait_readable(manager);
+        return manager;
+    }
+
+    if (!event_manager_uds_setup_buffer_ring(manager, num_buffers, buffer_size))
+    {
+        event_manager_uds_destroy(manager);
+        return NULL;
+    }
+
+    event_manager_uds_recv_multishot(manager);
 
     return manager;
 }
@@ -40,10 +113,14 @@ void event_manager_uds_destroy(kb_event_manager_uds_t *manager)
 {
     assert(manager != NULL);
 
-    if (manager)
+    if (manager->buf_ring != NULL)
     {
-        free(manager);
+        io_uring_free_buf_ring(manager->base.ring, manager->buf_ring, manager->num_buffers, manager->buffer_group);
     }
+
+    free(manager->buffers);
+    free(manager->buffer_refs);
+    free(manager);
 }
 
 void event_manager_uds_wait_readable(kb_event_manager_uds_t *manager)
@@ -57,7 +134,15 @@ void event_manager_uds_wait_readable(kb_event_manager_uds_t *manager)
 
     kb_transport_uds_t *transport = (kb_transport_uds_t *)manager->base.transport;
 
-    io_uring_prep_recv(sqe, transport->sock_fd, NULL, 0, 0);
+    // Zero-length reads take a whole datagram away
+    if (transport->seqpacket)
+    {
+        io_uring_prep_poll_add(sqe, transport->sock_fd, POLLIN);
+    }
+    else
+    {
+        io_uring_prep_recv(sqe, transport->sock_fd, NULL, 0, 0);
+    }
 
     int ret = io_uring_submit(ring);
     if (ret < 0)
@@ -66,6 +151,161 @@ void event_manager_uds_wait_readable(kb_event_manager_uds_t *manager)
     }
 }
 
+void event_manager_uds_schedule_read(kb_event_manager_uds_t *manager)
+{
+    assert(manager != NULL);
+
+    if (manager->read_scheduled)
+    {
+        return;
+    }
+
+    struct io_uring *ring = manager->base.ring;
+    struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+
+    io_uring_sqe_set_data(sqe, &manager->pending_event);
+    io_uring_prep_nop(sqe);
+    manager->read_scheduled = true;
+
+    int ret = io_uring_submit(ring);
+    if (ret < 0)
+    {
+        log4c_category_log(manager->base.logger, LOG4C_PRIORITY_ERROR, "io_uring nop submit error: %s", strerror(-ret));
+    }
+}
+
+void event_manager_uds_recv_multishot(kb_event_manager_uds_t *manager)
+{
+    assert(manager != NULL);
+    assert(manager->buf_ring != NULL);
+
+    struct io_uring *ring = manager->base.ring;
+    struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+
+    io_uring_sqe_set_data(sqe, &manager->read_event);
+
+    kb_transport_uds_t *transport = (kb_transport_uds_t *)manager->base.transport;
+
+    // The kernel picks a buffer from the group for each chunk of data
+    io_uring_prep_recv_multishot(sqe, transport->sock_fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = manager->buffer_group;
+
+    manager->recv_stalled = false;
+
+    int ret = io_uring_submit(ring);
+    if (ret < 0)
+    {
+        log4c_category_log(manager->base.logger, LOG4C_PRIORITY_ERROR, "io_uring multishot recv submit error: %s", strerror(-ret));
+    }
+}
+
+char *event_manager_uds_buffer_data(kb_event_manager_uds_t *manager, uint16_t buffer_id)
+{
+    assert(manager != NULL);
+    assert(buffer_id < manager->num_buffers);
+
+    return manager->buffers + buffer_id * manager->buffer_size;
+}
+
+void event_manager_uds_buffer_ref(kb_event_manager_uds_t *manager, uint16_t buffer_id)
+{
+    assert(manager != NULL);
+    assert(buffer_id < manager->num_buffers);
+
+    manager->buffer_refs[buffer_id]++;
+}
+
+void event_manager_uds_buffer_unref(kb_event_manager_uds_t *manager, uint16_t buffer_id)
+{
+    assert(manager != NULL);
+    assert(buffer_id < manager->num_buffers);
+    assert(manager->buffer_refs[buffer_id] > 0);
+
+    if (--manager->buffer_refs[buffer_id] > 0)
+    {
+        return;
+    }
+
+    io_uring_buf_ring_add(manager->buf_ring, event_manager_uds_buffer_data(manager, buffer_id), manager->buffer_size,
+                          buffer_id, io_uring_buf_ring_mask(manager->num_buffers), 0);
+    io_uring_buf_ring_advance(manager->buf_ring, 1);
+
+    // The receive ran out of buffers before. Now there's one
+    if (manager->recv_stalled)
+    {
+        event_manager_uds_recv_multishot(manager);
+    }
+}
+
+// Pass a chunk received into a provided buffer to the transport and keep the receive going
+static void event_manager_uds_handle_buffer(kb_event_manager_uds_t *manager, struct io_uring_cqe *cqe)
+{
+    if (cqe->flags & IORING_CQE_F_BUFFER)
+    {
+        uint16_t buffer_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+        if (cqe->res > 0)
+        {
+            transport_uds_push_buffer(manager->base.transport, buffer_id, cqe->res);
+        }
+        else
+        {
+            // Not used. Give it back right away
+            event_manager_uds_buffer_ref(manager, buffer_id);
+            event_manager_uds_buffer_unref(manager, buffer_id);
+        }
+    }
+
+    if (cqe->flags & IORING_CQE_F_MORE)
+    {
+        return;
+    }
+
+    // The multishot receive has stopped
+    if (cqe->res > 0 || cqe->res == -EINTR)
+    {
+        event_manager_uds_recv_multishot(manager);
+    }
+    else if (cqe->res == -ENOBUFS)
+    {
+        // All buffers are held by the messages. Restarted when a buffer is released
+        log4c_category_log(manager->base.logger, LOG4C_PRIORITY_DEBUG, "No free receive buffers for `%s`", manager->base.transport->name);
+        manager->recv_stalled = true;
+    }
+    else if (cqe->res == 0)
+    {
+        log4c_category_log(manager->base.logger, LOG4C_PRIORITY_DEBUG, "Peer of `%s` closed the connection", manager->base.transport->name);
+        ((kb_transport_uds_t *)manager->base.transport)->disconnected = true;
+    }
+    else
+    {
+        log4c_category_log(manager->base.logger, LOG4C_PRIORITY_ERROR, "io_uring multishot recv error: %s", strerror(-cqe->res));
+    }
+}
+
+void event_manager_uds_send_zerocopy(kb_event_manager_uds_t *manager, kb_event_t *event, struct msghdr *msg)
+{
+    assert(manager != NULL);
+    assert(event != NULL);
+    assert(msg != NULL);
+
+    struct io_uring *ring = manager->base.ring;
+    struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+
+    io_uring_sqe_set_data(sqe, event);
+
+    kb_transport_uds_t *transport = (kb_transport_uds_t *)manager->base.transport;
+
+    io_uring_prep_sendmsg_zc(sqe, transport->sock_fd, msg, 0);
+
+    int ret = io_uring_submit(ring);
+    if (ret < 0)
+    {
+        log4c_category_log(manager->base.logger, LOG4C_PRIORITY_ERROR, "io_uring zero-copy send submit error: %s", strerror(-ret));
+    }
+}
+
 void event_manager_uds_wait_writeable(kb_event_manager_uds_t *manager)
 {
     assert(manager != NULL);
@@ -77,7 +317,15 @@ void event_manager_uds_wait_writeable(kb_event_manager_uds_t *manager)
 
     kb_transport_uds_t *transport = (kb_transport_uds_t *)manager->base.transport;
 
-    io_uring_prep_send(sqe, transport->sock_fd, NULL, 0, 0);
+    // Zero-length writes send an empty datagram
+    if (transport->seqpacket)
+    {
+        io_uring_prep_poll_add(sqe, transport->sock_fd, POLLOUT);
+    }
+    else
+    {
+        io_uring_prep_send(sqe, transport->sock_fd, NULL, 0, 0);
+    }
 
     int ret = io_uring_submit(ring);
     if (ret < 0)
@@ -86,37 +334,110 @@ void event_manager_uds_wait_writeable(kb_event_manager_uds_t *manager)
     }
 }
 
-kb_message_t *event_manager_uds_handle_event(struct io_uring_cqe *cqe)
+// Write buffered messages and wait for the socket if some are left
+static void event_manager_uds_write(kb_event_manager_uds_t *manager)
 {
-    assert(cqe != NULL);
+    kb_transport_uds_t *transport = (kb_transport_uds_t *)manager->base.transport;
 
-    kb_event_t *event = (kb_event_t *)io_uring_cqe_get_data(cqe);
+    // A zero-copy send completion continues writing instead
+    if (transport_uds_write_messages(&transport->base) > 0 && !transport->zerocopy_in_flight)
+    {
+        event_manager_uds_wait_writeable(manager);
+    }
+}
 
-    kb_event_manager_uds_t *self = (kb_event_manager_uds_t *)event->manager;
+// Receive up to `max_messages` after a read completion and schedule the next read
+static size_t event_manager_uds_handle_readable(kb_event_manager_uds_t *self, kb_event_t *event, struct io_uring_cqe *cqe,
+                                                kb_message_t **messages, size_t max_messages)
+{
+    kb_transport_t *transport = self->base.transport;
+    kb_transport_uds_t *uds_transport = (kb_transport_uds_t *)transport;
 
-    if (event->event_type == KB_UDS_EVENT_READABLE)
+    if (event == &self->pending_event)
+    {
+        self->read_scheduled = false;
+    }
+    else if (self->buf_ring != NULL)
+    {
+        event_manager_uds_handle_buffer(self, cqe);
+    }
+    else if (cqe->res == -EINTR || cqe->res == -EAGAIN)
     {
         event_manager_uds_wait_readable(self);
+        return 0;
+    }
 
-        if (cqe->res == EINTR || cqe->res == EAGAIN)
-        {
-            return NULL;
-        }
-        return transport_uds_message_receive(event->manager->transport);
+    size_t num_messages = transport_uds_message_receive_batch(transport, messages, max_messages);
+
+    // The socket may be drained while the buffer still has messages. Get back here without waiting for data
+    if (transport_uds_has_buffered_message(transport))
+    {
+        event_manager_uds_schedule_read(self);
     }
-    else if (event->event_type == KB_UDS_EVENT_WRITEABLE)
+    else if (self->buf_ring == NULL && !self->read_scheduled && !uds_transport->receive_stalled && !uds_transport->disconnected)
     {
-        if (cqe->res == EINTR || cqe->res == EAGAIN)
+        // Provided buffers are filled by the multishot receive, which keeps running.
+        // A stalled receive is resumed when a message is released
+        event_manager_uds_wait_readable(self);
+    }
+
+    return num_messages;
+}
+
+// Handle a completion of a non-read event
+static void event_manager_uds_handle_other(kb_event_manager_uds_t *self, kb_event_t *event, struct io_uring_cqe *cqe)
+{
+    if (event->event_type == KB_UDS_EVENT_WRITEABLE)
+    {
+        if (cqe->res == -EINTR || cqe->res == -EAGAIN)
         {
             event_manager_uds_wait_writeable(self);
-            return NULL;
+            return;
         }
 
-        if (transport_uds_write_messages(event->manager->transport) > 0)
+        event_manager_uds_write(self);
+    }
+    else if (event->event_type == KB_UDS_EVENT_SEND_ZC)
+    {
+        // A full socket waits until it's writeable. The manager may be freed with a destroyed transport
+        if (transport_uds_complete_zerocopy(event->manager->transport, event, cqe) == 0)
         {
-            event_manager_uds_wait_writeable(self);
+            event_manager_uds_write(self);
         }
+    }
+}
 
-        return NULL;
+kb_message_t *event_manager_uds_handle_event(struct io_uring_cqe *cqe)
+{
+    assert(cqe != NULL);
+
+    kb_event_t *event = (kb_event_t *)io_uring_cqe_get_data(cqe);
+    kb_event_manager_uds_t *self = (kb_event_manager_uds_t *)event->manager;
+
+    if (event->event_type == KB_UDS_EVENT_READABLE)
+    {
+        kb_message_t *message = NULL;
+        event_manager_uds_handle_readable(self, event, cqe, &message, 1);
+        return message;
     }
-}
\ No newline at end of file
+
+    event_manager_uds_handle_other(self, event, cqe);
+    return NULL;
+}
+
+size_t event_manager_uds_handle_event_batch(struct io_uring_cqe *cqe, kb_message_t **messages, size_t max_messages)
+{
+    assert(cqe != NULL);
+    assert(messages != NULL);
+
+    kb_event_t *event = (kb_event_t *)io_uring_cqe_get_data(cqe);
+    kb_event_manager_uds_t *self = (kb_event_manager_uds_t *)event->manager;
+
+    if (event->event_type == KB_UDS_EVENT_READABLE)
+    {
+        return event_manager_uds_handle_readable(self, event, cqe, messages, max_messages);
+    }
+
+    event_manager_uds_handle_other(self, event, cqe);
+    return 0;
+}
@@ -10,6 +10,8 @@ extern "C" {
 struct kb_transport_uds_s;
 struct io_uring;
 struct io_uring_cqe;
+struct io_uring_buf_ring;
+struct msghdr;
 
 /**
  * @brief Unix Domain Socket implementation of the event manager
@@ -18,8 +20,19 @@ struct kb_event_manager_uds_s
 {
     kb_event_manager_t base; // Base event manager interface
 
-    kb_event_t read_event;  // Event triggered when data is available to read
-    kb_event_t write_event; // Event triggered when buffer is available to write
+    kb_event_t read_event;    // Event triggered when data is available to read
+    kb_event_t write_event;   // Event triggered when buffer is available to write
+    kb_event_t pending_event; // Event posted when the transport has buffered messages left
+    bool read_scheduled;      // Whether the pending event is posted and not handled yet
+
+    // Provided buffers for the multishot receive. Not used if `buf_ring` is NULL
+    struct io_uring_buf_ring *buf_ring; // Ring of free buffers the kernel picks from
+    char *buffers;                      // Memory of all buffers
+    uint32_t *buffer_refs;              // Number of users of each buffer. Zero means the buffer is in the ring
+    unsigned int num_buffers;           // Number of buffers. Power of two
+    size_t buffer_size;                 // Size of each buffer
+    uint16_t buffer_group;              // Buffer group id of the ring
+    bool recv_stalled;                  // Whether the receive stopped because all buffers are in use
 };
 
 typedef struct kb_event_manager_uds_s kb_event_manager_uds_t;
@@ -34,6 +47,21 @@ typedef struct kb_event_manager_uds_s kb_event_manager_uds_t;
  */
 kb_event_manager_uds_t *event_manager_uds_create(struct kb_transport_uds_s *transport, struct io_uring *ring, log4c_category_t *logger);
 
+/**
+ * @brief Create a UDS event manager, which receives data with a multishot receive into provided buffers.
+ *        The kernel reads the socket into a free buffer, so there is no readiness round-trip
+ *
+ * @param transport Transport used for message passing
+ * @param ring IO_URING instance for asynchronous operations
+ * @param num_buffers Number of provided buffers. Must be a power of two. Zero disables provided buffers
+ * @param buffer_size Size of each provided buffer
+ * @param logger Logger for debugging
+ * @return Initialized event manager or NULL on failure
+ */
+kb_event_manager_uds_t *event_manager_uds_create_with_buffer_ring(struct kb_transport_uds_s *transport, struct io_uring *ring,
+                                                                  unsigned int num_buffers, size_t buffer_size,
+                                                                  log4c_category_t *logger);
+
 /**
  * @brief Destroy a UDS event manager and release all resources
  *
@@ -48,6 +76,55 @@ void event_manager_uds_destroy(kb_event_manager_uds_t *manager);
  */
 void event_manager_uds_wait_readable(kb_event_manager_uds_t *manager);
 
+/**
+ * @brief Post a readable event right away, without waiting for the socket.
+ *        Used when the transport has buffered messages left after a read
+ *
+ * @param manager Event manager to post the event to
+ */
+void event_manager_uds_schedule_read(kb_event_manager_uds_t *manager);
+
+/**
+ * @brief Start a multishot receive into the provided buffers
+ *
+ * @param manager Event manager to receive with
+ */
+void event_manager_uds_recv_multishot(kb_event_manager_uds_t *manager);
+
+/**
+ * @brief Get the memory of a provided buffer
+ *
+ * @param manager Event manager owning the buffer
+ * @param buffer_id Buffer id
+ * @return Pointer to the buffer memory
+ */
+char *event_manager_uds_buffer_data(kb_event_manager_uds_t *manager, uint16_t buffer_id);
+
+/**
+ * @brief Add a user to a provided buffer. The buffer is not given back to the kernel while it has users
+ *
+ * @param manager Event manager owning the buffer
+ * @param buffer_id Buffer id
+ */
+void event_manager_uds_buffer_ref(kb_event_manager_uds_t *manager, uint16_t buffer_id);
+
+/**
+ * @brief Remove a user from a provided buffer. The last user gives the buffer back to the kernel
+ *
+ * @param manager Event manager owning the buffer
+ * @param buffer_id Buffer id
+ */
+void event_manager_uds_buffer_unref(kb_event_manager_uds_t *manager, uint16_t buffer_id);
+
+/**
+ * @brief Send a message without copying its data into the socket buffer
+ *
+ * @param manager Event manager to send with
+ * @param event Completion tag of the send
+ * @param msg Message to send. Must live until the send completes
+ */
+void event_manager_uds_send_zerocopy(kb_event_manager_uds_t *manager, kb_event_t *event, struct msghdr *msg);
+
 /**
  * @brief Wait for socket to become writeable
  *
@@ -63,6 +140,16 @@ void event_manager_uds_wait_writeable(kb_event_manager_uds_t *manager);
  */
 kb_message_t *event_manager_uds_handle_event(struct io_uring_cqe *cqe);
 
+/**
+ * @brief Handle a completion event and retrieve all available messages up to a limit
+ *
+ * @param cqe Completion queue event from io_uring
+ * @param messages Array to put received messages into
+ * @param max_messages Size of the array
+ * @return Number of received messages
+ */
+size_t event_manager_uds_handle_event_batch(struct io_uring_cqe *cqe, kb_message_t **messages, size_t max_messages);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -1,6 +1,7 @@
 #include "message_uds.h"
 
 #include <assert.h>
+#include <stdalign.h>
 
 kb_message_uds_t *message_uds_init(kb_transport_uds_t *transport,
                                    char *buffer,
@@ -10,10 +11,21 @@ kb_message_uds_t *message_uds_init(kb_transport_uds_t *transport,
     assert(buffer != NULL);
     assert(size > 0);
 
-    kb_message_uds_t *message = malloc(sizeof(kb_message_uds_t));
+    // BSON documents may require extra alignment
+    kb_message_uds_t *message = aligned_alloc(alignof(kb_message_uds_t), sizeof(kb_message_uds_t));
+    if (message == NULL)
+    {
+        log4c_category_log(transport->base.logger, LOG4C_PRIORITY_ERROR, "Failed to allocate message");
+        return NULL;
+    }
+
     message->transport = transport;
+    message->buffer_id = -1;
+    message->receive_data = NULL;
+    message->mapping = NULL;
+    message->mapping_size = 0;
 
-    message_init(&message->base, buffer, size);
+    message_init_static(&message->base, &message->document, (uint8_t *)buffer, size);
     message->base.destroy = message_uds_clean;
 
     return message;
@@ -14,6 +14,11 @@ struct kb_message_uds_s
 {
     kb_message_t base;             // Base message interface
     kb_transport_uds_t *transport; // Transport that provided the message
+    int32_t buffer_id;             // Provided buffer the message points into, or -1 for the receive buffer
+    char *receive_data;            // Receive buffer, or its datagram slot, the message points into, if `buffer_id` is -1
+    void *mapping;                 // Memfd mapping the message points into, or NULL
+    size_t mapping_size;           // Size of the mapping
+    bson_t document;               // Message document storage
 };
 
 typedef struct kb_message_uds_s kb_message_uds_t;
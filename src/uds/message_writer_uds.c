@@ -1,6 +1,18 @@
 #include "message_writer_uds.h"
 
 #include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Return the writer to the transport pool
+static void message_writer_uds_release(kb_message_writer_uds_t *writer)
+{
+    kb_transport_uds_t *transport = writer->transport;
+
+    writer->next_free = transport->free_writers;
+    transport->free_writers = writer;
+}
 
 kb_message_writer_uds_t *message_writer_uds_init(kb_transport_uds_t *transport,
                                                  char *buffer,
@@ -10,16 +22,157 @@ kb_message_writer_uds_t *message_writer_uds_init(kb_transport_uds_t *transport,
     assert(buffer != NULL);
     assert(buffer_size > 0);
 
-    kb_message_writer_uds_t *writer = malloc(sizeof(kb_message_writer_uds_t));
-    writer->transport = transport;
+    kb_message_writer_uds_t *writer = transport->free_writers;
+    if (writer != NULL)
+    {
+        // Pooled writers keep their document writer
+        transport->free_writers = writer->next_free;
+        message_writer_reset(&writer->base, (uint8_t *)buffer, buffer_size);
+    }
+    else
+    {
+        writer = malloc(sizeof(kb_message_writer_uds_t));
+        if (writer == NULL)
+        {
+            log4c_category_log(transport->base.logger, LOG4C_PRIORITY_ERROR, "Failed to allocate message writer");
+            return NULL;
+        }
+
+        writer->transport = transport;
+
+        message_writer_init(&writer->base, (uint8_t *)buffer, buffer_size, transport->base.logger);
+        writer->base.send = message_writer_uds_send;
+        writer->base.cancel = message_writer_uds_cancel;
+    }
 
-    message_writer_init(&writer->base, buffer, buffer_size, transport->base.logger);
-    writer->base.send = message_writer_uds_send;
-    writer->base.cancel = message_writer_uds_cancel;
+    writer->base.grow = NULL;
+    writer->memfd = -1;
+    writer->mapping_size = 0;
+    writer->memfd_size = 0;
+    writer->next_free = NULL;
 
     return writer;
 }
 
+void message_writer_uds_destroy(kb_message_writer_uds_t *writer)
+{
+    assert(writer != NULL);
+
+    message_writer_deinit(&writer->base);
+    free(writer);
+}
+
+// Grow the memfd and its mapping. The mapping may move
+static uint8_t *message_writer_uds_grow(kb_message_writer_t *writer, size_t new_size)
+{
+    kb_message_writer_uds_t *self = (kb_message_writer_uds_t *)writer;
+
+    if (ftruncate(self->memfd, new_size) == -1)
+    {
+        log4c_category_log(writer->logger, LOG4C_PRIORITY_ERROR, "ftruncate failed: %s", strerror(errno));
+        return NULL;
+    }
+
+    void *buffer = mremap(writer->buffer, self->mapping_size, new_size, MREMAP_MAYMOVE);
+    if (buffer == MAP_FAILED)
+    {
+        log4c_category_log(writer->logger, LOG4C_PRIORITY_ERROR, "mremap failed: %s", strerror(errno));
+        return NULL;
+    }
+
+    self->mapping_size = new_size;
+    return buffer;
+}
+
+kb_message_writer_uds_t *message_writer_uds_init_memfd(kb_transport_uds_t *transport, size_t size)
+{
+    assert(transport != NULL);
+    assert(size > 0);
+
+    log4c_category_t *logger = transport->base.logger;
+
+    int fd = memfd_create(transport->base.name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1)
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "memfd_create failed: %s", strerror(errno));
+        return NULL;
+    }
+
+    if (ftruncate(fd, size) == -1)
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "ftruncate failed: %s", strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    void *buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (buffer == MAP_FAILED)
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "mmap failed: %s", strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    kb_message_writer_uds_t *writer = message_writer_uds_init(transport, buffer, size);
+    if (writer == NULL)
+    {
+        munmap(buffer, size);
+        close(fd);
+        return NULL;
+    }
+
+    writer->memfd = fd;
+    writer->mapping_size = size;
+    writer->base.grow = message_writer_uds_grow;
+
+    return writer;
+}
+
+int message_writer_uds_seal(kb_message_writer_uds_t *writer)
+{
+    assert(writer != NULL);
+    assert(writer->memfd >= 0);
+
+    log4c_category_t *logger = writer->base.logger;
+
+    // Write seal fails while there are writable mappings
+    writer->memfd_size = message_writer_size(&writer->base);
+    munmap(writer->base.buffer, writer->mapping_size);
+    writer->base.buffer = NULL;
+    writer->mapping_size = 0;
+
+    if (ftruncate(writer->memfd, writer->memfd_size) == -1)
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "ftruncate failed: %s", strerror(errno));
+        return -1;
+    }
+
+    if (fcntl(writer->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1)
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Failed to seal memfd: %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+// Release the message buffer, which wasn't taken by the transport
+static void message_writer_uds_free_buffer(kb_message_writer_uds_t *writer)
+{
+    if (writer->memfd < 0)
+    {
+        transport_uds_release_payload(writer->transport, (char *)writer->base.buffer);
+        return;
+    }
+
+    if (writer->base.buffer != NULL)
+    {
+        munmap(writer->base.buffer, writer->mapping_size);
+    }
+
+    close(writer->memfd);
+}
+
 int message_writer_uds_send(kb_message_writer_t *writer)
 {
     if (writer == NULL)
@@ -29,14 +182,27 @@ int message_writer_uds_send(kb_message_writer_t *writer)
 
     kb_message_writer_uds_t *self = (kb_message_writer_uds_t *)writer;
 
-    transport_uds_message_send(&self->transport->base, writer);
-    free(writer);
+    // The peer maps the memfd, so it must not change after sending
+    int result = self->memfd >= 0 ? message_writer_uds_seal(self) : 0;
 
-    return 0;
+    // The transport takes the buffer, so only the document writer is released
+    if (result == 0)
+    {
+        result = transport_uds_message_send(&self->transport->base, writer);
+    }
+
+    if (result != 0)
+    {
+        message_writer_uds_free_buffer(self);
+    }
+
+    message_writer_uds_release(self);
+
+    return result;
 }
 
 void message_writer_uds_cancel(kb_message_writer_t *writer)
 {
-    free(writer->buffer);
-    free(writer);
+    message_writer_uds_free_buffer((kb_message_writer_uds_t *)writer);
+    message_writer_uds_release((kb_message_writer_uds_t *)writer);
 }
\ No newline at end of file
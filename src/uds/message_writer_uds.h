@@ -14,6 +14,10 @@ struct kb_message_writer_uds_s
 {
     kb_message_writer_t base;      // Base message writer interface
     kb_transport_uds_t *transport; // Transport used for sending the message
+    int memfd;                     // Memfd holding the buffer, or -1 if the buffer is allocated on the heap
+    size_t mapping_size;           // Size of the memfd mapping
+    size_t memfd_size;             // Size of the sealed payload in the memfd
+    struct kb_message_writer_uds_s *next_free; // Next writer in the transport pool
 };
 
 typedef struct kb_message_writer_uds_s kb_message_writer_uds_t;
@@ -30,6 +34,31 @@ kb_message_writer_uds_t *message_writer_uds_init(kb_transport_uds_t *transport,
                                                  char *buffer,
                                                  size_t buffer_size);
 
+/**
+ * @brief Destroy a pooled message writer
+ *
+ * @param writer Message writer to destroy
+ */
+void message_writer_uds_destroy(kb_message_writer_uds_t *writer);
+
+/**
+ * @brief Initialize a UDS message writer, which writes the message right into a memfd.
+ *        The descriptor is passed to the peer instead of the message data
+ *
+ * @param transport Transport to use for sending the message
+ * @param size Initial size of the memfd
+ * @return Initialized message writer or NULL on failure
+ */
+kb_message_writer_uds_t *message_writer_uds_init_memfd(kb_transport_uds_t *transport, size_t size);
+
+/**
+ * @brief Unmap the memfd of a writer and seal it, so the peer can map it safely
+ *
+ * @param writer Message writer with a memfd buffer
+ * @return 0 on success, negative error code on failure
+ */
+int message_writer_uds_seal(kb_message_writer_uds_t *writer);
+
 /**
  * @brief Send a message through the UDS transport
  *
@@ -1,55 +1,199 @@
 #include "transport_uds.h"
 
 #include <assert.h>
+#include <stddef.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
 
-#include <utlist.h>
+#include <liburing.h>
 
 #include "message_writer_uds.h"
 #include "message_uds.h"
 
 static uint8_t MAGIC = 0x42;
+// Frame without inline data. The data is in a memfd passed with the header
+static uint8_t MAGIC_MEMFD = 0x43;
+
+// Maximum number of buffers gathered into a single `sendmsg`. Each message takes two: a header and data
+#define MAX_SEND_IOVECS 64
+
+// Maximum number of datagrams sent with a single `sendmmsg` on SEQPACKET sockets
+#define MAX_SEND_DATAGRAMS 32
 
 kb_transport_t *transport_uds_init(const char *name, int fd, size_t max_message_size, size_t max_buffered_messages,
                                    struct io_uring *ring, log4c_category_t *logger)
+{
+    return transport_uds_init_with_buffer_ring(name, fd, max_message_size, max_buffered_messages, 0, 0, ring, logger);
+}
+
+// Release memory owned by the transport. Unallocated parts are NULL
+static void transport_uds_free(kb_transport_uds_t *self)
+{
+    if (self->base.name != NULL)
+    {
+        free((char *)self->base.name);
+    }
+
+    while (self->free_writers != NULL)
+    {
+        kb_message_writer_uds_t *writer = self->free_writers;
+        self->free_writers = writer->next_free;
+        message_writer_uds_destroy(writer);
+    }
+
+    free(self->out_messages);
+    free(self->payloads);
+    free(self->payload_states);
+    free(self->free_payloads);
+    free(self->in_buffer.data);
+    free(self->chunks);
+    free(self->free_slots);
+
+    while (self->retired_buffers != NULL)
+    {
+        retired_buffer_t *retired = self->retired_buffers;
+        self->retired_buffers = retired->next;
+        free(retired->data);
+        free(retired);
+    }
+
+    free(self);
+}
+
+kb_transport_t *transport_uds_init_with_buffer_ring(const char *name, int fd, size_t max_message_size, size_t max_buffered_messages,
+                                                    unsigned int num_buffers, size_t buffer_size,
+                                                    struct io_uring *ring, log4c_category_t *logger)
 {
     assert(name != NULL);
     assert(ring != NULL);
     assert(logger != NULL);
+    assert(max_buffered_messages > 0);
 
-    kb_transport_uds_t *transport = malloc(sizeof(kb_transport_uds_t));
+    kb_transport_uds_t *transport = calloc(1, sizeof(kb_transport_uds_t));
     if (transport == NULL)
     {
         log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "malloc failed");
         return NULL;
     }
 
-    transport->out_messages = NULL;
+    transport->out_head = 0;
     transport->out_message_count = 0;
     transport->max_message_size = max_message_size;
     transport->max_buffered_messages = max_buffered_messages;
+    transport->free_writers = NULL;
+    transport->zerocopy_threshold = UDS_ZEROCOPY_THRESHOLD;
+    transport->zerocopy_in_flight = false;
+    transport->destroyed = false;
+    transport->memfd_threshold = UDS_MEMFD_THRESHOLD;
+    transport->received_fds_head = 0;
+    transport->num_received_fds = 0;
+    transport->datagrams_head = 0;
+    transport->num_datagrams = 0;
+    transport->free_slots = NULL;
+    transport->num_free_slots = 0;
+    transport->slot_size = 0;
+    transport->seqpacket = false;
     transport->sock_fd = fd;
-    transport->in_message.data = NULL;
+
+    // Every queued message takes one payload buffer, so the queue never runs out of them
+    transport->out_messages = malloc(max_buffered_messages * sizeof(out_messages_t));
+    transport->payloads = malloc(max_buffered_messages * max_message_size);
+    transport->payload_states = malloc(max_buffered_messages * sizeof(payload_state_t));
+    transport->free_payloads = malloc(max_buffered_messages * sizeof(size_t));
+
+    // Fits at least two frames of the maximum size
+    size_t frame_size = max_message_size + sizeof(message_header_t);
+    transport->in_buffer.data_size = 2 * frame_size > UDS_RECEIVE_BUFFER_SIZE ? 2 * frame_size : UDS_RECEIVE_BUFFER_SIZE;
+    transport->in_buffer.data = malloc(transport->in_buffer.data_size);
+    transport->in_buffer.read_offset = 0;
+    transport->in_buffer.write_offset = 0;
+    transport->in_buffer.num_held = 0;
+    transport->retired_buffers = NULL;
+    transport->receive_stalled = false;
+    transport->disconnected = false;
+
+    // Each provided buffer takes at most one slot
+    transport->chunks = num_buffers > 0 ? malloc(num_buffers * sizeof(received_chunk_t)) : NULL;
+    transport->chunks_head = 0;
+    transport->num_chunks = 0;
+    transport->max_chunks = num_buffers;
+
+    if (transport->out_messages == NULL || transport->payloads == NULL || transport->payload_states == NULL ||
+        transport->free_payloads == NULL || transport->in_buffer.data == NULL || (num_buffers > 0 && transport->chunks == NULL))
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "malloc failed");
+        transport_uds_free(transport);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < max_buffered_messages; i++)
+    {
+        transport->payload_states[i].zerocopy_event.event_type = KB_UDS_EVENT_SEND_ZC;
+        transport->payload_states[i].pending_notifications = 0;
+        transport->payload_states[i].queued = false;
+
+        // Lower buffers go first
+        transport->free_payloads[i] = max_buffered_messages - i - 1;
+    }
+
+    transport->num_free_payloads = max_buffered_messages;
 
     transport->base.name = strdup(name);
     transport->base.logger = logger;
     transport->base.message_init = transport_uds_message_init;
+    transport->base.message_init_sized = transport_uds_message_init_sized;
     transport->base.message_receive = transport_uds_message_receive;
+    transport->base.message_receive_batch = transport_uds_message_receive_batch;
+    transport->base.flush = NULL;
     transport->base.destroy = transport_uds_destroy;
 
-    kb_event_manager_uds_t *event_manager = event_manager_uds_create(transport, ring, logger);
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    // Datagrams keep message boundaries, so no framing is needed
+    int socket_type = 0;
+    socklen_t option_size = sizeof(socket_type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &socket_type, &option_size) == 0)
+    {
+        transport->seqpacket = socket_type == SOCK_SEQPACKET;
+    }
+
+    // Datagrams are received into slots of the maximum message size. Lower slots go first
+    if (transport->seqpacket)
+    {
+        transport->slot_size = max_message_size > sizeof(message_header_t) ? max_message_size : sizeof(message_header_t);
+        transport->num_free_slots = transport->in_buffer.data_size / transport->slot_size;
+        transport->free_slots = malloc(transport->num_free_slots * sizeof(size_t));
+        if (transport->free_slots == NULL)
+        {
+            log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "malloc failed");
+            transport_uds_free(transport);
+            return NULL;
+        }
+
+        for (size_t i = 0; i < transport->num_free_slots; i++)
+        {
+            transport->free_slots[i] = transport->num_free_slots - i - 1;
+        }
+    }
+
+    kb_event_manager_uds_t *event_manager = event_manager_uds_create_with_buffer_ring(transport, ring, num_buffers, buffer_size, logger);
     if (event_manager == NULL)
     {
-        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "malloc failed");
-        transport_uds_destroy((kb_transport_t *)transport);
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Failed to create UDS event manager");
+        transport_uds_free(transport);
         return NULL;
     }
     transport->base.event_manager = (kb_event_manager_t *)event_manager;
 
-    int flags = fcntl(fd, F_GETFL);
-    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    for (size_t i = 0; i < max_buffered_messages; i++)
+    {
+        transport->payload_states[i].zerocopy_event.manager = transport->base.event_manager;
+    }
 
     log4c_category_log(logger, LOG4C_PRIORITY_DEBUG, "UDS transport `%s` initialized", name);
 
@@ -62,23 +206,76 @@ kb_message_writer_t *transport_uds_message_init(kb_transport_t *transport)
 
     kb_transport_uds_t *self = (kb_transport_uds_t *)transport;
 
-    if (self->out_message_count >= self->max_buffered_messages)
+    // All payloads are either queued or being written
+    if (self->num_free_payloads == 0)
     {
         return NULL;
     }
 
-    char *buffer = malloc(self->max_message_size);
-    if (!buffer)
+    size_t index = self->free_payloads[--self->num_free_payloads];
+    char *buffer = self->payloads + index * self->max_message_size;
+
+    kb_message_writer_uds_t *writer = message_writer_uds_init(self, buffer, self->max_message_size);
+    if (writer == NULL)
     {
-        log4c_category_log(transport->logger, LOG4C_PRIORITY_ERROR, "malloc failed");
+        transport_uds_release_payload(self, buffer);
         return NULL;
     }
 
-    kb_message_writer_uds_t *writer = message_writer_uds_init(self, buffer, self->max_message_size);
+    return &writer->base;
+}
+
+static size_t transport_uds_payload_index(kb_transport_uds_t *self, char *payload)
+{
+    assert(payload >= self->payloads && payload < self->payloads + self->max_buffered_messages * self->max_message_size);
+
+    return (payload - self->payloads) / self->max_message_size;
+}
+
+void transport_uds_release_payload(kb_transport_uds_t *transport, char *payload)
+{
+    assert(transport != NULL);
+    assert(payload != NULL);
+
+    size_t index = transport_uds_payload_index(transport, payload);
+    assert(!transport->payload_states[index].queued);
+
+    transport->free_payloads[transport->num_free_payloads++] = index;
+}
+
+kb_message_writer_t *transport_uds_message_init_sized(kb_transport_t *transport, size_t size_hint)
+{
+    assert(transport != NULL);
+
+    kb_transport_uds_t *self = (kb_transport_uds_t *)transport;
+
+    if (self->memfd_threshold == 0 || size_hint < self->memfd_threshold)
+    {
+        return transport_uds_message_init(transport);
+    }
+
+    if (self->out_message_count >= self->max_buffered_messages)
+    {
+        return NULL;
+    }
+
+    kb_message_writer_uds_t *writer = message_writer_uds_init_memfd(self, size_hint);
+    if (writer == NULL)
+    {
+        return NULL;
+    }
 
     return &writer->base;
 }
 
+void transport_uds_set_memfd_threshold(kb_transport_t *transport, size_t threshold)
+{
+    assert(transport != NULL);
+
+    kb_transport_uds_t *self = (kb_transport_uds_t *)transport;
+    self->memfd_threshold = threshold;
+}
+
 int transport_uds_message_send(kb_transport_t *transport, kb_message_writer_t *writer)
 {
     assert(transport != NULL);
@@ -87,21 +284,38 @@ int transport_uds_message_send(kb_transport_t *transport, kb_message_writer_t *w
     kb_transport_uds_t *self = (kb_transport_uds_t *)transport;
     kb_message_writer_uds_t *writer_uds = (kb_message_writer_uds_t *)writer;
 
-    size_t message_size = message_writer_size(writer);
-    char *data = writer->buffer;
+    // Sealed memfd is unmapped already
+    size_t message_size = writer_uds->memfd >= 0 ? writer_uds->memfd_size : message_writer_size(writer);
+
+    // Memfd messages don't take a payload buffer, so they may find the queue full
+    if (self->out_message_count == self->max_buffered_messages)
+    {
+        log4c_category_log(transport->logger, LOG4C_PRIORITY_ERROR, "Outgoing queue of `%s` is full", transport->name);
+        return -1;
+    }
 
-    // Shrink message to fre some extra memory
-    data = realloc(data, message_size);
-    out_messages_t *out_message = malloc(sizeof(out_messages_t));
-    out_message->prev = NULL;
-    out_message->next = NULL;
+    out_messages_t *out_message = &self->out_messages[(self->out_head + self->out_message_count) % self->max_buffered_messages];
 
-    out_message->message.data = data;
+    // The queue takes the writer buffer as is
+    out_message->header.magic = MAGIC;
+    out_message->header.data_len = message_size;
+    out_message->message.data = (char *)writer->buffer;
     out_message->message.data_size = message_size;
     out_message->message.current_offset = 0;
-    out_message->message.header_sent = false;
+    out_message->fd = writer_uds->memfd;
 
-    DL_APPEND(self->out_messages, out_message);
+    // Only the header goes through the socket. The peer maps the data
+    if (writer_uds->memfd >= 0)
+    {
+        out_message->header.magic = MAGIC_MEMFD;
+        out_message->header.data_len = writer_uds->memfd_size;
+        out_message->message.data = NULL;
+        out_message->message.data_size = 0;
+    }
+    else
+    {
+        self->payload_states[transport_uds_payload_index(self, out_message->message.data)].queued = true;
+    }
 
     if (self->out_message_count == 0)
     {
@@ -110,161 +324,1179 @@ int transport_uds_message_send(kb_transport_t *transport, kb_message_writer_t *w
 
     self->out_message_count++;
     log4c_category_log(transport->logger, LOG4C_PRIORITY_DEBUG, "New uds message in `%s`: %zu messages in the buffer", transport->name, self->out_message_count);
+
+    return 0;
 }
 
-int transport_uds_write_messages(kb_transport_t *transport)
+// Remove the oldest message from the queue. The payload is kept while the kernel may still read it
+static void transport_uds_dequeue(kb_transport_uds_t *self)
 {
-    assert(transport != NULL);
-
-    kb_transport_uds_t *self = (kb_transport_uds_t *)transport;
+    assert(self->out_message_count > 0);
 
-    out_messages_t *out_message, *tmp;
-    ssize_t bytes_sent = 0;
+    out_messages_t *out_message = &self->out_messages[self->out_head];
+    self->out_head = (self->out_head + 1) % self->max_buffered_messages;
+    self->out_message_count--;
 
-    DL_FOREACH_SAFE(self->out_messages, out_message, tmp)
+    if (out_message->fd >= 0)
     {
-        if (!out_message->message.header_sent)
-        {
-            message_header_t header = {.magic = MAGIC, .data_len = out_message->message.data_size};
-            bytes_sent = send(self->sock_fd, &header, sizeof(header), 0);
-
-            if (bytes_sent == -1)
-            {
-                log4c_category_log(transport->logger, LOG4C_PRIORITY_ERROR, "send failed: %s", strerror(errno));
-                return -1;
-            }
-
-            out_message->message.header_sent = true;
-        }
+        close(out_message->fd);
+    }
 
-        bytes_sent = send(self->sock_fd, out_message->message.data, out_message->message.data_size, 0);
+    if (out_message->message.data != NULL)
+    {
+        payload_state_t *state = &self->payload_states[transport_uds_payload_index(self, out_message->message.data)];
+        state->queued = false;
 
-        if (bytes_sent == -1)
+        if (state->pending_notifications == 0)
         {
-            log4c_category_log(transport->logger, LOG4C_PRIORITY_ERROR, "send failed: %s", strerror(errno));
-            return -1;
+            transport_uds_release_payload(self, out_message->message.data);
         }
+    }
+}
 
-        if (bytes_sent < out_message->message.data_size)
-        {
-            out_message->message.data += bytes_sent;
-            out_message->message.data_size -= bytes_sent;
-            return self->out_message_count;
-        }
+// Fill I/O vectors with the unsent part of a message frame. Returns the number of used vectors
+static size_t out_message_fill_iovecs(out_messages_t *out_message, struct iovec *iovecs)
+{
+    size_t num_iovecs = 0;
+    size_t offset = out_message->message.current_offset;
 
-        DL_DELETE(self->out_messages, out_message);
-        free(out_message->message.data);
-        free(out_message);
-        self->out_message_count--;
+    if (offset < sizeof(message_header_t))
+    {
+        iovecs[num_iovecs].iov_base = (char *)&out_message->header + offset;
+        iovecs[num_iovecs].iov_len = sizeof(message_header_t) - offset;
+        num_iovecs++;
 
-        log4c_category_log(transport->logger, LOG4C_PRIORITY_DEBUG, "Message send from `%s`: %zu messages in the buffer", transport->name, self->out_message_count);
+        offset = 0;
+    }
+    else
+    {
+        offset -= sizeof(message_header_t);
     }
 
-    return self->out_message_count;
+    iovecs[num_iovecs].iov_base = out_message->message.data + offset;
+    iovecs[num_iovecs].iov_len = out_message->message.data_size - offset;
+    num_iovecs++;
+
+    return num_iovecs;
 }
 
-kb_message_t *transport_uds_message_receive(kb_transport_t *transport)
+void transport_uds_set_zerocopy_threshold(kb_transport_t *transport, size_t threshold)
 {
     assert(transport != NULL);
 
     kb_transport_uds_t *self = (kb_transport_uds_t *)transport;
+    self->zerocopy_threshold = threshold;
+}
+
+static bool transport_uds_is_zerocopy(kb_transport_uds_t *self, out_messages_t *out_message)
+{
+    return self->zerocopy_threshold > 0 && out_message->message.data_size >= self->zerocopy_threshold;
+}
+
+// Remove a completely sent message from the queue
+static void transport_uds_message_sent(kb_transport_uds_t *self)
+{
+    transport_uds_dequeue(self);
+
+    log4c_category_log(self->base.logger, LOG4C_PRIORITY_DEBUG, "Message send from `%s`: %zu messages in the buffer", self->base.name, self->out_message_count);
+}
+
+// Submit the unsent part of a message frame as a zero-copy send
+static void transport_uds_send_zerocopy(kb_transport_uds_t *self, out_messages_t *out_message)
+{
+    size_t num_iovecs = out_message_fill_iovecs(out_message, self->zerocopy_iovecs);
 
-    // Receiving a new message
-    if (self->in_message.data == NULL)
+    memset(&self->zerocopy_msg, 0, sizeof(struct msghdr));
+    self->zerocopy_msg.msg_iov = self->zerocopy_iovecs;
+    self->zerocopy_msg.msg_iovlen = num_iovecs;
+
+    payload_state_t *state = &self->payload_states[transport_uds_payload_index(self, out_message->message.data)];
+
+    self->zerocopy_in_flight = true;
+    event_manager_uds_send_zerocopy((kb_event_manager_uds_t *)self->base.event_manager, &state->zerocopy_event, &self->zerocopy_msg);
+}
+
+// Free a destroyed transport once the kernel is done with all of its payloads
+static void transport_uds_free_destroyed(kb_transport_uds_t *self)
+{
+    assert(self->destroyed);
+
+    if (self->zerocopy_in_flight)
     {
-        message_header_t header;
+        return;
+    }
 
-        // Check if we can read message size
-        ssize_t bytes_received = recv(self->sock_fd, &header, sizeof(header), MSG_PEEK);
-        if (bytes_received != sizeof(header))
+    for (size_t i = 0; i < self->max_buffered_messages; i++)
+    {
+        if (self->payload_states[i].pending_notifications > 0)
         {
-            return NULL;
+            return;
         }
+    }
+
+    event_manager_uds_destroy((kb_event_manager_uds_t *)self->base.event_manager);
+    transport_uds_free(self);
+}
+
+int transport_uds_complete_zerocopy(kb_transport_t *transport, kb_event_t *event, struct io_uring_cqe *cqe)
+{
+    assert(transport != NULL);
+    assert(event != NULL);
+    assert(cqe != NULL);
+
+    kb_transport_uds_t *self = (kb_transport_uds_t *)transport;
+    payload_state_t *state = (payload_state_t *)((char *)event - offsetof(payload_state_t, zerocopy_event));
+    char *payload = self->payloads + (state - self->payload_states) * self->max_message_size;
 
-        // Note: read_size contains the size, but we need to pop size from the socket
-        recv(self->sock_fd, &header, sizeof(header), 0);
+    if (cqe->flags & IORING_CQE_F_NOTIF)
+    {
+        assert(state->pending_notifications > 0);
+        state->pending_notifications--;
 
-        if (header.magic != MAGIC)
+        if (self->destroyed)
         {
-            log4c_category_log(transport->logger, LOG4C_PRIORITY_ERROR, "Invalid magic number: %d", header.magic);
-            return NULL;
+            transport_uds_free_destroyed(self);
+        }
+        else if (state->pending_notifications == 0 && !state->queued)
+        {
+            // The kernel is done with the payload of a sent message
+            transport_uds_release_payload(self, payload);
         }
 
-        self->in_message.data_size = header.data_len;
-        self->in_message.current_offset = 0;
-        self->in_message.data = malloc(header.data_len);
+        return 1;
+    }
+
+    self->zerocopy_in_flight = false;
+
+    // A notification follows when the payload is released
+    if (cqe->flags & IORING_CQE_F_MORE)
+    {
+        state->pending_notifications++;
+    }
+
+    if (self->destroyed)
+    {
+        transport_uds_free_destroyed(self);
+        return 1;
     }
 
-    ssize_t bytes_received = recv(self->sock_fd,
-                                  self->in_message.data + self->in_message.current_offset,
-                                  self->in_message.data_size - self->in_message.current_offset,
-                                  0);
+    // Nothing else is written while a zero-copy send is in flight, so it's always the oldest message
+    out_messages_t *out_message = &self->out_messages[self->out_head];
+    assert(self->out_message_count > 0 && out_message->message.data == payload);
+    size_t frame_size = sizeof(message_header_t) + out_message->message.data_size;
 
-    if (bytes_received > 0)
+    if (cqe->res < 0)
     {
-        self->in_message.current_offset += bytes_received;
+        if (cqe->res == -EINTR)
+        {
+            return 0;
+        }
 
-        if (self->in_message.current_offset == self->in_message.data_size)
+        if (cqe->res == -EAGAIN)
         {
-            log4c_category_log(transport->logger, LOG4C_PRIORITY_DEBUG, "Incoming message for `%s`", transport->name);
+            // The socket is full. Resubmitting right away would spin
+            event_manager_uds_wait_writeable((kb_event_manager_uds_t *)transport->event_manager);
+            return 1;
+        }
 
-            kb_message_uds_t *message = message_uds_init(self, self->in_message.data, self->in_message.data_size);
-            return &message->base;
+        if (cqe->res == -EOPNOTSUPP || cqe->res == -EINVAL)
+        {
+            // The socket can't send without copying. Copy from now on
+            log4c_category_log(transport->logger, LOG4C_PRIORITY_WARN, "Zero-copy send is not supported by `%s`: %s", transport->name, strerror(-cqe->res));
+            self->zerocopy_threshold = 0;
+            return 0;
         }
+
+        log4c_category_log(transport->logger, LOG4C_PRIORITY_ERROR, "Zero-copy send failed: %s", strerror(-cqe->res));
+        return -1;
     }
 
-    return NULL;
+    out_message->message.current_offset += cqe->res;
+    if (out_message->message.current_offset == frame_size)
+    {
+        transport_uds_message_sent(self);
+    }
+
+    return 0;
 }
 
-int transport_uds_message_release(kb_transport_t *transport, kb_message_t *message)
+// Send each message as a datagram. Datagrams are sent whole or not at all
+static int transport_uds_write_datagrams(kb_transport_uds_t *self)
 {
-    assert(transport != NULL);
-    assert(message != NULL);
+    while (self->out_message_count > 0)
+    {
+        struct mmsghdr msgs[MAX_SEND_DATAGRAMS];
+        struct iovec iovecs[MAX_SEND_DATAGRAMS];
+        char controls[MAX_SEND_DATAGRAMS][CMSG_SPACE(sizeof(int))];
 
-    kb_transport_uds_t *self = (kb_transport_uds_t *)transport;
+        size_t num_messages = self->out_message_count < MAX_SEND_DATAGRAMS ? self->out_message_count : MAX_SEND_DATAGRAMS;
+        memset(msgs, 0, num_messages * sizeof(struct mmsghdr));
+
+        for (size_t i = 0; i < num_messages; i++)
+        {
+            out_messages_t *out_message = &self->out_messages[(self->out_head + i) % self->max_buffered_messages];
 
-    free(self->in_message.data);
-    self->in_message.data = NULL;
-    self->in_message.data_size = 0;
+            iovecs[i].iov_base = out_message->message.data;
+            iovecs[i].iov_len = out_message->message.data_size;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
 
-    return 0;
+            // Memfd messages send the header with the descriptor
+            if (out_message->fd >= 0)
+            {
+                iovecs[i].iov_base = &out_message->header;
+                iovecs[i].iov_len = sizeof(message_header_t);
+
+                msgs[i].msg_hdr.msg_control = controls[i];
+                msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+
+                struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_RIGHTS;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+                memcpy(CMSG_DATA(cmsg), &out_message->fd, sizeof(int));
+            }
+        }
+
+        int num_sent = sendmmsg(self->sock_fd, msgs, num_messages, 0);
+        if (num_sent == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                return self->out_message_count;
+            }
+
+            log4c_category_log(self->base.logger, LOG4C_PRIORITY_ERROR, "sendmmsg failed: %s", strerror(errno));
+            return -1;
+        }
+
+        for (int i = 0; i < num_sent; i++)
+        {
+            transport_uds_message_sent(self);
+        }
+
+        // Socket buffer is full. Wait until it's writeable again
+        if ((size_t)num_sent < num_messages)
+        {
+            return self->out_message_count;
+        }
+    }
+
+    return self->out_message_count;
 }
 
-void transport_uds_destroy(kb_transport_t *transport)
+int transport_uds_write_messages(kb_transport_t *transport)
 {
     assert(transport != NULL);
 
-    log4c_category_log(transport->logger, LOG4C_PRIORITY_DEBUG, "UDS transport `%s` destoryed", transport->name);
-
     kb_transport_uds_t *self = (kb_transport_uds_t *)transport;
 
-    if (self->sock_fd != 0)
+    if (self->seqpacket)
     {
-        close(self->sock_fd);
+        return transport_uds_write_datagrams(self);
     }
 
-    if (transport->name != NULL)
+    while (self->out_message_count > 0)
     {
-        free((char *)transport->name);
-    }
+        out_messages_t *head = &self->out_messages[self->out_head];
 
-    if (self->out_messages != NULL)
-    {
-        out_messages_t *out_message, *tmp;
-        DL_FOREACH_SAFE(self->out_messages, out_message, tmp)
+        // The stream must stay in order. Nothing else goes out until the zero-copy send completes
+        if (self->zerocopy_in_flight)
         {
-            DL_DELETE(self->out_messages, out_message);
-            free(out_message->message.data);
-            free(out_message);
+            return self->out_message_count;
         }
-    }
 
-    if (self->in_message.data != NULL)
-    {
-        free(self->in_message.data);
+        if (transport_uds_is_zerocopy(self, head))
+        {
+            transport_uds_send_zerocopy(self, head);
+            return self->out_message_count;
+        }
+
+        struct iovec iovecs[MAX_SEND_IOVECS];
+        size_t num_iovecs = 0;
+        struct msghdr msg = {0};
+        char control[CMSG_SPACE(sizeof(int))];
+
+        for (size_t i = 0; i < self->out_message_count; i++)
+        {
+            out_messages_t *out_message = &self->out_messages[(self->out_head + i) % self->max_buffered_messages];
+
+            // Large messages go with a separate zero-copy send
+            if (num_iovecs + 2 > MAX_SEND_IOVECS || transport_uds_is_zerocopy(self, out_message))
+            {
+                break;
+            }
+
+            // A descriptor goes with the first byte of a `sendmsg`. Only one fits
+            if (out_message->fd >= 0)
+            {
+                if (num_iovecs > 0)
+                {
+                    break;
+                }
+
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof(control);
+
+                struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_RIGHTS;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+                memcpy(CMSG_DATA(cmsg), &out_message->fd, sizeof(int));
+            }
+
+            num_iovecs += out_message_fill_iovecs(out_message, &iovecs[num_iovecs]);
+        }
+
+        msg.msg_iov = iovecs;
+        msg.msg_iovlen = num_iovecs;
+        ssize_t bytes_sent = sendmsg(self->sock_fd, &msg, 0);
+
+        if (bytes_sent == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                return self->out_message_count;
+            }
+
+            log4c_category_log(transport->logger, LOG4C_PRIORITY_ERROR, "sendmsg failed: %s", strerror(errno));
+            return -1;
+        }
+
+        // The peer has the descriptor now
+        if (msg.msg_control != NULL)
+        {
+            close(head->fd);
+            head->fd = -1;
+        }
+
+        // Drop completely sent messages and remember the position in a partially sent one
+        size_t bytes_left = bytes_sent;
+        while (bytes_left > 0)
+        {
+            out_messages_t *out_message = &self->out_messages[self->out_head];
+
+            size_t frame_left = sizeof(message_header_t) + out_message->message.data_size - out_message->message.current_offset;
+            if (bytes_left < frame_left)
+            {
+                out_message->message.current_offset += bytes_left;
+
+                // Socket buffer is full. Wait until it's writeable again
+                return self->out_message_count;
+            }
+
+            bytes_left -= frame_left;
+
+            out_message->message.current_offset += frame_left;
+            transport_uds_message_sent(self);
+        }
     }
 
-    event_manager_uds_destroy((kb_event_manager_uds_t *)transport->event_manager);
+    return self->out_message_count;
+}
 
-    free(self);
+// Size of the frame in the stream. Memfd frames have no inline data
+static size_t transport_uds_frame_size(message_header_t *header)
+{
+    return sizeof(message_header_t) + (header->magic == MAGIC_MEMFD ? 0 : header->data_len);
+}
+
+static bool transport_uds_check_header(kb_transport_uds_t *self, message_header_t *header)
+{
+    if (header->magic == MAGIC_MEMFD)
+    {
+        return true;
+    }
+
+    if (header->magic != MAGIC || header->data_len > self->max_message_size)
+    {
+        log4c_category_log(self->base.logger, LOG4C_PRIORITY_ERROR, "Invalid message header: magic %d, size %u", header->magic, header->data_len);
+        return false;
+    }
+
+    return true;
+}
+
+// Check if a datagram is the header of a memfd message
+static bool transport_uds_is_memfd_header(const char *data, size_t size)
+{
+    return size == sizeof(message_header_t) && (uint8_t)data[0] == MAGIC_MEMFD;
+}
+
+// Map the memfd received for a memfd frame and make a message pointing into the mapping
+static kb_message_t *transport_uds_map_memfd(kb_transport_uds_t *self, message_header_t *header)
+{
+    log4c_category_t *logger = self->base.logger;
+
+    if (self->num_received_fds == 0)
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "No descriptor received for a memfd message in `%s`", self->base.name);
+        return NULL;
+    }
+
+    int fd = self->received_fds[self->received_fds_head];
+    self->received_fds_head = (self->received_fds_head + 1) % UDS_MAX_RECEIVED_FDS;
+    self->num_received_fds--;
+
+    // The sender must not be able to change the data under us
+    int seals = fcntl(fd, F_GET_SEALS);
+    struct stat stat;
+    if (seals == -1 || (seals & (F_SEAL_WRITE | F_SEAL_SHRINK)) != (F_SEAL_WRITE | F_SEAL_SHRINK) ||
+        fstat(fd, &stat) == -1 || (size_t)stat.st_size < header->data_len || header->data_len == 0)
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "Invalid memfd received in `%s`", self->base.name);
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, header->data_len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        log4c_category_log(logger, LOG4C_PRIORITY_ERROR, "mmap failed: %s", strerror(errno));
+        return NULL;
+    }
+
+    kb_message_uds_t *message = message_uds_init(self, data, header->data_len);
+    if (message == NULL)
+    {
+        munmap(data, header->data_len);
+        return NULL;
+    }
+
+    message->mapping = data;
+    message->mapping_size = header->data_len;
+    log4c_category_log(logger, LOG4C_PRIORITY_DEBUG, "Incoming memfd message for `%s`", self->base.name);
+
+    return &message->base;
+}
+
+// Parse the next complete frame in the receive buffer
+static kb_message_t *transport_uds_parse_message(kb_transport_uds_t *self)
+{
+    receive_buffer_t *buffer = &self->in_buffer;
+    size_t bytes_available = buffer->write_offset - buffer->read_offset;
+
+    if (bytes_available < sizeof(message_header_t))
+    {
+        return NULL;
+    }
+
+    // The header is packed and may be unaligned
+    message_header_t header;
+    memcpy(&header, buffer->data + buffer->read_offset, sizeof(header));
+
+    if (!transport_uds_check_header(self, &header))
+    {
+        // The stream is out of sync. Drop everything we've got
+        buffer->read_offset = buffer->write_offset;
+        return NULL;
+    }
+
+    if (bytes_available < transport_uds_frame_size(&header))
+    {
+        return NULL;
+    }
+
+    if (header.magic == MAGIC_MEMFD)
+    {
+        buffer->read_offset += sizeof(header);
+        return transport_uds_map_memfd(self, &header);
+    }
+
+    char *data = buffer->data + buffer->read_offset + sizeof(header);
+    buffer->read_offset += sizeof(header) + header.data_len;
+
+    kb_message_uds_t *message = message_uds_init(self, data, header.data_len);
+    if (message == NULL)
+    {
+        return NULL;
+    }
+
+    message->receive_data = buffer->data;
+    buffer->num_held++;
+    log4c_category_log(self->base.logger, LOG4C_PRIORITY_DEBUG, "Incoming message for `%s`", self->base.name);
+
+    return &message->base;
+}
+
+// Move the unparsed tail to the beginning, unless received messages still point into the buffer
+static void transport_uds_compact_buffer(receive_buffer_t *buffer)
+{
+    if (buffer->num_held == 0 && buffer->read_offset > 0)
+    {
+        memmove(buffer->data, buffer->data + buffer->read_offset, buffer->write_offset - buffer->read_offset);
+        buffer->write_offset -= buffer->read_offset;
+        buffer->read_offset = 0;
+    }
+}
+
+// Number of bytes missing to complete a frame started in the receive buffer
+static size_t transport_uds_missing_bytes(receive_buffer_t *buffer)
+{
+    size_t bytes_available = buffer->write_offset - buffer->read_offset;
+
+    if (bytes_available < sizeof(message_header_t))
+    {
+        return sizeof(message_header_t) - bytes_available;
+    }
+
+    message_header_t header;
+    memcpy(&header, buffer->data + buffer->read_offset, sizeof(header));
+
+    return transport_uds_frame_size(&header) - bytes_available;
+}
+
+// Make room for `size` more bytes after the received data. If received messages pin the buffer, the unparsed tail
+// moves into a new one and the old buffer is freed when they are released
+static bool transport_uds_reserve(kb_transport_uds_t *self, size_t size)
+{
+    receive_buffer_t *buffer = &self->in_buffer;
+
+    transport_uds_compact_buffer(buffer);
+
+    if (buffer->data_size - buffer->write_offset >= size)
+    {
+        return true;
+    }
+
+    size_t tail_size = buffer->write_offset - buffer->read_offset;
+    if (buffer->num_held == 0 || buffer->data_size - tail_size < size)
+    {
+        return false;
+    }
+
+    retired_buffer_t *retired = malloc(sizeof(retired_buffer_t));
+    char *data = malloc(buffer->data_size);
+    if (retired == NULL || data == NULL)
+    {
+        log4c_category_log(self->base.logger, LOG4C_PRIORITY_ERROR, "malloc failed");
+        free(retired);
+        free(data);
+        return false;
+    }
+
+    memcpy(data, buffer->data + buffer->read_offset, tail_size);
+
+    retired->data = buffer->data;
+    retired->num_held = buffer->num_held;
+    retired->next = self->retired_buffers;
+    self->retired_buffers = retired;
+
+    buffer->data = data;
+    buffer->read_offset = 0;
+    buffer->write_offset = tail_size;
+    buffer->num_held = 0;
+
+    return true;
+}
+
+// Queue descriptors received with the data. Frames take them in order
+static void transport_uds_take_fds(kb_transport_uds_t *self, struct msghdr *msg)
+{
+    if (msg->msg_flags & MSG_CTRUNC)
+    {
+        log4c_category_log(self->base.logger, LOG4C_PRIORITY_ERROR, "Received descriptors truncated in `%s`", self->base.name);
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        {
+            continue;
+        }
+
+        size_t num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < num_fds; i++)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+
+            if (self->num_received_fds == UDS_MAX_RECEIVED_FDS)
+            {
+                log4c_category_log(self->base.logger, LOG4C_PRIORITY_ERROR, "Too many received descriptors in `%s`", self->base.name);
+                close(fd);
+                continue;
+            }
+
+            self->received_fds[(self->received_fds_head + self->num_received_fds) % UDS_MAX_RECEIVED_FDS] = fd;
+            self->num_received_fds++;
+        }
+    }
+}
+
+// Read as much data as fits into the receive buffer. Returns true if anything was read
+static bool transport_uds_fill_buffer(kb_transport_uds_t *self)
+{
+    receive_buffer_t *buffer = &self->in_buffer;
+
+    // The frame started in the buffer must be able to complete
+    if (!transport_uds_reserve(self, transport_uds_missing_bytes(buffer)))
+    {
+        self->receive_stalled = true;
+        return false;
+    }
+
+    size_t free_size = buffer->data_size - buffer->write_offset;
+
+    // Memfd messages come with descriptors
+    struct iovec iovec = {.iov_base = buffer->data + buffer->write_offset, .iov_len = free_size};
+    char control[CMSG_SPACE(sizeof(int) * UDS_MAX_RECEIVED_FDS)];
+    struct msghdr msg = {.msg_iov = &iovec, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+
+    ssize_t bytes_received = recvmsg(self->sock_fd, &msg, MSG_CMSG_CLOEXEC);
+    if (bytes_received == 0)
+    {
+        log4c_category_log(self->base.logger, LOG4C_PRIORITY_DEBUG, "Peer of `%s` closed the connection", self->base.name);
+        self->disconnected = true;
+        return false;
+    }
+    else if (bytes_received == -1)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            log4c_category_log(self->base.logger, LOG4C_PRIORITY_ERROR, "recvmsg failed: %s", strerror(errno));
+            self->disconnected = true;
+        }
+
+        return false;
+    }
+
+    transport_uds_take_fds(self, &msg);
+
+    buffer->write_offset += bytes_received;
+    return true;
+}
+
+// Receive as many datagrams as there are free slots of the maximum message size in the receive buffer.
+// Each received message holds its slot until released
+static bool transport_uds_receive_datagrams(kb_transport_uds_t *self)
+{
+    receive_buffer_t *buffer = &self->in_buffer;
+    assert(self->datagrams_head == self->num_datagrams);
+
+    size_t num_slots = self->num_free_slots < UDS_MAX_RECEIVE_DATAGRAMS ? self->num_free_slots : UDS_MAX_RECEIVE_DATAGRAMS;
+    if (num_slots == 0)
+    {
+        // Resumed when a message gives its slot back
+        self->receive_stalled = true;
+        return false;
+    }
+
+    struct mmsghdr msgs[UDS_MAX_RECEIVE_DATAGRAMS];
+    struct iovec iovecs[UDS_MAX_RECEIVE_DATAGRAMS];
+    char controls[UDS_MAX_RECEIVE_DATAGRAMS][CMSG_SPACE(sizeof(int))];
+    size_t slots[UDS_MAX_RECEIVE_DATAGRAMS];
+    memset(msgs, 0, num_slots * sizeof(struct mmsghdr));
+
+    for (size_t i = 0; i < num_slots; i++)
+    {
+        slots[i] = self->free_slots[self->num_free_slots - i - 1];
+        iovecs[i].iov_base = buffer->data + slots[i] * self->slot_size;
+        iovecs[i].iov_len = self->slot_size;
+
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = controls[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+    }
+
+    int num_received = recvmmsg(self->sock_fd, msgs, num_slots, MSG_CMSG_CLOEXEC, NULL);
+    if (num_received <= 0)
+    {
+        if (num_received == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            log4c_category_log(self->base.logger, LOG4C_PRIORITY_ERROR, "recvmmsg failed: %s", strerror(errno));
+            self->disconnected = true;
+        }
+
+        return false;
+    }
+
+    self->datagrams_head = 0;
+    self->num_datagrams = 0;
+
+    // Slots of dropped datagrams go back right away
+    self->num_free_slots -= num_received;
+
+    for (int i = 0; i < num_received; i++)
+    {
+        size_t num_fds = self->num_received_fds;
+        transport_uds_take_fds(self, &msgs[i].msg_hdr);
+
+        if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+        {
+            log4c_category_log(self->base.logger, LOG4C_PRIORITY_ERROR, "Message larger than %zu bytes dropped in `%s`", self->slot_size, self->base.name);
+            self->free_slots[self->num_free_slots++] = slots[i];
+            continue;
+        }
+
+        // Messages are never empty. This is the end of the stream
+        if (msgs[i].msg_len == 0)
+        {
+            log4c_category_log(self->base.logger, LOG4C_PRIORITY_DEBUG, "Peer of `%s` closed the connection", self->base.name);
+            self->disconnected = true;
+            self->free_slots[self->num_free_slots++] = slots[i];
+            continue;
+        }
+
+        received_datagram_t *datagram = &self->datagrams[self->num_datagrams++];
+        datagram->slot = slots[i];
+        datagram->size = msgs[i].msg_len;
+        datagram->has_fd = self->num_received_fds > num_fds;
+    }
+
+    return true;
+}
+
+// Take the next datagram received with `recvmmsg`
+static kb_message_t *transport_uds_parse_datagram(kb_transport_uds_t *self)
+{
+    receive_buffer_t *buffer = &self->in_buffer;
+
+    while (self->datagrams_head < self->num_datagrams)
+    {
+        received_datagram_t *datagram = &self->datagrams[self->datagrams_head++];
+        char *data = buffer->data + datagram->slot * self->slot_size;
+        kb_message_t *message = NULL;
+
+        if (datagram->has_fd || transport_uds_is_memfd_header(data, datagram->size))
+        {
+            message_header_t header;
+            memcpy(&header, data, datagram->size < sizeof(header) ? datagram->size : sizeof(header));
+
+            // The mapping doesn't need the slot
+            self->free_slots[self->num_free_slots++] = datagram->slot;
+
+            if (!transport_uds_is_memfd_header(data, datagram->size))
+            {
+                log4c_category_log(self->base.logger, LOG4C_PRIORITY_ERROR, "Invalid memfd message header in `%s`", self->base.name);
+                continue;
+            }
+
+            message = transport_uds_map_memfd(self, &header);
+        }
+        else
+        {
+            kb_message_uds_t *uds_message = message_uds_init(self, data, datagram->size);
+            if (uds_message != NULL)
+            {
+                uds_message->receive_data = data;
+                buffer->num_held++;
+                message = &uds_message->base;
+                log4c_category_log(self->base.logger, LOG4C_PRIORITY_DEBUG, "Incoming message for `%s`", self->base.name);
+            }
+            else
+            {
+                self->free_slots[self->num_free_slots++] = datagram->slot;
+            }
+        }
+
+        if (message != NULL)
+        {
+            return message;
+        }
+    }
+
+    return NULL;
+}
+
+// Parse the next message already received
+static kb_message_t *transport_uds_next_message(kb_transport_uds_t *self)
+{
+    return self->seqpacket ? transport_uds_parse_datagram(self) : transport_uds_parse_message(self);
+}
+
+// Read the socket into the receive buffer. Returns true if anything was read
+static bool transport_uds_read_socket(kb_transport_uds_t *self)
+{
+    return self->seqpacket ? transport_uds_receive_datagrams(self) : transport_uds_fill_buffer(self);
+}
+
+// Copy data into the receive buffer. Returns false if it doesn't fit
+static bool transport_uds_append(kb_transport_uds_t *self, const char *data, size_t size)
+{
+    receive_buffer_t *buffer = &self->in_buffer;
+
+    if (!transport_uds_reserve(self, size))
+    {
+        log4c_category_log(self->base.logger, LOG4C_PRIORITY_WARN, "No space to reassemble a message in `%s`", self->base.name);
+        self->receive_stalled = true;
+        return false;
+    }
+
+    memcpy(buffer->data + buffer->write_offset, data, size);
+    buffer->write_offset += size;
+
+    return true;
+}
+
+// Parse the next frame received into provided buffers. Complete frames point right into the buffer,
+// frames split between buffers are copied into the receive buffer
+static kb_message_t *transport_uds_parse_chunks(kb_transport_uds_t *self)
+{
+    kb_event_manager_uds_t *event_manager = (kb_event_manager_uds_t *)self->base.event_manager;
+    receive_buffer_t *buffer = &self->in_buffer;
+
+    while (self->num_chunks > 0)
+    {
+        received_chunk_t *chunk = &self->chunks[self->chunks_head];
+        char *data = event_manager_uds_buffer_data(event_manager, chunk->buffer_id) + chunk->offset;
+        size_t bytes_available = chunk->size - chunk->offset;
+        kb_message_t *message = NULL;
+
+        if (self->seqpacket && bytes_available >= event_manager->buffer_size)
+        {
+            // The kernel drops the rest of a datagram, which doesn't fit
+            log4c_category_log(self->base.logger, LOG4C_PRIORITY_ERROR, "Message larger than %zu bytes dropped in `%s`", event_manager->buffer_size - 1, self->base.name);
+            chunk->offset = chunk->size;
+        }
+        else if (self->seqpacket && transport_uds_is_memfd_header(data, bytes_available))
+        {
+            // Provided buffers can't receive descriptors, so this one fails
+            message_header_t header;
+            memcpy(&header, data, sizeof(header));
+            message = transport_uds_map_memfd(self, &header);
+
+            chunk->offset = chunk->size;
+        }
+        else if (self->seqpacket)
+        {
+            // Each buffer holds a whole datagram
+            kb_message_uds_t *uds_message = message_uds_init(self, data, bytes_available);
+            if (uds_message != NULL)
+            {
+                uds_message->buffer_id = chunk->buffer_id;
+                event_manager_uds_buffer_ref(event_manager, chunk->buffer_id);
+                message = &uds_message->base;
+            }
+
+            chunk->offset = chunk->size;
+        }
+        else if (buffer->write_offset > buffer->read_offset)
+        {
+            // Complete the frame started in the previous buffer
+            size_t bytes_copied = transport_uds_missing_bytes(buffer);
+            bytes_copied = bytes_copied < bytes_available ? bytes_copied : bytes_available;
+
+            if (!transport_uds_append(self, data, bytes_copied))
+            {
+                // Try again when received messages are released
+                return NULL;
+            }
+
+            chunk->offset += bytes_copied;
+            message = transport_uds_parse_message(self);
+        }
+        else
+        {
+            message_header_t header;
+            memcpy(&header, data, bytes_available < sizeof(header) ? bytes_available : sizeof(header));
+
+            if (bytes_available >= sizeof(header) && !transport_uds_check_header(self, &header))
+            {
+                // The stream is out of sync. Drop the buffer
+                chunk->offset = chunk->size;
+            }
+            else if (bytes_available >= sizeof(header) && bytes_available >= transport_uds_frame_size(&header))
+            {
+                if (header.magic == MAGIC_MEMFD)
+                {
+                    // Provided buffers can't receive descriptors, so this one fails. Keeps the stream in sync though
+                    message = transport_uds_map_memfd(self, &header);
+                }
+                else
+                {
+                    kb_message_uds_t *uds_message = message_uds_init(self, data + sizeof(header), header.data_len);
+                    if (uds_message != NULL)
+                    {
+                        uds_message->buffer_id = chunk->buffer_id;
+                        event_manager_uds_buffer_ref(event_manager, chunk->buffer_id);
+                        message = &uds_message->base;
+                    }
+                }
+
+                chunk->offset += transport_uds_frame_size(&header);
+            }
+            else if (transport_uds_append(self, data, bytes_available))
+            {
+                // The frame continues in the next buffer
+                chunk->offset = chunk->size;
+            }
+            else
+            {
+                return NULL;
+            }
+        }
+
+        if (chunk->offset == chunk->size)
+        {
+            self->chunks_head = (self->chunks_head + 1) % self->max_chunks;
+            self->num_chunks--;
+            event_manager_uds_buffer_unref(event_manager, chunk->buffer_id);
+        }
+
+        if (message != NULL)
+        {
+            log4c_category_log(self->base.logger, LOG4C_PRIORITY_DEBUG, "Incoming message for `%s`", self->base.name);
+            return message;
+        }
+    }
+
+    return NULL;
+}
+
+void transport_uds_push_buffer(kb_transport_t *transport, uint16_t buffer_id, size_t size)
+{
+    assert(transport != NULL);
+
+    kb_transport_uds_t *self = (kb_transport_uds_t *)transport;
+    // The kernel can't pick more buffers than there are
+    assert(self->num_chunks < self->max_chunks);
+
+    received_chunk_t *chunk = &self->chunks[(self->chunks_head + self->num_chunks) % self->max_chunks];
+    chunk->buffer_id = buffer_id;
+    chunk->size = size;
+    chunk->offset = 0;
+    self->num_chunks++;
+
+    event_manager_uds_buffer_ref((kb_event_manager_uds_t *)transport->event_manager, buffer_id);
+}
+
+kb_message_t *transport_uds_message_receive(kb_transport_t *transport)
+{
+    assert(transport != NULL);
+
+    kb_transport_uds_t *self = (kb_transport_uds_t *)transport;
+
+    // Only touch the socket if there's no complete message in the buffer
+    kb_message_t *message = transport_uds_next_message(self);
+    if (message == NULL && self->chunks != NULL)
+    {
+        // The multishot receive reads the socket
+        message = transport_uds_parse_chunks(self);
+    }
+    else if (message == NULL && transport_uds_read_socket(self))
+    {
+        message = transport_uds_next_message(self);
+    }
+
+    return message;
+}
+
+size_t transport_uds_message_receive_batch(kb_transport_t *transport, kb_message_t **messages, size_t max_messages)
+{
+    assert(transport != NULL);
+    assert(messages != NULL);
+
+    kb_transport_uds_t *self = (kb_transport_uds_t *)transport;
+
+    size_t num_messages = 0;
+    bool buffer_filled = false;
+
+    while (num_messages < max_messages)
+    {
+        kb_message_t *message = transport_uds_next_message(self);
+        if (message == NULL && self->chunks != NULL)
+        {
+            message = transport_uds_parse_chunks(self);
+            if (message == NULL)
+            {
+                break;
+            }
+        }
+        else if (message == NULL)
+        {
+            // Read the socket once per batch
+            if (buffer_filled || !transport_uds_read_socket(self))
+            {
+                break;
+            }
+
+            buffer_filled = true;
+            continue;
+        }
+
+        messages[num_messages++] = message;
+    }
+
+    return num_messages;
+}
+
+bool transport_uds_has_buffered_message(kb_transport_t *transport)
+{
+    assert(transport != NULL);
+
+    kb_transport_uds_t *self = (kb_transport_uds_t *)transport;
+    receive_buffer_t *buffer = &self->in_buffer;
+    size_t bytes_available = buffer->write_offset - buffer->read_offset;
+
+    // Parsing can't go on until a released message makes room
+    if (self->receive_stalled)
+    {
+        return false;
+    }
+
+    if (self->seqpacket)
+    {
+        // Each provided buffer holds a whole datagram
+        return self->datagrams_head < self->num_datagrams || self->num_chunks > 0;
+    }
+
+    // The frame may start in the receive buffer and continue in provided buffers
+    message_header_t header;
+    size_t header_size = bytes_available < sizeof(header) ? bytes_available : sizeof(header);
+    memcpy(&header, buffer->data + buffer->read_offset, header_size);
+
+    for (size_t i = 0; i < self->num_chunks; i++)
+    {
+        received_chunk_t *chunk = &self->chunks[(self->chunks_head + i) % self->max_chunks];
+        size_t chunk_size = chunk->size - chunk->offset;
+
+        if (header_size < sizeof(header))
+        {
+            char *data = event_manager_uds_buffer_data((kb_event_manager_uds_t *)transport->event_manager, chunk->buffer_id) + chunk->offset;
+            size_t bytes_copied = sizeof(header) - header_size < chunk_size ? sizeof(header) - header_size : chunk_size;
+            memcpy((char *)&header + header_size, data, bytes_copied);
+            header_size += bytes_copied;
+        }
+
+        bytes_available += chunk_size;
+    }
+
+    if (header_size < sizeof(header))
+    {
+        return false;
+    }
+
+    // A broken header is dropped on receive
+    if (header.magic != MAGIC_MEMFD && (header.magic != MAGIC || header.data_len > self->max_message_size))
+    {
+        return true;
+    }
+
+    return bytes_available >= transport_uds_frame_size(&header);
+}
+
+bool transport_uds_is_disconnected(kb_transport_t *transport)
+{
+    assert(transport != NULL);
+
+    return ((kb_transport_uds_t *)transport)->disconnected;
+}
+
+// Release a message pointing into a retired receive buffer. The last one frees the buffer
+static void transport_uds_release_retired(kb_transport_uds_t *self, char *data)
+{
+    for (retired_buffer_t **retired = &self->retired_buffers; *retired != NULL; retired = &(*retired)->next)
+    {
+        if ((*retired)->data != data)
+        {
+            continue;
+        }
+
+        assert((*retired)->num_held > 0);
+        if (--(*retired)->num_held == 0)
+        {
+            retired_buffer_t *released = *retired;
+            *retired = released->next;
+            free(released->data);
+            free(released);
+        }
+
+        return;
+    }
+
+    assert(false);
+}
+
+int transport_uds_message_release(kb_transport_t *transport, kb_message_t *message)
+{
+    assert(transport != NULL);
+    assert(message != NULL);
+
+    kb_transport_uds_t *self = (kb_transport_uds_t *)transport;
+    kb_message_uds_t *uds_message = (kb_message_uds_t *)message;
+    receive_buffer_t *buffer = &self->in_buffer;
+
+    if (uds_message->mapping != NULL)
+    {
+        // The message points into a received memfd
+        munmap(uds_message->mapping, uds_message->mapping_size);
+        return 0;
+    }
+
+    if (uds_message->buffer_id >= 0)
+    {
+        // The message points into a provided buffer
+        event_manager_uds_buffer_unref((kb_event_manager_uds_t *)transport->event_manager, uds_message->buffer_id);
+        return 0;
+    }
+
+    if (self->seqpacket)
+    {
+        // Give the datagram slot back
+        assert(buffer->num_held > 0);
+        buffer->num_held--;
+        self->free_slots[self->num_free_slots++] = (uds_message->receive_data - buffer->data) / self->slot_size;
+    }
+    else if (uds_message->receive_data != buffer->data)
+    {
+        transport_uds_release_retired(self, uds_message->receive_data);
+    }
+    else
+    {
+        assert(buffer->num_held > 0);
+        buffer->num_held--;
+
+        // Everything is parsed and released. Start from the beginning without moving any data
+        if (buffer->num_held == 0 && buffer->read_offset == buffer->write_offset)
+        {
+            buffer->read_offset = 0;
+            buffer->write_offset = 0;
+        }
+    }
+
+    // The released message may have made room for the data
+    if (self->receive_stalled)
+    {
+        self->receive_stalled = false;
+        event_manager_uds_schedule_read((kb_event_manager_uds_t *)transport->event_manager);
+    }
+
+    return 0;
+}
+
+void transport_uds_destroy(kb_transport_t *transport)
+{
+    assert(transport != NULL);
+
+    log4c_category_log(transport->logger, LOG4C_PRIORITY_DEBUG, "UDS transport `%s` destoryed", transport->name);
+
+    kb_transport_uds_t *self = (kb_transport_uds_t *)transport;
+
+    if (self->sock_fd != 0)
+    {
+        close(self->sock_fd);
+    }
+
+    // Unsent memfds are still ours
+    for (size_t i = 0; i < self->out_message_count; i++)
+    {
+        out_messages_t *out_message = &self->out_messages[(self->out_head + i) % self->max_buffered_messages];
+        if (out_message->fd >= 0)
+        {
+            close(out_message->fd);
+        }
+    }
+
+    for (size_t i = 0; i < self->num_received_fds; i++)
+    {
+        close(self->received_fds[(self->received_fds_head + i) % UDS_MAX_RECEIVED_FDS]);
+    }
+
+    // Zero-copy sends in flight and their notifications point into the payloads.
+    // The completions still come through the ring, and the last one frees the transport
+    self->destroyed = true;
+    transport_uds_free_destroyed(self);
 }
\ No newline at end of file
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <sys/socket.h>
+#include <sys/uio.h>
+
 #include "event_manager_uds.h"
 #include "../transport.h"
 
@@ -9,6 +12,27 @@ extern "C" {
 
 struct io_uring;
 
+// Minimum size of the buffer for incoming data
+#ifndef UDS_RECEIVE_BUFFER_SIZE
+#define UDS_RECEIVE_BUFFER_SIZE 65536
+#endif
+
+// Default size of messages sent without copying. Zero disables zero-copy sends
+#ifndef UDS_ZEROCOPY_THRESHOLD
+#define UDS_ZEROCOPY_THRESHOLD 0
+#endif
+
+// Default size of messages written into a memfd, which is passed to the peer. Zero disables memfd messages
+#ifndef UDS_MEMFD_THRESHOLD
+#define UDS_MEMFD_THRESHOLD 0
+#endif
+
+// Maximum number of received descriptors waiting for their frames
+#define UDS_MAX_RECEIVED_FDS 16
+
+// Maximum number of datagrams received with a single `recvmmsg` on SEQPACKET sockets
+#define UDS_MAX_RECEIVE_DATAGRAMS 32
+
 /**
  * @brief Message header structure for UDS transport
  */
@@ -29,24 +53,87 @@ struct message_buffer_s
 {
     char *data;            // Buffer data
     size_t data_size;      // Size of the buffer
-    size_t current_offset; // Current read/write position
-    bool header_sent;      // Whether the header has been sent
+    size_t current_offset; // Current read/write position. Includes the header for outgoing messages
 };
 
 typedef struct message_buffer_s message_buffer_t;
 
+/**
+ * @brief Buffer for incoming data. Received messages point directly into it
+ */
+struct receive_buffer_s
+{
+    char *data;          // Buffer data
+    size_t data_size;    // Size of the buffer
+    size_t read_offset;  // Start of the first unparsed frame
+    size_t write_offset; // End of the received data
+    size_t num_held;     // Number of received messages not released yet. The data can't be moved while there are any
+};
+
+typedef struct receive_buffer_s receive_buffer_t;
+
+/**
+ * @brief Receive buffer replaced while received messages still point into it. Freed when the last of them is released
+ */
+struct retired_buffer_s
+{
+    char *data;                    // Buffer data
+    size_t num_held;               // Number of received messages not released yet
+    struct retired_buffer_s *next; // Next retired buffer
+};
+
+typedef struct retired_buffer_s retired_buffer_t;
+
+/**
+ * @brief Data received into a provided buffer, which is not parsed yet
+ */
+struct received_chunk_s
+{
+    uint16_t buffer_id; // Provided buffer holding the data
+    size_t size;        // Size of the received data
+    size_t offset;      // Start of the unparsed data
+};
+
+typedef struct received_chunk_s received_chunk_t;
+
+/**
+ * @brief Datagram received into the receive buffer of a SEQPACKET transport
+ */
+struct received_datagram_s
+{
+    size_t slot;   // Slot of the receive buffer holding the datagram
+    size_t size;   // Size of the datagram
+    bool has_fd;   // Whether a memfd came with the datagram
+};
+
+typedef struct received_datagram_s received_datagram_t;
+
 /**
  * @brief Queue element for outgoing messages
  */
 struct out_messages_s
 {
-    message_buffer_t message;    // Message buffer
-    struct out_messages_s *prev; // Previous message in the queue
-    struct out_messages_s *next; // Next message in the queue
+    message_header_t header;  // Frame header. Sent together with the message data
+    message_buffer_t message; // Message buffer. Points into the payload slab
+    int fd;                   // Memfd with the message data, which is passed with the header. -1 if the data is inline
 };
 
 typedef struct out_messages_s out_messages_t;
 
+/**
+ * @brief State of a payload buffer in the slab
+ */
+struct payload_state_s
+{
+    kb_event_t zerocopy_event;    // Completion tag of zero-copy sends of the payload
+    size_t pending_notifications; // Number of zero-copy sends which may still read the payload
+    bool queued;                  // Whether the payload is in the queue of outgoing messages
+};
+
+typedef struct payload_state_s payload_state_t;
+
+struct kb_message_writer_uds_s;
+
 /**
  * @brief Unix Domain Socket transport implementation
  */
@@ -54,17 +141,47 @@ struct kb_transport_uds_s
 {
     kb_transport_t base;          // Base transport interface
     int sock_fd;                  // Socket file descriptor
+    bool seqpacket;               // Each message is a datagram without a frame header. Set for SOCK_SEQPACKET sockets
     size_t max_message_size;      // Maximum message size
-    out_messages_t *out_messages; // Queue of outgoing messages
+    out_messages_t *out_messages; // Ring of outgoing messages of `max_buffered_messages` capacity
+    size_t out_head;              // Index of the oldest outgoing message
     size_t out_message_count;     // Current number of buffered messages
     size_t max_buffered_messages; // Maximum number of buffered messages
-    message_buffer_t in_message;  // Buffer for incoming message
+    char *payloads;               // Slab of `max_buffered_messages` payload buffers of `max_message_size`
+    payload_state_t *payload_states; // State of each payload buffer
+    size_t *free_payloads;        // Stack of free payload indices
+    size_t num_free_payloads;     // Number of free payloads
+    struct kb_message_writer_uds_s *free_writers; // Pool of message writers
+    size_t zerocopy_threshold;    // Minimum size of messages sent without copying. Zero disables zero-copy sends
+    bool zerocopy_in_flight;      // Whether a zero-copy send is submitted and not completed yet
+    bool destroyed;               // Whether the transport is destroyed and waits for zero-copy completions to be freed
+    struct iovec zerocopy_iovecs[2]; // Header and data of the zero-copy send in flight
+    struct msghdr zerocopy_msg;   // Message of the zero-copy send in flight
+    size_t memfd_threshold;       // Minimum size of sized messages written into a memfd. Zero disables memfd messages
+    int received_fds[UDS_MAX_RECEIVED_FDS]; // FIFO of received memfds waiting for their frames
+    size_t received_fds_head;     // Index of the oldest received descriptor
+    size_t num_received_fds;      // Number of received descriptors
+    receive_buffer_t in_buffer;   // Buffer for incoming messages. Reassembles frames split between provided buffers
+    retired_buffer_t *retired_buffers; // Previous receive buffers, which received messages still point into
+    bool receive_stalled;         // Whether receiving stopped for lack of room. Resumed when a message is released
+    bool disconnected;            // Whether the peer closed the connection
+    received_datagram_t datagrams[UDS_MAX_RECEIVE_DATAGRAMS]; // Datagrams of the last `recvmmsg`
+    size_t datagrams_head;        // Index of the next datagram to parse
+    size_t num_datagrams;         // Number of datagrams of the last `recvmmsg`
+    size_t *free_slots;           // Stack of free datagram slots of the receive buffer. NULL unless the socket is SOCK_SEQPACKET
+    size_t num_free_slots;        // Number of free slots
+    size_t slot_size;             // Size of each slot. Fits a message of the maximum size
+    received_chunk_t *chunks;     // FIFO of received provided buffers. NULL if the transport reads the socket itself
+    size_t chunks_head;           // Index of the oldest chunk
+    size_t num_chunks;            // Number of chunks in the FIFO
+    size_t max_chunks;            // Capacity of the FIFO
 };
 
 typedef struct kb_transport_uds_s kb_transport_uds_t;
 
 /**
- * @brief Initialize a UDS transport
+ * @brief Initialize a UDS transport.
+ *        SOCK_SEQPACKET sockets send each message as a datagram without framing, several per syscall
  *
  * @param name Name of the transport (for debugging)
  * @param fd Socket file descriptor
@@ -76,6 +193,25 @@ typedef struct kb_transport_uds_s kb_transport_uds_t;
  */
 kb_transport_t *transport_uds_init(const char *name, int fd, size_t max_message_size, size_t max_buffered_messages, struct io_uring *ring, log4c_category_t *logger);
 
+/**
+ * @brief Initialize a UDS transport, which receives data with a multishot receive into a ring of provided buffers.
+ *        Complete frames are not copied: received messages point into the provided buffers until destroyed
+ *
+ * @param name Name of the transport (for debugging)
+ * @param fd Socket file descriptor
+ * @param max_message_size Maximum size of messages for this transport
+ * @param max_buffered_messages Maximum number of messages to buffer
+ * @param num_buffers Number of provided buffers. Must be a power of two. Zero makes the transport read the socket itself
+ * @param buffer_size Size of each provided buffer. Must be larger than a message for SOCK_SEQPACKET sockets:
+ *                    a datagram filling the whole buffer is taken as truncated
+ * @param ring IO_URING instance for asynchronous operations
+ * @param logger Logger for debugging
+ * @return Initialized transport or NULL on failure
+ */
+kb_transport_t *transport_uds_init_with_buffer_ring(const char *name, int fd, size_t max_message_size, size_t max_buffered_messages,
+                                                    unsigned int num_buffers, size_t buffer_size,
+                                                    struct io_uring *ring, log4c_category_t *logger);
+
 /**
  * @brief Initialize a new message for writing
  *
@@ -84,6 +220,34 @@ kb_transport_t *transport_uds_init(const char *name, int fd, size_t max_message_
  */
 kb_message_writer_t *transport_uds_message_init(kb_transport_t *transport);
 
+/**
+ * @brief Initialize a new message for writing with an expected size.
+ *        Messages of at least the memfd threshold are written right into a memfd
+ *
+ * @param transport Transport to use for sending the message
+ * @param size_hint Expected message size
+ * @return Initialized message writer or NULL on failure
+ */
+kb_message_writer_t *transport_uds_message_init_sized(kb_transport_t *transport, size_t size_hint);
+
+/**
+ * @brief Set the minimum size of sized messages, which are written into a sealed memfd.
+ *        Only the descriptor goes through the socket and the peer maps the message.
+ *        The peer must not use provided buffers, which can't receive descriptors
+ *
+ * @param transport Transport to configure
+ * @param threshold Minimum message size. Zero disables memfd messages
+ */
+void transport_uds_set_memfd_threshold(kb_transport_t *transport, size_t threshold);
+
+/**
+ * @brief Give a payload buffer, which is not queued for sending, back to the slab
+ *
+ * @param transport Transport owning the slab
+ * @param payload Payload buffer
+ */
+void transport_uds_release_payload(kb_transport_uds_t *transport, char *payload);
+
 /**
  * @brief Send a message through the transport
  *
@@ -94,13 +258,35 @@ kb_message_writer_t *transport_uds_message_init(kb_transport_t *transport);
 int transport_uds_message_send(kb_transport_t *transport, kb_message_writer_t *writer);
 
 /**
- * @brief Write buffered messages to the socket
+ * @brief Write buffered messages to the socket.
+ *        Gathers frames of multiple messages into a single `sendmsg` call
  *
  * @param transport Transport to write messages from
  * @return 0 on success, negative error code on failure
  */
 int transport_uds_write_messages(kb_transport_t *transport);
 
+/**
+ * @brief Set the minimum size of messages sent with a zero-copy send.
+ *        The message buffer is held until the kernel notifies that it doesn't need it anymore
+ *
+ * @param transport Transport to configure
+ * @param threshold Minimum message size. Zero disables zero-copy sends
+ */
+void transport_uds_set_zerocopy_threshold(kb_transport_t *transport, size_t threshold);
+
+/**
+ * @brief Handle a completion of a zero-copy send.
+ *        A send which found the socket full waits until it's writeable.
+ *        The last completion after the transport is destroyed frees it
+ *
+ * @param transport Transport which sent the message
+ * @param event Completion tag of the send
+ * @param cqe Completion of the send or its notification
+ * @return 0 if writing can go on, 1 if nothing is to be written now, negative error code on failure
+ */
+int transport_uds_complete_zerocopy(kb_transport_t *transport, kb_event_t *event, struct io_uring_cqe *cqe);
+
 /**
  * @brief Receive a message from the transport
  *
@@ -109,6 +295,45 @@ int transport_uds_write_messages(kb_transport_t *transport);
  */
 kb_message_t *transport_uds_message_receive(kb_transport_t *transport);
 
+/**
+ * @brief Receive all buffered messages up to a limit.
+ *        Reads as much data as possible with a single `recv` and parses every complete frame.
+ *        The messages point into the receive buffer of the transport
+ *
+ * @param transport Transport to receive the messages from
+ * @param messages Array to put received messages into
+ * @param max_messages Size of the array
+ * @return Number of received messages
+ */
+size_t transport_uds_message_receive_batch(kb_transport_t *transport, kb_message_t **messages, size_t max_messages);
+
+/**
+ * @brief Take data received into a provided buffer. The transport holds the buffer until all of its messages are released
+ *
+ * @param transport Transport the data was received for
+ * @param buffer_id Provided buffer id
+ * @param size Size of the received data
+ */
+void transport_uds_push_buffer(kb_transport_t *transport, uint16_t buffer_id, size_t size);
+
+/**
+ * @brief Check if the received data has a complete frame, which doesn't need a socket read.
+ *        A frame may start in the receive buffer and continue in provided buffers.
+ *        Nothing is buffered while the receive is stalled for lack of room
+ *
+ * @param transport Transport to check
+ * @return true if the next receive parses a frame without reading the socket
+ */
+bool transport_uds_has_buffered_message(kb_transport_t *transport);
+
+/**
+ * @brief Check if the peer closed the connection. Nothing is received after it
+ *
+ * @param transport Transport to check
+ * @return true if the connection is closed
+ */
+bool transport_uds_is_disconnected(kb_transport_t *transport);
+
 /**
  * @brief Release a received message back to the transport
  *
@@ -119,7 +344,8 @@ kb_message_t *transport_uds_message_receive(kb_transport_t *transport);
 int transport_uds_message_release(kb_transport_t *transport, kb_message_t *message);
 
 /**
- * @brief Destroy a UDS transport and release all resources
+ * @brief Destroy a UDS transport and release all resources.
+ *        If zero-copy sends are not completed yet, the memory is released when their completions are handled
  *
  * @param transport Transport to destroy
  */
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <log4c.h>
 
 #ifdef NDEBUG
@@ -7,3 +10,24 @@
 #else
     #define log_trace(a_category, a_format, ...) log4c_category_log(a_category, LOG4C_PRIORITY_TRACE, a_format, ##__VA_ARGS__);
 #endif
+
+// Packed arrays are little-endian in the document. Converts them from or to the host byte order in place
+static inline void packed_values_swap_order(uint8_t *values, size_t count, size_t element_size)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t *value = values + i * element_size;
+        for (size_t low = 0, high = element_size - 1; low < high; low++, high--)
+        {
+            uint8_t byte = value[low];
+            value[low] = value[high];
+            value[high] = byte;
+        }
+    }
+#else
+    (void)values;
+    (void)count;
+    (void)element_size;
+#endif
+}
@@ -1,28 +1,75 @@
+#pragma once
+
 #include <bson.h>
 #include <log4c/category.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maximum nesting depth of documents and arrays below the root document
+#define KB_WRITER_MAX_DEPTH 8
+
+// Append with BSON unless the message buffer has failed to grow. The append which hits the failure fails too
+#define WRITER_APPEND(stack, append) (!(stack)->failed && (append) && !(stack)->failed)
+
+typedef struct kb_writer_stack_s kb_writer_stack_t;
+
 struct kb_document_writer_s
 {
-    bson_t *bson;
-    bson_t *parent_document;
-    bson_array_builder_t *parent_array;
+    uint8_t *buffer;                   // Root document buffer. Updated by BSON when it grows the buffer
+    size_t buffer_size;                // Root document buffer size
+    bson_t *bson;                      // Points to `nested` for nested documents
+    bson_t nested;                     // Nested document written in place into the parent buffer
+    bson_t *parent;                    // Parent document or array. NULL for the root document
+    kb_writer_stack_t *stack;          // Nested writers of the root document
     log4c_category_t *logger;
 };
 
 struct kb_array_writer_s
 {
-    bson_array_builder_t *builder;
-    bson_t *parent_document;
-    bson_array_builder_t *parent_array;
+    bson_t bson;                       // Array written in place into the parent buffer
+    bson_t *parent;                    // Parent document or array
+    uint32_t index;                    // Index of the next element, which is its key
+    kb_writer_stack_t *stack;          // Nested writers of the root document
     log4c_category_t *logger;
 };
 
+/**
+ * @brief Nested writer slot
+ */
+union kb_writer_frame_u
+{
+    struct kb_document_writer_s document;
+    struct kb_array_writer_s array;
+};
+
+/**
+ * @brief Fixed-depth stack of nested writers. Allocated with the root document writer,
+ *        so nested documents and arrays don't allocate
+ */
+struct kb_writer_stack_s
+{
+    size_t depth;                                   // Number of open nested writers
+    bool failed;                                    // The buffer failed to grow. Nothing can be appended anymore
+    union kb_writer_frame_u frames[KB_WRITER_MAX_DEPTH];
+};
+
 // Document
-kb_document_writer_t *doc_writer_from_buffer(uint8_t *data, size_t size, log4c_category_t *logger);
+kb_document_writer_t *doc_writer_from_buffer(uint8_t *data, size_t size, bson_realloc_func realloc_func,
+                                             void *realloc_ctx, log4c_category_t *logger);
 bool doc_writer_destroy(kb_document_writer_t *writer);
+void doc_writer_reset(kb_document_writer_t *writer, uint8_t *data, size_t size);
 
 size_t doc_writer_data_size(kb_document_writer_t *writer);
 
-// Array
-kb_array_writer_t *arr_writer_create(kb_document_writer_t *document, const char *key, log4c_category_t *logger);
-bool arr_writer_finish(kb_array_writer_t *writer);
\ No newline at end of file
+// Nested writers
+kb_document_writer_t *writer_stack_push_document(kb_writer_stack_t *stack, bson_t *parent, const char *key,
+                                                 int key_length, log4c_category_t *logger);
+kb_array_writer_t *writer_stack_push_array(kb_writer_stack_t *stack, bson_t *parent, const char *key,
+                                           int key_length, log4c_category_t *logger);
+bool writer_stack_pop(kb_writer_stack_t *stack, bson_t *parent, bson_t *child, bool is_array, log4c_category_t *logger);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
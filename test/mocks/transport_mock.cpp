@@ -18,7 +18,7 @@ int MessageWriterMock::send_impl(struct kb_message_writer_s *writer)
 
 MessageMock::MessageMock(std::array<uint8_t, MESSAGE_SIZE> &&data): m_data(std::move(data))
 {
-    message_init(this, m_data.data(), m_data.size());
+    message_init_static(this, &m_document, m_data.data(), m_data.size());
     destroy = destroy_impl;
 }
 
@@ -35,7 +35,10 @@ TransportMock::TransportMock(log4c_category_t *logger,
     logger = logger;
     name = name;
     message_init = message_init_impl;
+    message_init_sized = nullptr;
     message_receive = message_receive_impl;
+    message_receive_batch = nullptr;
+    flush = nullptr;
 }
 
 kb_message_writer_t *TransportMock::TransportMock::message_init_impl(struct kb_transport_s *transport)
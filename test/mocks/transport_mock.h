@@ -35,6 +35,7 @@ public:
 
 private:
     std::array<uint8_t, MESSAGE_SIZE> m_data;
+    bson_t m_document;
 };
 
 class TransportMock: public kb_transport_s
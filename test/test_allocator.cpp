@@ -127,7 +127,7 @@ TEST_F(AllocatorTest, TestAllocatorCreation)
     ASSERT_EQ(allocator->header->futex, 0);
     ASSERT_LT(allocator->header->total_size, memory.size());
     ASSERT_EQ(allocator->header->free_size, allocator->header->total_size);
-    ASSERT_NE(allocator->header->next_free_block_offset, (size_t)-1); // Should have a free block
+    ASSERT_NE(allocator->header->free_bins_bitmap, 0); // Should have a free block
 
     // Check that we have a single free block
     auto blocks = getAllBlocks(allocator);
@@ -299,6 +299,180 @@ TEST_F(AllocatorTest, TestAllocUntilFull)
     allocator_free(allocator, ptr);
 }
 
+TEST_F(AllocatorTest, TestFragmentedReuse)
+{
+    std::vector<void *> ptrs;
+
+    while (true)
+    {
+        void *ptr = allocator_alloc(allocator);
+        if (ptr == nullptr)
+            break;
+        ptrs.push_back(ptr);
+    }
+
+    ASSERT_GT(ptrs.size(), 4);
+
+    // Free every other block, so none of the free blocks can be coalesced
+    std::vector<void *> freed;
+    for (size_t i = 0; i < ptrs.size(); i += 2)
+    {
+        allocator_free(allocator, ptrs[i]);
+        freed.push_back(ptrs[i]);
+    }
+
+    ASSERT_NE(allocator->header->free_bins_bitmap, 0);
+
+    // All fragments are reused by the same size allocations
+    std::vector<void *> reused;
+    for (size_t i = 0; i < freed.size(); i++)
+    {
+        void *ptr = allocator_alloc(allocator);
+        ASSERT_NE(ptr, nullptr);
+        reused.push_back(ptr);
+    }
+
+    std::sort(freed.begin(), freed.end());
+    std::sort(reused.begin(), reused.end());
+    ASSERT_EQ(freed, reused);
+
+    for (size_t i = 1; i < ptrs.size(); i += 2)
+    {
+        allocator_free(allocator, ptrs[i]);
+    }
+
+    for (void *ptr : reused)
+    {
+        allocator_free(allocator, ptr);
+    }
+
+    // Everything is coalesced back into a single block
+    auto blocks = getAllBlocks(allocator);
+    ASSERT_EQ(blocks.size(), 1);
+    ASSERT_EQ(blocks[0].type, KB_BLOCK_TAG_FREE);
+    ASSERT_EQ(allocator->header->free_size, allocator->header->total_size);
+}
+
+TEST_F(AllocatorTest, TestSameClassFit)
+{
+    // Two blocks of the same size class, separated so they can't be coalesced
+    void *big = allocator_alloc_n(allocator, 944);
+    void *big_separator = allocator_alloc_n(allocator, 16);
+    void *small = allocator_alloc_n(allocator, 560);
+    void *small_separator = allocator_alloc_n(allocator, 16);
+    ASSERT_NE(big, nullptr);
+    ASSERT_NE(big_separator, nullptr);
+    ASSERT_NE(small, nullptr);
+    ASSERT_NE(small_separator, nullptr);
+
+    // Take the rest of the arena, so no bigger block is free
+    std::vector<void *> rest;
+    while (void *ptr = allocator_alloc_n(allocator, 16))
+    {
+        rest.push_back(ptr);
+    }
+
+    // The smaller block becomes the head of the size class
+    allocator_free(allocator, big);
+    allocator_free(allocator, small);
+
+    // The head is too small, the block behind it fits
+    void *ptr = allocator_alloc_n(allocator, 896);
+    ASSERT_EQ(ptr, big);
+
+    allocator_free(allocator, ptr);
+    allocator_free(allocator, big_separator);
+    allocator_free(allocator, small_separator);
+    for (void *ptr : rest)
+    {
+        allocator_free(allocator, ptr);
+    }
+
+    auto blocks = getAllBlocks(allocator);
+    ASSERT_EQ(blocks.size(), 1);
+    ASSERT_EQ(allocator->header->free_size, allocator->header->total_size);
+}
+
+TEST_F(AllocatorTest, TestSizedAllocation)
+{
+    void *small = allocator_alloc_n(allocator, 16);
+    void *big = allocator_alloc(allocator);
+    ASSERT_NE(small, nullptr);
+    ASSERT_NE(big, nullptr);
+
+    auto blocks = getAllBlocks(allocator);
+    ASSERT_EQ(blocks[0].type, KB_BLOCK_TAG_ALLOCATED);
+    ASSERT_EQ(blocks[1].type, KB_BLOCK_TAG_ALLOCATED);
+    ASSERT_LT(blocks[0].size, blocks[1].size);
+
+    allocator_free(allocator, small);
+    allocator_free(allocator, big);
+
+    blocks = getAllBlocks(allocator);
+    ASSERT_EQ(blocks.size(), 1);
+}
+
+TEST_F(AllocatorTest, TestTinyAllocation)
+{
+    void *tiny = allocator_alloc_n(allocator, 8);
+    void *separator = allocator_alloc_n(allocator, 16);
+    ASSERT_NE(tiny, nullptr);
+    ASSERT_NE(separator, nullptr);
+
+    // Tiny blocks still get a full size class
+    auto blocks = getAllBlocks(allocator);
+    ASSERT_EQ(blocks[0].size, blocks[1].size);
+
+    // Trimming can't shrink a block below the smallest size class either
+    void *trimmed = allocator_alloc(allocator);
+    ASSERT_NE(trimmed, nullptr);
+    allocator_trim(allocator, trimmed, 8);
+
+    blocks = getAllBlocks(allocator);
+    ASSERT_EQ(blocks[2].size, blocks[0].size);
+
+    // A freed tiny block is not handed out for a bigger allocation
+    allocator_free(allocator, tiny);
+    void *big = allocator_alloc(allocator);
+    ASSERT_NE(big, nullptr);
+    ASSERT_NE(big, tiny);
+
+    allocator_free(allocator, big);
+    allocator_free(allocator, trimmed);
+    allocator_free(allocator, separator);
+
+    blocks = getAllBlocks(allocator);
+    ASSERT_EQ(blocks.size(), 1);
+    ASSERT_EQ(allocator->header->free_size, allocator->header->total_size);
+}
+
+TEST_F(AllocatorTest, TestGrowInPlace)
+{
+    void *ptr = allocator_alloc_n(allocator, 16);
+    ASSERT_NE(ptr, nullptr);
+    memcpy(ptr, TEST_DATA, 16);
+
+    // The rest of the arena is free, so the block grows in place
+    ASSERT_TRUE(allocator_grow(allocator, ptr, 512));
+    ASSERT_EQ(memcmp(ptr, TEST_DATA, 16), 0);
+
+    auto blocks = getAllBlocks(allocator);
+    ASSERT_EQ(blocks[0].type, KB_BLOCK_TAG_ALLOCATED);
+    ASSERT_GE(blocks[0].size, 512);
+
+    // A taken neighbour prevents growing
+    void *next = allocator_alloc_n(allocator, 16);
+    ASSERT_NE(next, nullptr);
+    ASSERT_FALSE(allocator_grow(allocator, ptr, 1024));
+
+    allocator_free(allocator, ptr);
+    allocator_free(allocator, next);
+
+    blocks = getAllBlocks(allocator);
+    ASSERT_EQ(blocks.size(), 1);
+    ASSERT_EQ(allocator->header->free_size, allocator->header->total_size);
+}
+
 TEST_F(AllocatorTest, TestBlockOffset)
 {
     // Get a block and check its offset
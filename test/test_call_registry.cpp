@@ -0,0 +1,131 @@
+#include <random>
+#include <unordered_map>
+
+#include <gtest/gtest.h>
+#include <log4c.h>
+
+#include <call_registry.h>
+
+TEST(CallRegistry, TestFullWidthIds)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    kb_call_registry_t registry;
+    ASSERT_TRUE(call_registry_init(&registry, 4, logger));
+
+    // IDs which are the same in the lower 32 bits
+    uint64_t low_id = 42;
+    uint64_t high_id = (1ull << 40) | 42;
+
+    int low_context = 0;
+    int high_context = 0;
+    ASSERT_NE(call_registry_insert(&registry, low_id, KB_MESSAGE_TYPE_CALL, nullptr, &low_context), nullptr);
+    ASSERT_NE(call_registry_insert(&registry, high_id, KB_MESSAGE_TYPE_SUBSCRIPTION, nullptr, &high_context), nullptr);
+
+    kb_call_entry_t *entry = call_registry_find(&registry, high_id);
+    ASSERT_NE(entry, nullptr);
+    ASSERT_EQ(entry->context, &high_context);
+    ASSERT_EQ(entry->type, KB_MESSAGE_TYPE_SUBSCRIPTION);
+
+    ASSERT_TRUE(call_registry_remove(&registry, low_id));
+    ASSERT_FALSE(call_registry_remove(&registry, low_id));
+    ASSERT_EQ(call_registry_find(&registry, low_id), nullptr);
+    ASSERT_NE(call_registry_find(&registry, high_id), nullptr);
+    ASSERT_EQ(registry.size, 1);
+
+    call_registry_deinit(&registry);
+}
+
+TEST(CallRegistry, TestRandomOperations)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    kb_call_registry_t registry;
+    ASSERT_TRUE(call_registry_init(&registry, 8, logger));
+
+    std::mt19937_64 random(12345);
+    std::unordered_map<uint64_t, size_t> expected;
+
+    // Small ID range for a lot of collisions and removals in the middle of clusters
+    for (size_t i = 0; i < 100000; i++)
+    {
+        uint64_t id = random() % 2048;
+        if (random() % 3 != 0 && expected.find(id) == expected.end())
+        {
+            ASSERT_NE(call_registry_insert(&registry, id, KB_MESSAGE_TYPE_CALL, nullptr, (void *)i), nullptr);
+            expected[id] = i;
+        }
+        else
+        {
+            ASSERT_EQ(call_registry_remove(&registry, id), expected.erase(id) == 1);
+        }
+
+        ASSERT_EQ(registry.size, expected.size());
+    }
+
+    // The registry grew from 8 entries
+    ASSERT_GE(registry.capacity, expected.size());
+
+    for (uint64_t id = 0; id < 2048; id++)
+    {
+        kb_call_entry_t *entry = call_registry_find(&registry, id);
+        auto it = expected.find(id);
+        if (it == expected.end())
+        {
+            ASSERT_EQ(entry, nullptr);
+        }
+        else
+        {
+            ASSERT_NE(entry, nullptr);
+            ASSERT_EQ(entry->context, (void *)it->second);
+        }
+    }
+
+    call_registry_deinit(&registry);
+}
+
+static void count_timeout(kb_message_t *message, void *context)
+{
+    ASSERT_EQ(message, nullptr);
+    (*(int *)context)++;
+}
+
+TEST(CallRegistry, TestDeadlines)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    kb_call_registry_t registry;
+    ASSERT_TRUE(call_registry_init(&registry, 2, logger));
+
+    int timeouts = 0;
+    uint64_t now = 5000;
+
+    kb_call_entry_t *entry = call_registry_insert(&registry, 1, KB_MESSAGE_TYPE_CALL, count_timeout, &timeouts);
+    call_registry_set_deadline(&registry, entry, now + 100, now);
+    entry = call_registry_insert(&registry, 2, KB_MESSAGE_TYPE_CALL, count_timeout, &timeouts);
+    call_registry_set_deadline(&registry, entry, now + 200, now);
+    // No deadline
+    call_registry_insert(&registry, 3, KB_MESSAGE_TYPE_CALL, count_timeout, &timeouts);
+
+    // The growth keeps the deadlines
+    for (uint64_t id = 10; id < 20; id++)
+    {
+        call_registry_insert(&registry, id, KB_MESSAGE_TYPE_CALL, count_timeout, &timeouts);
+    }
+
+    // May be earlier than the deadline if the timer wheel has to cascade
+    ASSERT_GT(call_registry_next_expiry(&registry), now);
+    ASSERT_LE(call_registry_next_expiry(&registry), now + 100);
+
+    // Responded calls don't time out
+    ASSERT_TRUE(call_registry_remove(&registry, 2));
+
+    ASSERT_EQ(call_registry_expire(&registry, now + 99), 0);
+    ASSERT_EQ(call_registry_expire(&registry, now + 1000), 1);
+    ASSERT_EQ(timeouts, 1);
+    ASSERT_EQ(call_registry_find(&registry, 1), nullptr);
+    ASSERT_NE(call_registry_find(&registry, 3), nullptr);
+    ASSERT_EQ(call_registry_next_expiry(&registry), UINT64_MAX);
+
+    call_registry_deinit(&registry);
+}
@@ -0,0 +1,605 @@
+#include <gtest/gtest.h>
+#include <log4c.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <bson.h>
+
+#include <array.h>
+#include <document.h>
+#include <document_schema.h>
+#include <array_writer.h>
+#include <document_writer.h>
+#include <message_writer.h>
+#include <writers_private.h>
+#include <readers_private.h>
+
+static bson_t *make_document(size_t num_fields)
+{
+    bson_t *bson = bson_new();
+    BSON_APPEND_INT32(bson, "int", 42);
+    BSON_APPEND_UTF8(bson, "string", "hello");
+    BSON_APPEND_DOUBLE(bson, "double", 4.2);
+    BSON_APPEND_BOOL(bson, "bool", true);
+
+    for (size_t i = 0; i < num_fields; i++)
+    {
+        char key[32];
+        snprintf(key, sizeof(key), "field_%zu", i);
+        BSON_APPEND_INT64(bson, key, (int64_t)i);
+    }
+
+    return bson;
+}
+
+static void check_fields(kb_document_t *document, size_t num_fields)
+{
+    bool success = false;
+
+    // Read backwards, so every lookup starts past the field
+    for (size_t i = num_fields; i-- > 0;)
+    {
+        char key[32];
+        snprintf(key, sizeof(key), "field_%zu", i);
+        ASSERT_EQ(document_get_int64(document, key, &success), (int64_t)i);
+        ASSERT_TRUE(success);
+    }
+
+    ASSERT_TRUE(document_get_bool(document, "bool", &success));
+    ASSERT_TRUE(success);
+    ASSERT_EQ(document_get_double(document, "double", &success), 4.2);
+    ASSERT_TRUE(success);
+
+    size_t size = 0;
+    ASSERT_STREQ(document_get_utf8(document, "string", &size, &success), "hello");
+    ASSERT_TRUE(success);
+    ASSERT_EQ(size, 5);
+
+    ASSERT_EQ(document_get_int32(document, "int", &success), 42);
+    ASSERT_TRUE(success);
+
+    ASSERT_FALSE(document_has_field(document, "missing"));
+    ASSERT_FALSE(document_has_field(document, "in"));
+    document_get_int32(document, "string", &success);
+    ASSERT_FALSE(success);
+}
+
+TEST(Document, TestOutOfOrderLookup)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    bson_t *bson = make_document(4);
+    kb_document_t *document = document_from_data((uint8_t *)bson_get_data(bson), bson->len, logger);
+    ASSERT_NE(document, nullptr);
+
+    check_fields(document, 4);
+
+    document_destroy(document);
+    bson_destroy(bson);
+}
+
+TEST(Document, TestIndexedLookup)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    // Enough fields to grow the index a couple of times
+    bson_t *bson = make_document(200);
+    kb_document_t *document = document_from_data((uint8_t *)bson_get_data(bson), bson->len, logger);
+    ASSERT_NE(document, nullptr);
+
+    ASSERT_TRUE(document_build_index(document));
+    ASSERT_EQ(document->index_size, 204);
+    ASSERT_GE(document->index_capacity, 2 * document->index_size);
+
+    check_fields(document, 200);
+
+    document_destroy(document);
+    bson_destroy(bson);
+}
+
+TEST(Document, TestIndexedDuplicateKeys)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    bson_t *bson = bson_new();
+    BSON_APPEND_INT32(bson, "key", 1);
+    BSON_APPEND_INT32(bson, "key", 2);
+
+    kb_document_t *document = document_from_data((uint8_t *)bson_get_data(bson), bson->len, logger);
+    ASSERT_NE(document, nullptr);
+    ASSERT_TRUE(document_build_index(document));
+
+    // Same as a linear search: the first field wins
+    bool success = false;
+    ASSERT_EQ(document_get_int32(document, "key", &success), 1);
+    ASSERT_TRUE(success);
+
+    document_destroy(document);
+    bson_destroy(bson);
+}
+
+struct Telemetry
+{
+    int32_t int_value;
+    kb_schema_string_t string_value;
+    double double_value;
+    bool bool_value;
+    int64_t optional_value;
+};
+
+static const kb_schema_field_t TELEMETRY_FIELDS[] = {
+    {"int", KB_VALUE_TYPE_INT32, offsetof(Telemetry, int_value), true},
+    {"string", KB_VALUE_TYPE_STRING, offsetof(Telemetry, string_value), true},
+    {"double", KB_VALUE_TYPE_DOUBLE, offsetof(Telemetry, double_value), true},
+    {"bool", KB_VALUE_TYPE_BOOL, offsetof(Telemetry, bool_value), true},
+    {"optional", KB_VALUE_TYPE_INT64, offsetof(Telemetry, optional_value), false},
+};
+
+TEST(Document, TestSchemaExtract)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    kb_document_schema_t *schema = document_schema_create(TELEMETRY_FIELDS, 5, logger);
+    ASSERT_NE(schema, nullptr);
+
+    // Extra fields are skipped
+    bson_t *bson = make_document(3);
+    kb_document_t *document = document_from_data((uint8_t *)bson_get_data(bson), bson->len, logger);
+    ASSERT_NE(document, nullptr);
+
+    Telemetry telemetry = {};
+    uint64_t present = 0;
+    ASSERT_TRUE(document_schema_extract(schema, document, &telemetry, &present));
+    ASSERT_EQ(present, 0b1111);
+    ASSERT_EQ(telemetry.int_value, 42);
+    ASSERT_EQ(std::string(telemetry.string_value.str, telemetry.string_value.len), "hello");
+    ASSERT_EQ(telemetry.double_value, 4.2);
+    ASSERT_TRUE(telemetry.bool_value);
+
+    document_destroy(document);
+    bson_destroy(bson);
+
+    // Out of order fields
+    bson = bson_new();
+    BSON_APPEND_INT64(bson, "optional", 11);
+    BSON_APPEND_BOOL(bson, "bool", false);
+    BSON_APPEND_DOUBLE(bson, "double", 1.5);
+    BSON_APPEND_UTF8(bson, "string", "world");
+    BSON_APPEND_INT32(bson, "int", 7);
+
+    document = document_from_data((uint8_t *)bson_get_data(bson), bson->len, logger);
+    ASSERT_TRUE(document_schema_extract(schema, document, &telemetry, &present));
+    ASSERT_EQ(present, 0b11111);
+    ASSERT_EQ(telemetry.int_value, 7);
+    ASSERT_EQ(std::string(telemetry.string_value.str, telemetry.string_value.len), "world");
+    ASSERT_EQ(telemetry.double_value, 1.5);
+    ASSERT_FALSE(telemetry.bool_value);
+    ASSERT_EQ(telemetry.optional_value, 11);
+
+    document_destroy(document);
+    bson_destroy(bson);
+    document_schema_destroy(schema);
+}
+
+TEST(Document, TestSchemaValidation)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    kb_document_schema_t *schema = document_schema_create(TELEMETRY_FIELDS, 5, logger);
+    ASSERT_NE(schema, nullptr);
+
+    // Wrong type
+    bson_t *bson = bson_new();
+    BSON_APPEND_UTF8(bson, "int", "42");
+
+    kb_document_t *document = document_from_data((uint8_t *)bson_get_data(bson), bson->len, logger);
+    Telemetry telemetry = {};
+    ASSERT_FALSE(document_schema_extract(schema, document, &telemetry, nullptr));
+
+    document_destroy(document);
+    bson_destroy(bson);
+
+    // Wrong type after a valid field still reports the fields found before it
+    bson = bson_new();
+    BSON_APPEND_INT32(bson, "int", 42);
+    BSON_APPEND_INT32(bson, "string", 42);
+
+    document = document_from_data((uint8_t *)bson_get_data(bson), bson->len, logger);
+    uint64_t present = ~0ull;
+    ASSERT_FALSE(document_schema_extract(schema, document, &telemetry, &present));
+    ASSERT_EQ(present, 0b1);
+
+    document_destroy(document);
+    bson_destroy(bson);
+
+    // Missing required fields
+    bson = bson_new();
+    BSON_APPEND_INT32(bson, "int", 42);
+
+    document = document_from_data((uint8_t *)bson_get_data(bson), bson->len, logger);
+    present = ~0ull;
+    ASSERT_FALSE(document_schema_extract(schema, document, &telemetry, &present));
+    ASSERT_EQ(present, 0b1);
+
+    document_destroy(document);
+    bson_destroy(bson);
+    document_schema_destroy(schema);
+}
+
+TEST(Document, TestNestedReaders)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    bson_t *bson = bson_new();
+    bson_t child, array, array_child;
+    bson_append_document_begin(bson, "child", -1, &child);
+    BSON_APPEND_INT32(&child, "value", 42);
+    bson_append_document_end(bson, &child);
+
+    bson_append_array_begin(bson, "array", -1, &array);
+    for (int32_t i = 0; i < 10; i++)
+    {
+        char key[16];
+        snprintf(key, sizeof(key), "%d", i);
+        BSON_APPEND_INT32(&array, key, i);
+    }
+    bson_append_array_end(bson, &array);
+
+    bson_append_array_begin(bson, "mixed", -1, &array);
+    BSON_APPEND_UTF8(&array, "0", "hello");
+    bson_append_document_begin(&array, "1", -1, &array_child);
+    BSON_APPEND_BOOL(&array_child, "flag", true);
+    bson_append_document_end(&array, &array_child);
+    bson_append_array_end(bson, &array);
+
+    kb_document_t *document = document_from_data((uint8_t *)bson_get_data(bson), bson->len, logger);
+    ASSERT_NE(document, nullptr);
+
+    bool success = false;
+    kb_document_t *child_document = document_get_document(document, "child", &success);
+    ASSERT_TRUE(success);
+    ASSERT_EQ(document_get_int32(child_document, "value", &success), 42);
+    ASSERT_TRUE(success);
+
+    // Readers are cached by the parent
+    ASSERT_EQ(document_get_document(document, "child", &success), child_document);
+    kb_value_t value = document_get_value(document, "child");
+    ASSERT_EQ(value.type, KB_VALUE_TYPE_DOCUMENT);
+    ASSERT_EQ(value.value.document, child_document);
+
+    ASSERT_EQ(document_get_document(document, "array", &success), nullptr);
+    ASSERT_FALSE(success);
+
+    kb_array_t *numbers = document_get_array(document, "array", &success);
+    ASSERT_TRUE(success);
+    ASSERT_EQ(array_length(numbers), 10);
+
+    int32_t values[16];
+    ASSERT_EQ(array_get_int32_values(numbers, values, 16, &success), 10);
+    ASSERT_TRUE(success);
+    for (int32_t i = 0; i < 10; i++)
+    {
+        ASSERT_EQ(values[i], i);
+    }
+
+    ASSERT_EQ(array_get_int32_values(numbers, values, 4, &success), 4);
+    ASSERT_TRUE(success);
+
+    int64_t wide_values[16];
+    ASSERT_EQ(array_get_int64_values(numbers, wide_values, 16, &success), 0);
+    ASSERT_FALSE(success);
+
+    value = document_get_value(document, "mixed");
+    ASSERT_EQ(value.type, KB_VALUE_TYPE_ARRAY);
+    kb_array_t *mixed = value.value.array;
+
+    ASSERT_TRUE(array_next(mixed));
+    ASSERT_EQ(array_value_type(mixed), KB_VALUE_TYPE_STRING);
+    value = array_get_value(mixed);
+    ASSERT_EQ(std::string(value.value.utf8.str, value.value.utf8.len), "hello");
+
+    ASSERT_TRUE(array_next(mixed));
+    value = array_get_value(mixed);
+    ASSERT_EQ(value.type, KB_VALUE_TYPE_DOCUMENT);
+    ASSERT_TRUE(document_get_bool(value.value.document, "flag", &success));
+    ASSERT_TRUE(success);
+
+    ASSERT_FALSE(array_next(mixed));
+
+    array_rewind(mixed);
+    ASSERT_TRUE(array_next(mixed));
+    ASSERT_EQ(array_value_type(mixed), KB_VALUE_TYPE_STRING);
+
+    // Frees the nested readers
+    document_destroy(document);
+    bson_destroy(bson);
+}
+
+TEST(Document, TestManyNestedReaders)
+{
+    static constexpr int32_t NUM_CHILDREN = 1000;
+
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    bson_t *bson = bson_new();
+    bson_t array, array_child;
+    bson_append_array_begin(bson, "children", -1, &array);
+    for (int32_t i = 0; i < NUM_CHILDREN; i++)
+    {
+        char key[16];
+        snprintf(key, sizeof(key), "%d", i);
+        bson_append_document_begin(&array, key, -1, &array_child);
+        BSON_APPEND_INT32(&array_child, "index", i);
+        bson_append_document_end(&array, &array_child);
+    }
+    bson_append_array_end(bson, &array);
+
+    kb_document_t *document = document_from_data((uint8_t *)bson_get_data(bson), bson->len, logger);
+    ASSERT_NE(document, nullptr);
+
+    bool success = false;
+    kb_array_t *children = document_get_array(document, "children", &success);
+    ASSERT_TRUE(success);
+
+    // Every element gets its own reader, found by its data the next time
+    std::vector<kb_document_t *> readers;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        array_rewind(children);
+        for (int32_t i = 0; i < NUM_CHILDREN; i++)
+        {
+            ASSERT_TRUE(array_next(children));
+            kb_value_t value = array_get_value(children);
+            ASSERT_EQ(value.type, KB_VALUE_TYPE_DOCUMENT);
+            ASSERT_EQ(document_get_int32(value.value.document, "index", &success), i);
+
+            if (pass == 0)
+            {
+                readers.push_back(value.value.document);
+            }
+            else
+            {
+                ASSERT_EQ(value.value.document, readers[i]);
+            }
+        }
+    }
+
+    ASSERT_EQ(children->children.size, (size_t)NUM_CHILDREN);
+
+    document_destroy(document);
+    bson_destroy(bson);
+}
+
+TEST(Document, TestPackedArrays)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    std::vector<int32_t> int_values(1000);
+    std::vector<double> double_values(1000);
+    for (size_t i = 0; i < int_values.size(); i++)
+    {
+        int_values[i] = (int32_t)i;
+        double_values[i] = i * 0.5;
+    }
+    int64_t wide_values[] = {INT64_MIN, 0, INT64_MAX};
+
+    uint8_t *buffer = (uint8_t *)malloc(64);
+    kb_document_writer_t *writer = doc_writer_from_buffer(buffer, 64, bson_realloc_ctx, NULL, logger);
+    ASSERT_NE(writer, nullptr);
+
+    // Different key lengths need different padding
+    ASSERT_TRUE(doc_writer_append_int32_array(writer, "ints", int_values.data(), int_values.size()));
+    ASSERT_TRUE(doc_writer_append_double_array(writer, "doubles_", double_values.data(), double_values.size()));
+    ASSERT_TRUE(doc_writer_append_int64_array(writer, "i", wide_values, 3));
+    ASSERT_TRUE(doc_writer_append_int32_array(writer, "empty", nullptr, 0));
+
+    // Packed arrays are written as binaries, so a couple of bytes per element
+    ASSERT_LT(doc_writer_data_size(writer), 1000 * (sizeof(int32_t) + sizeof(double)) + 128);
+
+    kb_document_t *document = document_from_data(writer->buffer, doc_writer_data_size(writer), logger);
+    ASSERT_NE(document, nullptr);
+
+    bool success = false;
+    size_t count = 0;
+    const int32_t *ints = document_get_int32_array(document, "ints", &count, &success);
+    ASSERT_TRUE(success);
+    ASSERT_EQ(count, int_values.size());
+    ASSERT_EQ((uintptr_t)ints % alignof(int32_t), 0);
+    ASSERT_TRUE(std::equal(ints, ints + count, int_values.begin()));
+
+    const double *doubles = document_get_double_array(document, "doubles_", &count, &success);
+    ASSERT_TRUE(success);
+    ASSERT_EQ(count, double_values.size());
+    ASSERT_EQ((uintptr_t)doubles % alignof(double), 0);
+    ASSERT_TRUE(std::equal(doubles, doubles + count, double_values.begin()));
+
+    const int64_t *wide = document_get_int64_array(document, "i", &count, &success);
+    ASSERT_TRUE(success);
+    ASSERT_EQ(count, 3);
+    ASSERT_EQ(wide[0], INT64_MIN);
+    ASSERT_EQ(wide[2], INT64_MAX);
+
+    document_get_int32_array(document, "empty", &count, &success);
+    ASSERT_TRUE(success);
+    ASSERT_EQ(count, 0);
+
+    // Wrong element type
+    document_get_double_array(document, "ints", &count, &success);
+    ASSERT_FALSE(success);
+
+    document_destroy(document);
+
+    // Stream transports put documents right after a 5 byte frame header
+    std::vector<uint8_t> shifted(doc_writer_data_size(writer) + 5 + alignof(double));
+    uint8_t *odd_data = shifted.data() + (alignof(double) - (uintptr_t)shifted.data() % alignof(double)) + 5;
+    memcpy(odd_data, writer->buffer, doc_writer_data_size(writer));
+
+    document = document_from_data(odd_data, doc_writer_data_size(writer), logger);
+    ASSERT_NE(document, nullptr);
+
+    // Misaligned values are read from an aligned copy, which is made once
+    doubles = document_get_double_array(document, "doubles_", &count, &success);
+    ASSERT_TRUE(success);
+    ASSERT_EQ(count, double_values.size());
+    ASSERT_EQ((uintptr_t)doubles % alignof(double), 0);
+    ASSERT_TRUE(std::equal(doubles, doubles + count, double_values.begin()));
+    ASSERT_EQ(document_get_double_array(document, "doubles_", &count, &success), doubles);
+
+    ints = document_get_int32_array(document, "ints", &count, &success);
+    ASSERT_TRUE(success);
+    ASSERT_EQ((uintptr_t)ints % alignof(int32_t), 0);
+    ASSERT_TRUE(std::equal(ints, ints + count, int_values.begin()));
+
+    document_destroy(document);
+
+    uint8_t *data = writer->buffer;
+    doc_writer_destroy(writer);
+    free(data);
+}
+
+TEST(Document, TestNestedWriters)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    uint8_t *buffer = (uint8_t *)malloc(64);
+    kb_document_writer_t *writer = doc_writer_from_buffer(buffer, 64, bson_realloc_ctx, NULL, logger);
+    ASSERT_NE(writer, nullptr);
+
+    kb_document_writer_t *command = doc_writer_document_begin(writer, "command");
+    ASSERT_NE(command, nullptr);
+    ASSERT_TRUE(doc_writer_append_int32(command, "id", 7));
+
+    kb_array_writer_t *targets = doc_writer_array_begin(command, "targets");
+    ASSERT_NE(targets, nullptr);
+    ASSERT_TRUE(arr_writer_append_utf8(targets, "", "left", 4));
+
+    kb_document_writer_t *target = arr_writer_document_begin(targets, "");
+    ASSERT_NE(target, nullptr);
+    ASSERT_TRUE(doc_writer_append_double(target, "speed", 1.5));
+
+    // Nested writers are finished in the reverse order
+    ASSERT_FALSE(doc_writer_array_end(targets));
+    ASSERT_TRUE(arr_writer_document_end(target));
+
+    kb_array_writer_t *numbers = arr_writer_array_begin(targets, "");
+    ASSERT_NE(numbers, nullptr);
+    ASSERT_TRUE(arr_writer_append_int64(numbers, "", 1));
+    ASSERT_TRUE(arr_writer_append_int64(numbers, "", 2));
+    ASSERT_TRUE(arr_writer_array_end(numbers));
+
+    ASSERT_TRUE(doc_writer_array_end(targets));
+    ASSERT_TRUE(doc_writer_document_end(command));
+    ASSERT_TRUE(doc_writer_append_bool(writer, "done", true));
+
+    kb_document_t *document = document_from_data(writer->buffer, doc_writer_data_size(writer), logger);
+    ASSERT_NE(document, nullptr);
+
+    bool success = false;
+    kb_document_t *command_reader = document_get_document(document, "command", &success);
+    ASSERT_TRUE(success);
+    ASSERT_EQ(document_get_int32(command_reader, "id", &success), 7);
+
+    kb_array_t *targets_reader = document_get_array(command_reader, "targets", &success);
+    ASSERT_TRUE(success);
+    ASSERT_EQ(array_length(targets_reader), 3);
+
+    ASSERT_TRUE(array_next(targets_reader));
+    ASSERT_EQ(array_value_type(targets_reader), KB_VALUE_TYPE_STRING);
+    ASSERT_TRUE(array_next(targets_reader));
+    kb_value_t value = array_get_value(targets_reader);
+    ASSERT_EQ(value.type, KB_VALUE_TYPE_DOCUMENT);
+    ASSERT_EQ(document_get_double(value.value.document, "speed", &success), 1.5);
+    ASSERT_TRUE(array_next(targets_reader));
+    value = array_get_value(targets_reader);
+    ASSERT_EQ(value.type, KB_VALUE_TYPE_ARRAY);
+
+    int64_t values[2];
+    ASSERT_EQ(array_get_int64_values(value.value.array, values, 2, &success), 2);
+    ASSERT_TRUE(success);
+    ASSERT_EQ(values[1], 2);
+
+    ASSERT_TRUE(document_get_bool(document, "done", &success));
+    ASSERT_TRUE(success);
+
+    document_destroy(document);
+
+    uint8_t *data = writer->buffer;
+    doc_writer_destroy(writer);
+    free(data);
+}
+
+TEST(Document, TestNestedWritersDepthLimit)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    uint8_t *buffer = (uint8_t *)malloc(64);
+    kb_document_writer_t *writer = doc_writer_from_buffer(buffer, 64, bson_realloc_ctx, NULL, logger);
+    ASSERT_NE(writer, nullptr);
+
+    std::vector<kb_document_writer_t *> writers = {writer};
+    for (int i = 0; i < KB_WRITER_MAX_DEPTH; i++)
+    {
+        kb_document_writer_t *child = doc_writer_document_begin(writers.back(), "child");
+        ASSERT_NE(child, nullptr);
+        writers.push_back(child);
+    }
+
+    ASSERT_EQ(doc_writer_document_begin(writers.back(), "child"), nullptr);
+
+    for (size_t i = writers.size() - 1; i > 0; i--)
+    {
+        ASSERT_TRUE(doc_writer_document_end(writers[i]));
+    }
+
+    // A reset drops the open writers of a cancelled message
+    ASSERT_NE(doc_writer_document_begin(writer, "child"), nullptr);
+    doc_writer_reset(writer, writer->buffer, writer->buffer_size);
+    ASSERT_TRUE(doc_writer_append_int32(writer, "value", 1));
+
+    uint8_t *data = writer->buffer;
+    doc_writer_destroy(writer);
+    free(data);
+}
+
+TEST(Document, TestFailedGrowth)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    struct Writer
+    {
+        kb_message_writer_t base;
+        int sent = 0;
+        int cancelled = 0;
+    } writer;
+
+    uint8_t buffer[32];
+    message_writer_init(&writer.base, buffer, sizeof(buffer), logger);
+    writer.base.grow = [](kb_message_writer_t *, size_t) -> uint8_t * { return nullptr; };
+    writer.base.send = [](kb_message_writer_t *base) { ((Writer *)base)->sent++; return 0; };
+    writer.base.cancel = [](kb_message_writer_t *base) { ((Writer *)base)->cancelled++; };
+
+    kb_document_writer_t *document = message_writer_root(&writer.base);
+    ASSERT_TRUE(doc_writer_append_int32(document, "small", 1));
+    ASSERT_FALSE(message_writer_failed(&writer.base));
+
+    // Doesn't fit the buffer
+    std::vector<uint8_t> blob(256, 0xab);
+    ASSERT_FALSE(doc_writer_append_binary(document, "blob", blob.data(), blob.size()));
+    ASSERT_TRUE(message_writer_failed(&writer.base));
+
+    // The failure is sticky
+    ASSERT_FALSE(doc_writer_append_int32(document, "after", 2));
+    ASSERT_EQ(doc_writer_document_begin(document, "nested"), nullptr);
+
+    ASSERT_NE(message_send(&writer.base), 0);
+    ASSERT_EQ(writer.sent, 0);
+    ASSERT_EQ(writer.cancelled, 1);
+
+    // A reset writer is usable again
+    message_writer_reset(&writer.base, buffer, sizeof(buffer));
+    ASSERT_FALSE(message_writer_failed(&writer.base));
+    ASSERT_TRUE(doc_writer_append_int32(document, "small", 1));
+
+    message_writer_deinit(&writer.base);
+}
@@ -0,0 +1,71 @@
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <log4c.h>
+
+#include <method_registry.h>
+
+static void test_handler(struct kb_rpc_message_s *, void *)
+{
+}
+
+TEST(MethodRegistry, TestStableIds)
+{
+    ASSERT_EQ(method_id("echo"), method_id("echo"));
+    ASSERT_NE(method_id("echo"), method_id("ping"));
+    ASSERT_NE(method_id(""), KB_METHOD_NONE);
+}
+
+TEST(MethodRegistry, TestAddFind)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    kb_method_registry_t registry;
+    ASSERT_TRUE(method_registry_init(&registry, 4, logger));
+
+    int context = 0;
+    uint32_t id = method_registry_add(&registry, "echo", test_handler, &context);
+    ASSERT_EQ(id, method_id("echo"));
+
+    // Duplicate names are rejected
+    ASSERT_EQ(method_registry_add(&registry, "echo", test_handler, nullptr), KB_METHOD_NONE);
+
+    kb_method_entry_t *entry = method_registry_find(&registry, id);
+    ASSERT_NE(entry, nullptr);
+    ASSERT_STREQ(entry->name, "echo");
+    ASSERT_EQ(entry->context, &context);
+    ASSERT_EQ(method_registry_find(&registry, method_id("ping")), nullptr);
+
+    method_registry_deinit(&registry);
+}
+
+TEST(MethodRegistry, TestGrowth)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    kb_method_registry_t registry;
+    ASSERT_TRUE(method_registry_init(&registry, 4, logger));
+
+    std::vector<std::string> names;
+    for (int i = 0; i < 256; i++)
+    {
+        names.push_back("method_" + std::to_string(i));
+    }
+
+    for (auto &name : names)
+    {
+        ASSERT_NE(method_registry_add(&registry, name.c_str(), test_handler, nullptr), KB_METHOD_NONE);
+    }
+
+    ASSERT_EQ(registry.size, names.size());
+
+    for (auto &name : names)
+    {
+        kb_method_entry_t *entry = method_registry_find(&registry, method_id(name.c_str()));
+        ASSERT_NE(entry, nullptr);
+        ASSERT_EQ(entry->name, name.c_str());
+    }
+
+    method_registry_deinit(&registry);
+}
@@ -168,4 +168,148 @@ TEST(Rpc, TestRpcSubscriptions)
     rpc_message_release(rpc_message);
     rpc_destroy(rpc_writer);
     rpc_destroy(rpc_reader);
-}
\ No newline at end of file
+}
+
+TEST(Rpc, TestRpcHeader)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    TransportMock transport(logger, "test");
+    auto rpc_writer = rpc_init(&transport, logger);
+
+    auto outgoing_message = rpc_call_method(rpc_writer, method_id("echo"), [](kb_message_t *, void *) {}, nullptr, 1000);
+    ASSERT_NE(outgoing_message, nullptr);
+    ASSERT_TRUE(doc_writer_append_int32(message_writer_root(outgoing_message), "value", 42));
+    ASSERT_EQ(message_send(outgoing_message), 0);
+
+    auto incoming_message = transport_message_receive(&transport);
+    ASSERT_NE(incoming_message, nullptr);
+
+    kb_rpc_header_t header;
+    ASSERT_TRUE(rpc_read_message_header(incoming_message, &header));
+    ASSERT_EQ(header.type, KB_MESSAGE_TYPE_CALL);
+    ASSERT_EQ(header.method_id, method_id("echo"));
+    ASSERT_NE(header.id, 0);
+    ASSERT_NE(header.deadline, 0);
+    ASSERT_EQ(header.flags, 0);
+
+    // The header must be the first element
+    auto late_header = transport_message_init(&transport);
+    ASSERT_NE(late_header, nullptr);
+    ASSERT_TRUE(doc_writer_append_int32(message_writer_root(late_header), "value", 42));
+    ASSERT_FALSE(rpc_write_message_header(late_header, &header));
+    message_cancel(late_header);
+
+    message_destroy(incoming_message);
+    rpc_destroy(rpc_writer);
+}
+
+TEST(Rpc, TestRpcStreamCredits)
+{
+    struct Counters
+    {
+        int responses = 0;
+        int ends = 0;
+        int writable = 0;
+    } counters;
+
+    auto callback = [](kb_message_t *message, void *context)
+    {
+        auto counters = (Counters *)context;
+        if (rpc_message_end_of_stream(message))
+        {
+            counters->ends++;
+        }
+        else
+        {
+            counters->responses++;
+        }
+    };
+
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    TransportMock transport(logger, "test");
+    auto rpc_subscriber = rpc_init(&transport, logger);
+    auto rpc_publisher = rpc_init(&transport, logger);
+
+    uint64_t stream_id = 0;
+    auto request = rpc_stream_open(rpc_subscriber, KB_METHOD_NONE, 1, callback, &counters, &stream_id);
+    ASSERT_NE(request, nullptr);
+    ASSERT_EQ(message_send(request), 0);
+
+    auto stream = rpc_handle_incoming_message(rpc_publisher, transport_message_receive(&transport));
+    ASSERT_NE(stream, nullptr);
+    ASSERT_EQ(stream->type, KB_MESSAGE_TYPE_STREAM);
+    ASSERT_EQ(stream->id, stream_id);
+    ASSERT_NE(stream->stream, nullptr);
+
+    rpc_stream_set_writable_callback(stream, [](kb_rpc_message_t *, void *context) { ((Counters *)context)->writable++; }, &counters);
+
+    // A cancelled response gives its credit back and wakes up the blocked publisher
+    auto response = rpc_message_respond(stream);
+    ASSERT_NE(response, nullptr);
+    ASSERT_EQ(rpc_message_respond(stream), nullptr);
+    message_cancel(response);
+    ASSERT_EQ(stream->stream->credits, 1);
+    ASSERT_EQ(counters.writable, 1);
+
+    // The only credit
+    response = rpc_message_respond(stream);
+    ASSERT_NE(response, nullptr);
+    ASSERT_EQ(message_send(response), 0);
+    ASSERT_EQ(rpc_handle_incoming_message(rpc_subscriber, transport_message_receive(&transport)), nullptr);
+    ASSERT_EQ(counters.responses, 1);
+
+    // Out of credits
+    ASSERT_EQ(rpc_message_respond(stream), nullptr);
+
+    ASSERT_EQ(rpc_stream_grant(rpc_subscriber, stream_id, 2), 0);
+    ASSERT_EQ(rpc_handle_incoming_message(rpc_publisher, transport_message_receive(&transport)), nullptr);
+    ASSERT_EQ(counters.writable, 2);
+
+    response = rpc_message_respond(stream);
+    ASSERT_NE(response, nullptr);
+    ASSERT_EQ(message_send(response), 0);
+    ASSERT_EQ(rpc_handle_incoming_message(rpc_subscriber, transport_message_receive(&transport)), nullptr);
+    ASSERT_EQ(counters.responses, 2);
+
+    ASSERT_EQ(rpc_stream_end(stream), 0);
+    ASSERT_EQ(rpc_message_respond(stream), nullptr);
+    ASSERT_EQ(rpc_handle_incoming_message(rpc_subscriber, transport_message_receive(&transport)), nullptr);
+    ASSERT_EQ(counters.ends, 1);
+    ASSERT_EQ(call_registry_find(&rpc_subscriber->calls_registry, stream_id), nullptr);
+
+    rpc_message_release(stream);
+    rpc_destroy(rpc_subscriber);
+    rpc_destroy(rpc_publisher);
+}
+
+TEST(Rpc, TestRpcStreamCancel)
+{
+    int responses = 0;
+    auto callback = [](kb_message_t *, void *context) { (*(int *)context)++; };
+
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    TransportMock transport(logger, "test");
+    auto rpc_subscriber = rpc_init(&transport, logger);
+    auto rpc_publisher = rpc_init(&transport, logger);
+
+    uint64_t stream_id = 0;
+    auto request = rpc_stream_open(rpc_subscriber, KB_METHOD_NONE, 8, callback, &responses, &stream_id);
+    ASSERT_EQ(message_send(request), 0);
+
+    auto stream = rpc_handle_incoming_message(rpc_publisher, transport_message_receive(&transport));
+    ASSERT_NE(stream, nullptr);
+
+    ASSERT_EQ(rpc_stream_cancel(rpc_subscriber, stream_id), 0);
+    ASSERT_EQ(rpc_handle_incoming_message(rpc_publisher, transport_message_receive(&transport)), nullptr);
+    ASSERT_TRUE(rpc_stream_cancelled(stream));
+    ASSERT_EQ(rpc_message_respond(stream), nullptr);
+
+    rpc_message_release(stream);
+    ASSERT_EQ(call_registry_find(&rpc_publisher->streams, stream_id), nullptr);
+
+    rpc_destroy(rpc_subscriber);
+    rpc_destroy(rpc_publisher);
+}
@@ -70,4 +70,101 @@ TEST(EventManagers, TestShmemEventManager)
     future.wait();
 }
 
+TEST(EventManagers, TestShmemWakeWithoutCompletion)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+    auto map_fd_0 = transport_shm_create_mapping("map0", ARENA_SIZE, logger);
+    auto map_fd_1 = transport_shm_create_mapping("map1", ARENA_SIZE, logger);
+
+    struct io_uring ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &ring, 0), 0);
+
+    auto transport_writer = transport_shm_init("test_writer", map_fd_0, map_fd_1, MESSAGE_SIZE, &ring, logger);
+    auto transport_reader = transport_shm_init("test_reader", map_fd_1, map_fd_0, MESSAGE_SIZE, &ring, logger);
+    auto writer_event_manager = (kb_event_manager_shm_t *)transport_writer->event_manager;
+    auto reader_event_manager = (kb_event_manager_shm_t *)transport_reader->event_manager;
+
+    // Successful wake doesn't post a completion, so it can't be confused with the reader events
+    event_manager_shm_signal_new_message(writer_event_manager);
+
+    struct io_uring_cqe *cqe;
+    ASSERT_EQ(io_uring_peek_cqe(&ring, &cqe), -EAGAIN);
+
+    // Reader waiting on the same ring gets its own completion
+    event_manager_shm_wait_messages(reader_event_manager);
+    event_manager_shm_signal_new_message(writer_event_manager);
+
+    __kernel_timespec timeout = {0, 40000000};
+    ASSERT_EQ(io_uring_wait_cqe_timeout(&ring, &cqe, &timeout), 0);
+    ASSERT_EQ(io_uring_cqe_get_data(cqe), &reader_event_manager->write_event);
+    ASSERT_EQ(cqe->res, 0);
+    io_uring_cqe_seen(&ring, cqe);
+
+    ASSERT_EQ(io_uring_peek_cqe(&ring, &cqe), -EAGAIN);
+
+    transport_destroy(transport_writer);
+    transport_destroy(transport_reader);
+    io_uring_queue_exit(&ring);
+}
+
+TEST(EventManagers, TestShmemSpinWait)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+    auto map_fd_0 = transport_shm_create_mapping("map0", ARENA_SIZE, logger);
+    auto map_fd_1 = transport_shm_create_mapping("map1", ARENA_SIZE, logger);
+
+    struct io_uring ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &ring, 0), 0);
+
+    auto transport_writer = transport_shm_init("test_writer", map_fd_0, map_fd_1, MESSAGE_SIZE, &ring, logger);
+    auto transport_reader = (kb_transport_shm_t *)transport_shm_init("test_reader", map_fd_1, map_fd_0, MESSAGE_SIZE, &ring, logger);
+    auto reader_event_manager = (kb_event_manager_shm_t *)transport_reader->base.event_manager;
+    auto arena_header = transport_reader->read_arena.header;
+
+    event_manager_shm_set_spin_limit(reader_event_manager, 1024);
+
+    // Nothing arrives while spinning. The reader parks and spins less next time
+    event_manager_shm_wait_messages(reader_event_manager);
+    ASSERT_EQ(arena_header->receiver_waiting, 1);
+    ASSERT_EQ(reader_event_manager->spin_limit, 512);
+
+    auto message_writer = transport_message_init(transport_writer);
+    ASSERT_TRUE(doc_writer_append_bool(message_writer_root(message_writer), "test_bool", true));
+    ASSERT_EQ(message_send(message_writer), 0);
+
+    struct io_uring_cqe *cqe;
+    __kernel_timespec timeout = {0, 40000000};
+    ASSERT_EQ(io_uring_wait_cqe_timeout(&ring, &cqe, &timeout), 0);
+    ASSERT_EQ(cqe->res, 0);
+
+    auto received_message = event_manager_shm_handle_event(cqe);
+    ASSERT_NE(received_message, nullptr);
+    message_destroy(received_message);
+    io_uring_cqe_seen(&ring, cqe);
+
+    ASSERT_EQ(arena_header->receiver_waiting, 0);
+
+    // A message is already there. The spin finds it and the reader never parks
+    message_writer = transport_message_init(transport_writer);
+    ASSERT_TRUE(doc_writer_append_bool(message_writer_root(message_writer), "test_bool", true));
+    ASSERT_EQ(message_send(message_writer), 0);
+
+    event_manager_shm_wait_messages(reader_event_manager);
+    ASSERT_EQ(arena_header->receiver_waiting, 0);
+    ASSERT_EQ(reader_event_manager->spin_limit, 1024);
+
+    // The futex wait completes right away, because the counter isn't zero
+    ASSERT_EQ(io_uring_wait_cqe_timeout(&ring, &cqe, &timeout), 0);
+    ASSERT_EQ(cqe->res, -EAGAIN);
+
+    received_message = event_manager_shm_handle_event(cqe);
+    ASSERT_NE(received_message, nullptr);
+    message_destroy(received_message);
+    io_uring_cqe_seen(&ring, cqe);
+
+    transport_destroy(transport_writer);
+    transport_destroy(&transport_reader->base);
+    io_uring_queue_exit(&ring);
+}
+
 #endif
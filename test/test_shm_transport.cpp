@@ -10,7 +10,7 @@
 #include <shmem/message_shm.h>
 #include <shmem/message_writer_shm.h>
 
-static constexpr size_t ARENA_SIZE = 768;
+static constexpr size_t ARENA_SIZE = 1024;
 static constexpr size_t MESSAGE_SIZE = 128;
 static constexpr size_t RING_QUEUE_DEPTH = 32;
 
@@ -397,12 +397,296 @@ TEST(Transport, TestShmemMessageCancel)
 
     ASSERT_EQ(arena->header->size, ARENA_SIZE);
 
+    auto free_size = arena->allocator->header->free_size;
+
     auto message_writer = transport_message_init(transport_writer);
     message_cancel(message_writer);
 
     ASSERT_EQ(arena->header->num_messages, 0);
+    // Message memory is back in the arena
+    ASSERT_EQ(arena->allocator->header->free_size, free_size);
+
+    transport_destroy(transport_writer);
+}
+
+TEST(Transport, TestShmemSizedMessage)
+{
+    struct io_uring ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &ring, 0), 0);
+
+    auto logger = log4c_category_get("libkrossbar.test");
+    auto map_fd_0 = transport_shm_create_mapping("map0", ARENA_SIZE, logger);
+    auto map_fd_1 = transport_shm_create_mapping("map1", ARENA_SIZE, logger);
+
+    auto transport_writer = transport_shm_init("test_writer", map_fd_0, map_fd_1, MESSAGE_SIZE, &ring, logger);
+    auto transport_reader = transport_shm_init("test_reader", map_fd_1, map_fd_0, MESSAGE_SIZE, &ring, logger);
+
+    auto message_writer = transport_message_init_sized(transport_writer, 16);
+    ASSERT_NE(message_writer, nullptr);
+
+    auto shm_writer = (kb_message_writer_shm_t *)message_writer;
+    ASSERT_EQ(shm_writer->header->size, 16);
+
+    // Overflow the hint. The message grows into the free memory after it
+    ASSERT_TRUE(doc_writer_append_binary(message_writer_root(message_writer), "data", (const uint8_t *)RANDOM_BUFFER, 64));
+    ASSERT_GE(shm_writer->header->size, 64);
+
+    // Another message takes the memory after the first one
+    auto next_message_writer = transport_message_init_sized(transport_writer, 16);
+    ASSERT_NE(next_message_writer, nullptr);
+
+    // No free memory after the first message anymore. It moves to grow
+    auto header_before_move = shm_writer->header;
+    ASSERT_TRUE(doc_writer_append_binary(message_writer_root(message_writer), "more_data", (const uint8_t *)RANDOM_BUFFER, 64));
+    ASSERT_NE(shm_writer->header, header_before_move);
+    ASSERT_EQ(message_send(message_writer), 0);
+    ASSERT_EQ(message_send(next_message_writer), 0);
+
+    auto message = transport_message_receive(transport_reader);
+    ASSERT_NE(message, nullptr);
+
+    bson_iter_t iter;
+    ASSERT_TRUE(bson_iter_init_find(&iter, message_get_document(message), "data"));
+    ASSERT_EQ(bson_iter_type(&iter), BSON_TYPE_BINARY);
+
+    uint32_t length = 0;
+    const uint8_t *data = nullptr;
+    bson_iter_binary(&iter, nullptr, &length, &data);
+    ASSERT_EQ(length, 64);
+
+    ASSERT_TRUE(bson_iter_find(&iter, "more_data"));
+    bson_iter_binary(&iter, nullptr, &length, &data);
+    ASSERT_EQ(length, 64);
+
+    message_destroy(message);
+
+    message = transport_message_receive(transport_reader);
+    ASSERT_NE(message, nullptr);
+    message_destroy(message);
 
     transport_destroy(transport_writer);
+    transport_destroy(transport_reader);
+}
+
+TEST(Transport, TestShmemRingQueue)
+{
+    struct io_uring ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &ring, 0), 0);
+
+    auto logger = log4c_category_get("libkrossbar.test");
+    auto map_fd_0 = transport_shm_create_mapping_with_mode("map0", ARENA_SIZE, KB_SHM_QUEUE_SPSC_RING, logger);
+    auto map_fd_1 = transport_shm_create_mapping_with_mode("map1", ARENA_SIZE, KB_SHM_QUEUE_SPSC_RING, logger);
+
+    auto transport_writer = (kb_transport_shm_t *)transport_shm_init("test_writer", map_fd_0, map_fd_1, MESSAGE_SIZE, &ring, logger);
+    auto transport_reader = transport_shm_init("test_reader", map_fd_1, map_fd_0, MESSAGE_SIZE, &ring, logger);
+    auto arena = &transport_writer->write_arena;
+
+    ASSERT_EQ(arena->header->queue_mode, KB_SHM_QUEUE_SPSC_RING);
+
+    for (int32_t i = 0; i < 3; i++)
+    {
+        auto message_writer = transport_message_init(&transport_writer->base);
+        ASSERT_NE(message_writer, nullptr);
+        ASSERT_TRUE(doc_writer_append_int32(message_writer_root(message_writer), "index", i));
+        ASSERT_EQ(message_send(message_writer), 0);
+    }
+
+    ASSERT_EQ(arena->header->num_messages, 3);
+    ASSERT_EQ(arena->header->ring_tail - arena->header->ring_head, 3);
+
+    // The list is not used in the ring mode
+    ASSERT_EQ(arena->header->first_message_offset, (size_t)-1);
+
+    for (int32_t i = 0; i < 3; i++)
+    {
+        auto message = transport_message_receive(transport_reader);
+        ASSERT_NE(message, nullptr);
+
+        bson_iter_t iter;
+        ASSERT_TRUE(bson_iter_init_find(&iter, message_get_document(message), "index"));
+        ASSERT_EQ(bson_iter_int32(&iter), i);
+
+        message_destroy(message);
+    }
+
+    ASSERT_EQ(arena->header->num_messages, 0);
+    ASSERT_EQ(transport_message_receive(transport_reader), nullptr);
+
+    transport_destroy(&transport_writer->base);
+    transport_destroy(transport_reader);
+}
+
+TEST(Transport, TestShmemReceiveBatch)
+{
+    struct io_uring ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &ring, 0), 0);
+
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    for (auto queue_mode : {KB_SHM_QUEUE_LIST, KB_SHM_QUEUE_SPSC_RING})
+    {
+        auto map_fd_0 = transport_shm_create_mapping_with_mode("map0", ARENA_SIZE, queue_mode, logger);
+        auto map_fd_1 = transport_shm_create_mapping_with_mode("map1", ARENA_SIZE, queue_mode, logger);
+
+        auto transport_writer = (kb_transport_shm_t *)transport_shm_init("test_writer", map_fd_0, map_fd_1, MESSAGE_SIZE, &ring, logger);
+        auto transport_reader = transport_shm_init("test_reader", map_fd_1, map_fd_0, MESSAGE_SIZE, &ring, logger);
+        auto arena = &transport_writer->write_arena;
+
+        for (int32_t i = 0; i < 3; i++)
+        {
+            auto message_writer = transport_message_init(&transport_writer->base);
+            ASSERT_NE(message_writer, nullptr);
+            ASSERT_TRUE(doc_writer_append_int32(message_writer_root(message_writer), "index", i));
+            ASSERT_EQ(message_send(message_writer), 0);
+        }
+
+        // Take the first two messages and leave the last one in the queue
+        kb_message_t *messages[4];
+        ASSERT_EQ(transport_message_receive_batch(transport_reader, messages, 2), 2);
+        ASSERT_EQ(arena->header->num_messages, 1);
+
+        // The rest of the queue is drained in one go
+        ASSERT_EQ(transport_message_receive_batch(transport_reader, &messages[2], 2), 1);
+        ASSERT_EQ(arena->header->num_messages, 0);
+        ASSERT_EQ(arena->header->first_message_offset, (size_t)-1);
+        ASSERT_EQ(arena->header->last_message_offset, (size_t)-1);
+
+        for (int32_t i = 0; i < 3; i++)
+        {
+            bson_iter_t iter;
+            ASSERT_TRUE(bson_iter_init_find(&iter, message_get_document(messages[i]), "index"));
+            ASSERT_EQ(bson_iter_int32(&iter), i);
+
+            message_destroy(messages[i]);
+        }
+
+        ASSERT_EQ(transport_message_receive_batch(transport_reader, messages, 4), 0);
+
+        transport_destroy(&transport_writer->base);
+        transport_destroy(transport_reader);
+    }
+}
+
+TEST(Transport, TestShmemDeferredSend)
+{
+    struct io_uring ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &ring, 0), 0);
+
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    for (auto queue_mode : {KB_SHM_QUEUE_LIST, KB_SHM_QUEUE_SPSC_RING})
+    {
+        auto map_fd_0 = transport_shm_create_mapping_with_mode("map0", ARENA_SIZE, queue_mode, logger);
+        auto map_fd_1 = transport_shm_create_mapping_with_mode("map1", ARENA_SIZE, queue_mode, logger);
+
+        auto transport_writer = (kb_transport_shm_t *)transport_shm_init("test_writer", map_fd_0, map_fd_1, MESSAGE_SIZE, &ring, logger);
+        auto transport_reader = transport_shm_init("test_reader", map_fd_1, map_fd_0, MESSAGE_SIZE, &ring, logger);
+        auto arena = &transport_writer->write_arena;
+
+        // Nobody waits for the messages, so the flush doesn't need to wake anyone
+        ASSERT_EQ(arena->header->receiver_waiting, 0);
+
+        for (int32_t i = 0; i < 2; i++)
+        {
+            auto message_writer = transport_message_init(&transport_writer->base);
+            ASSERT_NE(message_writer, nullptr);
+            ASSERT_TRUE(doc_writer_append_int32(message_writer_root(message_writer), "index", i));
+            ASSERT_EQ(message_send_deferred(message_writer), 0);
+        }
+
+        // Deferred messages are invisible to the reader
+        ASSERT_EQ(transport_writer->num_deferred, 2);
+        ASSERT_EQ(arena->header->num_messages, 0);
+        ASSERT_EQ(transport_message_receive(transport_reader), nullptr);
+
+        ASSERT_EQ(transport_flush(&transport_writer->base), 0);
+        ASSERT_EQ(transport_writer->num_deferred, 0);
+        ASSERT_EQ(arena->header->num_messages, 2);
+
+        // A regular send delivers after the flushed messages
+        auto message_writer = transport_message_init(&transport_writer->base);
+        ASSERT_NE(message_writer, nullptr);
+        ASSERT_TRUE(doc_writer_append_int32(message_writer_root(message_writer), "index", 2));
+        ASSERT_EQ(message_send(message_writer), 0);
+        ASSERT_EQ(arena->header->num_messages, 3);
+
+        for (int32_t i = 0; i < 3; i++)
+        {
+            auto message = transport_message_receive(transport_reader);
+            ASSERT_NE(message, nullptr);
+
+            bson_iter_t iter;
+            ASSERT_TRUE(bson_iter_init_find(&iter, message_get_document(message), "index"));
+            ASSERT_EQ(bson_iter_int32(&iter), i);
+
+            message_destroy(message);
+        }
+
+        ASSERT_EQ(transport_message_receive(transport_reader), nullptr);
+        // Nothing to flush
+        ASSERT_EQ(transport_flush(&transport_writer->base), 0);
+
+        transport_destroy(&transport_writer->base);
+        transport_destroy(transport_reader);
+    }
+}
+
+TEST(Transport, TestShmemObjectPools)
+{
+    struct io_uring ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &ring, 0), 0);
+
+    auto logger = log4c_category_get("libkrossbar.test");
+    auto map_fd_0 = transport_shm_create_mapping("map0", ARENA_SIZE, logger);
+    auto map_fd_1 = transport_shm_create_mapping("map1", ARENA_SIZE, logger);
+
+    auto transport_writer = (kb_transport_shm_t *)transport_shm_init("test_writer", map_fd_0, map_fd_1, MESSAGE_SIZE, &ring, logger);
+    auto transport_reader = (kb_transport_shm_t *)transport_shm_init("test_reader", map_fd_1, map_fd_0, MESSAGE_SIZE, &ring, logger);
+
+    kb_message_writer_t *first_writer = nullptr;
+    kb_message_t *first_message = nullptr;
+
+    for (int32_t i = 0; i < 3; i++)
+    {
+        auto message_writer = transport_message_init(&transport_writer->base);
+        ASSERT_NE(message_writer, nullptr);
+        ASSERT_TRUE(doc_writer_append_int32(message_writer_root(message_writer), "index", i));
+        ASSERT_EQ(message_send(message_writer), 0);
+
+        auto message = transport_message_receive(&transport_reader->base);
+        ASSERT_NE(message, nullptr);
+
+        bson_iter_t iter;
+        ASSERT_TRUE(bson_iter_init_find(&iter, message_get_document(message), "index"));
+        ASSERT_EQ(bson_iter_int32(&iter), i);
+
+        message_destroy(message);
+
+        // The same objects are used for every message
+        if (i == 0)
+        {
+            first_writer = message_writer;
+            first_message = message;
+        }
+        else
+        {
+            ASSERT_EQ(message_writer, first_writer);
+            ASSERT_EQ(message, first_message);
+        }
+    }
+
+    ASSERT_EQ(&transport_writer->free_writers->base, first_writer);
+    ASSERT_EQ(&transport_reader->free_messages->base, first_message);
+
+    // Cancelled writers go back to the pool as well
+    auto message_writer = transport_message_init(&transport_writer->base);
+    ASSERT_EQ(message_writer, first_writer);
+    ASSERT_EQ(transport_writer->free_writers, nullptr);
+    message_cancel(message_writer);
+    ASSERT_EQ(&transport_writer->free_writers->base, first_writer);
+
+    transport_destroy(&transport_writer->base);
+    transport_destroy(&transport_reader->base);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,110 @@
+#include <map>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <log4c.h>
+
+#include <timer_wheel.h>
+
+struct Expirations
+{
+    kb_timer_wheel_t *wheel;
+    std::vector<std::pair<uint32_t, uint64_t>> fired; // Timer index and the tick it fired at
+};
+
+static void on_expired(uint32_t index, void *context)
+{
+    Expirations *expirations = (Expirations *)context;
+    expirations->fired.push_back({index, expirations->wheel->now});
+}
+
+TEST(TimerWheel, TestExpirationTicks)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    kb_timer_wheel_t wheel;
+    ASSERT_TRUE(timer_wheel_init(&wheel, 8, logger));
+    Expirations expirations = {&wheel, {}};
+
+    uint64_t start = 1000000;
+    // Every level of the wheel and beyond
+    std::vector<uint64_t> delays = {1, 63, 64, 5000, 300000, 20000000};
+    for (uint32_t i = 0; i < delays.size(); i++)
+    {
+        timer_wheel_arm(&wheel, i, start + delays[i], start);
+    }
+
+    // Already due
+    timer_wheel_arm(&wheel, 6, start - 10, start);
+
+    // Cancelled
+    timer_wheel_arm(&wheel, 7, start + 100, start);
+    timer_wheel_cancel(&wheel, 7);
+
+    ASSERT_EQ(timer_wheel_next_expiry(&wheel), start + 1);
+
+    ASSERT_EQ(timer_wheel_advance(&wheel, start + 63, on_expired, &expirations), 3);
+    ASSERT_EQ(timer_wheel_advance(&wheel, start + 100000000, on_expired, &expirations), 4);
+    ASSERT_EQ(wheel.armed_count, 0);
+    ASSERT_EQ(timer_wheel_next_expiry(&wheel), UINT64_MAX);
+
+    std::map<uint32_t, uint64_t> fired(expirations.fired.begin(), expirations.fired.end());
+    ASSERT_EQ(fired.size(), 7);
+    for (uint32_t i = 0; i < delays.size(); i++)
+    {
+        ASSERT_EQ(fired[i], start + delays[i]) << "timer " << i;
+    }
+    ASSERT_EQ(fired[6], start + 1);
+
+    timer_wheel_deinit(&wheel);
+}
+
+TEST(TimerWheel, TestRandomTimers)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    kb_timer_wheel_t wheel;
+    ASSERT_TRUE(timer_wheel_init(&wheel, 1024, logger));
+    Expirations expirations = {&wheel, {}};
+
+    std::mt19937_64 random(42);
+    std::map<uint32_t, uint64_t> armed;
+
+    uint64_t now = 0;
+    for (size_t round = 0; round < 2000; round++)
+    {
+        uint32_t index = random() % 1024;
+        if (armed.count(index) == 0)
+        {
+            uint64_t expires = now + random() % (1 << (random() % 20));
+            timer_wheel_arm(&wheel, index, expires, now);
+            armed[index] = expires > now ? expires : now + 1;
+        }
+        else if (random() % 4 == 0)
+        {
+            timer_wheel_cancel(&wheel, index);
+            armed.erase(index);
+        }
+
+        now += random() % 2000;
+        expirations.fired.clear();
+        timer_wheel_advance(&wheel, now, on_expired, &expirations);
+
+        for (auto [fired_index, tick] : expirations.fired)
+        {
+            ASSERT_EQ(armed.count(fired_index), 1);
+            ASSERT_EQ(armed[fired_index], tick);
+            armed.erase(fired_index);
+        }
+
+        // Nothing due is left
+        for (auto [armed_index, expires] : armed)
+        {
+            ASSERT_GT(expires, now);
+        }
+        ASSERT_EQ(wheel.armed_count, armed.size());
+    }
+
+    timer_wheel_deinit(&wheel);
+}
@@ -1,4 +1,5 @@
 #include <string>
+#include <vector>
 
 #include <gtest/gtest.h>
 #include <liburing.h>
@@ -231,8 +232,607 @@ TEST(Transport, TestUDSMessageCancel)
 
     auto transport_writer = transport_uds_init("test", sockets[0], MESSAGE_SIZE, MAX_MESSAGE_NUM, &ring, logger);
 
+    auto uds_writer = (kb_transport_uds_t *)transport_writer;
+
     auto message_writer = transport_message_init(transport_writer);
+    ASSERT_EQ(uds_writer->num_free_payloads, MAX_MESSAGE_NUM - 1);
     message_cancel(message_writer);
 
+    // The payload goes back to the slab and the writer to the pool
+    ASSERT_EQ(uds_writer->num_free_payloads, MAX_MESSAGE_NUM);
+    ASSERT_EQ(&uds_writer->free_writers->base, message_writer);
+
+    transport_destroy(transport_writer);
+}
+
+TEST(Transport, TestUDSOutgoingRing)
+{
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    struct io_uring ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &ring, 0), 0);
+
+    int sockets[2];
+    // Create socket pair
+    ASSERT_NE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), -1);
+    set_nonblocking(sockets[0]);
+    set_nonblocking(sockets[1]);
+
+    auto transport_writer = transport_uds_init("test_writer", sockets[0], MESSAGE_SIZE, MAX_MESSAGE_NUM, &ring, logger);
+    auto transport_reader = transport_uds_init("test_reader", sockets[1], MESSAGE_SIZE, MAX_MESSAGE_NUM, &ring, logger);
+    auto uds_writer = (kb_transport_uds_t *)transport_writer;
+
+    // Go around the ring a few times
+    for (int32_t round = 0; round < 3; round++)
+    {
+        for (size_t i = 0; i < MAX_MESSAGE_NUM; i++)
+        {
+            auto message_writer = transport_message_init(transport_writer);
+            ASSERT_NE(message_writer, nullptr);
+
+            // Payloads come from the slab
+            ASSERT_GE((char *)message_writer->buffer, uds_writer->payloads);
+            ASSERT_LT((char *)message_writer->buffer, uds_writer->payloads + MAX_MESSAGE_NUM * MESSAGE_SIZE);
+
+            ASSERT_TRUE(doc_writer_append_int32(message_writer_root(message_writer), "index", i));
+            ASSERT_EQ(message_send(message_writer), 0);
+        }
+
+        // Every payload is queued
+        ASSERT_EQ(transport_message_init(transport_writer), nullptr);
+        ASSERT_EQ(uds_writer->out_message_count, MAX_MESSAGE_NUM);
+
+        ASSERT_EQ(transport_uds_write_messages(transport_writer), 0);
+        ASSERT_EQ(uds_writer->num_free_payloads, MAX_MESSAGE_NUM);
+
+        for (size_t i = 0; i < MAX_MESSAGE_NUM; i++)
+        {
+            auto message = transport_message_receive(transport_reader);
+            ASSERT_NE(message, nullptr);
+
+            bson_iter_t iter;
+            ASSERT_TRUE(bson_iter_init_find(&iter, message_get_document(message), "index"));
+            ASSERT_EQ(bson_iter_int32(&iter), (int32_t)i);
+
+            message_destroy(message);
+        }
+    }
+
+    transport_destroy(transport_writer);
+    transport_destroy(transport_reader);
+}
+
+TEST(Transport, TestUDSPartialWrite)
+{
+    static constexpr size_t LARGE_MESSAGE_SIZE = 16384;
+    static constexpr int32_t NUM_MESSAGES = 4;
+
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    struct io_uring ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &ring, 0), 0);
+
+    int sockets[2];
+    // Create socket pair
+    ASSERT_NE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), -1);
+    set_nonblocking(sockets[0]);
+    set_nonblocking(sockets[1]);
+
+    // Small socket buffer splits the frames at random places
+    int send_buffer_size = 4096;
+    ASSERT_EQ(setsockopt(sockets[0], SOL_SOCKET, SO_SNDBUF, &send_buffer_size, sizeof(send_buffer_size)), 0);
+
+    auto transport_writer = transport_uds_init("test_writer", sockets[0], LARGE_MESSAGE_SIZE, MAX_MESSAGE_NUM, &ring, logger);
+    auto transport_reader = transport_uds_init("test_reader", sockets[1], LARGE_MESSAGE_SIZE, MAX_MESSAGE_NUM, &ring, logger);
+
+    std::vector<uint8_t> payload(LARGE_MESSAGE_SIZE / 2, 0x42);
+    for (int32_t i = 0; i < NUM_MESSAGES; i++)
+    {
+        auto message_writer = transport_message_init(transport_writer);
+        ASSERT_NE(message_writer, nullptr);
+        ASSERT_TRUE(doc_writer_append_int32(message_writer_root(message_writer), "index", i));
+        ASSERT_TRUE(doc_writer_append_binary(message_writer_root(message_writer), "data", payload.data(), payload.size()));
+        ASSERT_EQ(message_send(message_writer), 0);
+    }
+
+    // Not everything fits into the socket buffer
+    ASSERT_GT(transport_uds_write_messages(transport_writer), 0);
+
+    int32_t num_received = 0;
+    for (int attempt = 0; attempt < 1000 && num_received < NUM_MESSAGES; attempt++)
+    {
+        auto message = transport_message_receive(transport_reader);
+        if (message == nullptr)
+        {
+            ASSERT_GE(transport_uds_write_messages(transport_writer), 0);
+            continue;
+        }
+
+        bson_iter_t iter;
+        ASSERT_TRUE(bson_iter_init_find(&iter, message_get_document(message), "index"));
+        ASSERT_EQ(bson_iter_int32(&iter), num_received);
+
+        ASSERT_TRUE(bson_iter_init_find(&iter, message_get_document(message), "data"));
+        uint32_t data_size;
+        const uint8_t *data;
+        bson_iter_binary(&iter, nullptr, &data_size, &data);
+        ASSERT_EQ(data_size, payload.size());
+        ASSERT_EQ(memcmp(data, payload.data(), data_size), 0);
+
+        message_destroy(message);
+        num_received++;
+    }
+
+    ASSERT_EQ(num_received, NUM_MESSAGES);
+    ASSERT_EQ(transport_uds_write_messages(transport_writer), 0);
+
+    transport_destroy(transport_writer);
+    transport_destroy(transport_reader);
+}
+
+TEST(Transport, TestUDSReceiveBatch)
+{
+    static constexpr int32_t NUM_MESSAGES = 5;
+
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    struct io_uring ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &ring, 0), 0);
+
+    int sockets[2];
+    // Create socket pair
+    ASSERT_NE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), -1);
+    set_nonblocking(sockets[0]);
+    set_nonblocking(sockets[1]);
+
+    auto transport_writer = transport_uds_init("test_writer", sockets[0], MESSAGE_SIZE, MAX_MESSAGE_NUM, &ring, logger);
+    auto transport_reader = transport_uds_init("test_reader", sockets[1], MESSAGE_SIZE, MAX_MESSAGE_NUM, &ring, logger);
+    auto uds_reader = (kb_transport_uds_t *)transport_reader;
+
+    for (int32_t i = 0; i < NUM_MESSAGES; i++)
+    {
+        auto message_writer = transport_message_init(transport_writer);
+        ASSERT_NE(message_writer, nullptr);
+        ASSERT_TRUE(doc_writer_append_int32(message_writer_root(message_writer), "index", i));
+        ASSERT_EQ(message_send(message_writer), 0);
+    }
+
+    ASSERT_EQ(transport_uds_write_messages(transport_writer), 0);
+
+    // All messages come with a single read
+    kb_message_t *messages[NUM_MESSAGES + 1];
+    ASSERT_EQ(transport_message_receive_batch(transport_reader, messages, NUM_MESSAGES + 1), NUM_MESSAGES);
+    ASSERT_EQ(uds_reader->in_buffer.num_held, NUM_MESSAGES);
+    ASSERT_FALSE(transport_uds_has_buffered_message(transport_reader));
+
+    for (int32_t i = 0; i < NUM_MESSAGES; i++)
+    {
+        // Messages point into the receive buffer
+        auto data = (const char *)bson_get_data(message_get_document(messages[i]));
+        ASSERT_GE(data, uds_reader->in_buffer.data);
+        ASSERT_LT(data, uds_reader->in_buffer.data + uds_reader->in_buffer.write_offset);
+
+        bson_iter_t iter;
+        ASSERT_TRUE(bson_iter_init_find(&iter, message_get_document(messages[i]), "index"));
+        ASSERT_EQ(bson_iter_int32(&iter), i);
+
+        message_destroy(messages[i]);
+    }
+
+    // Everything is released, so the buffer starts over
+    ASSERT_EQ(uds_reader->in_buffer.num_held, 0);
+    ASSERT_EQ(uds_reader->in_buffer.write_offset, 0);
+    ASSERT_EQ(transport_message_receive_batch(transport_reader, messages, NUM_MESSAGES + 1), 0);
+
+    transport_destroy(transport_writer);
+    transport_destroy(transport_reader);
+}
+
+TEST(Transport, TestUDSHeldMessagesPartialFrame)
+{
+    static constexpr size_t LARGE_MESSAGE_SIZE = 32768;
+    static constexpr int32_t NUM_MESSAGES = 3;
+
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    struct io_uring ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &ring, 0), 0);
+
+    int sockets[2];
+    // Create socket pair
+    ASSERT_NE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), -1);
+    set_nonblocking(sockets[0]);
+    set_nonblocking(sockets[1]);
+
+    auto transport_writer = transport_uds_init("test_writer", sockets[0], LARGE_MESSAGE_SIZE, MAX_MESSAGE_NUM, &ring, logger);
+    auto transport_reader = transport_uds_init("test_reader", sockets[1], LARGE_MESSAGE_SIZE, MAX_MESSAGE_NUM, &ring, logger);
+    auto uds_reader = (kb_transport_uds_t *)transport_reader;
+
+    // The receive buffer fits two frames and a part of the third one
+    std::vector<uint8_t> payload(LARGE_MESSAGE_SIZE * 3 / 4, 0x42);
+    for (int32_t i = 0; i < NUM_MESSAGES; i++)
+    {
+        auto message_writer = transport_message_init(transport_writer);
+        ASSERT_NE(message_writer, nullptr);
+        ASSERT_TRUE(doc_writer_append_int32(message_writer_root(message_writer), "index", i));
+        ASSERT_TRUE(doc_writer_append_binary(message_writer_root(message_writer), "data", payload.data(), payload.size()));
+        ASSERT_EQ(message_send(message_writer), 0);
+    }
+
+    for (int attempt = 0; attempt < 1000 && transport_uds_write_messages(transport_writer) > 0; attempt++)
+    {
+    }
+
+    // Received messages are held while the rest of the last frame comes
+    kb_message_t *messages[NUM_MESSAGES];
+    int32_t num_received = 0;
+    for (int attempt = 0; attempt < 1000 && num_received < NUM_MESSAGES; attempt++)
+    {
+        auto message = transport_message_receive(transport_reader);
+        if (message != nullptr)
+        {
+            messages[num_received++] = message;
+        }
+    }
+
+    ASSERT_EQ(num_received, NUM_MESSAGES);
+    // The partial frame moved into a new buffer
+    ASSERT_NE(uds_reader->retired_buffers, nullptr);
+
+    for (int32_t i = 0; i < NUM_MESSAGES; i++)
+    {
+        bson_iter_t iter;
+        ASSERT_TRUE(bson_iter_init_find(&iter, message_get_document(messages[i]), "index"));
+        ASSERT_EQ(bson_iter_int32(&iter), i);
+
+        message_destroy(messages[i]);
+    }
+
+    ASSERT_EQ(uds_reader->retired_buffers, nullptr);
+
+    // The end of the stream is a disconnect, not an empty read
+    transport_destroy(transport_writer);
+    ASSERT_EQ(transport_message_receive(transport_reader), nullptr);
+    ASSERT_TRUE(transport_uds_is_disconnected(transport_reader));
+
+    transport_destroy(transport_reader);
+}
+
+TEST(Transport, TestUDSEventBatch)
+{
+    static constexpr int32_t NUM_MESSAGES = 5;
+
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    struct io_uring writer_ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &writer_ring, 0), 0);
+
+    struct io_uring reader_ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &reader_ring, 0), 0);
+
+    int sockets[2];
+    // Create socket pair
+    ASSERT_NE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), -1);
+    set_nonblocking(sockets[0]);
+    set_nonblocking(sockets[1]);
+
+    auto transport_writer = transport_uds_init("test_writer", sockets[0], MESSAGE_SIZE, MAX_MESSAGE_NUM, &writer_ring, logger);
+    auto transport_reader = transport_uds_init("test_reader", sockets[1], MESSAGE_SIZE, MAX_MESSAGE_NUM, &reader_ring, logger);
+
+    for (int32_t i = 0; i < NUM_MESSAGES; i++)
+    {
+        auto message_writer = transport_message_init(transport_writer);
+        ASSERT_NE(message_writer, nullptr);
+        ASSERT_TRUE(doc_writer_append_int32(message_writer_root(message_writer), "index", i));
+        ASSERT_EQ(message_send(message_writer), 0);
+    }
+
+    ASSERT_EQ(transport_uds_write_messages(transport_writer), 0);
+
+    struct io_uring_cqe *cqe;
+    __kernel_timespec timeout = {0, 20000000};
+    ASSERT_EQ(io_uring_wait_cqe_timeout(&reader_ring, &cqe, &timeout), 0);
+
+    // All messages come with a single completion through the generic interface
+    kb_message_t *messages[NUM_MESSAGES + 1];
+    ASSERT_EQ(event_manager_handle_event_batch(transport_get_event_manager(transport_reader), cqe, messages, NUM_MESSAGES + 1),
+              NUM_MESSAGES);
+    io_uring_cqe_seen(&reader_ring, cqe);
+
+    for (int32_t i = 0; i < NUM_MESSAGES; i++)
+    {
+        bson_iter_t iter;
+        ASSERT_TRUE(bson_iter_init_find(&iter, message_get_document(messages[i]), "index"));
+        ASSERT_EQ(bson_iter_int32(&iter), i);
+
+        message_destroy(messages[i]);
+    }
+
+    transport_destroy(transport_writer);
+    transport_destroy(transport_reader);
+}
+
+TEST(Transport, TestUDSBufferRing)
+{
+    static constexpr int32_t NUM_MESSAGES = 5;
+    // Smaller than a few frames, so some frames are split between buffers
+    static constexpr size_t PROVIDED_BUFFER_SIZE = 64;
+    static constexpr unsigned int NUM_PROVIDED_BUFFERS = 8;
+
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    struct io_uring writer_ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &writer_ring, 0), 0);
+
+    struct io_uring reader_ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &reader_ring, 0), 0);
+
+    int sockets[2];
+    // Create socket pair
+    ASSERT_NE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), -1);
+    set_nonblocking(sockets[0]);
+    set_nonblocking(sockets[1]);
+
+    auto transport_writer = transport_uds_init("test_writer", sockets[0], MESSAGE_SIZE, MAX_MESSAGE_NUM, &writer_ring, logger);
+    auto transport_reader = transport_uds_init_with_buffer_ring("test_reader", sockets[1], MESSAGE_SIZE, MAX_MESSAGE_NUM,
+                                                                NUM_PROVIDED_BUFFERS, PROVIDED_BUFFER_SIZE, &reader_ring, logger);
+    ASSERT_NE(transport_reader, nullptr);
+    auto event_manager = (kb_event_manager_uds_t *)transport_reader->event_manager;
+
+    for (int32_t i = 0; i < NUM_MESSAGES; i++)
+    {
+        auto message_writer = transport_message_init(transport_writer);
+        ASSERT_NE(message_writer, nullptr);
+        ASSERT_TRUE(doc_writer_append_int32(message_writer_root(message_writer), "index", i));
+        ASSERT_EQ(message_send(message_writer), 0);
+    }
+
+    ASSERT_EQ(transport_uds_write_messages(transport_writer), 0);
+
+    std::vector<kb_message_t *> messages;
+    while (messages.size() < (size_t)NUM_MESSAGES)
+    {
+        struct io_uring_cqe *cqe;
+        __kernel_timespec timeout = {0, 20000000};
+        ASSERT_EQ(io_uring_wait_cqe_timeout(&reader_ring, &cqe, &timeout), 0);
+
+        auto message = event_manager_handle_event(&event_manager->base, cqe);
+        io_uring_cqe_seen(&reader_ring, cqe);
+
+        if (message != nullptr)
+        {
+            messages.push_back(message);
+        }
+    }
+
+    // Nothing is left to parse, so no read is scheduled
+    ASSERT_FALSE(transport_uds_has_buffered_message(transport_reader));
+
+    for (int32_t i = 0; i < NUM_MESSAGES; i++)
+    {
+        bson_iter_t iter;
+        ASSERT_TRUE(bson_iter_init_find(&iter, message_get_document(messages[i]), "index"));
+        ASSERT_EQ(bson_iter_int32(&iter), i);
+    }
+
+    // The first message is complete in the first buffer, so it points right into it
+    auto data = (const char *)bson_get_data(message_get_document(messages[0]));
+    ASSERT_GE(data, event_manager->buffers);
+    ASSERT_LT(data, event_manager->buffers + NUM_PROVIDED_BUFFERS * PROVIDED_BUFFER_SIZE);
+
+    for (auto message : messages)
+    {
+        message_destroy(message);
+    }
+
+    // All buffers are back in the ring
+    for (unsigned int i = 0; i < NUM_PROVIDED_BUFFERS; i++)
+    {
+        ASSERT_EQ(event_manager->buffer_refs[i], 0);
+    }
+
+    transport_destroy(transport_writer);
+    transport_destroy(transport_reader);
+}
+
+TEST(Transport, TestUDSZeroCopySend)
+{
+    static constexpr size_t LARGE_MESSAGE_SIZE = 16384;
+    static constexpr int32_t NUM_MESSAGES = 3;
+
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    struct io_uring writer_ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &writer_ring, 0), 0);
+
+    struct io_uring reader_ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &reader_ring, 0), 0);
+
+    int sockets[2];
+    // Create socket pair
+    ASSERT_NE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), -1);
+    set_nonblocking(sockets[0]);
+    set_nonblocking(sockets[1]);
+
+    auto transport_writer = transport_uds_init("test_writer", sockets[0], LARGE_MESSAGE_SIZE, MAX_MESSAGE_NUM, &writer_ring, logger);
+    auto transport_reader = transport_uds_init("test_reader", sockets[1], LARGE_MESSAGE_SIZE, MAX_MESSAGE_NUM, &reader_ring, logger);
+    auto uds_writer = (kb_transport_uds_t *)transport_writer;
+
+    // Only the large messages go without copying
+    transport_uds_set_zerocopy_threshold(transport_writer, LARGE_MESSAGE_SIZE / 4);
+
+    std::vector<uint8_t> payload(LARGE_MESSAGE_SIZE / 2, 0x42);
+    for (int32_t i = 0; i < NUM_MESSAGES; i++)
+    {
+        auto message_writer = transport_message_init(transport_writer);
+        ASSERT_NE(message_writer, nullptr);
+        ASSERT_TRUE(doc_writer_append_int32(message_writer_root(message_writer), "index", i));
+        if (i != 1)
+        {
+            ASSERT_TRUE(doc_writer_append_binary(message_writer_root(message_writer), "data", payload.data(), payload.size()));
+        }
+        ASSERT_EQ(message_send(message_writer), 0);
+    }
+
+    // The first message is large, so it's submitted and nothing else goes out before it completes
+    ASSERT_EQ(transport_uds_write_messages(transport_writer), NUM_MESSAGES);
+    ASSERT_TRUE(uds_writer->zerocopy_in_flight);
+
+    // Sockets which can't send without copying fall back to copying
+    for (int attempt = 0; attempt < 100 && (uds_writer->out_message_count > 0 || uds_writer->num_free_payloads < MAX_MESSAGE_NUM); attempt++)
+    {
+        struct io_uring_cqe *cqe;
+        __kernel_timespec timeout = {0, 20000000};
+        ASSERT_EQ(io_uring_wait_cqe_timeout(&writer_ring, &cqe, &timeout), 0);
+
+        ASSERT_EQ(event_manager_handle_event(transport_writer->event_manager, cqe), nullptr);
+        io_uring_cqe_seen(&writer_ring, cqe);
+    }
+
+    ASSERT_EQ(uds_writer->out_message_count, 0);
+    ASSERT_EQ(uds_writer->num_free_payloads, MAX_MESSAGE_NUM);
+
+    for (int32_t i = 0; i < NUM_MESSAGES; i++)
+    {
+        auto message = transport_message_receive(transport_reader);
+        ASSERT_NE(message, nullptr);
+
+        bson_iter_t iter;
+        ASSERT_TRUE(bson_iter_init_find(&iter, message_get_document(message), "index"));
+        ASSERT_EQ(bson_iter_int32(&iter), i);
+
+        message_destroy(message);
+    }
+
+    transport_destroy(transport_writer);
+    transport_destroy(transport_reader);
+}
+
+TEST(Transport, TestUDSMemfdMessage)
+{
+    static constexpr size_t MEMFD_THRESHOLD = 1024;
+    // Larger than the maximum size of inline messages
+    static constexpr size_t PAYLOAD_SIZE = 65536;
+
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    struct io_uring ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &ring, 0), 0);
+
+    int sockets[2];
+    // Create socket pair
+    ASSERT_NE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), -1);
+    set_nonblocking(sockets[0]);
+    set_nonblocking(sockets[1]);
+
+    auto transport_writer = transport_uds_init("test_writer", sockets[0], MESSAGE_SIZE, MAX_MESSAGE_NUM, &ring, logger);
+    auto transport_reader = transport_uds_init("test_reader", sockets[1], MESSAGE_SIZE, MAX_MESSAGE_NUM, &ring, logger);
+    transport_uds_set_memfd_threshold(transport_writer, MEMFD_THRESHOLD);
+
+    // Small messages stay inline
+    auto message_writer = transport_message_init_sized(transport_writer, MESSAGE_SIZE);
+    ASSERT_NE(message_writer, nullptr);
+    ASSERT_EQ(((kb_message_writer_uds_t *)message_writer)->memfd, -1);
+    ASSERT_TRUE(doc_writer_append_int32(message_writer_root(message_writer), "index", 0));
+    ASSERT_EQ(message_send(message_writer), 0);
+
+    // The hint is too small, so the memfd grows
+    message_writer = transport_message_init_sized(transport_writer, MEMFD_THRESHOLD);
+    ASSERT_NE(message_writer, nullptr);
+    ASSERT_GE(((kb_message_writer_uds_t *)message_writer)->memfd, 0);
+
+    std::vector<uint8_t> payload(PAYLOAD_SIZE, 0x42);
+    ASSERT_TRUE(doc_writer_append_int32(message_writer_root(message_writer), "index", 1));
+    ASSERT_TRUE(doc_writer_append_binary(message_writer_root(message_writer), "data", payload.data(), payload.size()));
+    ASSERT_EQ(message_send(message_writer), 0);
+
+    ASSERT_EQ(transport_uds_write_messages(transport_writer), 0);
+
+    auto message = transport_message_receive(transport_reader);
+    ASSERT_NE(message, nullptr);
+    ASSERT_EQ(((kb_message_uds_t *)message)->mapping, nullptr);
+
+    bson_iter_t iter;
+    ASSERT_TRUE(bson_iter_init_find(&iter, message_get_document(message), "index"));
+    ASSERT_EQ(bson_iter_int32(&iter), 0);
+    message_destroy(message);
+
+    message = transport_message_receive(transport_reader);
+    ASSERT_NE(message, nullptr);
+    // The message points right into the mapped memfd
+    ASSERT_NE(((kb_message_uds_t *)message)->mapping, nullptr);
+
+    ASSERT_TRUE(bson_iter_init_find(&iter, message_get_document(message), "index"));
+    ASSERT_EQ(bson_iter_int32(&iter), 1);
+
+    ASSERT_TRUE(bson_iter_init_find(&iter, message_get_document(message), "data"));
+    uint32_t data_size;
+    const uint8_t *data;
+    bson_iter_binary(&iter, nullptr, &data_size, &data);
+    ASSERT_EQ(data_size, payload.size());
+    ASSERT_EQ(memcmp(data, payload.data(), data_size), 0);
+
+    message_destroy(message);
+    ASSERT_EQ(((kb_transport_uds_t *)transport_reader)->num_received_fds, 0);
+
     transport_destroy(transport_writer);
-}
\ No newline at end of file
+    transport_destroy(transport_reader);
+}
+
+TEST(Transport, TestUDSSeqpacket)
+{
+    static constexpr int32_t NUM_MESSAGES = 5;
+
+    auto logger = log4c_category_get("libkrossbar.test");
+
+    struct io_uring ring;
+    ASSERT_EQ(io_uring_queue_init(RING_QUEUE_DEPTH, &ring, 0), 0);
+
+    int sockets[2];
+    // Create socket pair
+    ASSERT_NE(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets), -1);
+    set_nonblocking(sockets[0]);
+    set_nonblocking(sockets[1]);
+
+    auto transport_writer = transport_uds_init("test_writer", sockets[0], MESSAGE_SIZE, MAX_MESSAGE_NUM, &ring, logger);
+    auto transport_reader = transport_uds_init("test_reader", sockets[1], MESSAGE_SIZE, MAX_MESSAGE_NUM, &ring, logger);
+    auto uds_reader = (kb_transport_uds_t *)transport_reader;
+    ASSERT_TRUE(uds_reader->seqpacket);
+
+    for (int32_t i = 0; i < NUM_MESSAGES; i++)
+    {
+        auto message_writer = transport_message_init(transport_writer);
+        ASSERT_NE(message_writer, nullptr);
+        ASSERT_TRUE(doc_writer_append_int32(message_writer_root(message_writer), "index", i));
+        ASSERT_EQ(message_send(message_writer), 0);
+    }
+
+    ASSERT_EQ(transport_uds_write_messages(transport_writer), 0);
+
+    // One datagram per message, all of them with a single read
+    kb_message_t *messages[NUM_MESSAGES + 1];
+    ASSERT_EQ(transport_message_receive_batch(transport_reader, messages, NUM_MESSAGES + 1), NUM_MESSAGES);
+    ASSERT_EQ(uds_reader->num_datagrams, NUM_MESSAGES);
+    ASSERT_FALSE(transport_uds_has_buffered_message(transport_reader));
+
+    for (int32_t i = 0; i < NUM_MESSAGES; i++)
+    {
+        // Messages point into the receive buffer, one slot each
+        auto data = (const char *)bson_get_data(message_get_document(messages[i]));
+        ASSERT_EQ(data, uds_reader->in_buffer.data + i * MESSAGE_SIZE);
+
+        bson_iter_t iter;
+        ASSERT_TRUE(bson_iter_init_find(&iter, message_get_document(messages[i]), "index"));
+        ASSERT_EQ(bson_iter_int32(&iter), i);
+
+        message_destroy(messages[i]);
+    }
+
+    // Released messages give their slots back
+    ASSERT_EQ(uds_reader->in_buffer.num_held, 0);
+    ASSERT_EQ(uds_reader->num_free_slots, uds_reader->in_buffer.data_size / MESSAGE_SIZE);
+    ASSERT_EQ(transport_message_receive_batch(transport_reader, messages, NUM_MESSAGES + 1), 0);
+
+    transport_destroy(transport_writer);
+    transport_destroy(transport_reader);
+}